@@ -34,7 +34,7 @@
 
 using namespace fs;
 
-Ext2BGMng::Ext2BGMng(Ext2FileSystem *fs) : _dirty(false), _groups(), _fs(fs) {
+Ext2BGMng::Ext2BGMng(Ext2FileSystem *fs) : _dirty(false), _groups(), _summary(), _fs(fs) {
 	/* read block-group-descriptors */
 	int res;
 	size_t bcount = _fs->bytesToBlocks(_fs->getBlockGroupCount());
@@ -45,6 +45,78 @@ Ext2BGMng::Ext2BGMng(Ext2FileSystem *fs) : _dirty(false), _groups(), _fs(fs) {
 		free(_groups);
 		VTHROWE("Unable to read group-table",res);
 	}
+
+	/* we know nothing about the free blocks yet */
+	_summary = (FreeSummary*)calloc(_fs->getBlockGroupCount(),sizeof(FreeSummary));
+	if(_summary == NULL) {
+		free(_groups);
+		VTHROWE("Unable to allocate memory for blockgroups",-ENOMEM);
+	}
+}
+
+void Ext2BGMng::summarize(size_t i,const uint8_t *bitmap,block_t max) {
+	FreeSummary *s = _summary + i;
+	s->first = max;
+	s->extStart = 0;
+	s->extLen = 0;
+	for(block_t b = 0; b < max; ) {
+		/* skip completely used bytes */
+		if((b % 8) == 0 && bitmap[b / 8] == 0xFF) {
+			b += 8;
+			continue;
+		}
+		if(bitmap[b / 8] & (1 << (b % 8))) {
+			b++;
+			continue;
+		}
+
+		block_t start = b;
+		while(b < max && !(bitmap[b / 8] & (1 << (b % 8))))
+			b++;
+		if(s->first == max)
+			s->first = start;
+		if(b - start > s->extLen) {
+			s->extStart = start;
+			s->extLen = b - start;
+		}
+	}
+	s->valid = true;
+}
+
+void Ext2BGMng::allocated(size_t i,block_t from,block_t first,size_t count) {
+	FreeSummary *s = _summary + i;
+	if(from <= s->first && first >= s->first)
+		s->first = first + count;
+
+	if(s->valid) {
+		/* taken from the front of the extent? */
+		if(first == s->extStart && count <= s->extLen) {
+			s->extStart += count;
+			s->extLen -= count;
+		}
+		/* otherwise, if it overlaps, we don't know the largest one anymore */
+		else if(first < s->extStart + s->extLen && first + count > s->extStart)
+			s->valid = false;
+	}
+}
+
+void Ext2BGMng::freed(size_t i,block_t no) {
+	FreeSummary *s = _summary + i;
+	if(no < s->first)
+		s->first = no;
+
+	if(s->valid) {
+		/* extend the extent if the block is adjacent. otherwise, the block might join two extents
+		 * to a larger one */
+		if(s->extLen > 0 && no + 1 == s->extStart) {
+			s->extStart--;
+			s->extLen++;
+		}
+		else if(s->extLen > 0 && no == s->extStart + s->extLen)
+			s->extLen++;
+		else
+			s->valid = false;
+	}
 }
 
 void Ext2BGMng::update() {
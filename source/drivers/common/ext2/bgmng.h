@@ -39,6 +39,7 @@ public:
 	 * Destroys the blockgroups
 	 */
 	~Ext2BGMng() {
+		free(_summary);
 		free(_groups);
 	}
 
@@ -50,6 +51,57 @@ public:
 		return _groups + i;
 	}
 
+	/**
+	 * @param i the block group number
+	 * @return true if the summary of free blocks in group <i> is up to date
+	 */
+	bool hasSummary(size_t i) const {
+		return _summary[i].valid;
+	}
+
+	/**
+	 * Determines the block in group <i> to start the search for <count> free blocks at. That is
+	 * the largest free extent, if it is large enough, or the first free block otherwise.
+	 * Requires an up to date summary.
+	 *
+	 * @param i the block group number
+	 * @param count the number of blocks
+	 * @return the block, relative to the group start
+	 */
+	block_t goal(size_t i,size_t count) const {
+		const FreeSummary *s = _summary + i;
+		return s->extLen >= count ? s->extStart : s->first;
+	}
+
+	/**
+	 * Builds the summary of free blocks in group <i> from its bitmap.
+	 *
+	 * @param i the block group number
+	 * @param bitmap the block bitmap of the group
+	 * @param max the number of blocks in the group
+	 */
+	void summarize(size_t i,const uint8_t *bitmap,block_t max);
+
+	/**
+	 * Updates the summary of free blocks after <count> blocks beginning with <first> have been
+	 * allocated in group <i>. The search for free blocks has been started at <from>, i.e., all
+	 * blocks between <from> and <first> are in use.
+	 *
+	 * @param i the block group number
+	 * @param from the block the search started at, relative to the group start
+	 * @param first the first block, relative to the group start
+	 * @param count the number of blocks
+	 */
+	void allocated(size_t i,block_t from,block_t first,size_t count);
+
+	/**
+	 * Updates the summary of free blocks after block <no> has been free'd in group <i>.
+	 *
+	 * @param i the block group number
+	 * @param no the block, relative to the group start
+	 */
+	void freed(size_t i,block_t no);
+
 	/**
 	 * Marks the superblock as dirty
 	 */
@@ -75,7 +127,20 @@ private:
 #endif
 
 private:
+	/* what we know about the free blocks of a group. this way, we don't need to search through
+	 * the used blocks at the beginning of the bitmap again and again and find room for
+	 * contiguous allocations directly */
+	struct FreeSummary {
+		/* the first block that might be free */
+		block_t first;
+		/* the largest free extent, if valid is true */
+		block_t extStart;
+		size_t extLen;
+		bool valid;
+	};
+
 	bool _dirty;
 	fs::Ext2BlockGrp *_groups;
+	FreeSummary *_summary;
 	Ext2FileSystem *_fs;
 };
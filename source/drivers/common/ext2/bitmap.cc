@@ -17,10 +17,12 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <esc/util.h>
 #include <fs/blockcache.h>
 #include <fs/fsdev.h>
 #include <sys/common.h>
 #include <sys/endian.h>
+#include <sys/stat.h>
 #include <sys/thread.h>
 #include <assert.h>
 
@@ -141,40 +143,73 @@ ino_t Ext2Bitmap::allocInodeIn(Ext2FileSystem *e,block_t groupStart,Ext2BlockGrp
 }
 
 block_t Ext2Bitmap::allocBlock(Ext2FileSystem *e,Ext2CInode *inode) {
+	/* take the next preallocated block, if there is any */
+	if(inode->resCount > 0) {
+		inode->resCount--;
+		return inode->resStart++;
+	}
+
 	size_t gcount = e->getBlockGroupCount();
-	block_t block = e->getBlockOfInode(inode->inodeNo);
-	block_t i,group = e->getGroupOfBlock(block);
-	block_t bno = 0;
 	uint32_t blocksPerGroup = le32tocpu(e->sb.get()->blocksPerGroup);
+	uint32_t firstBlock = le32tocpu(e->sb.get()->firstDataBlock);
+	block_t i,group = e->getBlockOfInode(inode->inodeNo);
+	block_t bno = 0;
+	size_t count = 1;
+	if(S_ISREG(le16tocpu(inode->inode.mode)))
+		count += EXT2_PREALLOC_BLOCKS;
 
 	sassert(tpool_lock(EXT2_SUPERBLOCK_LOCK,LOCK_EXCLUSIVE | LOCK_KEEP) == 0);
 	if(le32tocpu(e->sb.get()->freeBlockCount) == 0)
 		goto done;
 
-	/* first try to find a block in the block-group of the inode */
-	bno = allocBlockIn(e,group * blocksPerGroup,e->bgs.get(group));
+	/* first try to continue behind the last block of the inode */
+	if(inode->resStart > firstBlock && inode->resStart < le32tocpu(e->sb.get()->blockCount)) {
+		group = (inode->resStart - firstBlock) / blocksPerGroup;
+		bno = allocBlockIn(e,group,(inode->resStart - firstBlock) % blocksPerGroup,&count);
+		if(bno != 0)
+			goto done;
+	}
+
+	/* otherwise try to find room in the block-group of the inode */
+	bno = allocBlockIn(e,group,ANY_BLOCK,&count);
 	if(bno != 0)
 		goto done;
 
 	/* now try the other block-groups */
-	for(i = group + 1; i != group; i = (i + 1) % gcount) {
-		bno = allocBlockIn(e,i * blocksPerGroup,e->bgs.get(i));
+	for(i = (group + 1) % gcount; i != group; i = (i + 1) % gcount) {
+		bno = allocBlockIn(e,i,ANY_BLOCK,&count);
 		if(bno != 0)
 			goto done;
 	}
 
 done:
+	if(bno != 0) {
+		inode->resStart = bno + 1;
+		inode->resCount = count - 1;
+	}
 	sassert(tpool_unlock(EXT2_SUPERBLOCK_LOCK) == 0);
 	return bno;
 }
 
+void Ext2Bitmap::discard(Ext2FileSystem *e,Ext2CInode *inode) {
+	/* keep resStart, so that we continue there if the file is written again */
+	for(; inode->resCount > 0; inode->resCount--)
+		freeBlock(e,inode->resStart + inode->resCount - 1);
+}
+
 int Ext2Bitmap::freeBlock(Ext2FileSystem *e,block_t blockNo) {
-	block_t group = e->getGroupOfBlock(blockNo);
+	uint32_t blocksPerGroup = le32tocpu(e->sb.get()->blocksPerGroup);
+	block_t group;
 	CBlock *bitmap;
 	uint8_t *bitmapbuf;
 	uint16_t freeBlockCount;
 	uint32_t sFreeBlockCount;
 
+	/* the bitmap starts at the first data block */
+	blockNo -= le32tocpu(e->sb.get()->firstDataBlock);
+	group = blockNo / blocksPerGroup;
+	blockNo %= blocksPerGroup;
+
 	sassert(tpool_lock(EXT2_SUPERBLOCK_LOCK,LOCK_EXCLUSIVE | LOCK_KEEP) == 0);
 	bitmap = e->blockCache.request(le32tocpu(e->bgs.get(group)->blockBitmap),BlockCache::WRITE);
 	if(bitmap == NULL) {
@@ -183,10 +218,9 @@ int Ext2Bitmap::freeBlock(Ext2FileSystem *e,block_t blockNo) {
 	}
 
 	/* mark free in bitmap */
-	blockNo--;
-	blockNo %= le32tocpu(e->sb.get()->blocksPerGroup);
 	bitmapbuf = (uint8_t*)bitmap->buffer;
 	bitmapbuf[blockNo / 8] &= ~(1 << (blockNo % 8));
+	e->bgs.freed(group,blockNo);
 	freeBlockCount = le16tocpu(e->bgs.get(group)->freeBlockCount);
 	e->bgs.get(group)->freeBlockCount = cputole16(freeBlockCount + 1);
 	e->bgs.markDirty();
@@ -199,43 +233,63 @@ int Ext2Bitmap::freeBlock(Ext2FileSystem *e,block_t blockNo) {
 	return 0;
 }
 
-block_t Ext2Bitmap::allocBlockIn(Ext2FileSystem *e,block_t groupStart,Ext2BlockGrp *group) {
-	size_t i,j;
-	block_t bno;
+block_t Ext2Bitmap::allocBlockIn(Ext2FileSystem *e,block_t group,block_t goal,size_t *count) {
 	CBlock *bitmap;
 	uint8_t *bitmapbuf;
 	uint32_t sFreeBlockCount;
-	uint32_t blockCount = le32tocpu(e->sb.get()->blockCount);
-	if(le16tocpu(group->freeBlockCount) == 0)
+	uint16_t freeBlockCount;
+	Ext2BlockGrp *grp = e->bgs.get(group);
+	uint32_t blocksPerGroup = le32tocpu(e->sb.get()->blocksPerGroup);
+	block_t groupStart = group * blocksPerGroup + le32tocpu(e->sb.get()->firstDataBlock);
+	block_t bno,max = esc::Util::min(blocksPerGroup,le32tocpu(e->sb.get()->blockCount) - groupStart);
+	size_t n;
+	if(le16tocpu(grp->freeBlockCount) == 0 || (goal != ANY_BLOCK && goal >= max))
 		return 0;
 
 	/* load bitmap */
-	bitmap = e->blockCache.request(le32tocpu(group->blockBitmap),BlockCache::WRITE);
+	bitmap = e->blockCache.request(le32tocpu(grp->blockBitmap),BlockCache::WRITE);
 	if(bitmap == NULL)
 		return 0;
-
-	bno = 0;
 	bitmapbuf = (uint8_t*)bitmap->buffer;
-	for(i = 0; i < e->blockSize(); i++) {
-		for(j = 1; j < 256; bno++, j <<= 1) {
-			if(bno >= blockCount) {
-				e->blockCache.release(bitmap);
-				return 0;
-			}
-			if(!(bitmapbuf[i] & j)) {
-				uint16_t freeBlockCount = le16tocpu(group->freeBlockCount);
-				group->freeBlockCount = cputole16(freeBlockCount - 1);
-				e->bgs.markDirty();
-				bitmapbuf[i] |= j;
-				sFreeBlockCount = le32tocpu(e->sb.get()->freeBlockCount);
-				e->sb.get()->freeBlockCount = cputole32(sFreeBlockCount - 1);
-				e->sb.markDirty();
-				e->blockCache.markDirty(bitmap);
-				e->blockCache.release(bitmap);
-				return bno + groupStart + 1;
-			}
-		}
+
+	/* let the summary choose where to start */
+	if(goal == ANY_BLOCK) {
+		if(!e->bgs.hasSummary(group))
+			e->bgs.summarize(group,bitmapbuf,max);
+		goal = e->bgs.goal(group,*count);
+	}
+
+	/* search for the first free block, starting at <goal> and skipping completely used bytes */
+	for(bno = goal; bno < max; ) {
+		if((bno % 8) == 0 && bitmapbuf[bno / 8] == 0xFF)
+			bno += 8;
+		else if(bitmapbuf[bno / 8] & (1 << (bno % 8)))
+			bno++;
+		else
+			break;
+	}
+	if(bno >= max) {
+		e->blockCache.release(bitmap);
+		return 0;
 	}
+
+	/* take as many of the following free blocks as requested */
+	n = esc::Util::min(*count,(size_t)le16tocpu(grp->freeBlockCount));
+	for(*count = 0; *count < n && bno + *count < max; (*count)++) {
+		block_t b = bno + *count;
+		if(bitmapbuf[b / 8] & (1 << (b % 8)))
+			break;
+		bitmapbuf[b / 8] |= 1 << (b % 8);
+	}
+	e->bgs.allocated(group,goal,bno,*count);
+
+	freeBlockCount = le16tocpu(grp->freeBlockCount);
+	grp->freeBlockCount = cputole16(freeBlockCount - *count);
+	e->bgs.markDirty();
+	sFreeBlockCount = le32tocpu(e->sb.get()->freeBlockCount);
+	e->sb.get()->freeBlockCount = cputole32(sFreeBlockCount - *count);
+	e->sb.markDirty();
+	e->blockCache.markDirty(bitmap);
 	e->blockCache.release(bitmap);
-	return 0;
+	return groupStart + bno;
 }
@@ -49,8 +49,11 @@ public:
 	static int freeInode(Ext2FileSystem *e,ino_t ino,bool isDir);
 
 	/**
-	 * Allocates a new block for the given inode. It will be tried to allocate a block in the same
-	 * block-group.
+	 * Allocates a new block for the given inode. It will be tried to allocate the block behind
+	 * the last one of the inode or at least a block in the same block-group. Within a group, the
+	 * largest free extent is used if it is large enough, otherwise the first free block. For
+	 * regular files, EXT2_PREALLOC_BLOCKS following blocks are allocated in advance, if possible,
+	 * so that subsequent calls take the next block from these.
 	 *
 	 * @param e the ext2-fs
 	 * @param inode the inode
@@ -58,6 +61,14 @@ public:
 	 */
 	static block_t allocBlock(Ext2FileSystem *e,Ext2CInode *inode);
 
+	/**
+	 * Free's the blocks that have been allocated in advance for the given inode
+	 *
+	 * @param e the ext2-fs
+	 * @param inode the inode
+	 */
+	static void discard(Ext2FileSystem *e,Ext2CInode *inode);
+
 	/**
 	 * Free's the given block-number
 	 *
@@ -68,6 +79,9 @@ public:
 	static int freeBlock(Ext2FileSystem *e,block_t blockNo);
 
 private:
+	/* lets allocBlockIn choose the block to start at */
+	static const block_t ANY_BLOCK = (block_t)-1;
+
 	static ino_t allocInodeIn(Ext2FileSystem *e,block_t groupStart,fs::Ext2BlockGrp *group,bool isDir);
-	static block_t allocBlockIn(Ext2FileSystem *e,block_t groupStart,fs::Ext2BlockGrp *group);
+	static block_t allocBlockIn(Ext2FileSystem *e,block_t group,block_t goal,size_t *count);
 };
@@ -17,6 +17,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <fs/blockcache.h>
 #include <sys/common.h>
 #include <sys/endian.h>
 #include <sys/stat.h>
@@ -28,8 +29,11 @@
 #include "dir.h"
 #include "ext2.h"
 #include "file.h"
+#include "htree.h"
+#include "inode.h"
 #include "inodecache.h"
 #include "link.h"
+#include "namehash.h"
 
 using namespace fs;
 
@@ -69,22 +73,22 @@ int Ext2Dir::create(Ext2FileSystem *e,User *u,Ext2CInode *dir,const char *name,m
 }
 
 ino_t Ext2Dir::find(Ext2FileSystem *e,Ext2CInode *dir,const char *name,size_t nameLen) {
-	ino_t ino;
-	size_t size = le32tocpu(dir->inode.size);
-	int res;
-	Ext2DirEntry *buffer = (Ext2DirEntry*)malloc(size);
-	if(buffer == NULL)
-		return -ENOMEM;
-
-	/* read the directory */
-	if((res = Ext2File::readIno(e,dir,buffer,0,size)) < 0) {
-		free(buffer);
-		return res;
+	/* if we know the names already, we don't need to read the directory */
+	if(dir->names)
+		return dir->names->find(name,nameLen);
+
+	if(Ext2HTree::isIndexed(e,dir)) {
+		ino_t ino = Ext2HTree::find(e,dir,name,nameLen);
+		/* if the index is broken, fall back to a linear search */
+		if(ino != -EINVAL)
+			return ino;
 	}
+	return findLinear(e,dir,name,nameLen);
+}
 
-	ino = findIn(buffer,size,name,nameLen);
-	free(buffer);
-	return ino;
+void Ext2Dir::invalidate(Ext2CInode *dir) {
+	delete dir->names;
+	dir->names = NULL;
 }
 
 ino_t Ext2Dir::findIn(Ext2DirEntry *buffer,size_t bufSize,const char *name,size_t nameLen) {
@@ -92,20 +96,88 @@ ino_t Ext2Dir::findIn(Ext2DirEntry *buffer,size_t bufSize,const char *name,size_
 	Ext2DirEntry *entry = buffer;
 
 	/* search the directory-entries */
-	while(rem > 0 && le32tocpu(entry->inode) != 0) {
-		/* found a match? */
-		if(nameLen == le16tocpu(entry->nameLen) && strncmp(entry->name,name,nameLen) == 0) {
+	while(rem > 0) {
+		uint16_t recLen = le16tocpu(entry->recLen);
+		/* found a match? empty entries have no name */
+		if(le32tocpu(entry->inode) != 0 && nameLen == le16tocpu(entry->nameLen) &&
+				strncmp(entry->name,name,nameLen) == 0) {
 			ino_t ino = le32tocpu(entry->inode);
 			return ino;
 		}
+		if(recLen == 0)
+			break;
 
 		/* to next dir-entry */
-		rem -= le16tocpu(entry->recLen);
-		entry = (Ext2DirEntry*)((uintptr_t)entry + le16tocpu(entry->recLen));
+		rem -= recLen;
+		entry = (Ext2DirEntry*)((uintptr_t)entry + recLen);
 	}
 	return -ENOENT;
 }
 
+ino_t Ext2Dir::findLinear(Ext2FileSystem *e,Ext2CInode *dir,const char *name,size_t nameLen) {
+	size_t blockSize = e->blockSize();
+	size_t blocks = e->bytesToBlocks(le32tocpu(dir->inode.size));
+
+	/* small directories are read quickly, so that it's not worth it to remember the names */
+	Ext2NameHash *names = NULL;
+	if(blocks > 1) {
+		names = new Ext2NameHash(blocks * blockSize / 32);
+		if(!names->isValid()) {
+			delete names;
+			names = NULL;
+		}
+	}
+
+	ino_t ino = -ENOENT;
+	size_t i;
+	for(i = 0; i < blocks; ++i) {
+		block_t bno = Ext2INode::getDataBlock(e,dir,i);
+		if(bno == 0)
+			continue;
+		CBlock *block = e->blockCache.request(bno,BlockCache::READ);
+		if(block == NULL)
+			break;
+
+		if(names && !addNames(names,(Ext2DirEntry*)block->buffer,blockSize)) {
+			delete names;
+			names = NULL;
+		}
+		if(ino == -ENOENT)
+			ino = findIn((Ext2DirEntry*)block->buffer,blockSize,name,nameLen);
+		e->blockCache.release(block);
+
+		/* if we don't collect the names, we can stop as soon as we've found it */
+		if(ino >= 0 && names == NULL)
+			break;
+	}
+
+	if(i < blocks && ino == -ENOENT)
+		ino = -ENOBUFS;
+	if(names && i == blocks)
+		dir->names = names;
+	else
+		delete names;
+	return ino;
+}
+
+bool Ext2Dir::addNames(Ext2NameHash *names,Ext2DirEntry *buffer,size_t bufSize) {
+	ssize_t rem = bufSize;
+	Ext2DirEntry *entry = buffer;
+	while(rem > 0) {
+		uint16_t recLen = le16tocpu(entry->recLen);
+		if(le32tocpu(entry->inode) != 0) {
+			if(!names->add(entry->name,le16tocpu(entry->nameLen),le32tocpu(entry->inode)))
+				return false;
+		}
+		if(recLen == 0)
+			break;
+
+		rem -= recLen;
+		entry = (Ext2DirEntry*)((uintptr_t)entry + recLen);
+	}
+	return true;
+}
+
 int Ext2Dir::remove(Ext2FileSystem *e,User *u,Ext2CInode *dir,const char *name) {
 	ino_t ino;
 	size_t size = le32tocpu(dir->inode.size);
@@ -141,19 +213,22 @@ int Ext2Dir::remove(Ext2FileSystem *e,User *u,Ext2CInode *dir,const char *name)
 
 	/* search for other entries than '.' and '..' */
 	entry = buffer;
-	while(size > 0 && entry->inode != 0) {
+	while(size > 0) {
 		uint16_t namelen = le16tocpu(entry->nameLen);
+		uint16_t recLen = le16tocpu(entry->recLen);
 		/* found a match? */
-		if(namelen != 1 && namelen != 2 &&
+		if(entry->inode != 0 && namelen != 1 && namelen != 2 &&
 				strncmp(entry->name,".",namelen) != 0 &&
 				strncmp(entry->name,"..",namelen) != 0) {
 			res = -ENOTEMPTY;
 			goto error;
 		}
+		if(recLen == 0)
+			break;
 
 		/* to next dir-entry */
-		size -= le16tocpu(entry->recLen);
-		entry = (Ext2DirEntry*)((uintptr_t)entry + le16tocpu(entry->recLen));
+		size -= recLen;
+		entry = (Ext2DirEntry*)((uintptr_t)entry + recLen);
 	}
 	free(buffer);
 	buffer = NULL;
@@ -25,6 +25,7 @@
 
 struct Ext2CInode;
 class Ext2FileSystem;
+class Ext2NameHash;
 
 class Ext2Dir {
 	Ext2Dir() = delete;
@@ -53,6 +54,14 @@ public:
 	 */
 	static ino_t find(Ext2FileSystem *e,Ext2CInode *dir,const char *name,size_t nameLen);
 
+	/**
+	 * Forgets the names in <dir> that have been collected by find(). This has to be done whenever
+	 * the directory is changed.
+	 *
+	 * @param dir the directory
+	 */
+	static void invalidate(Ext2CInode *dir);
+
 	/**
 	 * Finds the inode-number to the entry <name> in the given buffer
 	 *
@@ -75,4 +84,15 @@ public:
 	 * @return 0 on success
 	 */
 	static int remove(Ext2FileSystem *e,fs::User *u,Ext2CInode *dir,const char *name);
+
+private:
+	/**
+	 * Searches the directory block by block. If it spans multiple blocks, all names are collected
+	 * in dir->names for the next lookups.
+	 */
+	static ino_t findLinear(Ext2FileSystem *e,Ext2CInode *dir,const char *name,size_t nameLen);
+	/**
+	 * Adds all entries in the given directory-block to <names>
+	 */
+	static bool addNames(Ext2NameHash *names,fs::Ext2DirEntry *buffer,size_t bufSize);
 };
@@ -20,6 +20,7 @@
 #include <fs/fsdev.h>
 #include <fs/permissions.h>
 #include <sys/common.h>
+#include <sys/conf.h>
 #include <sys/debug.h>
 #include <sys/endian.h>
 #include <sys/io.h>
@@ -61,7 +62,8 @@ int main(int argc,char *argv[]) {
 		error("Unable to set signal-handler for SIGTERM");
 
 	fsdev = new fs::FSDevice<fs::OpenFile>(new Ext2FileSystem(argv[2]),argv[1]);
-	fsdev->loop();
+	/* reads of different clients are handled in parallel */
+	fsdev->loop(sysconf(CONF_CPU_COUNT));
 	return 0;
 }
 
@@ -86,6 +88,8 @@ Ext2FileSystem::Ext2FileSystem(const char *device)
 }
 
 Ext2FileSystem::~Ext2FileSystem() {
+	/* files that are still open might have preallocated blocks */
+	inodeCache.discardPrealloc();
 	/* write pending changes */
 	sync();
 	::close(fd);
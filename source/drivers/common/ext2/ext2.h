@@ -25,6 +25,7 @@
 #include <fs/fsdev.h>
 #include <sys/common.h>
 #include <sys/endian.h>
+#include <mutex>
 
 #include "bgmng.h"
 #include "dir.h"
@@ -34,6 +35,8 @@
 static const size_t DISK_SECTOR_SIZE		= 512;
 static const size_t EXT2_ICACHE_SIZE		= 64;
 static const size_t EXT2_BCACHE_SIZE		= 2048;
+/* the number of blocks that are allocated in advance for regular files */
+static const size_t EXT2_PREALLOC_BLOCKS	= 8;
 
 static const uint EXT2_SUPERBLOCK_LOCK		= 0xF7180002;
 
@@ -216,4 +219,7 @@ public:
 	/* caches */
 	Ext2INodeCache inodeCache;
 	Ext2BlockCache blockCache;
+	/* reads run in parallel (all other operations exclusively). they lock the inode-cache and the
+	 * cached inodes with this. the block-cache is thread-safe on its own */
+	std::mutex inodeLock;
 };
@@ -25,6 +25,7 @@
 #include <sys/stat.h>
 #include <assert.h>
 #include <errno.h>
+#include <mutex>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -83,6 +84,9 @@ int Ext2File::truncate(Ext2FileSystem *e,Ext2CInode *cnode,bool del) {
 	if(S_ISLNK(le16tocpu(cnode->inode.mode)) && le32tocpu(cnode->inode.size) < 60)
 		return 0;
 
+	/* the indirect blocks are free'd */
+	cnode->indirBlock = 0;
+
 	/* free direct blocks */
 	for(i = 0; i < EXT2_DIRBLOCK_COUNT; i++) {
 		if(le32tocpu(cnode->inode.dBlocks[i]) == 0)
@@ -145,22 +149,23 @@ ssize_t Ext2File::read(Ext2FileSystem *e,ino_t inodeNo,void *buffer,off_t offset
 	ssize_t res;
 
 	/* at first we need the inode */
-	cnode = e->inodeCache.request(inodeNo,IMODE_WRITE);
-	if(cnode == NULL)
-		return -ENOBUFS;
+	{
+		std::lock_guard<std::mutex> guard(e->inodeLock);
+		cnode = e->inodeCache.request(inodeNo,IMODE_WRITE);
+		if(cnode == NULL)
+			return -ENOBUFS;
+	}
 
-	/* read */
+	/* read; the reference keeps the inode in the cache meanwhile */
 	res = readIno(e,cnode,buffer,offset,count);
-	if(res <= 0) {
-		e->inodeCache.release(cnode);
-		return res;
-	}
 
-	/* mark accessed */
-	cnode->inode.accesstime = cputole32(time(NULL));
-	e->inodeCache.markDirty(cnode);
+	std::lock_guard<std::mutex> guard(e->inodeLock);
+	if(res > 0) {
+		/* mark accessed */
+		cnode->inode.accesstime = cputole32(time(NULL));
+		e->inodeCache.markDirty(cnode);
+	}
 	e->inodeCache.release(cnode);
-
 	return res;
 }
 
@@ -193,25 +198,55 @@ ssize_t Ext2File::readIno(Ext2FileSystem *e,const Ext2CInode *cnode,void *buffer
 		/* use the offset in the first block; after the first one the offset is 0 anyway */
 		leftBytes = count;
 		bufWork = (uint8_t*)buffer;
-		for(i = 0; i < blockCount; i++) {
-			/* request block */
-			block_t block = Ext2INode::getDataBlock(e,cnode,startBlock + i);
-			CBlock *tmpBuffer = e->blockCache.request(block,BlockCache::READ);
-			if(tmpBuffer == NULL)
+		for(i = 0; i < blockCount; ) {
+			/* determine the blocks that are contiguous on disk */
+			/* this might update the remembered indirect block of the inode */
+			block_t first;
+			size_t run;
+			{
+				std::lock_guard<std::mutex> guard(e->inodeLock);
+				run = Ext2INode::getDataBlocks(e,cnode,startBlock + i,blockCount - i,&first);
+			}
+			if(run == 0)
 				return -ENOBUFS;
 
-			/* copy the requested part */
-			c = esc::Util::min(leftBytes,blockSize - offset);
-			memcpy(bufWork,(uint8_t*)tmpBuffer->buffer + offset,c);
-			bufWork += c;
-
-			e->blockCache.release(tmpBuffer);
+			/* read the blocks that are completely requested directly into the buffer, if it's
+			 * worth it. this way, large reads don't evict everything from the block-cache */
+			if(first != 0 && offset == 0) {
+				size_t full = esc::Util::min(run,leftBytes / blockSize);
+				if(full * blockSize >= MIN_DIRECT_SIZE) {
+					if(!e->blockCache.readDirect(bufWork,first,full))
+						return -ENOBUFS;
+					bufWork += full * blockSize;
+					leftBytes -= full * blockSize;
+					i += full;
+					continue;
+				}
+			}
 
-			/* we substract to much, but it matters only if we read an additional block. In this
-			 * case it is correct */
-			leftBytes -= blockSize - offset;
-			/* offset is always 0 for additional blocks */
-			offset = 0;
+			for(size_t j = 0; j < run; j++) {
+				c = esc::Util::min(leftBytes,blockSize - offset);
+				/* holes are not backed by a block */
+				if(first == 0)
+					memset(bufWork,0,c);
+				else {
+					CBlock *tmpBuffer = e->blockCache.request(first + j,BlockCache::READ);
+					if(tmpBuffer == NULL)
+						return -ENOBUFS;
+
+					/* copy the requested part */
+					memcpy(bufWork,(uint8_t*)tmpBuffer->buffer + offset,c);
+					e->blockCache.release(tmpBuffer);
+				}
+				bufWork += c;
+
+				/* we substract to much, but it matters only if we read an additional block. In
+				 * this case it is correct */
+				leftBytes -= blockSize - offset;
+				/* offset is always 0 for additional blocks */
+				offset = 0;
+			}
+			i += run;
 		}
 	}
 	return count;
@@ -26,6 +26,9 @@
 class Ext2File {
 	Ext2File() = delete;
 
+	/* runs of at least this many bytes are read past the block-cache */
+	static const size_t MIN_DIRECT_SIZE	= 32 * 1024;
+
 public:
 	/**
 	 * Creates an inode and links it in the given directory with given name
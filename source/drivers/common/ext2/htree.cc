@@ -0,0 +1,592 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <fs/blockcache.h>
+#include <fs/ext2/ext2.h>
+#include <sys/common.h>
+#include <sys/endian.h>
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dir.h"
+#include "ext2.h"
+#include "htree.h"
+#include "inode.h"
+#include "inodecache.h"
+#include "link.h"
+
+using namespace fs;
+
+/* the largest hash is reserved as end-marker */
+static const uint32_t HTREE_EOF		= 0x7FFFFFFF;
+static const uint32_t TEA_DELTA		= 0x9E3779B9;
+/* without the largedir feature, linux supports only one level of index-nodes below the root */
+static const size_t HTREE_MAX_INDIRECT	= 1;
+
+/* the basic MD4 functions: selection, majority and parity */
+#define MD4_F(x,y,z)				((z) ^ ((x) & ((y) ^ (z))))
+#define MD4_G(x,y,z)				(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define MD4_H(x,y,z)				((x) ^ (y) ^ (z))
+#define MD4_ROUND(f,a,b,c,d,x,s)	((a) += f((b),(c),(d)) + (x), (a) = ((a) << (s)) | ((a) >> (32 - (s))))
+#define MD4_K1						0
+#define MD4_K2						013240474631U
+#define MD4_K3						015666365641U
+
+bool Ext2HTree::isIndexed(Ext2FileSystem *e,const Ext2CInode *dir) {
+	return (le32tocpu(e->sb.get()->featureCompat) & EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+		(le32tocpu(dir->inode.flags) & EXT2_INDEX_FL);
+}
+
+ino_t Ext2HTree::find(Ext2FileSystem *e,const Ext2CInode *dir,const char *name,size_t nameLen) {
+	Frame frames[EXT2_HTREE_MAX_LEVELS + 1];
+	size_t levels;
+	uint32_t h;
+	uint version;
+	int res = probe(e,dir,name,nameLen,BlockCache::READ,frames,&levels,&h,&version);
+	if(res < 0)
+		return res;
+
+	ino_t ino;
+	do {
+		block_t bno = Ext2INode::getDataBlock(e,dir,getBlock(frames[levels].at));
+		CBlock *leaf = bno ? e->blockCache.request(bno,BlockCache::READ) : NULL;
+		if(leaf == NULL) {
+			ino = -EINVAL;
+			break;
+		}
+		ino = Ext2Dir::findIn((Ext2DirEntry*)leaf->buffer,e->blockSize(),name,nameLen);
+		e->blockCache.release(leaf);
+	}
+	while(ino == -ENOENT && nextLeaf(e,dir,h,BlockCache::READ,frames,levels));
+
+	releaseFrames(e,frames,levels);
+	return ino;
+}
+
+int Ext2HTree::insert(Ext2FileSystem *e,Ext2CInode *dir,const char *name,size_t nameLen,ino_t ino) {
+	while(true) {
+		Frame frames[EXT2_HTREE_MAX_LEVELS + 1];
+		size_t levels;
+		uint32_t h;
+		uint version;
+		int res = probe(e,dir,name,nameLen,BlockCache::WRITE,frames,&levels,&h,&version);
+		if(res < 0)
+			return res;
+
+		bool retry = false;
+		block_t bno = Ext2INode::getDataBlock(e,dir,getBlock(frames[levels].at));
+		CBlock *leaf = bno ? e->blockCache.request(bno,BlockCache::WRITE) : NULL;
+		if(leaf == NULL)
+			res = -EINVAL;
+		else {
+			if(insertInBlock((uint8_t*)leaf->buffer,e->blockSize(),name,nameLen,ino))
+				e->blockCache.markDirty(leaf);
+			else {
+				/* search for the deepest index-node with a free slot */
+				ssize_t avail = levels;
+				while(avail >= 0 && getCount(frames[avail].entries) >= getLimit(frames[avail].entries))
+					avail--;
+
+				/* if the leaf's node has one, split the leaf. otherwise, make room in the index
+				 * first and start again, because the path to the leaf has changed */
+				if(avail == (ssize_t)levels)
+					res = split(e,dir,version,h,frames + levels,leaf,name,nameLen,ino);
+				else {
+					res = splitNode(e,dir,frames,levels,avail);
+					retry = res == 0;
+				}
+			}
+			e->blockCache.release(leaf);
+		}
+
+		releaseFrames(e,frames,levels);
+		if(!retry)
+			return res;
+	}
+}
+
+int Ext2HTree::appendBlock(Ext2FileSystem *e,Ext2CInode *dir,block_t *no,CBlock **block) {
+	size_t blockSize = e->blockSize();
+	*no = le32tocpu(dir->inode.size) / blockSize;
+	block_t bno = Ext2INode::reqDataBlock(e,dir,*no);
+	if(bno == 0)
+		return -ENOSPC;
+	*block = e->blockCache.create(bno);
+	if(*block == NULL)
+		return -ENOBUFS;
+	dir->inode.size = cputole32(le32tocpu(dir->inode.size) + blockSize);
+	e->inodeCache.markDirty(dir);
+	return 0;
+}
+
+int Ext2HTree::splitNode(Ext2FileSystem *e,Ext2CInode *dir,Frame *frames,size_t levels,
+		ssize_t parent) {
+	/* if the root is full, we need another level, but linux supports only one without largedir */
+	if(parent < 0 && levels >= HTREE_MAX_INDIRECT)
+		return -ENOSPC;
+
+	block_t newNo;
+	CBlock *dst;
+	int res = appendBlock(e,dir,&newNo,&dst);
+	if(res < 0)
+		return res;
+
+	/* the new node is hidden in an empty directory-entry that spans the whole block */
+	size_t blockSize = e->blockSize();
+	Ext2DxNode *node = (Ext2DxNode*)dst->buffer;
+	node->fakeInode = cputole32(0);
+	node->fakeRecLen = cputole16(blockSize);
+	node->fakeNameLen = cputole16(0);
+	Ext2DxEntry *entries = (Ext2DxEntry*)(node + 1);
+	Ext2DxCountLimit *cl = reinterpret_cast<Ext2DxCountLimit*>(entries);
+	cl->limit = cputole16((blockSize - sizeof(Ext2DxNode)) / sizeof(Ext2DxEntry));
+
+	if(parent < 0) {
+		/* move all entries of the root into the new node, which becomes its only child */
+		Frame *root = frames;
+		size_t count = getCount(root->entries);
+		memcpy(entries + 1,root->entries + 1,(count - 1) * sizeof(Ext2DxEntry));
+		entries[0].block = root->entries[0].block;
+		cl->count = cputole16(count);
+
+		reinterpret_cast<Ext2DxCountLimit*>(root->entries)->count = cputole16(1);
+		root->entries[0].block = cputole32(newNo);
+		((Ext2DxRoot*)root->block->buffer)->indirectLevels++;
+		e->blockCache.markDirty(root->block);
+	}
+	else {
+		/* move the upper half of the full node below <parent> into the new node */
+		Frame *full = frames + parent + 1;
+		size_t count = getCount(full->entries);
+		size_t mid = count / 2;
+		memcpy(entries + 1,full->entries + mid + 1,(count - mid - 1) * sizeof(Ext2DxEntry));
+		entries[0].block = full->entries[mid].block;
+		cl->count = cputole16(count - mid);
+		reinterpret_cast<Ext2DxCountLimit*>(full->entries)->count = cputole16(mid);
+
+		/* and insert the index-entry for it behind the one of the full node. the hash keeps the
+		 * continuation-bit of the moved entry */
+		Frame *p = frames + parent;
+		size_t pcount = getCount(p->entries);
+		Ext2DxEntry *at = p->at + 1;
+		memmove(at + 1,at,(p->entries + pcount - at) * sizeof(Ext2DxEntry));
+		at->hash = full->entries[mid].hash;
+		at->block = cputole32(newNo);
+		reinterpret_cast<Ext2DxCountLimit*>(p->entries)->count = cputole16(pcount + 1);
+		e->blockCache.markDirty(full->block);
+		e->blockCache.markDirty(p->block);
+	}
+
+	e->blockCache.markDirty(dst);
+	e->blockCache.release(dst);
+	return 0;
+}
+
+int Ext2HTree::split(Ext2FileSystem *e,Ext2CInode *dir,uint version,uint32_t hash,Frame *node,
+		CBlock *leaf,const char *name,size_t nameLen,ino_t ino) {
+	size_t blockSize = e->blockSize();
+
+	/* we need a free slot in the index-node for the new leaf */
+	size_t count = getCount(node->entries);
+	if(count >= getLimit(node->entries))
+		return -ENOSPC;
+
+	/* append a new block to the directory */
+	block_t newNo;
+	CBlock *dst;
+	int res = appendBlock(e,dir,&newNo,&dst);
+	if(res < 0)
+		return res;
+
+	uint32_t splitHash;
+	res = splitLeaf(e,version,(uint8_t*)leaf->buffer,(uint8_t*)dst->buffer,&splitHash);
+	if(res == 0) {
+		/* insert the index-entry for the new leaf behind the current one */
+		Ext2DxEntry *at = node->at + 1;
+		memmove(at + 1,at,(node->entries + count - at) * sizeof(Ext2DxEntry));
+		at->hash = cputole32(splitHash);
+		at->block = cputole32(newNo);
+		reinterpret_cast<Ext2DxCountLimit*>(node->entries)->count = cputole16(count + 1);
+		e->blockCache.markDirty(node->block);
+		e->blockCache.markDirty(leaf);
+
+		/* now there is enough space in both halves */
+		CBlock *target = hash >= (splitHash & ~1U) ? dst : leaf;
+		if(!insertInBlock((uint8_t*)target->buffer,blockSize,name,nameLen,ino))
+			res = -ENOSPC;
+	}
+	else {
+		/* the block belongs to the directory now, so make it a valid, but empty one */
+		Ext2DirEntry *empty = (Ext2DirEntry*)dst->buffer;
+		empty->inode = cputole32(0);
+		empty->recLen = cputole16(blockSize);
+		empty->nameLen = cputole16(0);
+	}
+
+	e->blockCache.markDirty(dst);
+	e->blockCache.release(dst);
+	return res;
+}
+
+int Ext2HTree::probe(Ext2FileSystem *e,const Ext2CInode *dir,const char *name,size_t nameLen,
+		uint mode,Frame *frames,size_t *levels,uint32_t *hashp,uint *version) {
+	size_t blockSize = e->blockSize();
+	block_t bno = Ext2INode::getDataBlock(e,dir,0);
+	if(bno == 0)
+		return -EINVAL;
+	CBlock *block = e->blockCache.request(bno,mode);
+	if(block == NULL)
+		return -ENOBUFS;
+
+	Ext2DxRoot *root = (Ext2DxRoot*)block->buffer;
+	*version = getVersion(e,root);
+	if(root->reservedZero != 0 || root->infoLength != 8 || *version > EXT2_HASH_TEA_UNSIGNED ||
+			root->indirectLevels > EXT2_HTREE_MAX_LEVELS) {
+		e->blockCache.release(block);
+		return -EINVAL;
+	}
+
+	*hashp = hash(e,*version,name,nameLen);
+	*levels = root->indirectLevels;
+	Ext2DxEntry *entries = (Ext2DxEntry*)((uint8_t*)&root->reservedZero + root->infoLength);
+	for(size_t i = 0; ; ++i) {
+		size_t count = getCount(entries);
+		size_t limit = getLimit(entries);
+		size_t max = (blockSize - ((uint8_t*)entries - (uint8_t*)block->buffer)) / sizeof(Ext2DxEntry);
+		frames[i].block = block;
+		if(count == 0 || count > limit || limit > max) {
+			releaseFrames(e,frames,i);
+			return -EINVAL;
+		}
+
+		/* search for the last entry with a hash <= ours. the first one has no hash */
+		Ext2DxEntry *p = entries + 1;
+		Ext2DxEntry *q = entries + count - 1;
+		while(p <= q) {
+			Ext2DxEntry *m = p + (q - p) / 2;
+			if(le32tocpu(m->hash) > *hashp)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+		frames[i].entries = entries;
+		frames[i].at = p - 1;
+		if(i == *levels)
+			return 0;
+
+		/* go to the next level */
+		bno = Ext2INode::getDataBlock(e,dir,getBlock(frames[i].at));
+		block = bno ? e->blockCache.request(bno,mode) : NULL;
+		if(block == NULL) {
+			releaseFrames(e,frames,i);
+			return -EINVAL;
+		}
+		entries = (Ext2DxEntry*)((Ext2DxNode*)block->buffer + 1);
+	}
+}
+
+bool Ext2HTree::nextLeaf(Ext2FileSystem *e,const Ext2CInode *dir,uint32_t hash,uint mode,
+		Frame *frames,size_t levels) {
+	/* search for the deepest level that has further entries */
+	ssize_t i = levels;
+	while(i >= 0 && frames[i].at + 1 >= frames[i].entries + getCount(frames[i].entries))
+		i--;
+	if(i < 0)
+		return false;
+
+	/* the next leaf contains our hash only if it has been marked as a continuation */
+	uint32_t next = le32tocpu(frames[i].at[1].hash);
+	if((next & 1) == 0 || (next & ~1U) != hash)
+		return false;
+
+	/* walk down to the first leaf below the next entry */
+	frames[i].at++;
+	for(; i < (ssize_t)levels; ++i) {
+		block_t bno = Ext2INode::getDataBlock(e,dir,getBlock(frames[i].at));
+		CBlock *block = bno ? e->blockCache.request(bno,mode) : NULL;
+		if(block == NULL)
+			return false;
+		e->blockCache.release(frames[i + 1].block);
+		frames[i + 1].block = block;
+		frames[i + 1].entries = (Ext2DxEntry*)((Ext2DxNode*)block->buffer + 1);
+		frames[i + 1].at = frames[i + 1].entries;
+	}
+	return true;
+}
+
+void Ext2HTree::releaseFrames(Ext2FileSystem *e,Frame *frames,size_t levels) {
+	for(size_t i = 0; i <= levels; ++i)
+		e->blockCache.release(frames[i].block);
+}
+
+int Ext2HTree::splitLeaf(Ext2FileSystem *e,uint version,uint8_t *leaf,uint8_t *dst,
+		uint32_t *splitHash) {
+	size_t blockSize = e->blockSize();
+	size_t max = blockSize / Ext2Link::getDirESize(0);
+	LeafEntry *entries = (LeafEntry*)malloc(max * sizeof(LeafEntry));
+	uint8_t *copy = (uint8_t*)malloc(blockSize);
+	if(entries == NULL || copy == NULL) {
+		free(copy);
+		free(entries);
+		return -ENOMEM;
+	}
+
+	/* collect the used entries with their hashes */
+	memcpy(copy,leaf,blockSize);
+	size_t count = 0;
+	for(size_t off = 0; off < blockSize && count < max; ) {
+		Ext2DirEntry *dire = (Ext2DirEntry*)(copy + off);
+		size_t recLen = le16tocpu(dire->recLen);
+		if(recLen == 0)
+			break;
+		if(le32tocpu(dire->inode) != 0) {
+			entries[count].hash = hash(e,version,dire->name,le16tocpu(dire->nameLen));
+			entries[count].offset = off;
+			count++;
+		}
+		off += recLen;
+	}
+
+	int res = -ENOSPC;
+	if(count >= 2) {
+		/* keep the lower half of the hashes in <leaf> and move the upper half to <dst> */
+		std::sort(entries,entries + count,compareEntries);
+		size_t mid = count / 2;
+		*splitHash = entries[mid].hash;
+		/* if the hash continues in the new block, the lookup has to search both */
+		if(entries[mid - 1].hash == entries[mid].hash)
+			*splitHash |= 1;
+		compact(copy,entries,mid,leaf,blockSize);
+		compact(copy,entries + mid,count - mid,dst,blockSize);
+		res = 0;
+	}
+
+	free(copy);
+	free(entries);
+	return res;
+}
+
+void Ext2HTree::compact(const uint8_t *src,const LeafEntry *entries,size_t count,uint8_t *dst,
+		size_t size) {
+	Ext2DirEntry *last = NULL;
+	uint8_t *pos = dst;
+	for(size_t i = 0; i < count; ++i) {
+		const Ext2DirEntry *dire = (const Ext2DirEntry*)(src + entries[i].offset);
+		size_t len = Ext2Link::getDirESize(le16tocpu(dire->nameLen));
+		memcpy(pos,dire,len);
+		last = (Ext2DirEntry*)pos;
+		last->recLen = cputole16(len);
+		pos += len;
+	}
+
+	/* the last entry spans the rest of the block */
+	if(last)
+		last->recLen = cputole16(le16tocpu(last->recLen) + (dst + size - pos));
+	else {
+		last = (Ext2DirEntry*)dst;
+		last->inode = cputole32(0);
+		last->recLen = cputole16(size);
+		last->nameLen = cputole16(0);
+	}
+}
+
+bool Ext2HTree::insertInBlock(uint8_t *buffer,size_t size,const char *name,size_t nameLen,
+		ino_t ino) {
+	size_t tlen = Ext2Link::getDirESize(nameLen);
+	uint8_t *pos = buffer;
+	while(pos < buffer + size) {
+		Ext2DirEntry *dire = (Ext2DirEntry*)pos;
+		size_t recLen = le16tocpu(dire->recLen);
+		if(recLen == 0)
+			return false;
+
+		/* does our entry fit behind this one or replace an empty one? */
+		size_t used = 0;
+		if(le32tocpu(dire->inode) != 0)
+			used = Ext2Link::getDirESize(le16tocpu(dire->nameLen));
+		if(used < recLen && recLen - used >= tlen) {
+			if(used > 0) {
+				dire->recLen = cputole16(used);
+				dire = (Ext2DirEntry*)(pos + used);
+				recLen -= used;
+			}
+			dire->inode = cputole32(ino);
+			dire->nameLen = cputole16(nameLen);
+			dire->recLen = cputole16(recLen);
+			memcpy(dire->name,name,nameLen);
+			return true;
+		}
+		pos += recLen;
+	}
+	return false;
+}
+
+uint Ext2HTree::getVersion(Ext2FileSystem *e,const Ext2DxRoot *root) {
+	uint version = root->hashVersion;
+	/* the unsigned variants are not stored in the directory, but chosen via the super-block */
+	if(version <= EXT2_HASH_TEA && (le32tocpu(e->sb.get()->flags) & EXT2_FLAGS_UNSIGNED_HASH))
+		version += EXT2_HASH_LEGACY_UNSIGNED;
+	return version;
+}
+
+uint32_t Ext2HTree::hash(Ext2FileSystem *e,uint version,const char *name,size_t nameLen) {
+	uint32_t buf[4];
+	uint32_t in[8];
+	uint32_t h;
+
+	/* use the seed of the super-block, if there is one */
+	const Ext2SuperBlock *sb = e->sb.get();
+	for(size_t i = 0; i < 4; ++i)
+		buf[i] = le32tocpu(sb->hashSeed[i]);
+	if(!buf[0] && !buf[1] && !buf[2] && !buf[3]) {
+		buf[0] = 0x67452301;
+		buf[1] = 0xEFCDAB89;
+		buf[2] = 0x98BADCFE;
+		buf[3] = 0x10325476;
+	}
+
+	switch(version) {
+		case EXT2_HASH_LEGACY:
+		case EXT2_HASH_LEGACY_UNSIGNED:
+			h = legacyHash(name,nameLen,version == EXT2_HASH_LEGACY);
+			break;
+
+		case EXT2_HASH_HALF_MD4:
+		case EXT2_HASH_HALF_MD4_UNSIGNED:
+			for(size_t off = 0; off < nameLen; off += 32) {
+				strToHashBuf(name + off,nameLen - off,in,8,version == EXT2_HASH_HALF_MD4);
+				halfMD4Transform(buf,in);
+			}
+			h = buf[1];
+			break;
+
+		case EXT2_HASH_TEA:
+		case EXT2_HASH_TEA_UNSIGNED:
+			for(size_t off = 0; off < nameLen; off += 16) {
+				strToHashBuf(name + off,nameLen - off,in,4,version == EXT2_HASH_TEA);
+				teaTransform(buf,in);
+			}
+			h = buf[0];
+			break;
+
+		default:
+			h = 0;
+			break;
+	}
+
+	/* the lowest bit is used to mark continuations */
+	h &= ~1U;
+	if(h == (HTREE_EOF << 1))
+		h = (HTREE_EOF - 1) << 1;
+	return h;
+}
+
+uint32_t Ext2HTree::legacyHash(const char *name,size_t nameLen,bool isSigned) {
+	uint32_t h,h0 = 0x12A3FE2D,h1 = 0x37ABE8F9;
+	for(size_t i = 0; i < nameLen; ++i) {
+		int c = isSigned ? (int)(signed char)name[i] : (int)(unsigned char)name[i];
+		h = h1 + (h0 ^ (uint32_t)(c * 7152373));
+		if(h & 0x80000000)
+			h -= 0x7FFFFFFF;
+		h1 = h0;
+		h0 = h;
+	}
+	return h0 << 1;
+}
+
+void Ext2HTree::strToHashBuf(const char *name,size_t nameLen,uint32_t *buf,size_t num,
+		bool isSigned) {
+	/* the padding depends on the remaining length of the name */
+	uint32_t pad = (uint32_t)nameLen | ((uint32_t)nameLen << 8);
+	pad |= pad << 16;
+
+	uint32_t val = pad;
+	if(nameLen > num * 4)
+		nameLen = num * 4;
+	for(size_t i = 0; i < nameLen; ++i) {
+		int c = isSigned ? (int)(signed char)name[i] : (int)(unsigned char)name[i];
+		val = (uint32_t)c + (val << 8);
+		if((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+
+	if(num > 0) {
+		*buf++ = val;
+		num--;
+	}
+	while(num-- > 0)
+		*buf++ = pad;
+}
+
+void Ext2HTree::teaTransform(uint32_t buf[4],const uint32_t in[4]) {
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0],b1 = buf[1];
+	uint32_t a = in[0],b = in[1],c = in[2],d = in[3];
+	for(int n = 0; n < 16; ++n) {
+		sum += TEA_DELTA;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	}
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+void Ext2HTree::halfMD4Transform(uint32_t buf[4],const uint32_t in[8]) {
+	uint32_t a = buf[0],b = buf[1],c = buf[2],d = buf[3];
+
+	/* round 1 */
+	MD4_ROUND(MD4_F,a,b,c,d,in[0] + MD4_K1,3);
+	MD4_ROUND(MD4_F,d,a,b,c,in[1] + MD4_K1,7);
+	MD4_ROUND(MD4_F,c,d,a,b,in[2] + MD4_K1,11);
+	MD4_ROUND(MD4_F,b,c,d,a,in[3] + MD4_K1,19);
+	MD4_ROUND(MD4_F,a,b,c,d,in[4] + MD4_K1,3);
+	MD4_ROUND(MD4_F,d,a,b,c,in[5] + MD4_K1,7);
+	MD4_ROUND(MD4_F,c,d,a,b,in[6] + MD4_K1,11);
+	MD4_ROUND(MD4_F,b,c,d,a,in[7] + MD4_K1,19);
+
+	/* round 2 */
+	MD4_ROUND(MD4_G,a,b,c,d,in[1] + MD4_K2,3);
+	MD4_ROUND(MD4_G,d,a,b,c,in[3] + MD4_K2,5);
+	MD4_ROUND(MD4_G,c,d,a,b,in[5] + MD4_K2,9);
+	MD4_ROUND(MD4_G,b,c,d,a,in[7] + MD4_K2,13);
+	MD4_ROUND(MD4_G,a,b,c,d,in[0] + MD4_K2,3);
+	MD4_ROUND(MD4_G,d,a,b,c,in[2] + MD4_K2,5);
+	MD4_ROUND(MD4_G,c,d,a,b,in[4] + MD4_K2,9);
+	MD4_ROUND(MD4_G,b,c,d,a,in[6] + MD4_K2,13);
+
+	/* round 3 */
+	MD4_ROUND(MD4_H,a,b,c,d,in[3] + MD4_K3,3);
+	MD4_ROUND(MD4_H,d,a,b,c,in[7] + MD4_K3,9);
+	MD4_ROUND(MD4_H,c,d,a,b,in[2] + MD4_K3,11);
+	MD4_ROUND(MD4_H,b,c,d,a,in[6] + MD4_K3,15);
+	MD4_ROUND(MD4_H,a,b,c,d,in[1] + MD4_K3,3);
+	MD4_ROUND(MD4_H,d,a,b,c,in[5] + MD4_K3,9);
+	MD4_ROUND(MD4_H,c,d,a,b,in[0] + MD4_K3,11);
+	MD4_ROUND(MD4_H,b,c,d,a,in[4] + MD4_K3,15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
@@ -0,0 +1,150 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <fs/blockcache.h>
+#include <fs/ext2/ext2.h>
+#include <sys/common.h>
+
+#include "ext2.h"
+
+/**
+ * Supports the hash-tree index of ext2/ext3 directories (dir_index). The first block of an
+ * indexed directory contains a tree of hash -> block mappings, so that a lookup only has to
+ * read the index-blocks and one leaf-block instead of the whole directory. The leaf-blocks are
+ * ordinary directory-blocks, so that the directory can still be read linearly.
+ */
+class Ext2HTree {
+	Ext2HTree() = delete;
+
+	/* a level of the path from the root to a leaf */
+	struct Frame {
+		fs::CBlock *block;
+		fs::Ext2DxEntry *entries;
+		fs::Ext2DxEntry *at;
+	};
+
+	/* an entry of a leaf-block that is split */
+	struct LeafEntry {
+		uint32_t hash;
+		size_t offset;
+	};
+
+public:
+	/**
+	 * @param e the ext2-handle
+	 * @param dir the directory
+	 * @return true if <dir> has a hash-tree index that should be used
+	 */
+	static bool isIndexed(Ext2FileSystem *e,const Ext2CInode *dir);
+
+	/**
+	 * Searches for the entry <name> in the indexed directory <dir>.
+	 *
+	 * @param e the ext2-handle
+	 * @param dir the directory
+	 * @param name the name of the entry to find
+	 * @param nameLen the length of the name
+	 * @return the inode-number, -ENOENT if not found or -EINVAL if the index is invalid
+	 */
+	static ino_t find(Ext2FileSystem *e,const Ext2CInode *dir,const char *name,size_t nameLen);
+
+	/**
+	 * Inserts the entry <name> -> <ino> into the indexed directory <dir>. If the leaf-block is
+	 * full, it is split. If the index-node has no free slot anymore, it is split as well or, for
+	 * the root, another level is added. Only if the index can't grow anymore, -ENOSPC is returned
+	 * and the caller has to fall back to an unindexed directory.
+	 *
+	 * @param e the ext2-handle
+	 * @param dir the directory (requested for writing!)
+	 * @param name the name of the entry
+	 * @param nameLen the length of the name
+	 * @param ino the inode-number
+	 * @return 0 on success, -ENOSPC if the index is full or -EINVAL if it is invalid
+	 */
+	static int insert(Ext2FileSystem *e,Ext2CInode *dir,const char *name,size_t nameLen,ino_t ino);
+
+private:
+	static uint32_t hash(Ext2FileSystem *e,uint version,const char *name,size_t nameLen);
+	static uint32_t legacyHash(const char *name,size_t nameLen,bool isSigned);
+	static void strToHashBuf(const char *name,size_t nameLen,uint32_t *buf,size_t num,bool isSigned);
+	static void teaTransform(uint32_t buf[4],const uint32_t in[4]);
+	static void halfMD4Transform(uint32_t buf[4],const uint32_t in[8]);
+	static uint getVersion(Ext2FileSystem *e,const fs::Ext2DxRoot *root);
+
+	static size_t getCount(const fs::Ext2DxEntry *entries) {
+		return le16tocpu(reinterpret_cast<const fs::Ext2DxCountLimit*>(entries)->count);
+	}
+	static size_t getLimit(const fs::Ext2DxEntry *entries) {
+		return le16tocpu(reinterpret_cast<const fs::Ext2DxCountLimit*>(entries)->limit);
+	}
+	static block_t getBlock(const fs::Ext2DxEntry *entry) {
+		/* the upper bits are reserved */
+		return le32tocpu(entry->block) & 0x0FFFFFFF;
+	}
+
+	/**
+	 * Walks from the root to the leaf for <name>. Stores the path into <frames>, the number of
+	 * levels below the root into <levels>, the hash of <name> into <hash> and the hash-version
+	 * into <version>. The blocks in <frames> have to be released afterwards.
+	 */
+	static int probe(Ext2FileSystem *e,const Ext2CInode *dir,const char *name,size_t nameLen,
+		uint mode,Frame *frames,size_t *levels,uint32_t *hash,uint *version);
+	/**
+	 * Moves the path to the next leaf, if it might contain further entries with hash <hash>
+	 * (hash collisions can spread over multiple leafs).
+	 */
+	static bool nextLeaf(Ext2FileSystem *e,const Ext2CInode *dir,uint32_t hash,uint mode,
+		Frame *frames,size_t levels);
+	static void releaseFrames(Ext2FileSystem *e,Frame *frames,size_t levels);
+	/**
+	 * Appends a new block to <dir> and stores its number in <no> and the block in <block>.
+	 */
+	static int appendBlock(Ext2FileSystem *e,Ext2CInode *dir,block_t *no,fs::CBlock **block);
+	/**
+	 * Makes room in the index-node below level <parent> of the path <frames> by moving the upper
+	 * half of its entries to a new node. If <parent> is negative, the root is full and all its
+	 * entries are moved to a new node below it instead.
+	 */
+	static int splitNode(Ext2FileSystem *e,Ext2CInode *dir,Frame *frames,size_t levels,
+		ssize_t parent);
+	/**
+	 * Appends a new block to <dir>, moves the upper half of <leaf> to it and inserts the entry
+	 * <name> -> <ino> into the matching half afterwards.
+	 */
+	static int split(Ext2FileSystem *e,Ext2CInode *dir,uint version,uint32_t hash,Frame *node,
+		fs::CBlock *leaf,const char *name,size_t nameLen,ino_t ino);
+	/**
+	 * Puts the entry <name> -> <ino> into a free place of the directory-block <buffer>. Returns
+	 * false if there is not enough space.
+	 */
+	static bool insertInBlock(uint8_t *buffer,size_t size,const char *name,size_t nameLen,ino_t ino);
+	/**
+	 * Splits the leaf-block <leaf> into itself and <dst> by the hashes of the entries.
+	 * Returns the hash of the first entry in <dst> with the lowest bit set, if entries with that
+	 * hash are in <leaf> as well.
+	 */
+	static int splitLeaf(Ext2FileSystem *e,uint version,uint8_t *leaf,uint8_t *dst,uint32_t *splitHash);
+	static void compact(const uint8_t *src,const LeafEntry *entries,size_t count,uint8_t *dst,
+		size_t size);
+	static bool compareEntries(const LeafEntry &a,const LeafEntry &b) {
+		return a.hash < b.hash;
+	}
+};
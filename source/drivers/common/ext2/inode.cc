@@ -17,6 +17,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <esc/util.h>
 #include <fs/blockcache.h>
 #include <fs/permissions.h>
 #include <sys/common.h>
@@ -238,6 +239,97 @@ block_t Ext2INode::doGetDataBlock(Ext2FileSystem *e,Ext2CInode *cnode,block_t bl
 	return 0;
 }
 
+size_t Ext2INode::getDataBlocks(Ext2FileSystem *e,const Ext2CInode *cnode,block_t block,size_t count,
+		block_t *first) {
+	size_t n = 1;
+	if(block < EXT2_DIRBLOCK_COUNT) {
+		*first = le32tocpu(cnode->inode.dBlocks[block]);
+		while(n < count && block + n < EXT2_DIRBLOCK_COUNT) {
+			block_t next = le32tocpu(cnode->inode.dBlocks[block + n]);
+			if(*first ? next != *first + n : next != 0)
+				break;
+			n++;
+		}
+		return n;
+	}
+
+	size_t blocksPerBlock = e->blockSize() / sizeof(block_t);
+	block_t base;
+	block_t indir = getLeafIndir(e,(Ext2CInode*)cnode,block,&base);
+	size_t left = esc::Util::min(count,(size_t)(base + blocksPerBlock - block));
+	/* the whole range of the indirect block is a hole */
+	if(indir == 0) {
+		*first = 0;
+		return left;
+	}
+
+	CBlock *cblock = e->blockCache.request(indir,BlockCache::READ);
+	if(cblock == NULL) {
+		*first = 0;
+		return 0;
+	}
+	block_t *blockNos = (block_t*)cblock->buffer + (block - base);
+	*first = le32tocpu(blockNos[0]);
+	while(n < left) {
+		block_t next = le32tocpu(blockNos[n]);
+		if(*first ? next != *first + n : next != 0)
+			break;
+		n++;
+	}
+	e->blockCache.release(cblock);
+	return n;
+}
+
+block_t Ext2INode::getLeafIndir(Ext2FileSystem *e,Ext2CInode *cnode,block_t block,block_t *base) {
+	size_t blocksPerBlock = e->blockSize() / sizeof(block_t);
+
+	/* sequential reads use the same indirect block again */
+	if(cnode->indirBlock != 0 && block >= cnode->indirBase &&
+			block < cnode->indirBase + blocksPerBlock) {
+		*base = cnode->indirBase;
+		return cnode->indirBlock;
+	}
+
+	block_t indir,off = block - EXT2_DIRBLOCK_COUNT;
+	if(off < blocksPerBlock) {
+		*base = EXT2_DIRBLOCK_COUNT;
+		indir = le32tocpu(cnode->inode.singlyIBlock);
+	}
+	else {
+		off -= blocksPerBlock;
+		if(off < blocksPerBlock * blocksPerBlock) {
+			*base = EXT2_DIRBLOCK_COUNT + blocksPerBlock + (off / blocksPerBlock) * blocksPerBlock;
+			indir = readIndir(e,le32tocpu(cnode->inode.doublyIBlock),off / blocksPerBlock);
+		}
+		else {
+			off -= blocksPerBlock * blocksPerBlock;
+			*base = EXT2_DIRBLOCK_COUNT + blocksPerBlock + blocksPerBlock * blocksPerBlock +
+				(off / blocksPerBlock) * blocksPerBlock;
+			indir = readIndir(e,le32tocpu(cnode->inode.triplyIBlock),
+				off / (blocksPerBlock * blocksPerBlock));
+			indir = readIndir(e,indir,(off / blocksPerBlock) % blocksPerBlock);
+		}
+	}
+
+	/* holes are not remembered, because they might be filled */
+	if(indir != 0) {
+		cnode->indirBase = *base;
+		cnode->indirBlock = indir;
+	}
+	return indir;
+}
+
+block_t Ext2INode::readIndir(Ext2FileSystem *e,block_t indir,block_t i) {
+	if(indir == 0)
+		return 0;
+	CBlock *cblock = e->blockCache.request(indir,BlockCache::READ);
+	if(cblock == NULL)
+		return 0;
+	block_t bno = le32tocpu(((block_t*)cblock->buffer)[i]);
+	e->blockCache.release(cblock);
+	return bno;
+}
+
 #if DEBUGGING
 
 void Ext2INode::print(Ext2Inode *inode) {
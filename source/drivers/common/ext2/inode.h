@@ -116,6 +116,23 @@ public:
 		return doGetDataBlock(e,(Ext2CInode*)cnode,block,false);
 	}
 
+	/**
+	 * Determines the run of blocks on the disk that starts with the linear block <block> of the
+	 * given inode, i.e., the number of following linear blocks (at most <count>) that are stored
+	 * contiguously on the disk. Holes are returned as runs with <*first> = 0.
+	 * The last indirect block that has been used is remembered in <cnode>, so that sequential
+	 * calls don't need to walk through the indirect blocks again.
+	 *
+	 * @param e the ext2-handle
+	 * @param cnode the cached inode
+	 * @param block the linear-block-number
+	 * @param count the maximum number of blocks
+	 * @param first will be set to the first block on the disk (0 for holes)
+	 * @return the number of blocks in the run
+	 */
+	static size_t getDataBlocks(Ext2FileSystem *e,const Ext2CInode *cnode,block_t block,size_t count,
+		block_t *first);
+
 #if DEBUGGING
 
 	/**
@@ -138,4 +155,13 @@ private:
 	 * necessary. In this case cnode may be changed. Otherwise no changes will be made.
 	 */
 	static block_t doGetDataBlock(Ext2FileSystem *e,Ext2CInode *cnode,block_t block,bool req);
+	/**
+	 * Determines the indirect block that contains the block-number of the linear block <block>
+	 * (>= EXT2_DIRBLOCK_COUNT) and the linear block-number of its first entry.
+	 */
+	static block_t getLeafIndir(Ext2FileSystem *e,Ext2CInode *cnode,block_t block,block_t *base);
+	/**
+	 * Reads entry <i> of the indirect block <indir>
+	 */
+	static block_t readIndir(Ext2FileSystem *e,block_t indir,block_t i);
 };
@@ -28,6 +28,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bitmap.h"
+#include "dir.h"
 #include "ext2.h"
 #include "file.h"
 #include "inodecache.h"
@@ -36,13 +38,21 @@
 using namespace fs;
 
 Ext2INodeCache::Ext2INodeCache(Ext2FileSystem *fs)
-		: _hits(), _misses(), _cache(new Ext2CInode[EXT2_ICACHE_SIZE]), _fs(fs) {
+		: _hits(), _misses(), _evictions(), _ghostHits(), _hashmap(), _lists(),
+		  _inMax(EXT2_ICACHE_SIZE / 4), _ghost(EXT2_ICACHE_SIZE / 2),
+		  _cache(new Ext2CInode[EXT2_ICACHE_SIZE]), _fs(fs) {
 	size_t i;
 	Ext2CInode *inode = _cache;
 	for(i = 0; i < EXT2_ICACHE_SIZE; i++) {
 		inode->inodeNo = EXT2_BAD_INO;
 		inode->refs = 0;
 		inode->dirty = false;
+		inode->hnext = NULL;
+		inode->names = NULL;
+		inode->indirBlock = 0;
+		inode->resStart = 0;
+		inode->resCount = 0;
+		addToFront(inode,QUEUE_FREE);
 		inode++;
 	}
 }
@@ -59,65 +69,71 @@ void Ext2INodeCache::flush() {
 	}
 }
 
+void Ext2INodeCache::discardPrealloc() {
+	Ext2CInode *inode,*end = _cache + EXT2_ICACHE_SIZE;
+	for(inode = _cache; inode < end; inode++) {
+		if(inode->inodeNo != EXT2_BAD_INO)
+			Ext2Bitmap::discard(_fs,inode);
+	}
+}
+
 Ext2CInode *Ext2INodeCache::request(ino_t no,uint mode) {
-	/* search for the inode. perhaps it's already in cache */
-	Ext2CInode *startNode = _cache + (no & (EXT2_ICACHE_SIZE - 1));
-	Ext2CInode *iend = _cache + EXT2_ICACHE_SIZE;
-	Ext2CInode *inode;
 	if(no <= EXT2_BAD_INO)
 		return NULL;
 
 	/* tpool_lock the request of an inode */
 	sassert(tpool_lock(ALLOC_LOCK,LOCK_EXCLUSIVE | LOCK_KEEP) == 0);
 
-	for(inode = startNode; inode < iend; inode++) {
-		if(inode->inodeNo == no) {
-			acquire(inode,mode);
-			_hits++;
-			return inode;
-		}
-	}
-	/* look in 0 .. startNode; separate it to make the average-case fast */
-	if(inode == iend) {
-		for(inode = _cache; inode < startNode; inode++) {
-			if(inode->inodeNo == no) {
-				acquire(inode,mode);
-				_hits++;
-				return inode;
-			}
+	/* search for the inode. perhaps it's already in cache */
+	Ext2CInode *inode = find(no);
+	if(inode) {
+		/* only the main-queue is kept in LRU order; the in-queue is a FIFO */
+		if(inode->queue == QUEUE_MAIN) {
+			unlink(inode);
+			addToFront(inode,QUEUE_MAIN);
 		}
+		acquire(inode,mode);
+		_hits++;
+		return inode;
 	}
 
-	/* ok, not in cache. so we start again at the position to find a usable node */
-	/* if we have to load it from disk anyway I think we can waste a few cycles more
-	 * to reduce the number of cycles in the cache-lookup. therefore
-	 * we don't collect the information in the loops above. */
-	for(inode = startNode; inode < iend; inode++) {
-		if(inode->inodeNo == EXT2_BAD_INO || inode->refs == 0)
-			break;
+	/* ok, not in cache. so choose an entry to replace */
+	inode = getVictim();
+	if(inode == NULL) {
+		sassert(tpool_unlock(ALLOC_LOCK) == 0);
+		printf("NO FREE INODE-CACHE-SLOT! What to to??");
+		return NULL;
 	}
-	if(inode == iend) {
-		for(inode = _cache; inode < startNode; inode++) {
-			if(inode->inodeNo == EXT2_BAD_INO || inode->refs == 0)
-				break;
-		}
 
-		if(inode == startNode) {
-			printf("NO FREE INODE-CACHE-SLOT! What to to??");
-			return NULL;
+	uint from = inode->queue;
+	unlink(inode);
+	if(from != QUEUE_FREE) {
+		/* write the old inode back, if necessary */
+		if(inode->dirty) {
+			acquire(inode,IMODE_READ);
+			write(inode);
+			doRelease(inode,false);
 		}
-	}
-
-	/* write the old inode back, if necessary */
-	if(inode->dirty && inode->inodeNo != EXT2_BAD_INO) {
-		acquire(inode,IMODE_READ);
-		write(inode);
-		doRelease(inode,false);
+		unhash(inode);
+		Ext2Dir::invalidate(inode);
+		/* remember inodes that have been used only once to detect it if they come back */
+		if(from == QUEUE_IN)
+			_ghost.add(inode->inodeNo);
+		_evictions++;
 	}
 
 	/* build node */
 	inode->inodeNo = no;
 	inode->dirty = false;
+	inode->indirBlock = 0;
+	inode->resStart = 0;
+	inode->resCount = 0;
+	hash(inode);
+	bool ghostHit = _ghost.remove(no);
+	if(ghostHit)
+		_ghostHits++;
+	addToFront(inode,ghostHit ? QUEUE_MAIN : QUEUE_IN);
+
 	/* first for writing because we have to load it */
 	acquire(inode,IMODE_WRITE);
 
@@ -146,8 +162,12 @@ void Ext2INodeCache::print(FILE *f) {
 	fprintf(f,"\tTotal entries: %zu\n",EXT2_ICACHE_SIZE);
 	fprintf(f,"\tUsed entries: %zu\n",used);
 	fprintf(f,"\tDirty entries: %zu\n",dirty);
+	fprintf(f,"\tIn-queue: %zu of %zu\n",_lists[QUEUE_IN].count,_inMax);
+	fprintf(f,"\tMain-queue: %zu\n",_lists[QUEUE_MAIN].count);
 	fprintf(f,"\tHits: %zu\n",_hits);
 	fprintf(f,"\tMisses: %zu\n",_misses);
+	fprintf(f,"\tEvictions: %zu\n",_evictions);
+	fprintf(f,"\tGhost hits: %zu\n",_ghostHits);
 	if(_hits == 0)
 		hitrate = 0;
 	else
@@ -170,11 +190,17 @@ void Ext2INodeCache::doRelease(Ext2CInode *ino,bool unlockAlloc) {
 	sassert(tpool_lock(ALLOC_LOCK,LOCK_EXCLUSIVE | LOCK_KEEP) == 0);
 	/* if there are no references and no links anymore, we have to delete the file */
 	if(--ino->refs == 0) {
+		/* nobody uses the file anymore, so we don't need the preallocated blocks either */
+		Ext2Bitmap::discard(_fs,ino);
 		if(ino->inode.linkCount == 0) {
 			Ext2File::remove(_fs,ino);
 			/* ensure that we don't use the cached inode again */
+			unhash(ino);
+			unlink(ino);
+			Ext2Dir::invalidate(ino);
 			ino->inodeNo = EXT2_BAD_INO;
 			ino->dirty = false;
+			addToFront(ino,QUEUE_FREE);
 		}
 	}
 	if(unlockAlloc)
@@ -182,6 +208,78 @@ void Ext2INodeCache::doRelease(Ext2CInode *ino,bool unlockAlloc) {
 	sassert(tpool_unlock((uint)ino) == 0);
 }
 
+Ext2CInode *Ext2INodeCache::find(ino_t no) {
+	for(Ext2CInode *inode = _hashmap[no % HASH_SIZE]; inode != NULL; inode = inode->hnext) {
+		if(inode->inodeNo == no)
+			return inode;
+	}
+	return NULL;
+}
+
+Ext2CInode *Ext2INodeCache::getVictim() {
+	if(_lists[QUEUE_FREE].oldest)
+		return _lists[QUEUE_FREE].oldest;
+
+	/* replace inodes that have been used only once, as long as there are enough of them */
+	uint first = QUEUE_MAIN,second = QUEUE_IN;
+	if(_lists[QUEUE_IN].count > _inMax || _lists[QUEUE_MAIN].count == 0) {
+		first = QUEUE_IN;
+		second = QUEUE_MAIN;
+	}
+
+	/* take the oldest unused one; fall back to the other queue if all are in use */
+	uint queues[] = {first,second};
+	for(size_t i = 0; i < ARRAY_SIZE(queues); ++i) {
+		for(Ext2CInode *inode = _lists[queues[i]].oldest; inode != NULL; inode = inode->prev) {
+			if(inode->refs == 0)
+				return inode;
+		}
+	}
+	return NULL;
+}
+
+void Ext2INodeCache::hash(Ext2CInode *inode) {
+	Ext2CInode **list = _hashmap + inode->inodeNo % HASH_SIZE;
+	inode->hnext = *list;
+	*list = inode;
+}
+
+void Ext2INodeCache::unhash(Ext2CInode *inode) {
+	for(Ext2CInode **p = _hashmap + inode->inodeNo % HASH_SIZE; *p != NULL; p = &(*p)->hnext) {
+		if(*p == inode) {
+			*p = inode->hnext;
+			break;
+		}
+	}
+	inode->hnext = NULL;
+}
+
+void Ext2INodeCache::unlink(Ext2CInode *inode) {
+	List *list = _lists + inode->queue;
+	if(inode->prev)
+		inode->prev->next = inode->next;
+	else
+		list->newest = inode->next;
+	if(inode->next)
+		inode->next->prev = inode->prev;
+	else
+		list->oldest = inode->prev;
+	list->count--;
+}
+
+void Ext2INodeCache::addToFront(Ext2CInode *inode,uint queue) {
+	List *list = _lists + queue;
+	inode->queue = queue;
+	inode->prev = NULL;
+	inode->next = list->newest;
+	if(inode->next)
+		inode->next->prev = inode;
+	list->newest = inode;
+	if(list->oldest == NULL)
+		list->oldest = inode;
+	list->count++;
+}
+
 void Ext2INodeCache::read(Ext2CInode *inode) {
 	uint32_t inodesPerGroup = le32tocpu(_fs->sb.get()->inodesPerGroup);
 	Ext2BlockGrp *group = _fs->bgs.get((inode->inodeNo - 1) / inodesPerGroup);
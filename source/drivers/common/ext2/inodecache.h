@@ -19,17 +19,34 @@
 
 #pragma once
 
+#include <fs/ghostlist.h>
 #include <sys/common.h>
 #include <stdio.h>
 
 #include "inode.h"
 
 class Ext2FileSystem;
+class Ext2NameHash;
 
 struct Ext2CInode {
+	Ext2CInode *prev;
+	Ext2CInode *next;
+	Ext2CInode *hnext;
 	ino_t inodeNo;
 	ushort dirty;
 	ushort refs;
+	/* the queue the inode is in */
+	ushort queue;
+	/* for directories: the names in it, if already known */
+	Ext2NameHash *names;
+	/* the last indirect block with data block-numbers that has been used and the linear
+	 * block-number of its first entry */
+	block_t indirBase;
+	block_t indirBlock;
+	/* the blocks that have been allocated in advance for this inode. if resCount is 0, resStart is
+	 * just the block where the next allocation should start */
+	block_t resStart;
+	block_t resCount;
 	fs::Ext2Inode inode;
 };
 
@@ -38,7 +55,27 @@ enum {
 	IMODE_WRITE	= 0x2,
 };
 
+/**
+ * The inode-cache uses the 2Q replacement policy like the block-cache: new inodes go into the
+ * in-queue (FIFO) and only inodes that are requested again after they have been evicted from there
+ * go into the main-queue (LRU). Thus, walking through the whole filesystem does not evict the
+ * frequently used inodes.
+ */
 class Ext2INodeCache {
+	static const size_t HASH_SIZE	= 64;
+
+	enum {
+		QUEUE_IN,
+		QUEUE_MAIN,
+		QUEUE_FREE,
+	};
+
+	struct List {
+		Ext2CInode *newest;
+		Ext2CInode *oldest;
+		size_t count;
+	};
+
 public:
 	/**
 	 * Inits the inode-cache
@@ -48,11 +85,19 @@ public:
 		delete[] _cache;
 	}
 
+	Ext2INodeCache(const Ext2INodeCache&) = delete;
+	Ext2INodeCache &operator=(const Ext2INodeCache&) = delete;
+
 	/**
 	 * Writes all dirty inodes to disk
 	 */
 	void flush();
 
+	/**
+	 * Free's the blocks that have been allocated in advance for all inodes
+	 */
+	void discardPrealloc();
+
 	/**
 	 * Marks the given inode dirty
 	 *
@@ -100,6 +145,24 @@ private:
 	 * Releases the given inode
 	 */
 	void doRelease(Ext2CInode *ino,bool unlockAlloc);
+	/**
+	 * Searches for the inode with number <no>
+	 */
+	Ext2CInode *find(ino_t no);
+	/**
+	 * Determines the entry to replace according to 2Q. Returns NULL if all are in use.
+	 */
+	Ext2CInode *getVictim();
+	/**
+	 * Inserts the inode into the hashmap or removes it from there
+	 */
+	void hash(Ext2CInode *inode);
+	void unhash(Ext2CInode *inode);
+	/**
+	 * Removes <inode> from its queue or puts it at the beginning of queue <queue>
+	 */
+	void unlink(Ext2CInode *inode);
+	void addToFront(Ext2CInode *inode,uint queue);
 	/**
 	 * Reads the inode from block-cache. Requires inode->inodeNo to be valid!
 	 */
@@ -111,6 +174,12 @@ private:
 
 	size_t _hits;
 	size_t _misses;
+	size_t _evictions;
+	size_t _ghostHits;
+	Ext2CInode *_hashmap[HASH_SIZE];
+	List _lists[3];
+	size_t _inMax;
+	fs::GhostList _ghost;
 	Ext2CInode *_cache;
 	Ext2FileSystem *_fs;
 };
@@ -27,6 +27,7 @@
 #include "dir.h"
 #include "ext2.h"
 #include "file.h"
+#include "htree.h"
 #include "inodecache.h"
 #include "link.h"
 
@@ -45,6 +46,29 @@ int Ext2Link::create(Ext2FileSystem *e,User *u,Ext2CInode *dir,Ext2CInode *cnode
 	if((res = e->hasPermission(dir,u,MODE_WRITE)) < 0)
 		return res;
 
+	Ext2Dir::invalidate(dir);
+
+	/* in indexed directories, we only need to touch the index and one leaf */
+	if(Ext2HTree::isIndexed(e,dir)) {
+		ino_t ino = Ext2HTree::find(e,dir,name,len);
+		if(ino >= 0)
+			return -EEXIST;
+		if(ino == -ENOENT) {
+			res = Ext2HTree::insert(e,dir,name,len,cnode->inodeNo);
+			if(res == 0)
+				goto done;
+		}
+		else
+			res = ino;
+		if(res != -ENOSPC && res != -EINVAL)
+			return res;
+
+		/* the index can't grow anymore or is broken. since it is hidden in empty directory-
+		 * entries, the directory is still valid without it, so continue as an unindexed one */
+		dir->inode.flags = cputole32(le32tocpu(dir->inode.flags) & ~EXT2_INDEX_FL);
+		e->inodeCache.markDirty(dir);
+	}
+
 	/* TODO we don't have to read the whole directory at once */
 
 	/* read directory-entries */
@@ -97,6 +121,7 @@ int Ext2Link::create(Ext2FileSystem *e,User *u,Ext2CInode *dir,Ext2CInode *cnode
 	}
 	free(buf);
 
+done:
 	/* increase link-count */
 	cnode->inode.linkCount = cputole16(le16tocpu(cnode->inode.linkCount) + 1);
 	e->inodeCache.markDirty(cnode);
@@ -131,7 +156,10 @@ int Ext2Link::remove(Ext2FileSystem *e,User *u,Ext2CInode *pdir,Ext2CInode *dir,
 	prev = NULL;
 	dire = (Ext2DirEntry*)buf;
 	while((uint8_t*)dire < buf + dirSize) {
-		if(nameLen == le16tocpu(dire->nameLen) && strncmp(dire->name,name,nameLen) == 0) {
+		/* entries can't span multiple blocks */
+		if(((uint8_t*)dire - buf) % e->blockSize() == 0)
+			prev = NULL;
+		if(le32tocpu(dire->inode) != 0 && nameLen == le16tocpu(dire->nameLen) && strncmp(dire->name,name,nameLen) == 0) {
 			ino = le32tocpu(dire->inode);
 			if(pdir && ino == pdir->inodeNo)
 				cnode = pdir;
@@ -162,8 +190,10 @@ int Ext2Link::remove(Ext2FileSystem *e,User *u,Ext2CInode *pdir,Ext2CInode *dir,
 			if(prev != NULL)
 				prev->recLen = cputole16(le16tocpu(prev->recLen) + le16tocpu(dire->recLen));
 			/* otherwise make an empty entry */
-			else
+			else {
 				dire->inode = cputole32(0);
+				dire->nameLen = cputole16(0);
+			}
 			break;
 		}
 
@@ -186,6 +216,7 @@ int Ext2Link::remove(Ext2FileSystem *e,User *u,Ext2CInode *pdir,Ext2CInode *dir,
 		return res;
 	}
 	free(buf);
+	Ext2Dir::invalidate(dir);
 
 	/* update inode */
 	if(cnode != NULL) {
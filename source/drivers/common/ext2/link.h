@@ -54,9 +54,11 @@ public:
 	static int remove(Ext2FileSystem *e,fs::User *u,Ext2CInode *pdir,Ext2CInode *dir,const char *name,
 		bool delDir);
 
-private:
 	/**
 	 * Calculates the total size of a dir-entry, including padding
+	 *
+	 * @param namelen the length of the name
+	 * @return the size
 	 */
 	static size_t getDirESize(size_t namelen);
 };
@@ -0,0 +1,66 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/common.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "namehash.h"
+
+Ext2NameHash::Ext2NameHash(size_t count)
+		: _table(), _size(count < 16 ? 16 : count) {
+	_table = (Entry**)calloc(_size,sizeof(Entry*));
+}
+
+Ext2NameHash::~Ext2NameHash() {
+	if(_table) {
+		for(size_t i = 0; i < _size; ++i) {
+			Entry *e = _table[i];
+			while(e != NULL) {
+				Entry *next = e->next;
+				free(e);
+				e = next;
+			}
+		}
+		free(_table);
+	}
+}
+
+bool Ext2NameHash::add(const char *name,size_t nameLen,ino_t ino) {
+	Entry *e = (Entry*)malloc(sizeof(Entry) + nameLen);
+	if(e == NULL)
+		return false;
+
+	e->ino = ino;
+	e->nameLen = nameLen;
+	memcpy(e->name,name,nameLen);
+	Entry **list = _table + hash(name,nameLen);
+	e->next = *list;
+	*list = e;
+	return true;
+}
+
+ino_t Ext2NameHash::find(const char *name,size_t nameLen) const {
+	for(Entry *e = _table[hash(name,nameLen)]; e != NULL; e = e->next) {
+		if(e->nameLen == nameLen && memcmp(e->name,name,nameLen) == 0)
+			return e->ino;
+	}
+	return -ENOENT;
+}
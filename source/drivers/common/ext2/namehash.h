@@ -0,0 +1,86 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <sys/common.h>
+
+/**
+ * An in-memory hash of the names in a directory. It is built on the first lookup in a directory
+ * that is not indexed on disk and spans multiple blocks. Afterwards, lookups don't have to read
+ * the directory anymore until it is changed.
+ */
+class Ext2NameHash {
+	struct Entry {
+		Entry *next;
+		ino_t ino;
+		size_t nameLen;
+		char name[];
+	};
+
+public:
+	/**
+	 * Creates an empty hash for about <count> entries
+	 *
+	 * @param count the expected number of entries
+	 */
+	explicit Ext2NameHash(size_t count);
+	~Ext2NameHash();
+
+	Ext2NameHash(const Ext2NameHash&) = delete;
+	Ext2NameHash &operator=(const Ext2NameHash&) = delete;
+
+	/**
+	 * @return true if the hash has been created successfully
+	 */
+	bool isValid() const {
+		return _table != NULL;
+	}
+
+	/**
+	 * Adds the entry <name> -> <ino> to the hash
+	 *
+	 * @param name the name (not null-terminated)
+	 * @param nameLen the length of the name
+	 * @param ino the inode-number
+	 * @return true on success
+	 */
+	bool add(const char *name,size_t nameLen,ino_t ino);
+
+	/**
+	 * Searches for the entry with given name
+	 *
+	 * @param name the name
+	 * @param nameLen the length of the name
+	 * @return the inode-number or -ENOENT
+	 */
+	ino_t find(const char *name,size_t nameLen) const;
+
+private:
+	size_t hash(const char *name,size_t nameLen) const {
+		/* FNV-1a */
+		uint32_t h = 2166136261u;
+		for(size_t i = 0; i < nameLen; ++i)
+			h = (h ^ (uint8_t)name[i]) * 16777619u;
+		return h % _size;
+	}
+
+	Entry **_table;
+	size_t _size;
+};
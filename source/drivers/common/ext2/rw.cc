@@ -22,12 +22,18 @@
 #include <sys/io.h>
 #include <sys/messages.h>
 #include <sys/thread.h>
+#include <mutex>
 #include <stdio.h>
 
 #include "ext2.h"
 #include "rw.h"
 
+/* the block cache writes back dirty blocks in a separate thread, so that seek and read/write have
+ * to be done atomically */
+static std::mutex rwLock;
+
 int Ext2RW::readSectors(Ext2FileSystem *e,void *buffer,uint64_t lba,size_t secCount) {
+	std::lock_guard<std::mutex> guard(rwLock);
 	off_t off = seek(e->fd,lba * DISK_SECTOR_SIZE,SEEK_SET);
 	if(off < 0) {
 		printe("Unable to seek to %x",lba * DISK_SECTOR_SIZE);
@@ -44,6 +50,7 @@ int Ext2RW::readSectors(Ext2FileSystem *e,void *buffer,uint64_t lba,size_t secCo
 }
 
 int Ext2RW::writeSectors(Ext2FileSystem *e,const void *buffer,uint64_t lba,size_t secCount) {
+	std::lock_guard<std::mutex> guard(rwLock);
 	off_t off = seek(e->fd,lba * DISK_SECTOR_SIZE,SEEK_SET);
 	if(off < 0) {
 		printe("Unable to seek to %x",lba * DISK_SECTOR_SIZE);
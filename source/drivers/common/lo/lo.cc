@@ -35,7 +35,9 @@ public:
 		return 64 * 1024;
 	}
 	virtual ssize_t send(const void *packet,size_t size) {
-		Packet *pkt = (Packet*)malloc(sizeof(Packet) + size);
+		Packet *pkt = allocPacket();
+		if(!pkt)
+			return -ENOMEM;
 		pkt->length = size;
 		memcpy(pkt->data,packet,size);
 		insert(pkt);
@@ -20,12 +20,12 @@
 #include <esc/ipc/clientdevice.h>
 #include <esc/ipc/requestqueue.h>
 #include <sys/common.h>
+#include <sys/conf.h>
 #include <assert.h>
+#include <mutex>
 #include <stdio.h>
 #include <stdlib.h>
 
-static ulong buffer[IPC_DEF_SIZE / sizeof(ulong)];
-
 class VarRingBuf {
 public:
 	explicit VarRingBuf(size_t size) : _data(new uint8_t[size]), _size(size), _rdpos(), _wrpos(), _last() {
@@ -78,6 +78,15 @@ private:
 	size_t _last;
 };
 
+/* the lock that is shared by both ends of a pipe */
+struct PipeLock {
+	explicit PipeLock() : mutex(), refs(1) {
+	}
+
+	std::mutex mutex;
+	int refs;
+};
+
 class PipeClient : public esc::Client {
 public:
 	enum {
@@ -88,16 +97,24 @@ public:
 		FL_WRITE		= 2
 	};
 
-	explicit PipeClient(int f,uint _flags = FL_WRITE)
-		: esc::Client(f), partner(), pendingRead(), pendingWrite(), ringbuf(), flags(_flags) {
+	explicit PipeClient(int f,uint _flags = FL_WRITE,PipeLock *_lock = NULL)
+		: esc::Client(f), partner(), pendingRead(), pendingWrite(), ringbuf(), flags(_flags),
+		  lock(_lock ? _lock : new PipeLock()) {
 		if(flags & FL_READ)
 			ringbuf = new VarRingBuf(RINGBUF_SIZE);
 	}
 	virtual ~PipeClient() {
 		delete ringbuf;
+		/* the other end might release its reference in parallel */
+		lock->mutex.lock();
+		bool last = --lock->refs == 0;
+		lock->mutex.unlock();
+		if(last)
+			delete lock;
 	}
 
 	void replyRead() {
+		ulong buffer[IPC_DEF_SIZE / sizeof(ulong)];
 		if(pendingRead.count == 0)
 			return;
 
@@ -130,6 +147,7 @@ public:
 	}
 
 	void replyWrite() {
+		ulong buffer[IPC_DEF_SIZE / sizeof(ulong)];
 		if(pendingWrite.count == 0)
 			return;
 
@@ -182,6 +200,8 @@ public:
 	esc::Request pendingWrite;
 	VarRingBuf *ringbuf;
 	uint flags;
+	/* protects both ends of the pipe, since the workers might serve them in parallel */
+	PipeLock *lock;
 };
 
 class PipeDevice : public esc::ClientDevice<PipeClient> {
@@ -201,6 +221,7 @@ public:
 		esc::DevCancel::Request r;
 		is >> r;
 
+		std::lock_guard<std::mutex> guard(c->lock->mutex);
 		errcode_t res = -EINVAL;
 		if(r.msg == MSG_FILE_WRITE) {
 			/* we will not necessarily answer a pending read/write immediately. thus, don't tell the
@@ -231,7 +252,9 @@ public:
 		else {
 			res = createchan(id(),O_RDONLY);
 			if(res >= 0) {
-				PipeClient *nc = new PipeClient(res,PipeClient::FL_READ);
+				std::lock_guard<std::mutex> guard(c->lock->mutex);
+				c->lock->refs++;
+				PipeClient *nc = new PipeClient(res,PipeClient::FL_READ,c->lock);
 				nc->partner = c;
 				c->partner = nc;
 				add(res,nc);
@@ -245,6 +268,7 @@ public:
 		esc::FileRead::Request r;
 		is >> r;
 
+		std::lock_guard<std::mutex> guard(c->lock->mutex);
 		if(c->pendingRead.count != 0) {
 			is << esc::FileRead::Response::error(-EINVAL) << esc::Reply();
 			return;
@@ -266,6 +290,7 @@ public:
 		esc::FileWrite::Request r;
 		is >> r;
 
+		std::lock_guard<std::mutex> guard(c->lock->mutex);
 		int res = 0;
 		if(c->pendingWrite.count != 0 || r.count > PipeClient::RINGBUF_SIZE) {
 			res = -EINVAL;
@@ -293,12 +318,15 @@ public:
 
 	void close(esc::IPCStream &is) {
 		PipeClient *c = (*this)[is.fd()];
-		if(c->partner) {
-			c->partner->partner = NULL;
-			if(c->flags & PipeClient::FL_WRITE)
-				c->partner->replyRead();
-			else
-				c->partner->replyWrite();
+		{
+			std::lock_guard<std::mutex> guard(c->lock->mutex);
+			if(c->partner) {
+				c->partner->partner = NULL;
+				if(c->flags & PipeClient::FL_WRITE)
+					c->partner->replyRead();
+				else
+					c->partner->replyWrite();
+			}
 		}
 		esc::ClientDevice<PipeClient>::close(is);
 	}
@@ -306,6 +334,7 @@ public:
 
 int main() {
 	PipeDevice dev("/dev/pipe",0600);
-	dev.loop();
+	/* independent pipes don't share any state, so that they can be served in parallel */
+	dev.loop(sysconf(CONF_CPU_COUNT));
 	return EXIT_SUCCESS;
 }
@@ -24,6 +24,7 @@
 #include <esc/proto/nic.h>
 #include <esc/proto/socket.h>
 #include <sys/common.h>
+#include <mutex>
 
 struct Empty {
 	size_t size() const {
@@ -37,6 +38,9 @@ template<class T = Empty>
 class IPv4;
 class Socket;
 
+/* the stack lock (see tcpip.cc) */
+extern std::mutex mutex;
+
 enum {
 	ETHER_HEAD_SIZE		= 6 + 6 + 2
 };
@@ -37,15 +37,22 @@ Link::~Link() {
 	destroybuf(_buffer);
 }
 
-ssize_t Link::read(void *buffer,size_t size) {
-	ssize_t res = ::read(fd(),buffer,size);
-	if(res > 0) {
-		PRINT("Received packet of " << res << " bytes:\n"
-			<< *reinterpret_cast<Ethernet<>*>(buffer));
-		_rxpkts++;
-		_rxbytes += res;
-	}
-	return res;
+ssize_t Link::wait() {
+	esc::NIC::Ring *r = ring();
+	if(r->count() > 0)
+		return r->count();
+	/* the driver answers as soon as it has put packets into the ring. it doesn't write to the
+	 * buffer, but we have to read at least one byte to reach the driver */
+	return ::read(fd(),r,sizeof(*r));
+}
+
+esc::NIC::Ring::Slot *Link::fetch(size_t idx) {
+	esc::NIC::Ring::Slot *slot = get(idx);
+	PRINT("Received packet of " << slot->length << " bytes:\n"
+		<< *reinterpret_cast<Ethernet<>*>(slot->data));
+	_rxpkts++;
+	_rxbytes += slot->length;
+	return slot;
 }
 
 ssize_t Link::write(const void *buffer,size_t size) {
@@ -53,8 +60,9 @@ ssize_t Link::write(const void *buffer,size_t size) {
 	if(res > 0) {
 		PRINT("Sent packet of " << res << " bytes:\n"
 			<< *reinterpret_cast<const Ethernet<>*>(buffer));
-		_txpkts++;
-		_txbytes += res;
+		/* all sockets send in parallel */
+		__sync_fetch_and_add(&_txpkts,1);
+		__sync_fetch_and_add(&_txbytes,res);
 	}
 	return res;
 }
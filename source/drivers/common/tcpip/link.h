@@ -27,23 +27,29 @@
 #include "common.h"
 
 class Link : public esc::NIC, public std::enable_shared_from_this<Link> {
+	/* the amount of memory to use for the receive ring */
+	static const size_t RING_SIZE	= 256 * 1024;
+
 public:
 	static const size_t NAME_LEN	= 16;
 
 	explicit Link(const std::string &n,const char *path)
 		: esc::NIC(path,O_RDWRMSG), _rtid(), _rxpkts(), _txpkts(), _rxbytes(), _txbytes(),
 		  _mtu(getMTU()), _name(n), _status(esc::Net::DOWN), _mac(getMAC()), _ip(), _subnetmask() {
-		sharebuf(fd(),mtu(),&_buffer,0);
+		ulong slots = esc::Util::max(RING_SIZE / esc::NIC::Ring::slotSize(mtu()),(size_t)2);
+		sharebuf(fd(),esc::NIC::Ring::size(slots,mtu()),&_buffer,0);
 		if(_buffer == NULL)
 			throw esc::default_error("Not enough memory for buffer",-ENOMEM);
+		ring()->init(slots,mtu());
+		useRing(slots);
 	}
 	~Link();
 
 	const std::string &name() const {
 		return _name;
 	}
-	void *sharedmem() {
-		return _buffer;
+	esc::NIC::Ring *ring() {
+		return reinterpret_cast<esc::NIC::Ring*>(_buffer);
 	}
 
 	ulong txpackets() const {
@@ -94,7 +100,43 @@ public:
 		_rtid = tid;
 	}
 
-	ssize_t read(void *buffer,size_t size);
+	/**
+	 * Waits until the receive ring is not empty
+	 *
+	 * @return the number of packets in the ring or a negative error code
+	 */
+	ssize_t wait();
+	/**
+	 * Returns the packet at position <idx> in the receive ring, counting from the oldest one, and
+	 * accounts it in the statistics. Assumes that the ring contains more than <idx> packets.
+	 *
+	 * @param idx the position
+	 * @return the slot of the packet
+	 */
+	esc::NIC::Ring::Slot *fetch(size_t idx);
+	/**
+	 * Returns the packet at position <idx> in the receive ring again, without accounting it.
+	 *
+	 * @param idx the position
+	 * @return the slot of the packet
+	 */
+	esc::NIC::Ring::Slot *get(size_t idx) {
+		esc::NIC::Ring *r = ring();
+		return r->slot(r->tail + idx);
+	}
+	/**
+	 * Removes the <count> oldest packets from the receive ring, so that the driver can reuse the
+	 * slots.
+	 *
+	 * @param count the number of packets
+	 */
+	void release(size_t count) {
+		esc::NIC::Ring *r = ring();
+		/* we're done with the slots before the driver sees the new tail */
+		__sync_synchronize();
+		r->tail += count;
+	}
+
 	ssize_t write(const void *buffer,size_t size);
 
 private:
@@ -25,6 +25,7 @@
 #include "ethernet.h"
 #include "ipv4.h"
 
+std::mutex ARP::_mutex;
 ARP::pending_type ARP::_pending;
 ARP::cache_type ARP::_cache;
 
@@ -81,7 +82,10 @@ ssize_t ARP::handleRequest(const std::shared_ptr<Link> &link,const ARP *packet)
 		return -EINVAL;
 
 	// store the mapping in every case. perhaps we need it in future
-	_cache[packet->ipSender] = packet->hwSender;
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		_cache[packet->ipSender] = packet->hwSender;
+	}
 
 	// not for us?
 	if(packet->ipTarget != link->ip())
@@ -114,16 +118,25 @@ ssize_t ARP::send(const std::shared_ptr<Link> &link,Ethernet<> *packet,size_t si
 	else if(ip == link->ip())
 		mac = link->mac();
 	else {
-		cache_type::iterator it = _cache.find(ip);
+		bool known;
+		int res = 0;
+		{
+			std::lock_guard<std::mutex> guard(_mutex);
+			cache_type::iterator it = _cache.find(ip);
+			known = it != _cache.end();
+			if(known)
+				mac = it->second;
+			// if we don't know the MAC address yet, add packet to pending list
+			else
+				res = createPending(packet,size,ip,type);
+		}
 
-		// if we don't know the MAC address yet, start an ARP request and add packet to pending list
-		if(it == _cache.end()) {
-			int res = createPending(packet,size,ip,type);
+		// and start an ARP request
+		if(!known) {
 			if(res < 0)
 				return res;
 			return requestMAC(link,ip);
 		}
-		mac = it->second;
 	}
 
 	// otherwise just send the packet
@@ -138,14 +151,18 @@ ssize_t ARP::receive(const std::shared_ptr<Link> &link,const Packet &packet) {
 
 		case CMD_REPLY:
 			esc::sout << "Got MAC " << arp.hwSender << " for IP " << arp.ipSender << esc::endl;
-			_cache[arp.ipSender] = arp.hwSender;
-			sendPending(link);
+			{
+				std::lock_guard<std::mutex> guard(_mutex);
+				_cache[arp.ipSender] = arp.hwSender;
+				sendPending(link);
+			}
 			return 0;
 	}
 	return 0;
 }
 
 void ARP::print(esc::OStream &os) {
+	std::lock_guard<std::mutex> guard(_mutex);
 	for(auto it = _cache.begin(); it != _cache.end(); ++it)
 		os << it->first << " " << it->second << "\n";
 }
@@ -23,6 +23,7 @@
 #include <sys/common.h>
 #include <sys/endian.h>
 #include <map>
+#include <mutex>
 
 #include "../common.h"
 #include "../link.h"
@@ -62,6 +63,7 @@ public:
 	static ssize_t receive(const std::shared_ptr<Link> &link,const Packet &packet);
 
 	static int remove(const esc::Net::IPv4Addr &ip) {
+		std::lock_guard<std::mutex> guard(_mutex);
 		return _cache.erase(ip) ? 0 : -ENOTFOUND;
 	}
 	static ssize_t requestMAC(const std::shared_ptr<Link> &link,const esc::Net::IPv4Addr &ip);
@@ -86,6 +88,8 @@ public:
 	esc::Net::IPv4Addr ipTarget;
 
 private:
+	/* protects the cache and the pending packets, because all sockets send via ARP */
+	static std::mutex _mutex;
 	static pending_type _pending;
 	static cache_type _cache;
 } A_PACKED;
@@ -53,9 +53,12 @@ public:
 		const Ethernet<> *epkt = packet.data<const Ethernet<>*>();
 
 		// give all raw ethernet socket the received packet
-		for(auto it = RawEtherSocket::sockets.begin(); it != RawEtherSocket::sockets.end(); ++it) {
-			if((*it)->protocol() == esc::Socket::PROTO_ANY || (*it)->protocol() == epkt->type)
-				(*it)->push(esc::Socket::Addr(),packet);
+		if(!RawEtherSocket::sockets.empty()) {
+			std::lock_guard<std::mutex> guard(mutex);
+			for(auto it = RawEtherSocket::sockets.begin(); it != RawEtherSocket::sockets.end(); ++it) {
+				if((*it)->protocol() == esc::Socket::PROTO_ANY || (*it)->protocol() == epkt->type)
+					(*it)->push(esc::Socket::Addr(),packet);
+			}
 		}
 
 		switch(be16tocpu(epkt->type)) {
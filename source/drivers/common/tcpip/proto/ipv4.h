@@ -83,9 +83,12 @@ public:
 		uint8_t proto = ippkt->payload.protocol;
 
 		// give all raw IP socket the received packet
-		for(auto it = RawIPSocket::sockets.begin(); it != RawIPSocket::sockets.end(); ++it) {
-			if((*it)->protocol() == esc::Socket::PROTO_ANY || (*it)->protocol() == proto)
-				(*it)->push(esc::Socket::Addr(),packet,ETHER_HEAD_SIZE);
+		if(!RawIPSocket::sockets.empty()) {
+			std::lock_guard<std::mutex> guard(mutex);
+			for(auto it = RawIPSocket::sockets.begin(); it != RawIPSocket::sockets.end(); ++it) {
+				if((*it)->protocol() == esc::Socket::PROTO_ANY || (*it)->protocol() == proto)
+					(*it)->push(esc::Socket::Addr(),packet,ETHER_HEAD_SIZE);
+			}
 		}
 
 		switch(proto) {
@@ -112,27 +112,26 @@ ssize_t TCP::receive(const std::shared_ptr<Link>&,const Packet &packet) {
 	uint16_t srcp = be16tocpu(tcp->srcPort);
 	uint16_t dstp = be16tocpu(tcp->dstPort);
 
-	uint32_t key = getKey(dstp,srcp);
-	socket_map::iterator it = _socks.find(key);
+	/* TCP sockets are protected by the stack lock, which excludes the writers of the table */
+	std::lock_guard<std::mutex> guard(mutex);
+	StreamSocket *sock = _socks.find(getKey(dstp,srcp));
 	// if there is no socket for the specified remote port, try to find a listening socket on the
 	// local port (with remote=0).
-	if(it == _socks.end()) {
-		key = getKey(dstp,0);
-		it = _socks.find(key);
-	}
+	if(!sock)
+		sock = _socks.find(getKey(dstp,0));
 
 	PRINT_TCP(dstp,srcp,"received [%s] seq=%u ack=%u len=%zu win=%u",
 		flagsToStr(tcp->ctrlFlags),be32tocpu(tcp->seqNumber),be32tocpu(tcp->ackNumber),
 		be16tocpu(ip->packetSize) - IPv4<>().size() - ((tcp->dataOffset >> 4) * 4),
 		be16tocpu(tcp->windowSize));
 
-	if(it != _socks.end()) {
+	if(sock) {
 		esc::Socket::Addr sa;
 		sa.family = esc::Socket::AF_INET;
 		sa.d.ipv4.addr = pkt->payload.src.value();
 		sa.d.ipv4.port = srcp;
 		size_t offset = reinterpret_cast<const uint8_t*>(tcp + 1) - packet.data<uint8_t*>();
-		it->second->push(sa,packet,offset);
+		sock->push(sa,packet,offset);
 	}
 	// if it is no RST packet, and we have no socket associated with it, send a RST
 	else if(~tcp->ctrlFlags & FL_RST)
@@ -141,14 +140,16 @@ ssize_t TCP::receive(const std::shared_ptr<Link>&,const Packet &packet) {
 }
 
 void TCP::printSockets(esc::OStream &os) {
-	for(auto it = _socks.begin(); it != _socks.end(); ++it) {
-		Route r = Route::find(it->second->remoteIP());
-		os << it->second->fd() << " TCP " << it->second->state() << " ";
-		if(r.valid())
-			os << r.link->ip();
-		else
-			os << "?";
-		os << ":" << it->second->localPort() << "->";
-		os << it->second->remoteIP() << ":" << it->second->remotePort() << "\n";
+	for(size_t i = 0; i < socket_map::SIZE; ++i) {
+		for(const socket_map::Entry *e = _socks.bucket(i); e != NULL; e = e->next) {
+			Route r = Route::find(e->sock->remoteIP());
+			os << e->sock->fd() << " TCP " << e->sock->state() << " ";
+			if(r.valid())
+				os << r.link->ip();
+			else
+				os << "?";
+			os << ":" << e->sock->localPort() << "->";
+			os << e->sock->remoteIP() << ":" << e->sock->remotePort() << "\n";
+		}
 	}
 }
@@ -22,12 +22,12 @@
 #include <esc/stream/ostream.h>
 #include <sys/common.h>
 #include <sys/endian.h>
-#include <map>
 
 #include "../socket/streamsocket.h"
 #include "../common.h"
 #include "../link.h"
 #include "../portmng.h"
+#include "../sockettable.h"
 
 #define DEBUG_TCP	0
 
@@ -40,7 +40,7 @@
 class TCP {
 	friend class StreamSocket;
 
-	typedef std::map<uint32_t,StreamSocket*> socket_map;
+	typedef SocketTable<uint32_t,StreamSocket> socket_map;
 
 public:
 	enum {
@@ -77,18 +77,10 @@ private:
 		return ((uint32_t)localPort << 16) | remotePort;
 	}
 	static ssize_t addSocket(StreamSocket *sock,esc::port_t localPort,esc::port_t remotePort) {
-		uint32_t key = getKey(localPort,remotePort);
-		socket_map::iterator it = _socks.find(key);
-		if(it != _socks.end())
-			return it->second != sock ? -EADDRINUSE : 0;
-		_socks[key] = sock;
-		return 0;
+		return _socks.add(getKey(localPort,remotePort),sock);
 	}
 	static void remSocket(StreamSocket *sock,esc::port_t localPort,esc::port_t remotePort) {
-		uint32_t key = getKey(localPort,remotePort);
-		socket_map::iterator it = _socks.find(key);
-		if(it != _socks.end() && it->second == sock)
-			_socks.erase(it);
+		_socks.remove(getKey(localPort,remotePort),sock);
 	}
 
 public:
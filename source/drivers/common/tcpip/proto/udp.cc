@@ -54,19 +54,25 @@ ssize_t UDP::send(const esc::Net::IPv4Addr &ip,esc::port_t srcp,esc::port_t dstp
 ssize_t UDP::receive(const std::shared_ptr<Link>&,const Packet &packet) {
 	const Ethernet<IPv4<UDP>> *pkt = packet.data<const Ethernet<IPv4<UDP>>*>();
 	const UDP *udp = &pkt->payload.payload;
-	socket_map::iterator it = _socks.find(be16tocpu(udp->dstPort));
-	if(it != _socks.end()) {
+	/* only the socket is locked, so that packets for different sockets are handled in parallel */
+	socket_map::ReadGuard reader(_socks);
+	DGramSocket *sock = _socks.find(be16tocpu(udp->dstPort));
+	if(sock) {
 		esc::Socket::Addr sa;
 		sa.family = esc::Socket::AF_INET;
 		sa.d.ipv4.addr = pkt->payload.src.value();
 		sa.d.ipv4.port = be16tocpu(udp->srcPort);
 		size_t offset = reinterpret_cast<const uint8_t*>(udp + 1) - packet.data<uint8_t*>();
-		it->second->push(sa,packet,offset);
+		std::lock_guard<std::mutex> guard(sock->lock());
+		sock->push(sa,packet,offset);
 	}
 	return 0;
 }
 
 void UDP::printSockets(esc::OStream &os) {
-	for(auto it = _socks.begin(); it != _socks.end(); ++it)
-		os << it->second->fd() << " UDP *:" << it->first << "\n";
+	socket_map::ReadGuard reader(_socks);
+	for(size_t i = 0; i < socket_map::SIZE; ++i) {
+		for(const socket_map::Entry *e = _socks.bucket(i); e != NULL; e = e->next)
+			os << e->sock->fd() << " UDP *:" << e->key << "\n";
+	}
 }
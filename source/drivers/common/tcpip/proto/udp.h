@@ -22,17 +22,17 @@
 #include <esc/stream/ostream.h>
 #include <sys/common.h>
 #include <sys/endian.h>
-#include <map>
 
 #include "../socket/dgramsocket.h"
 #include "../common.h"
 #include "../link.h"
 #include "../portmng.h"
+#include "../sockettable.h"
 
 class UDP {
 	friend class DGramSocket;
 
-	typedef std::map<esc::port_t,DGramSocket*> socket_map;
+	typedef SocketTable<esc::port_t,DGramSocket> socket_map;
 
 public:
 	enum {
@@ -51,16 +51,10 @@ public:
 
 private:
 	static ssize_t addSocket(DGramSocket *sock,esc::port_t port) {
-		socket_map::iterator it = _socks.find(port);
-		if(it != _socks.end())
-			return it->second != sock ? -EADDRINUSE : 0;
-		_socks[port] = sock;
-		return 0;
+		return _socks.add(port,sock);
 	}
 	static void remSocket(DGramSocket *sock,esc::port_t port) {
-		socket_map::iterator it = _socks.find(port);
-		if(it != _socks.end() && it->second == sock)
-			_socks.erase(it);
+		_socks.remove(port,sock);
 	}
 
 public:
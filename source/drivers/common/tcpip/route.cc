@@ -18,11 +18,13 @@
  */
 
 #include <sys/common.h>
+#include <assert.h>
 
 #include "route.h"
 
 std::mutex Route::_mutex;
 std::vector<Route*> Route::_table;
+Route::Node Route::_root;
 
 int Route::insert(const esc::Net::IPv4Addr &dest,const esc::Net::IPv4Addr &nm,
 		const esc::Net::IPv4Addr &gw,uint flags,const std::shared_ptr<Link> &l) {
@@ -32,23 +34,42 @@ int Route::insert(const esc::Net::IPv4Addr &dest,const esc::Net::IPv4Addr &nm,
 	if(!nm.isNetmask() || !l)
 		return -EINVAL;
 
+	Route *r = new Route(dest,nm,gw,flags,l);
 	std::lock_guard<std::mutex> guard(_mutex);
+	Node *n = getNode(r,true);
+	if(!n) {
+		delete r;
+		return -ENOMEM;
+	}
+	n->routes.insert(n->routes.begin(),r);
+
 	auto it = _table.begin();
 	for(; it != _table.end(); ++it) {
 		if(nm >= (*it)->netmask)
 			break;
 	}
-	_table.insert(it,new Route(dest,nm,gw,flags,l));
+	_table.insert(it,r);
 	return 0;
 }
 
 Route Route::find(const esc::Net::IPv4Addr &ip) {
 	std::lock_guard<std::mutex> guard(_mutex);
-	for(auto it = _table.begin(); it != _table.end(); ++it) {
-		if(((*it)->flags & esc::Net::FL_UP) && (*it)->dest.sameNetwork(ip,(*it)->netmask))
-			return **it;
+	uint32_t addr = ip.value();
+	Route *best = NULL;
+	Node *n = &_root;
+	// walk down as far as possible; the deepest node with an active route is the longest match
+	for(size_t depth = 0; n; ++depth) {
+		for(auto it = n->routes.begin(); it != n->routes.end(); ++it) {
+			if((*it)->flags & esc::Net::FL_UP) {
+				best = *it;
+				break;
+			}
+		}
+		if(depth == 32)
+			break;
+		n = n->child[(addr >> (31 - depth)) & 1];
 	}
-	return Route();
+	return best ? *best : Route();
 }
 
 int Route::setStatus(const esc::Net::IPv4Addr &ip,esc::Net::Status status) {
@@ -69,6 +90,8 @@ int Route::remove(const esc::Net::IPv4Addr &ip) {
 	std::lock_guard<std::mutex> guard(_mutex);
 	for(auto it = _table.begin(); it != _table.end(); ++it) {
 		if((*it)->dest == ip) {
+			unindex(*it);
+			delete *it;
 			_table.erase(it);
 			return 0;
 		}
@@ -79,13 +102,50 @@ int Route::remove(const esc::Net::IPv4Addr &ip) {
 void Route::removeAll(const std::shared_ptr<Link> l) {
 	std::lock_guard<std::mutex> guard(_mutex);
 	for(auto it = _table.begin(); it != _table.end(); ) {
-		if((*it)->link == l)
-			_table.erase(it);
+		if((*it)->link == l) {
+			unindex(*it);
+			delete *it;
+			it = _table.erase(it);
+		}
 		else
 			++it;
 	}
 }
 
+Route::Node *Route::getNode(const Route *r,bool create) {
+	uint32_t addr = r->dest.value();
+	size_t prefix = __builtin_popcount(r->netmask.value());
+	Node *n = &_root;
+	for(size_t depth = 0; n && depth < prefix; ++depth) {
+		Node **child = n->child + ((addr >> (31 - depth)) & 1);
+		if(!*child && create)
+			*child = new Node();
+		n = *child;
+	}
+	return n;
+}
+
+void Route::unindex(Route *r) {
+	uint32_t addr = r->dest.value();
+	size_t prefix = __builtin_popcount(r->netmask.value());
+	// remember the path to the node, so that we can remove the nodes that are not needed anymore
+	Node *path[33];
+	path[0] = &_root;
+	for(size_t depth = 0; depth < prefix; ++depth) {
+		path[depth + 1] = path[depth]->child[(addr >> (31 - depth)) & 1];
+		assert(path[depth + 1] != NULL);
+	}
+	path[prefix]->routes.erase_first(r);
+
+	for(size_t depth = prefix; depth > 0; --depth) {
+		Node *n = path[depth];
+		if(!n->routes.empty() || n->child[0] || n->child[1])
+			break;
+		path[depth - 1]->child[(addr >> (32 - depth)) & 1] = NULL;
+		delete n;
+	}
+}
+
 void Route::print(esc::OStream &os) {
 	std::lock_guard<std::mutex> guard(_mutex);
 	for(auto it = _table.begin(); it != _table.end(); ++it) {
@@ -25,7 +25,25 @@
 #include "common.h"
 #include "link.h"
 
+/**
+ * The routing table. Besides the list of all routes, sorted by netmask, the routes are indexed by a
+ * binary trie over the bits of the destination, so that find() does a longest-prefix-match in at
+ * most 32 steps instead of scanning all routes.
+ */
 class Route {
+	struct Node {
+		explicit Node() : child(), routes() {
+		}
+		~Node() {
+			delete child[0];
+			delete child[1];
+		}
+
+		Node *child[2];
+		/* the routes with exactly this prefix; the newest first */
+		std::vector<Route*> routes;
+	};
+
 	explicit Route() : dest(), netmask(), gateway(), flags(), link() {
 	}
 
@@ -54,6 +72,10 @@ public:
 	std::shared_ptr<Link> link;
 
 private:
+	static Node *getNode(const Route *r,bool create);
+	static void unindex(Route *r);
+
 	static std::mutex _mutex;
 	static std::vector<Route*> _table;
+	static Node _root;
 };
@@ -44,5 +44,6 @@ public:
 private:
 	esc::Net::IPv4Addr _localIp;
 	esc::port_t _localPort;
+	/* only used by the thread of the datagram socket device, so that the socket lock suffices */
 	static PortMng<PRIVATE_PORTS_CNT> _ports;
 };
@@ -37,6 +37,13 @@ public:
 		sockets.remove(this);
 	}
 
+	/**
+	 * The list of raw sockets is shared, so that they are protected by the stack lock.
+	 */
+	virtual std::mutex &lock() {
+		return mutex;
+	}
+
 	virtual int bind(const esc::Socket::Addr *) {
 		return sockets.add(this);
 	}
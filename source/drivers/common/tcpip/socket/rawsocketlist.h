@@ -26,11 +26,17 @@
 
 class Socket;
 
+/**
+ * The list of raw sockets of one type. It is protected by the stack lock, except for empty().
+ */
 class RawSocketList {
 public:
 	typedef std::vector<Socket*> list_type;
 	typedef list_type::iterator iterator;
 
+	explicit RawSocketList() : _socks(), _count() {
+	}
+
 	iterator begin() {
 		return _socks.begin();
 	}
@@ -38,10 +44,21 @@ public:
 		return _socks.end();
 	}
 
+	/**
+	 * Can be used without the stack lock to skip the raw sockets in the common case. A socket that
+	 * is just being added might be missed.
+	 *
+	 * @return true if there are no raw sockets
+	 */
+	bool empty() const {
+		return _count == 0;
+	}
+
 	ssize_t add(Socket *sock) {
 		if(contains(sock))
 			return -EADDRINUSE;
 		_socks.push_back(sock);
+		_count = _socks.size();
 		return 0;
 	}
 	bool contains(Socket *sock) {
@@ -53,8 +70,10 @@ public:
 	}
 	void remove(Socket *sock) {
 		_socks.erase_first(sock);
+		_count = _socks.size();
 	}
 
 private:
 	list_type _socks;
+	volatile size_t _count;
 };
@@ -26,6 +26,7 @@
 #include <sys/mman.h>
 #include <assert.h>
 #include <list>
+#include <mutex>
 #include <string.h>
 
 #include "../common.h"
@@ -45,7 +46,7 @@ public:
 	};
 
 	explicit Socket(int f,int proto = esc::Socket::PROTO_ANY)
-		: esc::Client(f), _proto(proto), _pending() {
+		: esc::Client(f), _proto(proto), _pending(), _mutex() {
 	}
 	virtual ~Socket() {
 	}
@@ -54,6 +55,17 @@ public:
 		return _proto;
 	}
 
+	/**
+	 * The lock that protects the state of this socket. All operations except disconnect() are
+	 * called with this lock held, both by the socket device and the receive threads. By default,
+	 * every socket has its own lock.
+	 *
+	 * @return the lock
+	 */
+	virtual std::mutex &lock() {
+		return _mutex;
+	}
+
 	virtual int cancel(msgid_t mid) {
 		if(!_pending.count)
 			return esc::DevCancel::READY;
@@ -81,6 +93,11 @@ public:
 	virtual int abort() {
 		return -ENOTSUP;
 	}
+	/**
+	 * Is called without the lock, because the socket might be destroyed. The caller guarantees
+	 * that the socket device does not use it anymore and the protocols wait for their receive
+	 * threads when removing it from their socket table.
+	 */
 	virtual void disconnect() {
 		delete this;
 	}
@@ -139,4 +156,5 @@ protected:
 	int _proto;
 	PendingRequest _pending;
 	std::list<QueuedPacket> _packets;
+	std::mutex _mutex;
 };
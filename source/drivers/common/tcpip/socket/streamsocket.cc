@@ -252,6 +252,7 @@ int StreamSocket::abort() {
 }
 
 void StreamSocket::disconnect() {
+	std::lock_guard<std::mutex> guard(lock());
 	_closed = true;
 	switch(_state) {
 		// if the socket is completely closed, we can destroy it immediately
@@ -101,6 +101,14 @@ public:
 	virtual int abort();
 	virtual void disconnect();
 
+	/**
+	 * TCP sockets share their state with the timeouts and create new sockets when receiving
+	 * packets. Therefore, they are protected by the stack lock.
+	 */
+	virtual std::mutex &lock() {
+		return mutex;
+	}
+
 	esc::port_t localPort() const {
 		return _localPort;
 	}
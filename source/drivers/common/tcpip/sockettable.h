@@ -0,0 +1,181 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#pragma once
+
+#include <sys/common.h>
+#include <sys/thread.h>
+#include <errno.h>
+#include <mutex>
+
+/**
+ * A hashtable that maps keys (ports or port pairs) to sockets. In contrast to a std::map, the
+ * lookup for every received packet is a single hash computation and a short chain walk.
+ *
+ * Lookups don't take a lock: writers are serialized by an internal lock, publish new entries only
+ * after initializing them and free removed entries only after all readers have left the table
+ * again. Thus, find() may run concurrently to add() and remove(), as long as the caller is a
+ * reader, i.e., holds a ReadGuard. Removing an entry waits for the readers, so that the caller
+ * of remove() may destroy the socket afterwards.
+ */
+template<typename K,class S,size_t N = 64>
+class SocketTable {
+public:
+	static const size_t SIZE	= N;
+
+	struct Entry {
+		explicit Entry(K k,S *s,Entry *n) : key(k), sock(s), next(n) {
+		}
+
+		K key;
+		S *sock;
+		Entry *volatile next;
+	};
+
+	/**
+	 * Makes the current thread a reader of the table as long as it exists. Entries and sockets
+	 * that have been found during that time are not destroyed until the guard is gone.
+	 */
+	class ReadGuard {
+	public:
+		explicit ReadGuard(const SocketTable &table) : _table(table) {
+			__sync_fetch_and_add(&_table._readers,1);
+		}
+		~ReadGuard() {
+			__sync_fetch_and_sub(&_table._readers,1);
+		}
+
+		ReadGuard(const ReadGuard&) = delete;
+		ReadGuard &operator=(const ReadGuard&) = delete;
+
+	private:
+		const SocketTable &_table;
+	};
+
+	explicit SocketTable() : _count(), _readers(), _table(), _mutex() {
+	}
+	~SocketTable() {
+		for(size_t i = 0; i < SIZE; ++i) {
+			while(_table[i]) {
+				Entry *e = _table[i];
+				_table[i] = e->next;
+				delete e;
+			}
+		}
+	}
+
+	SocketTable(const SocketTable&) = delete;
+	SocketTable &operator=(const SocketTable&) = delete;
+
+	/**
+	 * @return the number of sockets in the table
+	 */
+	size_t count() const {
+		return _count;
+	}
+
+	/**
+	 * Note that the caller has to be a reader to walk through the bucket.
+	 *
+	 * @param i the bucket index (0..SIZE-1)
+	 * @return the first entry in bucket <i>
+	 */
+	const Entry *bucket(size_t i) const {
+		return _table[i];
+	}
+
+	/**
+	 * Note that the caller has to be a reader to use the returned socket.
+	 *
+	 * @param key the key
+	 * @return the socket with given key or NULL
+	 */
+	S *find(K key) const {
+		for(Entry *e = _table[hash(key)]; e != NULL; e = e->next) {
+			if(e->key == key)
+				return e->sock;
+		}
+		return NULL;
+	}
+
+	/**
+	 * Adds <sock> with given key.
+	 *
+	 * @param key the key
+	 * @param sock the socket
+	 * @return 0 on success or if <sock> is already present, -EADDRINUSE if another socket uses the key
+	 */
+	ssize_t add(K key,S *sock) {
+		std::lock_guard<std::mutex> guard(_mutex);
+		S *other = find(key);
+		if(other)
+			return other != sock ? -EADDRINUSE : 0;
+		Entry *volatile *head = _table + hash(key);
+		Entry *e = new Entry(key,sock,*head);
+		/* readers may see the entry as soon as it's in the chain */
+		__sync_synchronize();
+		*head = e;
+		_count++;
+		return 0;
+	}
+
+	/**
+	 * Removes the entry with given key, if it belongs to <sock>. Waits until no reader can use it
+	 * anymore.
+	 *
+	 * @param key the key
+	 * @param sock the socket
+	 */
+	void remove(K key,S *sock) {
+		Entry *e = NULL;
+		{
+			std::lock_guard<std::mutex> guard(_mutex);
+			for(Entry *volatile *p = _table + hash(key); *p != NULL; p = &(*p)->next) {
+				if((*p)->key == key) {
+					if((*p)->sock == sock) {
+						/* readers that are at this entry can still move on to the next one */
+						e = *p;
+						*p = e->next;
+						_count--;
+					}
+					break;
+				}
+			}
+		}
+
+		if(e) {
+			/* new readers can't find it anymore; wait for the ones that might have */
+			__sync_synchronize();
+			while(_readers > 0)
+				yield();
+			delete e;
+		}
+	}
+
+private:
+	static size_t hash(K key) {
+		/* fold the upper half in, so that both ports of a connection are used */
+		uint32_t val = static_cast<uint32_t>(key);
+		return (val ^ (val >> 16) ^ (val >> 8)) % SIZE;
+	}
+
+	size_t _count;
+	mutable volatile long _readers;
+	Entry *volatile _table[SIZE];
+	std::mutex _mutex;
+};
@@ -43,6 +43,10 @@
 #include "route.h"
 #include "timeouts.h"
 
+/* the stack lock. protects the TCP sockets, connections and ports, the raw sockets and the
+ * timeouts. UDP sockets have their own lock (see Socket::lock) and are found without a lock; ARP,
+ * routes and links have their own locks and the receive rings are only used by the receive thread
+ * of the link */
 std::mutex mutex;
 
 static int receiveThread(void *arg);
@@ -111,7 +115,7 @@ public:
 
 		errcode_t res;
 		{
-			std::lock_guard<std::mutex> guard(mutex);
+			std::lock_guard<std::mutex> guard(sock->lock());
 			res = sock->connect(&sa,is.msgid());
 		}
 		if(res < 0)
@@ -125,7 +129,7 @@ public:
 
 		errcode_t res;
 		{
-			std::lock_guard<std::mutex> guard(mutex);
+			std::lock_guard<std::mutex> guard(sock->lock());
 			res = sock->bind(&sa);
 		}
 		is << res << esc::Reply();
@@ -136,7 +140,7 @@ public:
 
 		errcode_t res;
 		{
-			std::lock_guard<std::mutex> guard(mutex);
+			std::lock_guard<std::mutex> guard(sock->lock());
 			res = sock->listen();
 		}
 		is << res << esc::Reply();
@@ -154,7 +158,7 @@ public:
 			res = -EINVAL;
 		}
 		else {
-			std::lock_guard<std::mutex> guard(mutex);
+			std::lock_guard<std::mutex> guard(sock->lock());
 			res = sock->cancel(r.mid);
 		}
 
@@ -168,7 +172,7 @@ public:
 
 		errcode_t res;
 		{
-			std::lock_guard<std::mutex> guard(mutex);
+			std::lock_guard<std::mutex> guard(sock->lock());
 			res = sock->accept(is.msgid(),id(),this);
 		}
 		if(res < 0)
@@ -198,14 +202,18 @@ public:
 
 	void abort(esc::IPCStream &is) {
 		Socket *sock = get(is.fd());
-		errcode_t res = sock->abort();
+		errcode_t res;
+		{
+			std::lock_guard<std::mutex> guard(sock->lock());
+			res = sock->abort();
+		}
 		is << res << esc::Reply();
 	}
 
 	void close(esc::IPCStream &is) {
 		Socket *sock = get(is.fd());
-		std::lock_guard<std::mutex> guard(mutex);
-		// don't delete it; let the object itself decide when it is destroyed (for TCP)
+		// don't delete it; let the object itself decide when it is destroyed (for TCP). the socket
+		// takes its lock itself, if it needs to
 		remove(is.fd(),false);
 		sock->disconnect();
 		Device::close(is);
@@ -224,7 +232,7 @@ private:
 			if(r.shmemoff != -1)
 				data = sock->shm() + r.shmemoff;
 
-			std::lock_guard<std::mutex> guard(mutex);
+			std::lock_guard<std::mutex> guard(sock->lock());
 			res = sock->recvfrom(is.msgid(),needsSockAddr,data,r.count);
 		}
 
@@ -242,7 +250,7 @@ private:
 
 		ssize_t res;
 		{
-			std::lock_guard<std::mutex> guard(mutex);
+			std::lock_guard<std::mutex> guard(sock->lock());
 			res = sock->sendto(is.msgid(),sa,buf.data(),r.count);
 		}
 
@@ -408,7 +416,6 @@ public:
 		esc::Net::IPv4Addr ip;
 		is >> ip;
 
-		std::lock_guard<std::mutex> guard(mutex);
 		errcode_t res = ARP::remove(ip);
 		is << res << esc::Reply();
 	}
@@ -450,7 +457,6 @@ public:
 
 	virtual std::string handleRead() {
 		esc::OStringStream os;
-		std::lock_guard<std::mutex> guard(mutex);
 		ARP::print(os);
 		return os.str();
 	}
@@ -464,8 +470,10 @@ public:
 
 	virtual std::string handleRead() {
 		esc::OStringStream os;
-		std::lock_guard<std::mutex> guard(mutex);
-		TCP::printSockets(os);
+		{
+			std::lock_guard<std::mutex> guard(mutex);
+			TCP::printSockets(os);
+		}
 		UDP::printSockets(os);
 		return os.str();
 	}
@@ -480,9 +488,8 @@ static int receiveThread(void *arg) {
 
 	std::shared_ptr<Link> *linkptr = reinterpret_cast<std::shared_ptr<Link>*>(arg);
 	const std::shared_ptr<Link> link = *linkptr;
-	uint8_t *buffer = reinterpret_cast<uint8_t*>(link->sharedmem());
 	while(link->status() != esc::Net::KILLED) {
-		ssize_t res = link->read(buffer,link->mtu());
+		ssize_t res = link->wait();
 		if(res < 0) {
 			if(res != -EINTR) {
 				printe("Reading packet failed");
@@ -491,15 +498,27 @@ static int receiveThread(void *arg) {
 			continue;
 		}
 
-		if((size_t)res >= sizeof(Ethernet<>)) {
-			std::lock_guard<std::mutex> guard(mutex);
-			Packet pkt(buffer,res);
-			ssize_t err = Ethernet<>::receive(link,pkt);
-			if(err < 0)
-				std::cerr << "Ignored packet of size " << res << ": " << strerror(err) << "\n";
+		/* the ring and the statistics belong to this link and are only used by this thread. the
+		 * protocols lock what they need, so that the links receive in parallel and UDP packets for
+		 * different sockets don't wait for each other */
+		ssize_t failed = 0,lastErr = 0;
+		for(ssize_t i = 0; i < res; ++i) {
+			esc::NIC::Ring::Slot *slot = link->fetch(i);
+			if(slot->length >= sizeof(Ethernet<>)) {
+				Packet pkt(slot->data,slot->length);
+				ssize_t err = Ethernet<>::receive(link,pkt);
+				if(err < 0) {
+					failed++;
+					lastErr = err;
+				}
+			}
+			else
+				printe("Ignoring packet of size %lu",slot->length);
 		}
-		else
-			printe("Ignoring packet of size %zd",res);
+		link->release(res);
+
+		if(failed > 0)
+			std::cerr << "Ignored " << failed << " packets: " << strerror(lastErr) << "\n";
 	}
 	LinkMng::rem(link->name());
 	delete linkptr;
@@ -111,9 +111,8 @@ bool ata_transferDMA(sATADevice *device,uint op,void *buffer,size_t secSize,size
 	ATA_PR2("Setting PRDT");
 	ctrl_outbmrl(ctrl,BMR_REG_PRDT,reinterpret_cast<uintptr_t>(ctrl->dma_prdt_phys));
 
-	/* write data to buffer, if we should write */
-	/* TODO we should use the buffer directly when reading from the client */
-	if(op == OP_WRITE || op == OP_PACKET)
+	/* write data to buffer, if we should write and the caller has not used it directly */
+	if((op == OP_WRITE || op == OP_PACKET) && buffer != ctrl->dma_buf_virt)
 		memcpy(ctrl->dma_buf_virt,buffer,size);
 
 	/* it seems to be necessary to read those ports here */
@@ -132,7 +131,9 @@ bool ata_transferDMA(sATADevice *device,uint op,void *buffer,size_t secSize,size
 	ATA_PR2("Waiting for an interrupt");
 	ctrl_waitIntrpt(ctrl);
 
-	res = ctrl_waitUntil(ctrl,DMA_TRANSFER_TIMEOUT,DMA_TRANSFER_SLEEPTIME,0,CMD_ST_BUSY | CMD_ST_DRQ);
+	/* if we got an interrupt, the transfer is complete. so, don't sleep but check it actively */
+	res = ctrl_waitUntil(ctrl,DMA_TRANSFER_TIMEOUT,ctrl->useIrq ? 0 : DMA_TRANSFER_SLEEPTIME,
+			0,CMD_ST_BUSY | CMD_ST_DRQ);
 	if(res == -1) {
 		ATA_LOG("Device %d: Timeout after DMA-transfer",device->id);
 		return false;
@@ -145,7 +146,7 @@ bool ata_transferDMA(sATADevice *device,uint op,void *buffer,size_t secSize,size
 	ctrl_inbmrb(ctrl,BMR_REG_STATUS);
 	ctrl_outbmrb(ctrl,BMR_REG_COMMAND,0);
 	/* copy data when reading */
-	if(op == OP_READ)
+	if(op == OP_READ && buffer != ctrl->dma_buf_virt)
 		memcpy(buffer,ctrl->dma_buf_virt,size);
 	return true;
 }
@@ -19,7 +19,9 @@
 
 #include <sys/arch/x86/ports.h>
 #include <esc/ipc/clientdevice.h>
+#include <esc/ipc/filedev.h>
 #include <esc/ipc/ipcstream.h>
+#include <esc/stream/ostringstream.h>
 #include <esc/util.h>
 #include <esc/vthrow.h>
 #include <sys/common.h>
@@ -30,10 +32,12 @@
 #include <sys/mman.h>
 #include <sys/proc.h>
 #include <sys/stat.h>
+#include <sys/sync.h>
 #include <sys/thread.h>
 #include <usergroup/usergroup.h>
 #include <assert.h>
 #include <errno.h>
+#include <mutex>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,25 +46,44 @@
 #include "controller.h"
 #include "device.h"
 #include "partition.h"
+#include "queue.h"
 
 using namespace esc;
 
 class ATAPartitionDevice;
 
 static const size_t MAX_RW_SIZE		= 4096;
+/* the number of requests per partition that can be in flight at once */
+static const size_t REQUEST_COUNT	= 8;
 static const int RETRY_COUNT		= 3;
 
-static ulong handleRead(sATADevice *device,sPartition *part,uint16_t *buf,uint offset,uint count);
-static ulong handleWrite(sATADevice *device,sPartition *part,uint16_t *buf,uint offset,uint count);
+typedef struct {
+	/* has to be the first member, because the queue passes it back to us */
+	sRequest req;
+	ATAPartitionDevice *dev;
+	bool used;
+	/* the client and the message to reply to */
+	int fd;
+	msgid_t mid;
+	bool shm;
+	uint count;
+	int tries;
+	/* the buffer for clients without shared memory. it's no dynamic memory since this may cause
+	 * trouble with swapping (which we do): if the heap hasn't enough memory and we request more
+	 * when we should swap the kernel may not have more memory and can't do anything about it */
+	uint16_t buffer[MAX_RW_SIZE / sizeof(uint16_t)];
+} sClientRequest;
+
+static bool handleRead(sATADevice *device,sPartition *part,sClientRequest *req,uint offset,
+	uint count);
+static bool handleWrite(sATADevice *device,sPartition *part,sClientRequest *req,uint offset,
+	uint count);
+static void requestDone(sRequest *r,bool res);
 static void initDrives(void);
 static void createVFSEntry(sATADevice *device,sPartition *part,const char *name);
 
 static size_t drvCount = 0;
 static ATAPartitionDevice *devs[DEVICE_COUNT * PARTITION_COUNT];
-/* don't use dynamic memory here since this may cause trouble with swapping (which we do) */
-/* because if the heap hasn't enough memory and we request more when we should swap the kernel
- * may not have more memory and can't do anything about it */
-static uint16_t buffer[MAX_RW_SIZE / sizeof(uint16_t)];
 
 class ATAPartitionDevice : public ClientDevice<> {
 public:
@@ -68,14 +91,21 @@ public:
 		: ClientDevice(name,mode,DEV_TYPE_BLOCK,
 			DEV_OPEN | DEV_DELEGATE | DEV_READ | DEV_WRITE | DEV_SIZE | DEV_CLOSE),
 		  _ataDev(ctrl_getDevice(dev)),
-		  _part(_ataDev ? _ataDev->partTable + part : NULL) {
+		  _part(_ataDev ? _ataDev->partTable + part : NULL), _free(semcrt(REQUEST_COUNT)),
+		  _lock(), _reqs() {
 		set(MSG_DEV_DELEGATE,std::make_memfun(this,&ATAPartitionDevice::delegate));
 		set(MSG_FILE_READ,std::make_memfun(this,&ATAPartitionDevice::read));
 		set(MSG_FILE_WRITE,std::make_memfun(this,&ATAPartitionDevice::write));
 		set(MSG_FILE_SIZE,std::make_memfun(this,&ATAPartitionDevice::size));
+		set(MSG_FILE_CLOSE,std::make_memfun(this,&ATAPartitionDevice::close),false);
 
 		if(_ataDev == NULL || _part == NULL || _ataDev->present == 0 || _part->present == 0)
 			VTHROW("Invalid device/partition (dev=" << dev << ",part=" << part << ")");
+		if(_free < 0)
+			VTHROWE("semcrt",_free);
+	}
+	virtual ~ATAPartitionDevice() {
+		semdestr(_free);
 	}
 
 	void delegate(IPCStream &is) {
@@ -99,36 +129,121 @@ public:
 		is >> r;
 		assert(!is.error());
 
-		uint16_t *buf = r.shmemoff == -1 ? buffer : (uint16_t*)(*this)[is.fd()]->shm() + (r.shmemoff >> 1);
-		size_t res = handleRead(_ataDev,_part,buf,r.offset,r.count);
-
-		is << FileRead::Response::success(res) << Reply();
-		if(r.shmemoff == -1 && res > 0)
-			is << ReplyData(buf,res);
+		/* the queue-thread replies as soon as the request is done */
+		sClientRequest *req = alloc(is,OP_READ,r.shmemoff);
+		if(!handleRead(_ataDev,_part,req,r.offset,r.count))
+			reply(req,false);
 	}
 
 	void write(IPCStream &is) {
 		FileWrite::Request r;
 		is >> r;
-		if(r.shmemoff == -1)
-			is >> ReceiveData(buffer,sizeof(buffer));
+		sClientRequest *req = alloc(is,OP_WRITE,r.shmemoff);
+		if(!req->shm)
+			is >> ReceiveData(req->buffer,sizeof(req->buffer));
 		assert(!is.error());
 
-		uint16_t *buf = r.shmemoff == -1 ? buffer : (uint16_t*)(*this)[is.fd()]->shm() + (r.shmemoff >> 1);
-		size_t res = handleWrite(_ataDev,_part,buf,r.offset,r.count);
-
-		is << FileWrite::Response::success(res) << Reply();
+		if(!handleWrite(_ataDev,_part,req,r.offset,r.count))
+			reply(req,false);
 	}
 
 	void size(IPCStream &is) {
 		is << FileSize::Response::success(_part->size * _ataDev->secSize) << Reply();
 	}
 
+	void close(IPCStream &is) {
+		/* requests in flight might still use the shared memory of the client */
+		for(size_t i = 0; i < REQUEST_COUNT; ++i)
+			IGNSIGS(semdown(_free));
+		for(size_t i = 0; i < REQUEST_COUNT; ++i)
+			semup(_free);
+		ClientDevice::close(is);
+	}
+
+	/**
+	 * Sends the reply for <req> to the client and makes <req> available again.
+	 *
+	 * @param req the request
+	 * @param res whether the request succeeded
+	 */
+	void reply(sClientRequest *req,bool res) {
+		ulong buffer[IPC_DEF_SIZE / sizeof(ulong)];
+		IPCStream is(req->fd,buffer,sizeof(buffer),req->mid);
+		size_t count = res ? req->count : 0;
+		/* we're called by the queue-thread, which should not die if the client is gone */
+		try {
+			if(req->req.op == OP_READ) {
+				is << FileRead::Response::success(count) << Reply();
+				if(!req->shm && count > 0)
+					is << ReplyData(req->buffer,count);
+			}
+			else
+				is << FileWrite::Response::success(count) << Reply();
+		}
+		catch(...) {
+			printe("Client %d: sending reply failed",req->fd);
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			req->used = false;
+		}
+		semup(_free);
+	}
+
 private:
+	sClientRequest *alloc(IPCStream &is,uint op,ssize_t shmemoff) {
+		/* wait until one of our requests is done, if all are in flight */
+		IGNSIGS(semdown(_free));
+		sClientRequest *req = _reqs;
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			while(req->used)
+				req++;
+			req->used = true;
+		}
+
+		req->dev = this;
+		req->fd = is.fd();
+		req->mid = is.msgid();
+		req->shm = shmemoff != -1;
+		req->tries = 0;
+		req->req.op = op;
+		if(req->shm)
+			req->req.buffer = (*this)[is.fd()]->shm() + shmemoff;
+		else
+			req->req.buffer = req->buffer;
+		return req;
+	}
+
 	sATADevice *_ataDev;
 	sPartition *_part;
+	/* counts the requests that are not in flight */
+	int _free;
+	/* protects the used-flags of the requests */
+	std::mutex _lock;
+	/* every device has its own requests, because they are served by different threads */
+	sClientRequest _reqs[REQUEST_COUNT];
+};
+
+class QueueFileDevice : public FileDevice {
+public:
+	explicit QueueFileDevice(const char *path,mode_t mode) : FileDevice(path,mode) {
+	}
+
+	virtual std::string handleRead() {
+		OStringStream os;
+		queue_print(os);
+		return os.str();
+	}
 };
 
+static int queue_dev_thread(void *) {
+	QueueFileDevice dev("/sys/dev/ataqueue",0440);
+	dev.loop();
+	return 0;
+}
+
 static int drive_thread(void *arg) {
 	ATAPartitionDevice *dev = reinterpret_cast<ATAPartitionDevice*>(arg);
 	dev->bindto(gettid());
@@ -155,6 +270,9 @@ int main(int argc,char **argv) {
 	/* detect and init all devices */
 	ctrl_init(useDma,useIRQ);
 	initDrives();
+	/* the drives are accessed via the I/O-queue of their controller */
+	for(size_t i = 0; i < 2; i++)
+		queue_start(ctrl_getCtrl(i));
 	/* flush prints */
 	fflush(stdout);
 
@@ -170,6 +288,8 @@ int main(int argc,char **argv) {
 		if(startthread(drive_thread, devs[i]) < 0)
 			error("Unable to start thread");
 	}
+	if(startthread(queue_dev_thread,NULL) < 0)
+		error("Unable to start thread");
 
 	/* mlock all regions to prevent that we're swapped out */
 	if(mlockall() < 0)
@@ -190,54 +310,61 @@ int main(int argc,char **argv) {
 	return EXIT_SUCCESS;
 }
 
-static ulong handleRead(sATADevice *ataDev,sPartition *part,uint16_t *buf,uint offset,uint count) {
+static bool handleRead(sATADevice *ataDev,sPartition *part,sClientRequest *req,uint offset,
+		uint count) {
 	/* we have to check whether it is at least one sector. otherwise ATA can't
 	 * handle the request */
 	if(offset + count <= part->size * ataDev->secSize && offset + count > offset) {
 		uint rcount = esc::Util::round_up((size_t)count,ataDev->secSize);
-		if(buf != buffer || rcount <= MAX_RW_SIZE) {
-			int i;
+		if(req->shm || rcount <= MAX_RW_SIZE) {
 			ATA_PR2("Reading %d bytes @ %x from device %d",
 					rcount,offset,ataDev->id);
-			for(i = 0; i < RETRY_COUNT; i++) {
-				if(i > 0)
-					ATA_LOG("Read failed; retry %d",i);
-				if(ataDev->rwHandler(ataDev,OP_READ,buf,
-						offset / ataDev->secSize + part->start,
-						ataDev->secSize,rcount / ataDev->secSize)) {
-					return count;
-				}
-			}
-			ATA_LOG("Giving up after %d retries",i);
-			return 0;
+			req->count = count;
+			req->req.device = ataDev;
+			req->req.lba = offset / ataDev->secSize + part->start;
+			req->req.secSize = ataDev->secSize;
+			req->req.secCount = rcount / ataDev->secSize;
+			req->req.done = requestDone;
+			queue_submit(&req->req);
+			return true;
 		}
 	}
 	ATA_LOG("Invalid read-request: offset=%u, count=%u, partSize=%zu (device %d)",
 			offset,count,part->size * ataDev->secSize,ataDev->id);
-	return 0;
+	return false;
 }
 
-static ulong handleWrite(sATADevice *ataDev,sPartition *part,uint16_t *buf,uint offset,uint count) {
+static bool handleWrite(sATADevice *ataDev,sPartition *part,sClientRequest *req,uint offset,
+		uint count) {
 	if(offset + count <= part->size * ataDev->secSize && offset + count > offset) {
-		if(buf != buffer || count <= MAX_RW_SIZE) {
-			int i;
+		if(req->shm || count <= MAX_RW_SIZE) {
 			ATA_PR2("Writing %d bytes @ %x to device %d",count,offset,ataDev->id);
-			for(i = 0; i < RETRY_COUNT; i++) {
-				if(i > 0)
-					ATA_LOG("Write failed; retry %d",i);
-				if(ataDev->rwHandler(ataDev,OP_WRITE,buf,
-						offset / ataDev->secSize + part->start,
-						ataDev->secSize,count / ataDev->secSize)) {
-					return count;
-				}
-			}
-			ATA_LOG("Giving up after %d retries",i);
-			return 0;
+			req->count = count;
+			req->req.device = ataDev;
+			req->req.lba = offset / ataDev->secSize + part->start;
+			req->req.secSize = ataDev->secSize;
+			req->req.secCount = count / ataDev->secSize;
+			req->req.done = requestDone;
+			queue_submit(&req->req);
+			return true;
 		}
 	}
 	ATA_LOG("Invalid write-request: offset=%u, count=%u, partSize=%zu (device %d)",
 			offset,count,part->size * ataDev->secSize,ataDev->id);
-	return 0;
+	return false;
+}
+
+static void requestDone(sRequest *r,bool res) {
+	sClientRequest *req = reinterpret_cast<sClientRequest*>(r);
+	if(!res) {
+		if(++req->tries < RETRY_COUNT) {
+			ATA_LOG("%s failed; retry %d",r->op == OP_READ ? "Read" : "Write",req->tries);
+			queue_submit(r);
+			return;
+		}
+		ATA_LOG("Giving up after %d retries",req->tries);
+	}
+	req->dev->reply(req,res);
 }
 
 static void initDrives(void) {
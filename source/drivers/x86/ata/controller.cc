@@ -27,6 +27,7 @@
 #include <sys/proc.h>
 #include <sys/sync.h>
 #include <sys/thread.h>
+#include <sys/time.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,8 +47,6 @@ static const int IDE_CTRL_BAR				= 4;
 
 static const size_t BMR_SEC_OFFSET			= 0x8;
 
-static const size_t DMA_BUF_SIZE			= 64 * 1024;
-
 static bool ctrl_isBusResponding(sATAController* ctrl);
 
 static PCI::Device ideCtrl;
@@ -196,22 +195,20 @@ void ctrl_waitIntrpt(sATAController *ctrl) {
 }
 
 int ctrl_waitUntil(sATAController *ctrl,time_t timeout,time_t sleepTime,uint8_t set,uint8_t unset) {
-	time_t elapsed = 0;
-	while(elapsed < timeout) {
+	/* measure the time, because the checks alone take much less than a millisecond */
+	uint64_t end = rdtsc() + timetotsc(timeout * 1000);
+	while(1) {
 		uint8_t status = ctrl_inb(ctrl,ATA_REG_STATUS);
 		if(status & CMD_ST_ERROR)
 			return ctrl_inb(ctrl,ATA_REG_ERROR);
 		if((status & set) == set && !(status & unset))
 			return 0;
 		ATA_PR1("Status %#x",status);
-		if(sleepTime) {
+		if(rdtsc() >= end)
+			return -1;
+		if(sleepTime)
 			usleep(1000 * sleepTime);
-			elapsed += sleepTime;
-		}
-		else
-			elapsed++;
 	}
-	return -1;
 }
 
 void ctrl_wait(sATAController *ctrl) {
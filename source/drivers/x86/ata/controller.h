@@ -57,6 +57,9 @@ static const size_t DEVICE_COUNT	= 4;
 
 static const int CTRL_IRQ_BASE		= 14;
 
+/* the size of the DMA-buffer, which is the maximum a single PRD can describe */
+static const size_t DMA_BUF_SIZE	= 64 * 1024;
+
 /**
  * Inits the controllers
  *
@@ -150,11 +153,10 @@ void ctrl_waitIntrpt(sATAController *ctrl);
 /**
  * Waits for <set> to set and <unset> to unset in the status-register. If <sleepTime> is not zero,
  * it sleeps that number of milliseconds between the checks. Otherwise it checks it actively.
- * It gives up as soon as <timeout> is reached. That are milliseconds if sleepTime is not zero or
- * retries.
+ * It gives up as soon as <timeout> milliseconds have passed.
  *
  * @param ctrl the controller
- * @param timeout the timeout (milliseconds or retries)
+ * @param timeout the timeout in milliseconds
  * @param sleepTime the number of milliseconds to sleep (0 = check actively)
  * @param set the bits to wait until they're set
  * @param unset the bits to wait until they're unset
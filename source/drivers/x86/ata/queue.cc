@@ -0,0 +1,295 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <esc/stream/ostream.h>
+#include <esc/util.h>
+#include <sys/common.h>
+#include <sys/sync.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ata.h"
+#include "controller.h"
+#include "device.h"
+#include "queue.h"
+
+/* the maximum number of requests that are merged into one transfer */
+static const size_t MAX_BATCH		= 16;
+
+typedef struct {
+	sATAController *ctrl;
+	/* protects all fields below */
+	tUserSem lock;
+	/* is up'ed for every new request */
+	int pending;
+	/* the requests in the order of their arrival */
+	sRequest *first;
+	sRequest *last;
+	size_t depth;
+	/* the position behind the last transfer */
+	uchar lastDev;
+	uint64_t lastLBA;
+	/* statistics */
+	size_t maxDepth;
+	ulong requests;
+	ulong completed;
+	ulong transfers;
+	ulong merged;
+	uint64_t totalLatency;
+	uint64_t maxLatency;
+} sQueue;
+
+static int queue_thread(void *arg);
+static sRequest *queue_next(sQueue *q);
+static size_t queue_collect(sQueue *q,sRequest *first,sRequest **batch);
+static bool queue_transfer(sRequest **batch,size_t count);
+static bool queue_canMerge(sATADevice *device);
+static bool queue_isBefore(uchar dev1,uint64_t lba1,uchar dev2,uint64_t lba2);
+static void queue_remove(sQueue *q,sRequest *r);
+
+static sQueue queues[2];
+static uint64_t deadline;
+
+void queue_start(sATAController *ctrl) {
+	if(!ctrl->devices[0].present && !ctrl->devices[1].present)
+		return;
+
+	sQueue *q = queues + ctrl->id;
+	if(usemcrt(&q->lock,1) < 0)
+		error("Unable to create queue-lock for controller %d",ctrl->id);
+	q->pending = semcrt(0);
+	if(q->pending < 0)
+		error("Unable to create queue-semaphore for controller %d",ctrl->id);
+	if(deadline == 0)
+		deadline = timetotsc(QUEUE_DEADLINE);
+	q->ctrl = ctrl;
+
+	if(startthread(queue_thread,q) < 0)
+		error("Unable to start queue-thread for controller %d",ctrl->id);
+}
+
+void queue_submit(sRequest *r) {
+	sQueue *q = queues + r->device->ctrl->id;
+	r->submitted = rdtsc();
+	r->next = NULL;
+
+	usemdown(&q->lock);
+	if(q->last)
+		q->last->next = r;
+	else
+		q->first = r;
+	q->last = r;
+	q->depth++;
+	q->maxDepth = esc::Util::max(q->maxDepth,q->depth);
+	q->requests++;
+	usemup(&q->lock);
+
+	/* wake up the queue-thread */
+	semup(q->pending);
+}
+
+void queue_print(esc::OStream &os) {
+	for(size_t i = 0; i < ARRAY_SIZE(queues); i++) {
+		sQueue *q = queues + i;
+		if(q->ctrl == NULL)
+			continue;
+
+		usemdown(&q->lock);
+		ulong completed = q->completed;
+		os << "Controller " << i << ":\n";
+		os << "\tQueue depth: " << q->depth << " (max " << q->maxDepth << ")\n";
+		os << "\tRequests: " << q->requests << "\n";
+		os << "\tTransfers: " << q->transfers << "\n";
+		os << "\tMerged: " << q->merged << " ("
+		   << (completed ? q->merged * 100 / completed : 0) << "%)\n";
+		uint64_t total = q->totalLatency;
+		uint64_t max = q->maxLatency;
+		usemup(&q->lock);
+
+		os << "\tAvg latency: " << (completed ? tsctotime(total / completed) : 0) << " us\n";
+		os << "\tMax latency: " << tsctotime(max) << " us\n";
+	}
+}
+
+static int queue_thread(void *arg) {
+	sQueue *q = (sQueue*)arg;
+	sRequest *batch[MAX_BATCH];
+	while(1) {
+		IGNSIGS(semdown(q->pending));
+
+		/* merged requests are taken together, so that there might be nothing to do */
+		size_t count = 0;
+		usemdown(&q->lock);
+		sRequest *r = queue_next(q);
+		if(r)
+			count = queue_collect(q,r,batch);
+		usemup(&q->lock);
+		if(count == 0)
+			continue;
+
+		bool res = queue_transfer(batch,count);
+
+		uint64_t now = rdtsc();
+		usemdown(&q->lock);
+		q->transfers++;
+		q->merged += count - 1;
+		q->completed += count;
+		for(size_t i = 0; i < count; ++i) {
+			uint64_t latency = now - batch[i]->submitted;
+			q->totalLatency += latency;
+			q->maxLatency = esc::Util::max(q->maxLatency,latency);
+		}
+		usemup(&q->lock);
+
+		/* the requests may be reused or submitted again as soon as we notify the submitter */
+		for(size_t i = 0; i < count; ++i)
+			batch[i]->done(batch[i],res);
+	}
+	return 0;
+}
+
+static sRequest *queue_next(sQueue *q) {
+	/* don't let requests starve */
+	if(q->first == NULL || rdtsc() - q->first->submitted > deadline)
+		return q->first;
+
+	/* otherwise move over the disk in one direction (C-LOOK): take the next request behind the
+	 * current position or start from the beginning again if there is none */
+	sRequest *next = NULL,*lowest = NULL;
+	for(sRequest *r = q->first; r != NULL; r = r->next) {
+		uchar dev = r->device->id;
+		if(!lowest || queue_isBefore(dev,r->lba,lowest->device->id,lowest->lba))
+			lowest = r;
+		if(!queue_isBefore(dev,r->lba,q->lastDev,q->lastLBA) &&
+				(!next || queue_isBefore(dev,r->lba,next->device->id,next->lba)))
+			next = r;
+	}
+	return next ? next : lowest;
+}
+
+static size_t queue_collect(sQueue *q,sRequest *first,sRequest **batch) {
+	size_t count = 1;
+	batch[0] = first;
+	queue_remove(q,first);
+
+	uint64_t start = first->lba;
+	uint64_t end = first->lba + first->secCount;
+	if(queue_canMerge(first->device)) {
+		/* add requests directly in front of or behind the batch, as long as they fit into the
+		 * DMA-buffer */
+		size_t maxSecs = DMA_BUF_SIZE / first->secSize;
+		size_t secs = first->secCount;
+		bool found = true;
+		while(found && count < MAX_BATCH) {
+			found = false;
+			for(sRequest *r = q->first; r != NULL; r = r->next) {
+				if(r->device != first->device || r->op != first->op ||
+						r->secSize != first->secSize || secs + r->secCount > maxSecs)
+					continue;
+
+				if(r->lba == end) {
+					batch[count++] = r;
+					end += r->secCount;
+				}
+				else if(r->lba + r->secCount == start) {
+					memmove(batch + 1,batch,count * sizeof(sRequest*));
+					batch[0] = r;
+					count++;
+					start = r->lba;
+				}
+				else
+					continue;
+
+				secs += r->secCount;
+				queue_remove(q,r);
+				found = true;
+				break;
+			}
+		}
+	}
+
+	q->lastDev = first->device->id;
+	q->lastLBA = end;
+	return count;
+}
+
+static bool queue_transfer(sRequest **batch,size_t count) {
+	sRequest *first = batch[0];
+	sATADevice *device = first->device;
+	size_t secSize = first->secSize;
+
+	if(count == 1) {
+		/* the controller can't transfer more than DMA_BUF_SIZE at once */
+		size_t maxSecs = DMA_BUF_SIZE / secSize;
+		char *buf = (char*)first->buffer;
+		for(size_t off = 0; off < first->secCount; off += maxSecs) {
+			size_t secs = esc::Util::min(maxSecs,first->secCount - off);
+			if(!device->rwHandler(device,first->op,buf + off * secSize,first->lba + off,secSize,secs))
+				return false;
+		}
+		return true;
+	}
+
+	/* use the DMA-buffer directly, so that we don't need another copy */
+	char *dmabuf = (char*)device->ctrl->dma_buf_virt;
+	size_t total = 0;
+	for(size_t i = 0; i < count; ++i) {
+		if(first->op == OP_WRITE)
+			memcpy(dmabuf + total * secSize,batch[i]->buffer,batch[i]->secCount * secSize);
+		total += batch[i]->secCount;
+	}
+
+	if(!device->rwHandler(device,first->op,dmabuf,first->lba,secSize,total))
+		return false;
+
+	if(first->op == OP_READ) {
+		total = 0;
+		for(size_t i = 0; i < count; ++i) {
+			memcpy(batch[i]->buffer,dmabuf + total * secSize,batch[i]->secCount * secSize);
+			total += batch[i]->secCount;
+		}
+	}
+	return true;
+}
+
+static bool queue_canMerge(sATADevice *device) {
+	/* merged requests are transferred via the DMA-buffer */
+	return device->rwHandler == ata_readWrite && device->ctrl->useDma && device->info.capabilities.DMA;
+}
+
+static bool queue_isBefore(uchar dev1,uint64_t lba1,uchar dev2,uint64_t lba2) {
+	return dev1 < dev2 || (dev1 == dev2 && lba1 < lba2);
+}
+
+static void queue_remove(sQueue *q,sRequest *r) {
+	sRequest *prev = NULL;
+	for(sRequest *p = q->first; p != r; p = p->next)
+		prev = p;
+	if(prev)
+		prev->next = r->next;
+	else
+		q->first = r->next;
+	if(q->last == r)
+		q->last = prev;
+	r->next = NULL;
+	q->depth--;
+}
@@ -0,0 +1,78 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <esc/stream/ostream.h>
+#include <sys/common.h>
+
+#include "device.h"
+
+/* requests that are older than this are handled next, regardless of their position */
+static const uint64_t QUEUE_DEADLINE		= 500 * 1000;	/* us */
+
+/**
+ * Inits the I/O-queue of the given controller and starts the thread that handles the requests.
+ * Does nothing if no device is present at this controller.
+ *
+ * @param ctrl the controller
+ */
+void queue_start(sATAController *ctrl);
+
+struct sRequest;
+
+/**
+ * Is called by the queue-thread when a request has been handled
+ *
+ * @param r the request
+ * @param res true on success
+ */
+typedef void (*fRequestDone)(struct sRequest *r,bool res);
+
+typedef struct sRequest {
+	sATADevice *device;
+	uint op;
+	void *buffer;
+	uint64_t lba;
+	size_t secSize;
+	size_t secCount;
+	/* the function to call on completion */
+	fRequestDone done;
+	/* the TSC value when the request has been submitted (set by queue_submit) */
+	uint64_t submitted;
+	struct sRequest *next;
+} sRequest;
+
+/**
+ * Puts a request into the I/O-queue of the device's controller and returns immediately. The queue
+ * handles the requests in the order of their position on the disk, as long as no request exceeds
+ * QUEUE_DEADLINE. Adjacent requests of the same device are merged into one transfer, if possible.
+ * As soon as the request has been handled, the queue-thread calls r->done. The request has to stay
+ * valid until then. It may be submitted again from r->done.
+ *
+ * @param r the request (device, op, buffer, lba, secSize, secCount and done have to be set)
+ */
+void queue_submit(sRequest *r);
+
+/**
+ * Prints statistics about the I/O-queues to <os>
+ *
+ * @param os the stream
+ */
+void queue_print(esc::OStream &os);
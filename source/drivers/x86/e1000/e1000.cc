@@ -25,8 +25,8 @@
 #include "e1000dev.h"
 
 int main(int argc,char **argv) {
-	if(argc != 3)
-		error("Usage: %s <bdf> <path>\n",argv[0]);
+	if(argc != 3 && argc != 4)
+		error("Usage: %s <bdf> <path> [<descriptors>]\n",argv[0]);
 
 	E1000 *e1000;
 	{
@@ -41,7 +41,8 @@ int main(int argc,char **argv) {
 		print("Using PCI-device %d.%d.%d: vendor=%hx, device=%hx",
 				nic.bus,nic.dev,nic.func,nic.vendorId,nic.deviceId);
 
-		e1000 = new E1000(pci,nic);
+		size_t descs = argc == 4 ? strtoul(argv[3],NULL,0) : E1000::DEF_DESC_COUNT;
+		e1000 = new E1000(pci,nic,descs);
 	}
 
 	esc::NICDevice nicdev(argv[2],0770,e1000);
@@ -30,9 +30,9 @@
 
 /* parts of the code are inspired by the iPXE intel driver */
 
-E1000::E1000(esc::PCI &pci,const esc::PCI::Device &nic)
-		: NICDriver(), _irq(nic.irq), _irqsem(), _curRxBuf(), _curTxBuf(), _bufs(),
-		  _bufsPhys(), _mmio(), _handler() {
+E1000::E1000(esc::PCI &pci,const esc::PCI::Device &nic,size_t descs)
+		: NICDriver(), _irq(nic.irq), _irqsem(), _curRxBuf(), _curTxBuf(), _descCount(), _bufs(),
+		  _bufsPhys(), _rxBuf(), _txBuf(), _rxDescs(), _txDescs(), _mmio(), _handler() {
 	if(_irqsem < 0)
 		error("Unable to create irq-semaphore");
 
@@ -48,17 +48,7 @@ E1000::E1000(esc::PCI &pci,const esc::PCI::Device &nic)
 		}
 	}
 
-	// create buffers in contiguous physical memory
-	uintptr_t phys = 0;
-	_bufs = reinterpret_cast<Buffers*>(mmapphys(&phys,sizeof(Buffers),PAGE_SIZE,MAP_PHYS_ALLOC));
-	if(_bufs == NULL)
-		error("Unable to map buffer space of %zu bytes",sizeof(Buffers));
-	print("Mapped buffer space @ virt=%p phys=%p",_bufs,phys);
-	_bufsPhys = reinterpret_cast<Buffers*>(phys);
-
-	// clear descriptors
-	memset(_bufs->rxDescs,0,sizeof(_bufs->rxDescs));
-	memset(_bufs->txDescs,0,sizeof(_bufs->txDescs));
+	allocBuffers(descs);
 
 	// reset card
 	reset();
@@ -90,6 +80,36 @@ E1000::E1000(esc::PCI &pci,const esc::PCI::Device &nic)
 	writeReg(REG_IMS,ICR_LSC | ICR_RXO | ICR_RXT0);
 }
 
+void E1000::allocBuffers(size_t descs) {
+	descs = esc::Util::round_up(esc::Util::max(descs,MIN_DESC_COUNT),MIN_DESC_COUNT);
+	descs = esc::Util::min(descs,MAX_DESC_COUNT);
+
+	// create buffers in contiguous physical memory; use less descriptors if that fails
+	for(; descs >= MIN_DESC_COUNT; descs /= 2) {
+		size_t size = descs * (RX_BUF_SIZE + TX_BUF_SIZE + sizeof(RxDesc) + sizeof(TxDesc));
+		_bufsPhys = 0;
+		_bufs = mmapphys(&_bufsPhys,size,PAGE_SIZE,MAP_PHYS_ALLOC);
+		if(_bufs) {
+			print("Mapped buffer space for %zu descriptors @ virt=%p phys=%p",descs,_bufs,_bufsPhys);
+			break;
+		}
+	}
+	if(_bufs == NULL)
+		error("Unable to map buffer space");
+
+	// the buffers are page-aligned and all sizes are multiples of 128, thus the descriptors are
+	// aligned properly as well
+	_descCount = descs;
+	_rxBuf = reinterpret_cast<uint8_t*>(_bufs);
+	_txBuf = _rxBuf + descs * RX_BUF_SIZE;
+	_rxDescs = reinterpret_cast<RxDesc*>(_txBuf + descs * TX_BUF_SIZE);
+	_txDescs = reinterpret_cast<TxDesc*>(_rxDescs + descs);
+
+	// clear descriptors
+	memset(_rxDescs,0,descs * sizeof(RxDesc));
+	memset(_txDescs,0,descs * sizeof(TxDesc));
+}
+
 void E1000::readEEPROM(uint8_t *dest,size_t len) {
 	int err;
 	if((err = EEPROM::init(this)) != 0) {
@@ -167,26 +187,26 @@ void E1000::reset() {
 
 	// init receive ring
 	writeReg(REG_RDBAH,0);
-	writeReg(REG_RDBAL,reinterpret_cast<uintptr_t>(_bufsPhys->rxDescs + 0));
-	writeReg(REG_RDLEN,RX_BUF_COUNT * sizeof(RxDesc));
+	writeReg(REG_RDBAL,phys(_rxDescs));
+	writeReg(REG_RDLEN,_descCount * sizeof(RxDesc));
 	writeReg(REG_RDH,0);
-	writeReg(REG_RDT,RX_BUF_COUNT - 1);
+	writeReg(REG_RDT,_descCount - 1);
 	writeReg(REG_RDTR,0);
 	writeReg(REG_RADV,0);
 
 	// init transmit ring
 	writeReg(REG_TDBAH,0);
-	writeReg(REG_TDBAL,reinterpret_cast<uintptr_t>(_bufsPhys->txDescs + 0));
-	writeReg(REG_TDLEN,TX_BUF_COUNT * sizeof(TxDesc));
+	writeReg(REG_TDBAL,phys(_txDescs));
+	writeReg(REG_TDLEN,_descCount * sizeof(TxDesc));
 	writeReg(REG_TDH,0);
 	writeReg(REG_TDT,0);
 	writeReg(REG_TIDV,0);
 	writeReg(REG_TADV,0);
 
 	// setup rx descriptors
-	for(size_t i = 0; i < RX_BUF_COUNT; i++) {
-		_bufs->rxDescs[i].length = RX_BUF_SIZE;
-		_bufs->rxDescs[i].buffer = reinterpret_cast<uint64_t>(_bufsPhys->rxBuf + i * RX_BUF_SIZE);
+	for(size_t i = 0; i < _descCount; i++) {
+		_rxDescs[i].length = RX_BUF_SIZE;
+		_rxDescs[i].buffer = phys(_rxBuf + i * RX_BUF_SIZE);
 	}
 
 	// enable rings
@@ -216,7 +236,7 @@ ssize_t E1000::send(const void *packet,size_t size) {
 	assert(size <= mtu());
 	// to next tx descriptor
 	uint32_t cur = _curTxBuf;
-	_curTxBuf = (_curTxBuf + 1) % TX_BUF_COUNT;
+	_curTxBuf = (_curTxBuf + 1) % _descCount;
 
 	// is there enough space?
 	uint32_t head = readReg(REG_TDH);
@@ -227,16 +247,16 @@ ssize_t E1000::send(const void *packet,size_t size) {
 	}
 
 	// copy to buffer
-	memcpy(_bufs->txBuf + cur * TX_BUF_SIZE,packet,size);
+	memcpy(_txBuf + cur * TX_BUF_SIZE,packet,size);
 
-	uint8_t *phys = _bufsPhys->txBuf + cur * TX_BUF_SIZE;
-	DBG2("TX %u: %p..%p",cur,phys,phys + size);
+	uint64_t bufPhys = phys(_txBuf + cur * TX_BUF_SIZE);
+	DBG2("TX %u: %#Lx..%#Lx",cur,bufPhys,bufPhys + size);
 
 	// setup descriptor
-	_bufs->txDescs[cur].cmd = TX_CMD_EOP | TX_CMD_IFCS;
-	_bufs->txDescs[cur].length = size;
-	_bufs->txDescs[cur].buffer = reinterpret_cast<uint64_t>(phys);
-	_bufs->txDescs[cur].status = 0;
+	_txDescs[cur].cmd = TX_CMD_EOP | TX_CMD_IFCS;
+	_txDescs[cur].length = size;
+	_txDescs[cur].buffer = bufPhys;
+	_txDescs[cur].status = 0;
 	asm volatile ("" : : : "memory");
 
 	writeReg(REG_TDT,_curTxBuf);
@@ -246,7 +266,7 @@ ssize_t E1000::send(const void *packet,size_t size) {
 void E1000::receive() {
 	uint32_t head = readReg(REG_RDH);
 	while(_curRxBuf != head) {
-		RxDesc *desc = _bufs->rxDescs + _curRxBuf;
+		RxDesc *desc = _rxDescs + _curRxBuf;
 
 		if(~desc->status & RDS_DONE)
 			break;
@@ -256,25 +276,27 @@ void E1000::receive() {
 
 		// read data into packet
 		size_t size = desc->length;
-		Packet *pkt = (Packet*)malloc(sizeof(Packet) + size);
+		Packet *pkt = allocPacket();
 		if(!pkt) {
 			printe("Not enough memory to read packet");
 			break;
 		}
 		pkt->length = size;
-		memcpy(pkt->data,_bufs->rxBuf + _curRxBuf * RX_BUF_SIZE,size);
+		memcpy(pkt->data,_rxBuf + _curRxBuf * RX_BUF_SIZE,size);
 
 		// insert into list
 		insert(pkt);
-		(*_handler)();
 
 		// to next packet
-		_curRxBuf = (_curRxBuf + 1) % RX_BUF_COUNT;
+		_curRxBuf = (_curRxBuf + 1) % _descCount;
 	}
 
+	// notify the clients once for all packets
+	(*_handler)();
+
 	// set new tail
 	if(_curRxBuf == head)
-		writeReg(REG_RDT,(head + RX_BUF_COUNT - 1) % RX_BUF_COUNT);
+		writeReg(REG_RDT,(head + _descCount - 1) % _descCount);
 	else
 		writeReg(REG_RDT,_curRxBuf);
 }
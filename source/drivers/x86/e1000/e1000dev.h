@@ -160,8 +160,9 @@ class E1000 : public esc::NICDriver {
 											 * finished the descriptor */
 	};
 
-	static const size_t RX_BUF_COUNT	= 8;
-	static const size_t TX_BUF_COUNT	= 8;
+	/* the descriptor ring lengths have to be a multiple of 128 bytes */
+	static const size_t MIN_DESC_COUNT	= 8;
+	static const size_t MAX_DESC_COUNT	= 4096;
 	static const size_t RX_BUF_SIZE		= 2048;
 	static const size_t TX_BUF_SIZE		= 2048;
 
@@ -184,15 +185,18 @@ class E1000 : public esc::NICDriver {
 		uint16_t : 16;
 	} A_PACKED A_ALIGNED(4);
 
-	struct Buffers {
-		RxDesc rxDescs[RX_BUF_COUNT] A_ALIGNED(16);
-		TxDesc txDescs[TX_BUF_COUNT] A_ALIGNED(16);
-		uint8_t rxBuf[RX_BUF_COUNT * RX_BUF_SIZE];
-		uint8_t txBuf[TX_BUF_COUNT * TX_BUF_SIZE];
-	};
-
 public:
-	explicit E1000(esc::PCI &pci,const esc::PCI::Device &nic);
+	static const size_t DEF_DESC_COUNT	= 64;
+
+	/**
+	 * Creates the driver for given NIC
+	 *
+	 * @param pci the PCI device
+	 * @param nic the NIC
+	 * @param descs the number of receive- and transmit-descriptors. It's reduced if there is not
+	 *  enough contiguous physical memory.
+	 */
+	explicit E1000(esc::PCI &pci,const esc::PCI::Device &nic,size_t descs = DEF_DESC_COUNT);
 
 	void start(std::Functor<void> *handler) {
 		_handler = handler;
@@ -226,13 +230,24 @@ private:
 	}
 
 	void reset();
+	void allocBuffers(size_t descs);
+
+	template<typename T>
+	uint64_t phys(T *virt) const {
+		return _bufsPhys + (reinterpret_cast<uintptr_t>(virt) - reinterpret_cast<uintptr_t>(_bufs));
+	}
 
 	int _irq;
 	int _irqsem;
 	uint32_t _curRxBuf;
 	uint32_t _curTxBuf;
-	Buffers *_bufs;
-	Buffers *_bufsPhys;
+	size_t _descCount;
+	void *_bufs;
+	uintptr_t _bufsPhys;
+	uint8_t *_rxBuf;
+	uint8_t *_txBuf;
+	RxDesc *_rxDescs;
+	TxDesc *_txDescs;
 	volatile uint32_t *_mmio;
 	esc::NIC::MAC _mac;
 	std::Functor<void> *_handler;
@@ -212,23 +212,32 @@ void Ne2k::receive() {
 
 		head.length -= 4;
 
-		/* read data into packet */
-		Packet *pkt = (Packet*)malloc(sizeof(Packet) + head.length);
-		if(!pkt) {
-			printe("Not enough memory to read packet");
-			break;
+		/* the packets have room for mtu() bytes; drop everything larger */
+		Packet *pkt = NULL;
+		if(head.length > mtu())
+			print("Dropping packet with %u bytes",head.length);
+		else {
+			/* read data into packet */
+			pkt = allocPacket();
+			if(!pkt) {
+				printe("Not enough memory to read packet");
+				break;
+			}
+			pkt->length = head.length;
+			accessPROM((_nextPacket << 8) | 0x4,head.length,pkt->data,PROM_READ);
 		}
-		pkt->length = head.length;
-		accessPROM((_nextPacket << 8) | 0x4,head.length,pkt->data,PROM_READ);
 
 		/* move boundary forward */
 		_nextPacket = head.status >> 8;
 		writeReg(REG_BNRY,_nextPacket == PAGE_RX ? (PAGE_STOP - 1) : _nextPacket - 1);
 
 		/* insert into list */
-		insert(pkt);
-		(*_handler)();
+		if(pkt)
+			insert(pkt);
 	}
+
+	/* notify the clients once for all packets */
+	(*_handler)();
 }
 
 int Ne2k::irqThread(void *ptr) {
@@ -129,6 +129,7 @@ public:
 	 * @return the client with given file-descriptor
 	 */
 	C *operator[](int fd) {
+		std::lock_guard<std::mutex> guard(_mutex);
 		typename map_type::iterator it = _clients.find(fd);
 		return it != _clients.end() ? it->second : NULL;
 	}
@@ -143,6 +144,7 @@ public:
 	 * @throws if the client does not exist
 	 */
 	C *get(int fd) {
+		std::lock_guard<std::mutex> guard(_mutex);
 		typename map_type::iterator it = _clients.find(fd);
 		if(it == _clients.end())
 			VTHROWE("No client with id " << fd,-ENOTFOUND);
@@ -25,6 +25,7 @@
 #include <functor.h>
 #include <map>
 #include <sstream>
+#include <vector>
 
 namespace esc {
 
@@ -115,6 +116,16 @@ public:
 	 */
 	void loop();
 
+	/**
+	 * Executes the device-loop with a pool of <workers> threads. The calling thread receives the
+	 * first message of every client and afterwards binds the client to one of the workers. Thus,
+	 * the messages of one client are still handled in order, but different clients are served in
+	 * parallel. Note that the handlers have to be thread-safe for that.
+	 *
+	 * @param workers the number of worker-threads (<= 1 is the same as loop())
+	 */
+	void loop(size_t workers);
+
 	/**
 	 * Calls the handler for the given message
 	 *
@@ -130,7 +141,21 @@ protected:
 	}
 
 private:
+	static int workerThread(void *arg);
+	void buildTable();
+
+	/* an entry of the op table (handler is NULL if it is free) */
+	struct Slot {
+		explicit Slot() : op(), handler() {
+		}
+
+		msgid_t op;
+		const Handler *handler;
+	};
+
 	oplist_type _ops;
+	/* perfect hash table for the ops: the op is at index op % size */
+	std::vector<Slot> _table;
 	int _id;
 	volatile bool _run;
 };
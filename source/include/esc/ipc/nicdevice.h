@@ -37,15 +37,49 @@ public:
 		uint16_t data[];
 	};
 
-	explicit NICDriver() : _mutex(), _first(), _last() {
+	explicit NICDriver() : _mutex(), _first(), _last(), _free() {
 	}
 	virtual ~NICDriver() {
+		while(_free) {
+			Packet *pkt = _free;
+			_free = _free->next;
+			free(pkt);
+		}
 	}
 
 	virtual esc::NIC::MAC mac() const = 0;
 	virtual ulong mtu() const = 0;
 	virtual ssize_t send(const void *packet,size_t size) = 0;
 
+	/**
+	 * Allocates a packet with room for mtu() bytes. Packets are reused, so that we don't need to
+	 * allocate memory for every received packet.
+	 *
+	 * @return the packet or NULL if there is not enough memory
+	 */
+	Packet *allocPacket() {
+		{
+			std::lock_guard<std::mutex> guard(_mutex);
+			if(_free) {
+				Packet *pkt = _free;
+				_free = _free->next;
+				return pkt;
+			}
+		}
+		return (Packet*)malloc(sizeof(Packet) + mtu());
+	}
+
+	/**
+	 * Puts the given packet back into the pool
+	 *
+	 * @param pkt the packet
+	 */
+	void freePacket(Packet *pkt) {
+		std::lock_guard<std::mutex> guard(_mutex);
+		pkt->next = _free;
+		_free = pkt;
+	}
+
 	Packet *fetch() {
 		std::lock_guard<std::mutex> guard(_mutex);
 		Packet *pkt = NULL;
@@ -72,9 +106,24 @@ private:
 	std::mutex _mutex;
 	Packet *_first;
 	Packet *_last;
+	Packet *_free;
 };
 
-class NICDevice : public ClientDevice<> {
+class NICClient : public Client {
+public:
+	explicit NICClient(int fd) : Client(fd), ring(), ringSlots(), ringMTU(), ringHead() {
+	}
+
+	/* the ring to put the packets into, if the client uses one */
+	NIC::Ring *ring;
+	/* our copies of the ring properties. the ring lives in memory that the client can write to,
+	 * so that we can't rely on the values in there */
+	ulong ringSlots;
+	ulong ringMTU;
+	ulong ringHead;
+};
+
+class NICDevice : public ClientDevice<NICClient> {
 	struct EthernetHeader {
 		esc::NIC::MAC dst;
 		esc::NIC::MAC src;
@@ -83,14 +132,15 @@ class NICDevice : public ClientDevice<> {
 
 public:
 	explicit NICDevice(const char *path,mode_t mode,NICDriver *driver)
-		: ClientDevice<>(path,mode,DEV_TYPE_CHAR,DEV_CANCEL | DEV_DELEGATE | DEV_READ | DEV_WRITE),
-		  _requests(std::make_memfun(this,&NICDevice::handleRead)), _mutex(), _driver(driver),
+		: ClientDevice<NICClient>(path,mode,DEV_TYPE_CHAR,DEV_CANCEL | DEV_DELEGATE | DEV_READ | DEV_WRITE),
+		  _requests(std::make_memfun(this,&NICDevice::handleRead)), _mutex(), _sendMutex(), _driver(driver),
 		  _tmpbuf(new char[_driver->mtu()]) {
 		set(MSG_DEV_CANCEL,std::make_memfun(this,&NICDevice::cancel));
 		set(MSG_FILE_READ,std::make_memfun(this,&NICDevice::read));
 		set(MSG_FILE_WRITE,std::make_memfun(this,&NICDevice::write));
 		set(MSG_NIC_GETMAC,std::make_memfun(this,&NICDevice::getMac));
 		set(MSG_NIC_GETMTU,std::make_memfun(this,&NICDevice::getMTU));
+		set(MSG_NIC_SETRING,std::make_memfun(this,&NICDevice::setRing));
 	}
 	virtual ~NICDevice() {
 		delete[] _tmpbuf;
@@ -126,7 +176,7 @@ private:
 	}
 
 	void read(IPCStream &is) {
-		Client *c = (*this)[is.fd()];
+		NICClient *c = (*this)[is.fd()];
 		FileRead::Request r;
 		is >> r;
 
@@ -134,13 +184,17 @@ private:
 		if(r.shmemoff != -1)
 			data = c->shm() + r.shmemoff;
 
-		if(!handleRead(is.fd(),is.msgid(),data,r.count)) {
-			std::lock_guard<std::mutex> guard(_mutex);
+		/* do both under the lock to not miss a packet that arrives in the meantime */
+		std::lock_guard<std::mutex> guard(_mutex);
+		if(!handleRead(is.fd(),is.msgid(),data,r.count))
 			_requests.enqueue(Request(is.fd(),is.msgid(),data,r.count));
-		}
 	}
 
 	void write(IPCStream &is) {
+		/* note that the ring is only used for receiving. packets are still sent one per message
+		 * and the drivers notify the device for each of them */
+		/* protects _tmpbuf and the driver */
+		std::lock_guard<std::mutex> guard(_sendMutex);
 		char *data = _tmpbuf;
 		FileWrite::Request r;
 		is >> r;
@@ -161,7 +215,7 @@ private:
 		ssize_t res = -ENOMEM;
 		EthernetHeader *eth = reinterpret_cast<EthernetHeader*>(data);
 		if(eth->dst == _driver->mac()) {
-			NICDriver::Packet *pkt = (NICDriver::Packet*)malloc(sizeof(NICDriver::Packet) + r.count);
+			NICDriver::Packet *pkt = _driver->allocPacket();
 			if(pkt) {
 				pkt->length = r.count;
 				memcpy(pkt->data,data,r.count);
@@ -184,7 +238,34 @@ private:
 		is << ValueResponse<ulong>::success(_driver->mtu()) << Reply();
 	}
 
+	void setRing(IPCStream &is) {
+		NICClient *c = (*this)[is.fd()];
+		ulong slots;
+		is >> slots;
+
+		errcode_t res = -EINVAL;
+		NIC::Ring *ring = reinterpret_cast<NIC::Ring*>(c->shm());
+		size_t size = ring ? c->sharedmem()->size : 0;
+		/* don't compute the size of the ring, because that might overflow */
+		if(size >= sizeof(NIC::Ring) && slots > 0 &&
+				slots <= (size - sizeof(NIC::Ring)) / NIC::Ring::slotSize(_driver->mtu()) &&
+				ring->slots == slots && ring->mtu == _driver->mtu()) {
+			std::lock_guard<std::mutex> guard(_mutex);
+			c->ring = ring;
+			c->ringSlots = slots;
+			c->ringMTU = _driver->mtu();
+			c->ringHead = ring->head;
+			res = 0;
+		}
+
+		is << res << Reply();
+	}
+
 	bool handleRead(int fd,msgid_t mid,char *data,size_t count) {
+		NICClient *c = (*this)[fd];
+		if(c && c->ring)
+			return handleRingRead(fd,mid,c);
+
 		NICDriver::Packet *pkt = _driver->fetch();
 		if(!pkt)
 			return false;
@@ -199,12 +280,46 @@ private:
 		if(!data && res > 0)
 			is << ReplyData(pkt->data,res);
 
-		free(pkt);
+		_driver->freePacket(pkt);
+		return true;
+	}
+
+	static NIC::Ring::Slot *ringSlot(NICClient *c,ulong idx) {
+		char *slots = reinterpret_cast<char*>(c->ring + 1);
+		return reinterpret_cast<NIC::Ring::Slot*>(
+			slots + (idx % c->ringSlots) * NIC::Ring::slotSize(c->ringMTU));
+	}
+
+	bool handleRingRead(int fd,msgid_t mid,NICClient *c) {
+		/* the client might change the ring at any time. thus, we only read the tail from it and
+		 * determine everything else with our own copies */
+		NIC::Ring *ring = c->ring;
+		NICDriver::Packet *pkt;
+		while(c->ringHead - ring->tail < c->ringSlots && (pkt = _driver->fetch())) {
+			NIC::Ring::Slot *slot = ringSlot(c,c->ringHead);
+			slot->length = pkt->length;
+			memcpy(slot->data,pkt->data,pkt->length);
+			_driver->freePacket(pkt);
+			/* the client may take the packet as soon as it sees the new head */
+			__sync_synchronize();
+			ring->head = ++c->ringHead;
+		}
+
+		ulong count = c->ringHead - ring->tail;
+		if(count == 0)
+			return false;
+		if(count > c->ringSlots)
+			count = c->ringSlots;
+
+		ulong buffer[IPC_DEF_SIZE / sizeof(ulong)];
+		IPCStream is(fd,buffer,sizeof(buffer),mid);
+		is << FileRead::Response::result(count) << Reply();
 		return true;
 	}
 
 	RequestQueue _requests;
 	std::mutex _mutex;
+	std::mutex _sendMutex;
 	NICDriver *_driver;
 	char *_tmpbuf;
 };
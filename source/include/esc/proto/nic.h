@@ -77,6 +77,77 @@ public:
 		uint8_t _bytes[LEN];
 	} A_PACKED;
 
+	/**
+	 * The ring of received packets, which is placed at the beginning of the memory that a client
+	 * shares with the NIC driver. The driver puts packets at the head and the client takes them
+	 * from the tail, so that no message per packet is required. Only if the ring is empty, the
+	 * client calls read(), which the driver answers as soon as there are packets in the ring.
+	 */
+	struct Ring {
+		struct Slot {
+			ulong length;
+			uint8_t data[];
+		};
+
+		/**
+		 * @param slots the number of slots
+		 * @param mtu the maximum packet size
+		 * @return the number of bytes that a ring with given properties needs
+		 */
+		static size_t size(ulong slots,ulong mtu) {
+			return sizeof(Ring) + slots * slotSize(mtu);
+		}
+		/**
+		 * @param mtu the maximum packet size
+		 * @return the size of a slot
+		 */
+		static size_t slotSize(ulong mtu) {
+			return (sizeof(Slot) + mtu + sizeof(ulong) - 1) & ~(sizeof(ulong) - 1);
+		}
+
+		/**
+		 * Initializes the ring. Has to be done by the client before it calls useRing().
+		 *
+		 * @param _slots the number of slots
+		 * @param _mtu the maximum packet size
+		 */
+		void init(ulong _slots,ulong _mtu) {
+			head = 0;
+			tail = 0;
+			slots = _slots;
+			mtu = _mtu;
+		}
+
+		/**
+		 * @return the number of packets in the ring
+		 */
+		ulong count() const {
+			return head - tail;
+		}
+		/**
+		 * @return true if there is no free slot
+		 */
+		bool full() const {
+			return count() == slots;
+		}
+
+		/**
+		 * @param idx the position (head or tail)
+		 * @return the slot at given position
+		 */
+		Slot *slot(ulong idx) {
+			char *slots = reinterpret_cast<char*>(this + 1);
+			return reinterpret_cast<Slot*>(slots + (idx % this->slots) * slotSize(mtu));
+		}
+
+		/* the next slot to fill; only changed by the driver */
+		volatile ulong head;
+		/* the next slot to take; only changed by the client */
+		volatile ulong tail;
+		ulong slots;
+		ulong mtu;
+	};
+
 	/**
 	 * Opens the given device
 	 *
@@ -124,6 +195,21 @@ public:
 		return r.res;
 	}
 
+	/**
+	 * Lets the driver put received packets into the ring at the beginning of the shared memory
+	 * (see Ring), which has to be initialized already. Afterwards, read() waits until the ring is
+	 * not empty and returns the number of packets in it instead of reading a single packet.
+	 *
+	 * @param slots the number of slots in the ring
+	 * @throws if the operation failed
+	 */
+	void useRing(ulong slots) {
+		errcode_t res;
+		_is << slots << SendReceive(MSG_NIC_SETRING) >> res;
+		if(res < 0)
+			VTHROWE("useRing(" << slots << ")",res);
+	}
+
 private:
 	IPCStream _is;
 };
@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include <fs/ghostlist.h>
 #include <sys/common.h>
+#include <mutex>
 #include <stdio.h>
 
 namespace fs {
@@ -32,12 +34,29 @@ struct CBlock {
 	size_t blockNo;
 	ushort dirty;
 	ushort refs;
+	/* the queue the block is in */
+	ushort queue;
 	/* NULL indicates an unused entry */
 	void *buffer;
 };
 
+/**
+ * The block cache uses the 2Q replacement policy: blocks that are loaded go into the in-queue,
+ * which is a FIFO and takes at most a quarter of the cache. Blocks that are evicted from there are
+ * remembered in a ghost-list. If they are loaded again while being remembered, they go into the
+ * main-queue, which is an LRU list. Thus, scans over the disk do only replace the blocks in the
+ * in-queue, but not the frequently used blocks like bitmaps and directories in the main-queue.
+ */
 class BlockCache {
-	static const size_t HASH_SIZE	= 256;
+	static const size_t HASH_SIZE		= 256;
+	/* the number of locks for the hashmap; a block belongs to lock (blockNo % LOCK_COUNT) */
+	static const size_t LOCK_COUNT		= 16;
+	/* the maximum number of blocks that are read or written with one request */
+	static const size_t MAX_IO_BLOCKS	= 32;
+	/* the number of blocks we start to read ahead with, when detecting sequential reads */
+	static const size_t MIN_READAHEAD	= 4;
+	/* the interval in microseconds in which the flusher writes back dirty blocks */
+	static const time_t FLUSH_INTERVAL	= 1000000;
 
 public:
 	enum {
@@ -82,15 +101,20 @@ public:
 	/**
 	 * Writes all dirty blocks to disk
 	 */
-	void flush();
+	void flush() {
+		writeBack(false);
+	}
 
 	/**
-	 * Marks the given block as dirty
+	 * Marks the given block as dirty. The first time a block becomes dirty, the flusher-thread is
+	 * started, which writes back dirty blocks periodically.
 	 *
 	 * @param b the block
 	 */
 	void markDirty(CBlock *b) {
 		b->dirty = true;
+		if(EXPECT_FALSE(!_flusherStarted))
+			startFlusher();
 	}
 
 	/**
@@ -123,9 +147,22 @@ public:
 	 * @param b the block
 	 */
 	void release(CBlock *b) {
-		doRelease(b,true);
+		doRelease(b);
 	}
 
+	/**
+	 * Reads <count> blocks beginning with <start> into <buffer> without putting them into the
+	 * cache. This is intended for large transfers, which would replace all cached blocks otherwise.
+	 * Blocks that are in the cache are copied from there, because they might be dirty. The others
+	 * are read with as few requests as possible.
+	 *
+	 * @param buffer the buffer to write to
+	 * @param start the start block number
+	 * @param count the number of blocks
+	 * @return true if successfull
+	 */
+	bool readDirect(void *buffer,block_t start,size_t count);
+
 	/**
 	 * Prints statistics about the given blockcache to the given file
 	 *
@@ -143,33 +180,133 @@ public:
 #endif
 
 private:
+	enum {
+		QUEUE_IN,
+		QUEUE_MAIN,
+		QUEUE_FREE,
+		/* the block is taken away to be replaced */
+		QUEUE_NONE,
+	};
+
+	/* the in-queue or main-queue */
+	struct BlockList {
+		CBlock *newest;
+		CBlock *oldest;
+		size_t count;
+	};
+
+	/* a dirty block, remembered with its block-number for sorting */
+	struct DirtyBlock {
+		block_t blockNo;
+		CBlock *block;
+	};
+
+	/* note that LOCK_COUNT divides HASH_SIZE, so that each hash-list is protected by one lock */
+	std::mutex &lockOf(block_t blockNo) {
+		return _locks[blockNo % LOCK_COUNT];
+	}
 	/**
 	 * Aquires the tpool_lock, depending on <mode>, for the given block
 	 */
 	void acquire(CBlock *b,uint mode);
 	/**
-	 * Releases the tpool_lock for given block
+	 * Drops the reference to the given block and releases its tpool_lock
+	 */
+	void doRelease(CBlock *b);
+	/**
+	 * Drops the reference to the given block
 	 */
-	void doRelease(CBlock *b,bool unlockAlloc);
+	void unref(CBlock *b);
 	/**
 	 * Requests the given block and reads it from disk if desired
 	 */
 	CBlock *doRequest(block_t blockNo,bool doRead,uint mode);
 	/**
-	 * Fetches a block-cache-entry
+	 * Reads the content of the new entry <block> from disk, together with the following blocks,
+	 * if we are reading sequentially.
+	 */
+	bool load(CBlock *block);
+	/**
+	 * Removes the new entry <block>, whose content could not be loaded, from the cache.
+	 */
+	void discard(CBlock *block);
+	/**
+	 * Searches for <blockNo> in the hashmap. The lock for <blockNo> has to be held.
+	 */
+	CBlock *find(block_t blockNo);
+	/**
+	 * Returns the entry for <blockNo> with an additional reference. If it is not in the cache, a
+	 * new entry is created and <created> is set to true. Returns NULL if all entries are in use.
+	 */
+	CBlock *get(block_t blockNo,bool *created);
+	/**
+	 * Takes an entry from the freelist or the one to replace according to 2Q and stores the queue
+	 * it has been taken from in <from>. The LRU-lock has to be held.
+	 */
+	CBlock *getVictim(uint *from);
+	/**
+	 * Removes <block> from its queue. The LRU-lock has to be held.
+	 */
+	void unlink(CBlock *block);
+	/**
+	 * Puts <block> at the beginning or the end of queue <queue>. The LRU-lock has to be held.
+	 */
+	void addToFront(CBlock *block,uint queue);
+	void addToBack(CBlock *block,uint queue);
+	/**
+	 * Puts <block> back on the freelist. The LRU-lock has to be held.
+	 */
+	void addToFree(CBlock *block);
+	/**
+	 * Inserts <block> into the hash-list of its block-number. The lock for it has to be held.
+	 */
+	void hash(CBlock *block);
+	/**
+	 * Removes <block> from the hash-list of its block-number. The lock for it has to be held.
+	 */
+	void unhash(CBlock *block);
+	/**
+	 * Writes all dirty blocks to disk, sorted by block-number and in as few requests as possible.
+	 * If <skipUsed> is true, blocks that are in use are left alone.
+	 */
+	void writeBack(bool skipUsed);
+	static bool compareDirty(const DirtyBlock &a,const DirtyBlock &b);
+	/**
+	 * Starts the flusher-thread
 	 */
-	CBlock *getBlock(block_t blockNo);
+	void startFlusher();
+	static int flusher(void *arg);
 
 	size_t _blockCacheSize;
 	size_t _blockSize;
 	CBlock **_hashmap;
-	CBlock *_oldestBlock;
-	CBlock *_newestBlock;
+	BlockList _lists[2];
+	size_t _inMax;
+	GhostList _ghost;
 	CBlock *_freeBlocks;
 	CBlock *_blockCache;
+	DirtyBlock *_dirtyList;
 	void *_blockmem;
+	/* MAX_IO_BLOCKS blocks behind the cached ones, used to read and write multiple blocks at once */
+	char *_iobuf;
+	/* protect the hash-lists, the block-numbers, the references and the dirty-flags */
+	std::mutex _locks[LOCK_COUNT];
+	/* protects the queues, the ghost-list and the freelist */
+	std::mutex _lruLock;
+	/* protects _iobuf, _dirtyList, the readahead-state and the start of the flusher */
+	std::mutex _ioLock;
+	block_t _raNext;
+	size_t _raWindow;
+	bool _flusherStarted;
+	int _flusher;
+	volatile bool _stop;
 	ulong _hits;
 	ulong _misses;
+	ulong _evictions;
+	ulong _ghostHits;
+	ulong _readahead;
+	ulong _writes;
+	ulong _directReads;
 };
 
 }
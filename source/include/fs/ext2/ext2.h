@@ -140,12 +140,27 @@
 #define EXT2_NOCOMPR_FL						0x00000400	/* access raw compressed data */
 #define EXT2_ECOMPR_FL						0x00000800	/* compression error */
 /* compression end */
-#define EXT2_BTREE_FL						0x00010000	/* b-tree format directory */
-#define EXT2_INDEX_FL						0x00010000  /* hash indexed directory */
-#define EXT2_IMAGIC_FL						0x00020000	/* AFS directory */
-#define EXT3_JOURNAL_DATA_FL				0x00040000	/* journal file data */
+#define EXT2_BTREE_FL						0x00001000	/* b-tree format directory */
+#define EXT2_INDEX_FL						0x00001000  /* hash indexed directory */
+#define EXT2_IMAGIC_FL						0x00002000	/* AFS directory */
+#define EXT3_JOURNAL_DATA_FL				0x00004000	/* journal file data */
 #define EXT2_RESERVED_FL					0x80000000	/* reserved for ext2 library */
 
+/* super-block flags */
+#define EXT2_FLAGS_SIGNED_HASH				0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH			0x0002
+
+/* hash versions for indexed directories */
+#define EXT2_HASH_LEGACY					0
+#define EXT2_HASH_HALF_MD4					1
+#define EXT2_HASH_TEA						2
+#define EXT2_HASH_LEGACY_UNSIGNED			3
+#define EXT2_HASH_HALF_MD4_UNSIGNED			4
+#define EXT2_HASH_TEA_UNSIGNED				5
+
+/* the maximum depth of the index-nodes below the root of an indexed directory */
+#define EXT2_HTREE_MAX_LEVELS				2
+
 namespace fs {
 
 struct Ext2SuperBlock {
@@ -242,8 +257,21 @@ struct Ext2SuperBlock {
 	uint32_t defMountOptions;
 	/* A 32bit value indicating the block group ID of the first meta block group. */
 	uint32_t firstMetaBg;
+	/* the time the file system was created */
+	uint32_t mkfsTime;
+	/* backup of the journal inode's block-numbers */
+	uint32_t journalBlocks[17];
+	/* the high 32 bits of the block counts (64bit file systems only) */
+	uint32_t blockCountHi;
+	uint32_t suResBlockCountHi;
+	uint32_t freeBlockCountHi;
+	/* the minimum and desired size of the additional inode fields */
+	uint16_t minExtraInodeSize;
+	uint16_t wantExtraInodeSize;
+	/* EXT2_FLAGS_* */
+	uint32_t flags;
 	/* UNUSED */
-	uint8_t unused[760];
+	uint8_t unused[668];
 } A_PACKED;
 
 struct Ext2BlockGrp {
@@ -273,6 +301,49 @@ struct Ext2DirEntry {
 	char name[];
 } A_PACKED;
 
+/* the header of the first block of an indexed directory. It starts with the entries for '.' and
+ * '..', whereas the latter spans the rest of the block, so that the index is invisible for
+ * implementations that don't know about it */
+struct Ext2DxRoot {
+	ino_t dotInode;
+	uint16_t dotRecLen;
+	uint16_t dotNameLen;
+	char dotName[4];
+	ino_t dotdotInode;
+	uint16_t dotdotRecLen;
+	uint16_t dotdotNameLen;
+	char dotdotName[4];
+	uint32_t reservedZero;
+	/* one of EXT2_HASH_* */
+	uint8_t hashVersion;
+	/* the length of this info, i.e. 8 */
+	uint8_t infoLength;
+	/* the number of levels of index-nodes below the root */
+	uint8_t indirectLevels;
+	uint8_t unusedFlags;
+	/* Ext2DxEntry's follow */
+} A_PACKED;
+
+/* the header of the other index-nodes of an indexed directory: an empty entry, spanning the block */
+struct Ext2DxNode {
+	ino_t fakeInode;
+	uint16_t fakeRecLen;
+	uint16_t fakeNameLen;
+	/* Ext2DxEntry's follow */
+} A_PACKED;
+
+/* an index-entry. All entries in block <block> have a hash >= <hash>. The first entry of each
+ * node has no hash, but stores the number of used and available entries instead */
+struct Ext2DxEntry {
+	uint32_t hash;
+	uint32_t block;
+} A_PACKED;
+
+struct Ext2DxCountLimit {
+	uint16_t limit;
+	uint16_t count;
+} A_PACKED;
+
 struct Ext2Inode {
 	uint16_t mode;
 	uint16_t uid;
@@ -24,7 +24,11 @@
 #include <fs/common.h>
 #include <sys/common.h>
 #include <sys/stat.h>
+#include <sys/thread.h>
+#include <mutex>
 #include <stdio.h>
+#include <stdlib.h>
+#include <vector>
 
 namespace fs {
 
@@ -46,7 +50,7 @@ class FSDevice : public esc::ClientDevice<F> {
 public:
 	explicit FSDevice(FileSystem<F> *fs,const char *fsDev)
 		: esc::ClientDevice<F>(fsDev,0700,DEV_TYPE_FS,DEV_OPEN | DEV_READ | DEV_WRITE | DEV_CLOSE | DEV_DELEGATE),
-		  _fs(fs), _clients(0) {
+		  _fs(fs), _clients(0), _workers(), _lock(), _readLock(), _readers(0) {
 		this->set(MSG_FILE_OPEN,std::make_memfun(this,&FSDevice::devopen));
 		this->set(MSG_FILE_CLOSE,std::make_memfun(this,&FSDevice::devclose),false);
 		this->set(MSG_FS_OPEN,std::make_memfun(this,&FSDevice::open));
@@ -72,23 +76,32 @@ public:
 	}
 
 	void loop() {
-		ulong buf[IPC_DEF_SIZE / sizeof(ulong)];
-		while(1) {
-			msgid_t mid;
-			int fd = getwork(this->id(),&mid,buf,sizeof(buf),this->isStopped() ? GW_NOBLOCK : 0);
-			if(EXPECT_FALSE(fd < 0)) {
-				if(fd != -EINTR) {
-					/* no requests anymore and we should shutdown? */
-					if(this->isStopped())
-						break;
-					printe("getwork failed");
-				}
-				continue;
-			}
+		run(false);
+	}
 
-			esc::IPCStream is(fd,buf,sizeof(buf),mid);
-			this->handleMsg(mid,is);
+	/**
+	 * Executes the device-loop with a pool of <workers> threads. Like esc::Device::loop(workers),
+	 * the calling thread binds every new client to one of the workers. The reads of different
+	 * clients are handled in parallel, all other operations exclusively. Thus, reads of the file
+	 * system have to be safe against each other.
+	 *
+	 * @param workers the number of worker-threads (<= 1 is the same as loop())
+	 */
+	void loop(size_t workers) {
+		if(workers <= 1) {
+			loop();
+			return;
+		}
+
+		for(size_t i = 0; i < workers; ++i) {
+			int tid = startthread(workerThread,this);
+			if(tid < 0) {
+				printe("Unable to start worker thread");
+				break;
+			}
+			_workers.push_back(tid);
 		}
+		run(true);
 	}
 
 	void devopen(esc::IPCStream &is) {
@@ -281,6 +294,61 @@ public:
 	}
 
 private:
+	void run(bool dispatch) {
+		ulong buf[IPC_DEF_SIZE / sizeof(ulong)];
+		size_t next = 0;
+		while(1) {
+			msgid_t mid;
+			int fd = getwork(this->id(),&mid,buf,sizeof(buf),this->isStopped() ? GW_NOBLOCK : 0);
+			if(EXPECT_FALSE(fd < 0)) {
+				if(fd != -EINTR) {
+					/* no requests anymore and we should shutdown? */
+					if(this->isStopped())
+						break;
+					printe("getwork failed");
+				}
+				continue;
+			}
+
+			esc::IPCStream is(fd,buf,sizeof(buf),mid);
+			handle(mid,is);
+
+			/* the dispatcher only gets the first message of a client, because all further ones
+			 * go to the worker we bind it to now. this keeps the order of its messages */
+			if(dispatch && _workers.size() > 0)
+				::bindto(fd,_workers[next++ % _workers.size()]);
+		}
+	}
+
+	void handle(msgid_t mid,esc::IPCStream &is) {
+		if((mid & 0xFFFF) == MSG_FILE_READ) {
+			{
+				std::lock_guard<std::mutex> guard(_readLock);
+				if(_readers++ == 0)
+					_lock.lock();
+			}
+			this->handleMsg(mid,is);
+			{
+				std::lock_guard<std::mutex> guard(_readLock);
+				if(--_readers == 0)
+					_lock.unlock();
+			}
+		}
+		else {
+			std::lock_guard<std::mutex> guard(_lock);
+			this->handleMsg(mid,is);
+		}
+	}
+
+	static int workerThread(void *arg) {
+		FSDevice *dev = static_cast<FSDevice*>(arg);
+		dev->run(false);
+		/* the device has been stopped and all clients are gone. but the dispatcher might wait
+		 * for new clients, which we can't interrupt. thus, shutdown the driver here */
+		dev->_fs->sync();
+		exit(EXIT_SUCCESS);
+	}
+
 	void handleInfoRead(esc::IPCStream &is,const esc::FileRead::Request &r) {
 		FILE *str = fopendyn();
 		char *data = NULL;
@@ -308,6 +376,11 @@ private:
 
 	FileSystem<F> *_fs;
 	size_t _clients;
+	std::vector<tid_t> _workers;
+	/* held shared by all running reads or exclusively by one other operation */
+	std::mutex _lock;
+	std::mutex _readLock;
+	size_t _readers;
 };
 
 }
@@ -0,0 +1,107 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <sys/common.h>
+
+namespace fs {
+
+/**
+ * The ghost-list of a 2Q-cache. It remembers the keys of the last <size> entries that have been
+ * evicted from the in-queue, i.e. entries that have been used only once. If such an entry is
+ * requested again while it is still remembered, it has proven to be used repeatedly and goes
+ * into the main-queue. Entries that are used only once (e.g. during a scan over the whole disk)
+ * do therefore never replace the ones in the main-queue.
+ */
+class GhostList {
+	struct Entry {
+		ulong key;
+		Entry *hnext;
+		bool used;
+	};
+
+public:
+	/**
+	 * Creates a ghost-list for <size> keys
+	 *
+	 * @param size the number of keys to remember
+	 */
+	explicit GhostList(size_t size)
+		: _entries(new Entry[size]()), _hashmap(new Entry*[size]()), _size(size), _pos() {
+	}
+	~GhostList() {
+		delete[] _hashmap;
+		delete[] _entries;
+	}
+
+	GhostList(const GhostList&) = delete;
+	GhostList &operator=(const GhostList&) = delete;
+
+	/**
+	 * Adds <key> to the list. If it is full, the oldest key is forgotten.
+	 *
+	 * @param key the key
+	 */
+	void add(ulong key) {
+		Entry *e = _entries + _pos;
+		_pos = (_pos + 1) % _size;
+		if(e->used)
+			unhash(e);
+		e->key = key;
+		e->used = true;
+		Entry **list = _hashmap + key % _size;
+		e->hnext = *list;
+		*list = e;
+	}
+
+	/**
+	 * Removes <key> from the list.
+	 *
+	 * @param key the key
+	 * @return true if it has been in the list
+	 */
+	bool remove(ulong key) {
+		for(Entry *e = _hashmap[key % _size]; e != NULL; e = e->hnext) {
+			if(e->key == key) {
+				unhash(e);
+				e->used = false;
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	void unhash(Entry *e) {
+		for(Entry **p = _hashmap + e->key % _size; *p != NULL; p = &(*p)->hnext) {
+			if(*p == e) {
+				*p = e->hnext;
+				break;
+			}
+		}
+	}
+
+	Entry *_entries;
+	Entry **_hashmap;
+	size_t _size;
+	size_t _pos;
+};
+
+}
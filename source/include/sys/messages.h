@@ -112,6 +112,7 @@ enum {
 	/* NIC */
 	MSG_NIC_GETMAC					= 1100,	/* get the MAC address of a NIC */
 	MSG_NIC_GETMTU					= 1101,	/* get the MTU of a NIC */
+	MSG_NIC_SETRING					= 1102,	/* receive packets into a ring in shared memory */
 
 	/* network */
 	MSG_NET_LINK_ADD				= 1200,	/* adds a link */
@@ -178,6 +178,37 @@ int execvpe(const char *path,const char **args,const char **env);
  */
 int fexecvpe(int fd,const char **args,const char **env);
 
+/**
+ * Creates a new process that executes the given program. This is the same as fork() followed by
+ * execv() in the child, but cheaper, because the address space of the current process is not
+ * cloned.
+ *
+ * @param path the program-path
+ * @param args a NULL-terminated array of arguments
+ * @return the pid of the child or a negative error-code if failed
+ */
+int spawnv(const char *path,const char **args);
+
+/**
+ * The same as spawnv(), but instead of the current environment, <env> is passed to the program.
+ *
+ * @param path the program-path
+ * @param args a NULL-terminated array of arguments
+ * @param env a NULL-terminated array of environment-variables
+ * @return the pid of the child or a negative error-code if failed
+ */
+int spawnvpe(const char *path,const char **args,const char **env);
+
+/**
+ * The same as spawnvpe(), but executes the program referenced by the given file descriptor.
+ *
+ * @param fd the file descriptor to the program (with exec and read permissions)
+ * @param args a NULL-terminated array of arguments
+ * @param env a NULL-terminated array of environment-variables
+ * @return the pid of the child or a negative error-code if failed
+ */
+int fspawnvpe(int fd,const char **args,const char **env);
+
 /**
  * The system function is used to issue a command. Execution of your program will not
  * continue until the command has completed.
@@ -114,6 +114,7 @@ enum {
 	SYSCALL_UTIME,
 	SYSCALL_TRUNCATE,
 	SYSCALL_SYMLINK,
+	SYSCALL_SPAWN,
 #	ifdef __x86__
 	SYSCALL_REQIOPORTS,
 	SYSCALL_RELIOPORTS,
@@ -102,6 +102,10 @@ inline void PageDirBase::removeAccess(A_UNUSED frameno_t frame) {
 	/* nothing to do */
 }
 
+inline bool PageDirBase::hasDirectAccess(A_UNUSED frameno_t frame) {
+	return true;
+}
+
 inline bool PageDirBase::isPresent(uintptr_t virt) const {
 	const PageDir *pdir = static_cast<const PageDir*>(this);
 	return pdir->pts.isPresent(virt);
@@ -112,6 +116,11 @@ inline frameno_t PageDirBase::getFrameNo(uintptr_t virt) const {
 	return pdir->pts.getFrameNo(virt);
 }
 
+inline bool PageDirBase::clearAccessed(uintptr_t virt) {
+	PageDir *pdir = static_cast<PageDir*>(this);
+	return pdir->pts.clearAccessed(virt);
+}
+
 inline void PageDirBase::copyToFrame(frameno_t frame,const void *src) {
 	memcpy((void*)(frame * PAGE_SIZE | DIR_MAP_AREA),src,PAGE_SIZE);
 }
@@ -31,6 +31,7 @@
 #define PTE_LARGE				0
 #define PTE_GLOBAL				0
 #define PTE_EXISTS				(1UL << 2)
+#define PTE_ACCESSED			0
 #define PTE_NO_EXEC				0
 #define PTE_FRAMENO(pte)		(((pte) >> PAGE_BITS) & ((1ULL << PT_BITS) - 1))
 #define PTE_FRAMENO_MASK		(((1ULL << PT_BITS) - 1) << PAGE_BITS)
@@ -43,6 +43,14 @@ public:
 	static void ackIntrpt();
 };
 
+inline bool TimerBase::archSetOneshot(A_UNUSED time_t msecs) {
+	/* not supported */
+	return false;
+}
+
+inline void TimerBase::archSetPeriodic() {
+}
+
 inline void TimerBase::getTimeval(struct timeval *tv) {
 	time_t time = Timer::getRuntime();
 	tv->tv_sec = time / 1000;
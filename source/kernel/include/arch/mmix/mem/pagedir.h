@@ -123,6 +123,11 @@ inline frameno_t PageDirBase::getFrameNo(uintptr_t virt) const {
 	return PTE_FRAMENO(pte);
 }
 
+inline bool PageDirBase::clearAccessed(A_UNUSED uintptr_t virt) {
+	/* there are no accessed-bits */
+	return false;
+}
+
 inline uintptr_t PageDirBase::getAccess(frameno_t frame) {
 	return frame * PAGE_SIZE | DIR_MAP_AREA;
 }
@@ -131,6 +136,10 @@ inline void PageDirBase::removeAccess(A_UNUSED frameno_t frame) {
 	/* nothing to do */
 }
 
+inline bool PageDirBase::hasDirectAccess(A_UNUSED frameno_t frame) {
+	return true;
+}
+
 inline void PageDirBase::copyToFrame(frameno_t frame,const void *src) {
 	memcpy((void*)(frame * PAGE_SIZE | DIR_MAP_AREA),src,PAGE_SIZE);
 }
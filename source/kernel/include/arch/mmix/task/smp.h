@@ -49,6 +49,18 @@ inline void SMPBase::ensureTLBFlushed() {
 	/* nothing to do */
 }
 
+inline void SMPBase::flushTLB(A_UNUSED PageDir *pdir,A_UNUSED uintptr_t addr,A_UNUSED size_t count) {
+	/* nothing to do */
+}
+
+inline void SMPBase::beginTLBBatch() {
+	/* nothing to do */
+}
+
+inline void SMPBase::endTLBBatch() {
+	/* nothing to do */
+}
+
 inline void SMPBase::sendIPI(A_UNUSED cpuid_t id,A_UNUSED uint8_t vector) {
 	/* ignored */
 }
@@ -196,6 +196,7 @@ private:
 	static void irqKeyboard(Thread *t,IntrptStackFrame *stack);
 	static void irqDefault(Thread *t,IntrptStackFrame *stack);
 	static void ipiWork(Thread *t,IntrptStackFrame *stack);
+	static void ipiFlushTLB(Thread *t,IntrptStackFrame *stack);
 	static void ipiCallback(Thread *t,IntrptStackFrame *stack);
 	static void ipiFPU(Thread *t,IntrptStackFrame *stack);
 
@@ -122,6 +122,7 @@ public:
 		write(REG_TIMER_DCR,0x3);	// set divider to 16
 	}
 	static void enableTimer();
+	static void oneshotTimer(uint msecs);
 
 	static void sendIPITo(cpuid_t id,uint8_t vector) {
 		writeIPI(id << 24,ICR_DESTSHORT_NO | ICR_LEVEL_ASSERT |
@@ -27,6 +27,7 @@
 #include <cpu.h>
 #include <string.h>
 #include <assert.h>
+#include <atomic.h>
 
 class PageDir : public PageDirBase {
 	friend class PageDirBase;
@@ -57,13 +58,41 @@ class PageDir : public PageDirBase {
 	};
 
 public:
-	explicit PageDir() : PageDirBase(), freeKStack(), lock(), pts() {
+	explicit PageDir() : PageDirBase(), freeKStack(), lock(), cpus(), pts() {
 	}
 
 	PageTables *getPageTables() {
 		return &pts;
 	}
 
+	/**
+	 * Reads the mask of CPUs that have this page-directory loaded. This is a full memory barrier,
+	 * so that a CPU that loads the page-directory afterwards sees all previous changes of the
+	 * page-tables. Without it, the store to a PTE might be reordered behind this load.
+	 *
+	 * @return the mask of CPUs that have this page-directory loaded (bit n = CPU n)
+	 */
+	ulong getCPUs() {
+		/* a locked operation is a full barrier on x86, which works on i586 as well */
+		return Atomic::fetch_and_or(&cpus,0UL);
+	}
+
+	/**
+	 * Notes that CPU <cpu> has loaded or unloaded this page-directory.
+	 *
+	 * @param cpu the CPU-id
+	 * @param loaded whether it has been loaded
+	 */
+	void setLoaded(cpuid_t cpu,bool loaded) {
+		/* if there are more CPUs, SMP::flushTLB doesn't use the mask */
+		if(cpu >= sizeof(ulong) * 8)
+			return;
+		if(loaded)
+			Atomic::fetch_and_or(&cpus,1UL << cpu);
+		else
+			Atomic::fetch_and_and(&cpus,~(1UL << cpu));
+	}
+
 	static void flushTLB() {
 		CPU::setCR3(CPU::getCR3());
 	}
@@ -100,6 +129,7 @@ private:
 
 	uintptr_t freeKStack;
 	SpinLock lock;
+	volatile ulong cpus;
 	PageTables pts;
 
 	static uintptr_t freeAreaAddr;
@@ -135,6 +165,10 @@ inline void PageDirBase::removeAccess(frameno_t frame) {
 		PageDir::unmapFromTemp();
 }
 
+inline bool PageDirBase::hasDirectAccess(frameno_t frame) {
+	return frame * PAGE_SIZE < DIR_MAP_AREA_SIZE;
+}
+
 inline bool PageDirBase::isPresent(uintptr_t virt) const {
 	const PageDir *pdir = static_cast<const PageDir*>(this);
 	return pdir->pts.isPresent(virt);
@@ -145,6 +179,11 @@ inline frameno_t PageDirBase::getFrameNo(uintptr_t virt) const {
 	return pdir->pts.getFrameNo(virt);
 }
 
+inline bool PageDirBase::clearAccessed(uintptr_t virt) {
+	PageDir *pdir = static_cast<PageDir*>(this);
+	return pdir->pts.clearAccessed(virt);
+}
+
 inline void PageDirBase::zeroToUser(void *dst,size_t count) {
 	PageDir::setWriteProtection(false);
 	memclear(dst,count);
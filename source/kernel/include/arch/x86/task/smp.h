@@ -22,6 +22,7 @@
 #include <arch/x86/gdt.h>
 #include <arch/x86/lapic.h>
 #include <common.h>
+#include <spinlock.h>
 
 class SMP : public SMPBase {
 	friend class SMPBase;
@@ -40,8 +41,49 @@ public:
 	 */
 	static void apIsRunning();
 
+	/**
+	 * Flushes the TLB entries that other CPUs have requested for CPU <id> via flushTLB().
+	 *
+	 * @param id the CPU-id (the current one)
+	 */
+	static void flushPending(cpuid_t id);
+
+	/**
+	 * @param id the CPU-id
+	 * @return the number of pages CPU <id> has still to flush (FLUSH_ALL = the whole TLB)
+	 */
+	static size_t getPendingFlushes(cpuid_t id);
+
+	static const size_t FLUSH_ALL		= static_cast<size_t>(-1);
+
 private:
+	/* the number of pages that are flushed individually; if more are pending, we flush all */
+	static const size_t FLUSH_PAGES		= 16;
+	/* the number of CPUs a ulong mask can hold (see PageDir::getCPUs). with more CPUs, we don't
+	 * know which ones have a page-directory loaded and flush all of them */
+	static const size_t MASK_CPUS		= sizeof(ulong) * 8;
+
+	/* the pages a CPU has to flush. an IPI is pending as long as count is not zero */
+	struct Shootdown {
+		SpinLock lock;
+		size_t count;
+		uintptr_t addrs[FLUSH_PAGES];
+	};
+
+	/* the state of a batch of shootdowns, started by a CPU */
+	struct Batch {
+		uint depth;
+		ulong targets;
+		/* whether CPUs that don't fit into <targets> have to be notified */
+		bool all;
+	};
+
+	static void requestFlush(Batch *batch,cpuid_t id,uintptr_t addr,size_t count);
+	static bool enqueueFlush(cpuid_t id,uintptr_t addr,size_t count);
+
 	static cpuid_t *log2Phys;
+	static Shootdown *shootdowns;
+	static Batch *batches;
 };
 
 inline cpuid_t SMP::getPhysId(cpuid_t logId) {
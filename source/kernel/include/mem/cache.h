@@ -33,8 +33,25 @@ class Cache {
 		size_t totalObjs;
 		size_t freeObjs;
 		void *freeList;
+		/* number of times we had to wait for the lock */
+		size_t contention;
 	};
 
+	/* a per-CPU stack of free objects in front of each cache. objects are linked like in the
+	 * freelist. the counters are per-CPU as well to not share cache lines between CPUs. */
+	struct Magazine {
+		void *objs;
+		size_t count;
+		size_t hits;
+		size_t misses;
+	};
+
+	/* the CPUs with a higher id always use the shared freelists */
+	static const size_t MAX_CPUS		= 32;
+	/* the maximum number of objects per magazine; half of it is moved at once */
+	static const size_t MAG_SIZE		= 16;
+	static const size_t CACHE_COUNT		= 11;
+
 public:
 	/**
 	 * Allocates <size> bytes from the cache
@@ -92,7 +109,7 @@ public:
 	static size_t getUsedMem();
 
 	/**
-	 * Prints the cache
+	 * Prints the cache, including the hits and misses of the per-CPU magazines
 	 *
 	 * @param os the output-stream
 	 */
@@ -113,10 +130,18 @@ private:
 	static size_t totalObjSize(size_t sz);
 	static void printBar(OStream &os,size_t mem,size_t maxMem,size_t total,size_t free);
 	static void *get(Entry *c,size_t i);
+	static void put(Entry *c,size_t i,ulong *area);
+	static bool refill(Entry *c,Magazine *m);
+	static void drain(Entry *c,Magazine *m,size_t count);
+	static bool grow(Entry *c);
+	static void *prepare(Entry *c,size_t i,ulong *area);
+	static Magazine *getMagazine(size_t i);
+	static void acquire(Entry *c);
 
 #if DEBUGGING
 	static bool aafEnabled;
 #endif
 	static SpinLock lock;
-	static Entry caches[];
+	static Entry caches[CACHE_COUNT];
+	static Magazine mags[MAX_CPUS][CACHE_COUNT];
 };
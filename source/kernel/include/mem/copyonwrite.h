@@ -19,22 +19,17 @@
 
 #pragma once
 
-#include <esc/col/slist.h>
 #include <task/proc.h>
 #include <common.h>
 
+/**
+ * Keeps track of frames that are shared copy-on-write. The number of users of each frame is stored
+ * in the per-frame reference counter of PhysMem, so that all operations are done in constant time
+ * and without a lock.
+ */
 class CopyOnWrite {
 	CopyOnWrite() = delete;
 
-	struct Entry : public esc::SListItem {
-		explicit Entry(frameno_t frameNo) : esc::SListItem(), frameNumber(frameNo), refCount(0) {
-		}
-		frameno_t frameNumber;
-		size_t refCount;
-	};
-
-	static const size_t HEAP_SIZE	= 64;
-
 public:
 	/**
 	 * Handles a pagefault for given address. Assumes that the pagefault was caused by a write access
@@ -47,15 +42,15 @@ public:
 	static size_t pagefault(uintptr_t address,frameno_t frameNumber);
 
 	/**
-	 * Adds the given frame to the cow-list.
+	 * Adds a user to the given frame.
 	 *
 	 * @param frameNo the frame-number
-	 * @return true if successfull
+	 * @return true if successfull (always)
 	 */
 	static bool add(frameno_t frameNo);
 
 	/**
-	 * Removes the given frame from the cow-list
+	 * Removes a user from the given frame
 	 *
 	 * @param frameNo the frame-number
 	 * @param foundOther will be set to true if another process still uses the frame
@@ -64,22 +59,19 @@ public:
 	static size_t remove(frameno_t frameNo,bool *foundOther);
 
 	/**
-	 * Note that this is intended for debugging or similar only! (not very efficient)
-	 *
-	 * @return the number of different frames that are in the cow-list
+	 * @return the number of different frames that are shared copy-on-write
 	 */
-	static size_t getFrmCount();
+	static size_t getFrmCount() {
+		return frameCount;
+	}
 
 	/**
-	 * Prints the cow-list
+	 * Prints the cow-list. Note that this is intended for debugging only (not very efficient)!
 	 *
 	 * @param os the output-stream
 	 */
 	static void print(OStream &os);
 
 private:
-	static Entry *getByFrame(frameno_t frameNo,bool dec);
-
-	static esc::SList<Entry> frames[];
-	static SpinLock lock;
+	static volatile size_t frameCount;
 };
@@ -0,0 +1,176 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#pragma once
+
+#include <esc/col/dlist.h>
+#include <sys/types.h>
+#include <common.h>
+#include <spinlock.h>
+
+class OStream;
+
+/**
+ * Caches pages of files in userspace filesystems, identified by device, inode and page offset. The
+ * pages are filled when demand-loading file-backed regions and used to satisfy later faults and
+ * read()s of the same file without asking the filesystem again. The frames are not copied, but
+ * shared copy-on-write with the regions that map them, i.e. the cache counts as one user of each
+ * of its frames. Frames that only the cache uses are handed back to PhysMem in LRU order when
+ * memory becomes short.
+ */
+class PageCache {
+	PageCache() = delete;
+
+	struct Entry : public esc::DListItem {
+		explicit Entry(dev_t dev,ino_t ino,off_t offset,frameno_t frame)
+			: esc::DListItem(), hashNext(), dev(dev), ino(ino), offset(offset), frame(frame) {
+		}
+		Entry *hashNext;
+		dev_t dev;
+		ino_t ino;
+		off_t offset;
+		frameno_t frame;
+	};
+
+	static const size_t HASH_SIZE		= 256;
+	/* at most 1/MAX_FRACTION of the memory is used for the cache */
+	static const size_t MAX_FRACTION	= 4;
+
+public:
+	/**
+	 * @return the current generation. It changes whenever a file is invalidated, which is used to
+	 * detect that a page that has been read might already be outdated when inserting it.
+	 */
+	static ulong getGeneration() {
+		return generation;
+	}
+
+	/**
+	 * Copies the page at <offset> of the given file to <dst>, if it is cached.
+	 *
+	 * @param dev the device number
+	 * @param ino the inode number
+	 * @param offset the offset in the file (page aligned)
+	 * @param dst the destination (PAGE_SIZE bytes)
+	 * @return true if the page has been found
+	 */
+	static bool get(dev_t dev,ino_t ino,off_t offset,void *dst);
+
+	/**
+	 * Makes the caller a copy-on-write user of the frame that holds the page at <offset> of the
+	 * given file, if it is cached.
+	 *
+	 * @param dev the device number
+	 * @param ino the inode number
+	 * @param offset the offset in the file (page aligned)
+	 * @return the frame or PhysMem::INVALID_FRAME if the page is not cached
+	 */
+	static frameno_t share(dev_t dev,ino_t ino,off_t offset);
+
+	/**
+	 * Inserts the page at <offset> of the given file, whose content is in <frame>, into the cache.
+	 * The cache and the caller become copy-on-write users of the frame, i.e. the caller has to map
+	 * it copy-on-write. If the generation has changed since <gen>, the page is not inserted.
+	 *
+	 * @param dev the device number
+	 * @param ino the inode number
+	 * @param offset the offset in the file (page aligned)
+	 * @param frame the frame with the content
+	 * @param gen the generation at the time the content was read
+	 * @return true if the page has been inserted
+	 */
+	static bool insert(dev_t dev,ino_t ino,off_t offset,frameno_t frame,ulong gen);
+
+	/**
+	 * Reads <count> bytes at <offset> from the given file into <buffer>, as far as the pages are
+	 * cached. It stops at the first page that is not cached.
+	 *
+	 * @param dev the device number
+	 * @param ino the inode number
+	 * @param offset the offset in the file
+	 * @param buffer the buffer to read into
+	 * @param count the number of bytes to read
+	 * @return the number of read bytes or a negative error-code
+	 */
+	static ssize_t read(dev_t dev,ino_t ino,off_t offset,USER void *buffer,size_t count);
+
+	/**
+	 * Removes all pages of the given file from the cache.
+	 *
+	 * @param dev the device number
+	 * @param ino the inode number
+	 */
+	static void invalidate(dev_t dev,ino_t ino);
+
+	/**
+	 * Removes all pages of the given device from the cache.
+	 *
+	 * @param dev the device number
+	 */
+	static void invalidateDev(dev_t dev);
+
+	/**
+	 * Removes up to <count> of the least recently used pages that are used by nobody else from the
+	 * cache and stores their frames into <frames>. The caller is responsible for freeing them.
+	 *
+	 * @param frames the array for the frames
+	 * @param count the maximum number of pages to evict
+	 * @return the number of evicted pages
+	 */
+	static size_t evict(frameno_t *frames,size_t count);
+
+	/**
+	 * @return the number of cached pages
+	 */
+	static size_t getPageCount() {
+		return lru.length();
+	}
+
+	/**
+	 * Prints the page cache
+	 *
+	 * @param os the output-stream
+	 */
+	static void print(OStream &os);
+
+private:
+	static size_t fileHash(dev_t dev,ino_t ino) {
+		return (static_cast<size_t>(dev) * 31 + static_cast<size_t>(ino)) % HASH_SIZE;
+	}
+	static size_t hash(dev_t dev,ino_t ino,off_t offset) {
+		return (fileHash(dev,ino) + static_cast<size_t>(offset / PAGE_SIZE)) % HASH_SIZE;
+	}
+	static Entry *find(dev_t dev,ino_t ino,off_t offset);
+	static void add(Entry *e);
+	static void remove(Entry *e);
+	static void removeIf(dev_t dev,ino_t ino,bool wholeDev);
+	static void release(frameno_t frame);
+
+	static Entry *table[];
+	/* the number of cached pages per file- and device-hash; lets us skip the search when
+	 * invalidating files or devices without cached pages, which is the common case */
+	static size_t filePages[];
+	static size_t devPages[];
+	static esc::DList<Entry> lru;
+	static ulong generation;
+	static size_t hits;
+	static size_t misses;
+	static size_t evictions;
+	static SpinLock lock;
+};
@@ -96,15 +96,24 @@ public:
 	static void removeAccess(frameno_t frame);
 
 	/**
-	 * Finishes the demand-loading-process by copying <loadCount> bytes from <buffer> into a new
-	 * frame and returning the frame-number
+	 * Checks whether the address returned by getAccess() for the given frame stays valid, even if
+	 * we switch threads in the meantime, i.e. whether no temporary mapping is required.
 	 *
-	 * @param buffer the buffer
+	 * @param frame the frame-number
+	 * @return true if so
+	 */
+	static bool hasDirectAccess(frameno_t frame);
+
+	/**
+	 * Finishes the demand-loading-process by copying <loadCount> bytes from <buffer> into the
+	 * given frame. If <buffer> is NULL, the content has already been read into the frame.
+	 *
+	 * @param frame the frame-number
+	 * @param buffer the buffer (may be NULL)
 	 * @param loadCount the number of bytes to copy
 	 * @param regFlags the flags of the affected region
-	 * @return the frame-number
 	 */
-	static frameno_t demandLoad(const void *buffer,size_t loadCount,ulong regFlags);
+	static void demandLoad(frameno_t frame,const void *buffer,size_t loadCount,ulong regFlags);
 
 	/**
 	 * Copies the memory (size=PAGE_SIZE) from <src> into the given frame.
@@ -181,6 +190,15 @@ public:
 	 */
 	frameno_t getFrameNo(uintptr_t virt) const;
 
+	/**
+	 * Clears the accessed-bit of the given page. On architectures without accessed-bits, it always
+	 * returns false.
+	 *
+	 * @param virt the virtual address
+	 * @return true if the page has been accessed since the last call
+	 */
+	bool clearAccessed(uintptr_t virt);
+
 	/**
 	 * Clones <count> pages at <virtSrc> to <virtDst> from <this> into <dst>. That means
 	 * the flags and frames are copied. Additionally, if <share> is false all present pages will
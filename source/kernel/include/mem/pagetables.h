@@ -22,8 +22,10 @@
 #include <mem/physmem.h>
 #include <mem/layout.h>
 #include <assert.h>
+#include <atomic.h>
 #include <common.h>
 #include <cppsupport.h>
+#include <spinlock.h>
 
 class PageTables {
 public:
@@ -50,6 +52,16 @@ public:
 		 */
 		virtual frameno_t allocPage() = 0;
 
+		/**
+		 * Allocates the frames for a large page, i.e., PT_ENTRY_COUNT contiguous frames, starting
+		 * at a multiple of PT_ENTRY_COUNT. Returns 0 to keep the currently set frames.
+		 *
+		 * @return the first frame or INVALID_FRAME if not possible
+		 */
+		virtual frameno_t allocLargePage() {
+			return PhysMem::INVALID_FRAME;
+		}
+
 		/**
 		 * Allocates a frame for a page-table
 		 */
@@ -71,7 +83,7 @@ public:
 			PhysMem::free(frame,PhysMem::KERN);
 		}
 
-	private:
+	protected:
 		int _pts;
 	};
 
@@ -84,10 +96,35 @@ public:
 		virtual frameno_t allocPage() override {
 			return 0;
 		}
+		virtual frameno_t allocLargePage() override {
+			return 0;
+		}
 		virtual void freePage(frameno_t) override {
 		}
 	};
 
+	/**
+	 * Like the NoAllocator, but allocates the frames for page-tables in batches to reduce the
+	 * contention on PhysMem. The unused frames are free'd on destruction.
+	 */
+	class BatchAllocator : public NoAllocator {
+		static const size_t BATCH_SIZE	= 8;
+
+	public:
+		explicit BatchAllocator() : NoAllocator(), _count(0) {
+		}
+		virtual ~BatchAllocator() {
+			if(_count > 0)
+				PhysMem::free(_frames,_count,PhysMem::KERN);
+		}
+
+		virtual frameno_t allocPT() override;
+
+	private:
+		size_t _count;
+		frameno_t _frames[BATCH_SIZE];
+	};
+
 	/**
 	 * The range allocator returns consecutive frame-numbers, starting at the given one.
 	 */
@@ -99,6 +136,13 @@ public:
 		virtual frameno_t allocPage() override {
 			return _frame++;
 		}
+		virtual frameno_t allocLargePage() override {
+			if(_frame % PT_ENTRY_COUNT != 0)
+				return PhysMem::INVALID_FRAME;
+			frameno_t first = _frame;
+			_frame += PT_ENTRY_COUNT;
+			return first;
+		}
 		virtual void freePage(frameno_t) override;
 
 	private:
@@ -221,11 +265,30 @@ public:
 		return PTE_FRAMENO(*pte) + (virt - base) / PAGE_SIZE;
 	}
 
+	/**
+	 * Clears the accessed-bit of the given page.
+	 *
+	 * @param virt the virtual address
+	 * @return true if the page has been accessed since the last call
+	 */
+	bool clearAccessed(uintptr_t virt) {
+		uintptr_t base;
+		pte_t *pte = getPTE(virt,&base);
+		if(!pte || !(*pte & PTE_ACCESSED))
+			return false;
+		/* the CPU might set the dirty-bit at the same time. we don't flush the TLB, because it's
+		 * only a hint; the page will be marked as accessed again after the next TLB miss */
+		Atomic::fetch_and_and(pte,~static_cast<pte_t>(PTE_ACCESSED));
+		return true;
+	}
+
 	/**
 	 * Clones <count> pages at <virtSrc> to <virtDst> from <this> into <dst>. That means
 	 * the flags and frames are copied. Additionally, if <share> is false all present pages will
 	 * be marked as not-writable and share the frame in the cloned pagedir so that they can be
 	 * copied on write-access. Note that either <this> or <dst> has to be the current page-dir!
+	 * On x86, page-tables that are completely covered are not copied in the copy-on-write case,
+	 * but shared read-only between <this> and <dst> instead (see isSharedPT()).
 	 *
 	 * @param dst the destination-pagedir
 	 * @param virtSrc the virtual source address
@@ -236,8 +299,43 @@ public:
 	 */
 	int clone(PageTables *dst,uintptr_t virtSrc,uintptr_t virtDst,size_t count,bool share);
 
+#if defined(__x86__)
+	/**
+	 * Determines whether the page-table that contains <virt> is shared with other page-
+	 * directories. Such a page-table is mapped read-only and may not be changed until it has
+	 * been unshared.
+	 *
+	 * @param virt the virtual address
+	 * @return true if so
+	 */
+	bool isSharedPT(uintptr_t virt) const;
+
+	/**
+	 * Gives this page-directory its own copy of the shared page-table that contains <virt>. The
+	 * present pages stay write-protected in both copies. If this page-directory is the last user
+	 * of the page-table, it gets the page-table back without copying it.
+	 *
+	 * @param virt the virtual address
+	 * @param alloc the allocator for the new page-table
+	 * @return 2 if it has been copied, 1 if we were the last user, 0 if it was not shared or a
+	 *  negative error-code
+	 */
+	int unsharePT(uintptr_t virt,Allocator &alloc);
+
+	/**
+	 * Removes the shared page-table that contains <virt> from this page-directory, if there are
+	 * other users of it.
+	 *
+	 * @param virt the virtual address
+	 * @return true if it has been removed; false if there are no other users
+	 */
+	bool releasePT(uintptr_t virt);
+#endif
+
 	/**
-	 * Maps <count> pages starting at <virt> in this page-directory.
+	 * Maps <count> pages starting at <virt> in this page-directory. Where the allocator provides
+	 * contiguous and suitably aligned frames (see Allocator::allocLargePage), large pages are used
+	 * on x86_64. Large pages are split when only a part of them is changed afterwards.
 	 *
 	 * @param virt the virt start-address
 	 * @param count the number of pages to map
@@ -279,11 +377,21 @@ private:
 	static void printPTE(OStream &os,uintptr_t from,uintptr_t to,pte_t page,int level);
 
 	int mapPage(uintptr_t virt,frameno_t frame,pte_t flags,Allocator &alloc);
-	frameno_t unmapPage(uintptr_t virt);
+	int mapLarge(uintptr_t virt,pte_t flags,Allocator &alloc);
+	int splitLarge(pte_t *pte,uintptr_t virt,Allocator &alloc);
+	frameno_t unmapPage(uintptr_t virt,Allocator &alloc);
 	pte_t *getPTE(uintptr_t virt,uintptr_t *base) const;
 	bool gc(uintptr_t virt,pte_t pte,int level,uint bits,Allocator &alloc);
 	size_t countEntries(pte_t pte,int level) const;
+#if defined(__x86__)
+	int sharePT(PageTables *dst,uintptr_t virt,Allocator &alloc);
+	pte_t *getDirEntry(uintptr_t virt,Allocator *alloc) const;
+#endif
 
 	pte_t root;
 	static bool hasNXE;
+#if defined(__x86__)
+	/* serializes the changes of the users of shared page-tables */
+	static SpinLock shareLock;
+#endif
 };
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <assert.h>
 #include <common.h>
 #include <lockguard.h>
 #include <spinlock.h>
@@ -44,6 +45,12 @@ typedef ulong tBitmap;
 class PhysMem {
 	PhysMem() = delete;
 
+	/* the CPUs with a higher id don't use a frame cache */
+	static const size_t MAX_CPUS					= 32;
+	/* the maximum number of frames per CPU and the number of frames to take at once */
+	static const size_t FRAME_CACHE_SIZE			= 64;
+	static const size_t FRAME_CACHE_BATCH			= 16;
+
 	struct SwapInJob {
 		uintptr_t addr;
 		Thread *thread;
@@ -56,16 +63,35 @@ class PhysMem {
 		frameno_t *frames;
 	};
 
+	/* a per-CPU cache of user frames in front of the stacks */
+	struct FrameCache {
+		SpinLock lock;
+		size_t count;
+		frameno_t frames[FRAME_CACHE_SIZE];
+	};
+
+	/* the buddy-allocator state for one frame of the contiguous memory */
+	struct ContFrame {
+		uint16_t prev;
+		uint16_t next;
+		/* 1 + the order, if it is the first frame of a free block. 0 otherwise */
+		uint8_t order;
+	};
+
 	static const size_t BITS_PER_BMWORD				= sizeof(tBitmap) * 8;
 	static const ulong KERNEL_MEM_PERCENT			= 20;
 	static const ulong KERNEL_MEM_MIN				= 750;
-	static const ulong MAX_SWAP_AT_ONCE				= 10;
+	static const ulong MAX_SWAP_AT_ONCE				= 16;
 	static const ulong SWAPIN_JOB_COUNT				= 64;
 	/* the amount of memory at which we should start to set the region-timestamp */
 	static const size_t REG_TS_BEGIN				= 4 * 1024 * PAGE_SIZE;
 
 	static const int OPEN_RETRIES					= 1000;
 
+	/* the number of block sizes (1 .. 2^(CONT_ORDERS-1) frames) of the buddy-allocator */
+	static const size_t CONT_ORDERS					= 12;
+	static const uint16_t CONT_NONE					= 0xFFFF;
+
 public:
 	static const frameno_t INVALID_FRAME			= -1;
 
@@ -116,10 +142,29 @@ public:
 	static int setAttributes(uintptr_t addr,size_t size,uint attr);
 
 	/**
-	 * @return the number of bytes used for the mm-stack
+	 * @return the number of bytes used for the mm-stack and the per-frame reference counters
 	 */
 	static size_t getStackSize() {
-		return (lower.pages + upper.pages) * PAGE_SIZE;
+		return (lower.pages + upper.pages + refPages) * PAGE_SIZE;
+	}
+
+	/**
+	 * @return the number of frames that have a reference counter (the highest frame number + 1)
+	 */
+	static size_t getFrameCount() {
+		return totalFrames;
+	}
+
+	/**
+	 * Every frame has a reference counter, which is used for frames that are shared via
+	 * copy-on-write. It should be changed atomically.
+	 *
+	 * @param frame the frame number
+	 * @return the reference counter of the given frame
+	 */
+	static volatile uint32_t *getRefCount(frameno_t frame) {
+		assert(frame < totalFrames);
+		return frameRefs + frame;
 	}
 
 	/**
@@ -144,7 +189,9 @@ public:
 	static bool shouldSetRegTimestamp();
 
 	/**
-	 * Allocates <count> contiguous frames from the MM-bitmap
+	 * Allocates <count> contiguous frames from the MM-bitmap. If <align> is a power of 2, the frames
+	 * are taken from the buddy-allocator in O(log n). Otherwise, or if no large enough block is
+	 * free, the bitmap is searched.
 	 *
 	 * @param count the number of frames
 	 * @param align the alignment of the memory (in pages)
@@ -185,13 +232,47 @@ public:
 	 */
 	static frameno_t allocate(FrameType type);
 
+	/**
+	 * Allocates up to <count> frames at once. Like allocate(type), the frames should be announced
+	 * with reserve() first. If user frames are requested and there is enough memory, the frame
+	 * cache of the current CPU is refilled as well.
+	 *
+	 * @param type the type of memory (FRM_*)
+	 * @param count the number of frames
+	 * @param frames the array to write the frame-numbers to
+	 * @return the number of allocated frames
+	 */
+	static size_t allocate(FrameType type,size_t count,frameno_t *frames);
+
+	/**
+	 * Takes up to <count> user frames from the frame cache of the current CPU. These have already
+	 * been taken from the free memory, so that they do not need to be announced with reserve().
+	 *
+	 * @param count the number of frames
+	 * @param frames the array to write the frame-numbers to
+	 * @return the number of frames
+	 */
+	static size_t allocateCached(size_t count,frameno_t *frames);
+
 	/**
 	 * Frees the given frame
 	 *
 	 * @param frame the frame-number
 	 * @param type the type of memory (FRM_*)
 	 */
-	static void free(frameno_t frame,FrameType type);
+	static void free(frameno_t frame,FrameType type) {
+		free(&frame,1,type);
+	}
+
+	/**
+	 * Frees the given frames. User frames are put into the frame cache of the current CPU, as long
+	 * as there is space.
+	 *
+	 * @param frames the frame-numbers
+	 * @param count the number of frames
+	 * @param type the type of memory (FRM_*)
+	 */
+	static void free(const frameno_t *frames,size_t count,FrameType type);
 
 	/**
 	 * Swaps the page with given address for the current process in
@@ -235,31 +316,57 @@ private:
 
 private:
 	static uintptr_t bitmapStartFrame();
+	static bool isContFrame(frameno_t frame);
 	static uintptr_t lowerStart();
 	static uintptr_t lowerEnd();
 	static frameno_t allocFrame(bool forceLower);
+	static frameno_t allocOne(FrameType type);
 	static void freeFrame(frameno_t frame);
+	static void freeDef(const frameno_t *frames,size_t count);
+	static void freeOne(frameno_t frame);
+	static FrameCache *getFrameCache();
+	static size_t putCached(const frameno_t *frames,size_t count);
+	static size_t getCachedFrames();
+	static void drainCaches();
+	static size_t shrinkPageCache(size_t count);
 	static size_t getFreeDef();
 	static void markRangeUsed(uintptr_t from,uintptr_t to,bool used);
 	static void doMarkRangeUsed(uintptr_t from,uintptr_t to,bool used);
 	static void markUsed(frameno_t frame,bool used);
+	static ssize_t scanContiguous(size_t count,size_t align);
+	static frameno_t takeBlock(size_t order);
+	static void claimRange(frameno_t frame,size_t count);
+	static void releaseRange(frameno_t frame,size_t count);
+	static void releaseBlock(frameno_t frame,size_t order);
+	static void contAdd(frameno_t frame,size_t order);
+	static void contRem(frameno_t frame,size_t order);
 	static void appendJob(SwapInJob *job);
 	static SwapInJob *getJob();
 	static void freeJob(SwapInJob *job);
 
 	static size_t totalMem;
 
+	/* one reference counter per frame */
+	static volatile uint32_t *frameRefs;
+	static size_t totalFrames;
+	static size_t refPages;
+
 	/* the bitmap for the frames of the lowest few MB; 0 = free, 1 = used */
 	static tBitmap *bitmap;
 	static uintptr_t bitmapStart;
 	static size_t freeCont;
 	static SpinLock contLock;
+	/* the buddy-allocator for the bitmap-memory: per-frame state and one freelist per order */
+	static ContFrame contFrames[BITMAP_PAGE_COUNT];
+	static uint16_t contFree[CONT_ORDERS];
 
 	/* We use a stack for the remaining memory
 	 * TODO Currently we don't free the frames for the stack */
 	static StackFrames lower;
 	static StackFrames upper;
 	static SpinLock defLock;
+	/* the frames in the caches count as used, i.e. they are not included in getFreeDef() */
+	static FrameCache frameCaches[MAX_CPUS];
 
 	static bool initialized;
 
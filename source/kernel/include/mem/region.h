@@ -153,6 +153,31 @@ public:
 		timestamp = ts;
 	}
 
+	/**
+	 * The readahead-state for demand-loading: the page that will be loaded next if the region is
+	 * accessed sequentially and the number of pages that have been loaded at once last time.
+	 */
+	size_t getRANext() const {
+		return raNext;
+	}
+	size_t getRAPages() const {
+		return raPages;
+	}
+	void setReadAhead(size_t next,size_t pages) {
+		raNext = next;
+		raPages = pages;
+	}
+
+	/**
+	 * The page at which the search for pages to swap out continues next time (CLOCK algorithm)
+	 */
+	size_t getClockHand() const {
+		return clockHand;
+	}
+	void setClockHand(size_t page) {
+		clockHand = page;
+	}
+
 	/**
 	 * @return the flags of the given page
 	 */
@@ -255,6 +280,9 @@ private:
 	size_t loadCount;
 	size_t byteCount;
 	uint64_t timestamp;
+	size_t raNext;
+	size_t raPages;
+	size_t clockHand;
 	size_t pfSize;			/* size of pageFlags */
 	ulong *pageFlags;		/* flags for each page; upper bits: swap-block, if swapped */
 	esc::ISList<VirtMem*> vms;
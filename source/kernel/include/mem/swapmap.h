@@ -30,7 +30,6 @@ class SwapMap {
 
 	struct Block {
 		uint refCount;
-		Block *next;
 	};
 
 public:
@@ -49,7 +48,20 @@ public:
 	 *
 	 * @return the starting block on the swap-device or INVALID if no free space is left
 	 */
-	static ulong alloc();
+	static ulong alloc() {
+		size_t count;
+		return alloc(1,&count);
+	}
+
+	/**
+	 * Allocates up to <count> consecutive blocks on the swap-device, so that they can be written
+	 * with one request.
+	 *
+	 * @param count the maximum number of blocks
+	 * @param allocated will be set to the number of allocated blocks
+	 * @return the starting block on the swap-device or INVALID if no free space is left
+	 */
+	static ulong alloc(size_t count,size_t *allocated);
 
 	/**
 	 * Increases the references of the given block
@@ -96,7 +108,7 @@ private:
 	static size_t totalBlocks;
 	static size_t freeBlocks;
 	static Block *swapBlocks;
-	static Block *freeList;
+	static size_t nextBlock;
 	static SpinLock lock;
 };
 
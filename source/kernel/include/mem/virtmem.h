@@ -51,6 +51,7 @@ enum {
 	MAP_FIXED			= 128UL,
 	MAP_NOMAP			= 256UL,		/* kernel-intern */
 	MAP_NOFREE			= RF_NOFREE,	/* kernel-intern */
+	MAP_LARGEPAGES		= 4096UL,		/* kernel-intern: align it so that large pages can be used */
 
 	MAP_USER_FLAGS		= MAP_SHARED | MAP_GROWABLE | MAP_GROWSDOWN | MAP_STACK |
  							MAP_LOCKED | MAP_POPULATE | MAP_NOSWAP | MAP_FIXED,
@@ -68,6 +69,13 @@ class Region;
 class OpenFile;
 
 class VirtMem : public esc::SListItem {
+	/* the number of pages around a random demand-load fault that are loaded as well */
+	static const size_t FAULT_AROUND_PAGES	= 4;
+	/* the maximum number of pages that are loaded at once for sequential faults */
+	static const size_t READAHEAD_MAX_PAGES	= 32;
+	/* the maximum number of pages that are written to or read from the swap-device at once */
+	static const size_t SWAP_CLUSTER_PAGES	= 8;
+
 	friend class ProcBase;
 
 public:
@@ -82,7 +90,8 @@ public:
 	static int pagefault(uintptr_t addr,bool write);
 
 	/**
-	 * Swaps <count> pages out. It searches for the best suited page to swap out.
+	 * Swaps <count> pages out. It chooses the least recently used region and the pages within it
+	 * that have not been accessed recently.
 	 *
 	 * @param file the file to write to
 	 * @param count the number of pages to swap out
@@ -90,14 +99,15 @@ public:
 	static void swapOut(OpenFile *file,size_t count);
 
 	/**
-	 * Swaps the page at given address of the given process in.
+	 * Swaps the page at given address of the given process in. If memory permits, the following
+	 * pages are swapped in as well, if they have been swapped out together with this one.
 	 *
 	 * @param file the file to write to
 	 * @param t the thread that wants to swap the page in (and has reserved the frame to do so)
 	 * @param addr the address of the page to swap in
-	 * @return true on success
+	 * @return the number of pages that have been swapped in
 	 */
-	static bool swapIn(OpenFile *file,Thread *t,uintptr_t addr);
+	static size_t swapIn(OpenFile *file,Thread *t,uintptr_t addr);
 
 	/**
 	 * Sets the timestamp for all regions that are used by the given thread
@@ -298,9 +308,44 @@ public:
 	 * Clones all regions of this virtmem (current) into the destination-virtmem
 	 *
 	 * @param dst the destination-virtmem
+	 * @param stackOnly whether to clone only the stack-regions of the current thread (for spawn)
+	 * @return 0 on success
+	 */
+	int cloneAll(VirtMem *dst,bool stackOnly);
+
+	/**
+	 * Lends the <count> pages at <addr> to the kernel. That means, the pages are marked as
+	 * copy-on-write and an additional reference to each frame is stored in <frames>. Thus, the
+	 * content of the frames stays unchanged until they are released via releasePages(), regardless
+	 * of what the owner does with the pages in the meantime.
+	 * This is only possible for present pages in private, unlocked regions.
+	 *
+	 * @param addr the page-aligned virtual address
+	 * @param count the number of pages
+	 * @param frames will be set to the frame-numbers
+	 * @return 0 on success
+	 */
+	int lendPages(uintptr_t addr,size_t count,frameno_t *frames);
+
+	/**
+	 * Maps the given lent frames copy-on-write at <addr>, replacing the <count> pages that are
+	 * currently there. The same restrictions as for lendPages() apply; additionally, the region
+	 * has to be writable. The references obtained by lendPages() are not touched.
+	 *
+	 * @param addr the page-aligned virtual address
+	 * @param count the number of pages
+	 * @param frames the frame-numbers
 	 * @return 0 on success
 	 */
-	int cloneAll(VirtMem *dst);
+	int adoptPages(uintptr_t addr,size_t count,const frameno_t *frames);
+
+	/**
+	 * Releases the references to the given frames that have been obtained by lendPages().
+	 *
+	 * @param frames the frame-numbers
+	 * @param count the number of frames
+	 */
+	static void releasePages(const frameno_t *frames,size_t count);
 
 	/**
 	 * If <amount> is positive, the region will be grown by <amount> pages. If negative it
@@ -387,18 +432,28 @@ private:
 	}
 
 	static Region *getLRURegion();
-	static ssize_t getPgIdxForSwap(const Region *reg);
+	static size_t getPagesForSwap(Region *reg,size_t *pages,size_t count);
+	static bool clearAccessed(Region *reg,size_t index);
 	static void setSwappedOut(Region *reg,size_t index);
 	static void setSwappedIn(Region *reg,size_t index,frameno_t frameNo);
+#if defined(__x86__)
+	static bool isInSharedPT(Region *reg,size_t index);
+#endif
 
 	int lockRegion(VMRegion *vm,int flags);
 	int populatePages(VMRegion *vm,size_t count);
+	VMRegion *getLendRegion(uintptr_t addr,size_t count);
 	int doPagefault(uintptr_t addr,VMRegion *vm,bool write);
 	void sync(VMRegion *vm) const;
 	void doUnmap(VMRegion *vm);
 	size_t doGrow(VMRegion *vm,ssize_t amount);
 	int demandLoad(VMRegion *vm,uintptr_t addr);
 	int loadFromFile(VMRegion *vm,uintptr_t addr,size_t loadCount);
+	size_t getLoadWindow(VMRegion *vm,size_t page,size_t *start);
+	void mapLoaded(VMRegion *vm,uintptr_t addr,frameno_t frame,bool cow);
+#if defined(__x86__)
+	int unsharePTs(VMRegion *vm,uintptr_t addr,size_t count);
+#endif
 	uintptr_t findFreeStack(size_t byteCount,ulong rflags);
 	bool isOccupied(uintptr_t start,uintptr_t end) const;
 	uintptr_t getFirstUsableAddr() const;
@@ -446,4 +501,7 @@ private:
 	ulong peakOwnFrames;
 	ulong peakSharedFrames;
 	ulong swapCount;
+
+	/* the buffer for swapping in and out (both is only done by the swapper-thread) */
+	static uint8_t swapBuffer[];
 };
@@ -19,8 +19,9 @@
 
 #pragma once
 
-#include <common.h>
 #include <esc/col/internal.h>
+#include <sys/arch.h>
+#include <common.h>
 
 class OStream;
 
@@ -55,9 +56,10 @@ public:
 	 *
 	 * @param map the map
 	 * @param size the size of the area
+	 * @param align the alignment of the area (a power of 2)
 	 * @return the address of 0 if failed
 	 */
-	uintptr_t allocate(size_t size);
+	uintptr_t allocate(size_t size,size_t align = PAGE_SIZE);
 
 	/**
 	 * Allocates an area in the given map at the specified address, that is <size> bytes large.
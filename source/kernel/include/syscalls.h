@@ -185,6 +185,7 @@ private:
 	static int fork(Thread *t,IntrptStackFrame *stack);
 	static int waitchild(Thread *t,IntrptStackFrame *stack);
 	static int exec(Thread *t,IntrptStackFrame *stack);
+	static int spawn(Thread *t,IntrptStackFrame *stack);
 
 	// signals
 	static int signal(Thread *t,IntrptStackFrame *stack);
@@ -35,6 +35,7 @@
 #include <common.h>
 #include <interrupts.h>
 #include <mutex.h>
+#include <semaphore.h>
 #include <spinlock.h>
 
 /* max number of coexistent processes */
@@ -251,9 +252,10 @@ public:
 	 * thread in Proc::clone() so that it will start there on thread_resume().
 	 *
 	 * @param flags the flags to set for the process (e.g. P_VM86)
+	 * @param stackOnly whether to clone only the stack of the current thread instead of all regions
 	 * @return < 0 if an error occurred, the child-pid for parent, 0 for child
 	 */
-	static int clone(uint8_t flags);
+	static int clone(uint8_t flags,bool stackOnly = false);
 
 	/**
 	 * Starts a new thread at given entry-point. Will clone the kernel-stack from the current thread
@@ -276,6 +278,18 @@ public:
 	 */
 	static int exec(OpenFile *file,int fd,const char *const *args,USER const char *const *env);
 
+	/**
+	 * Creates a new process that executes the given program. This is the same as a fork() with an
+	 * exec() in the child, but without cloning the address space of the current process, except for
+	 * the stack of the current thread.
+	 *
+	 * @param fd the file descriptor for the executable
+	 * @param args the arguments
+	 * @param env the environment
+	 * @return the pid of the child or a negative error-code (also if the exec in the child failed)
+	 */
+	static int spawn(int fd,USER const char *const *args,USER const char *const *env);
+
 	/**
 	 * Waits until the thread with given thread-id or all other threads of the process are terminated.
 	 *
@@ -545,6 +559,15 @@ public:
 	void print(OStream &os) const;
 
 private:
+	/* the result of the exec in a spawned child, which is passed to the parent */
+	struct SpawnResult {
+		explicit SpawnResult() : sem(0), res(0) {
+		}
+
+		Semaphore sem;
+		int res;
+	};
+
 	/**
 	 * Initializes the architecture specific parts of the given process
 	 *
@@ -565,6 +588,9 @@ private:
 	static void notifyProcDied(pid_t parent);
 	static int getExitState(pid_t ppid,pid_t pid,ExitState *state);
 	static void doRemoveRegions(Proc *p,bool remStack);
+	static int copyArgs(USER const char *const *args,USER const char *const *env,char **argBuffer,
+		size_t *argSize,int *argc,int *envc);
+	static int doExec(OpenFile *file,int fd,char *argBuffer,size_t argSize,int argc,int envc);
 	static pid_t getFreePid();
 	static void add(Proc *p);
 	static void remove(Proc *p);
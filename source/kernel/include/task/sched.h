@@ -70,15 +70,17 @@ public:
 	 * @param event the event
 	 * @param object the object
 	 * @param all if true, all are waked up, otherwise only the first one
+	 * @param handoff if true, the caller is going to block right away. thus, the first thread is
+	 *  moved to the front of the current CPU's ready-queue and the CPU switches directly to it
+	 *  when the caller has blocked, regardless of the priorities of the other ready threads.
 	 */
-	static void wakeup(uint event,evobj_t object,bool all = true);
+	static void wakeup(uint event,evobj_t object,bool all = true,bool handoff = false);
 
 	/**
-	 * @return the current ready-mask. 1 bit per priority.
+	 * @param cpu the CPU
+	 * @return the current ready-mask of the given CPU. 1 bit per priority.
 	 */
-	static ulong getReadyMask() {
-		return readyMask;
-	}
+	static ulong getReadyMask(cpuid_t cpu);
 
 	/**
 	 * Blocks the given thread
@@ -115,6 +117,16 @@ public:
 	static const char *getEventName(uint event);
 
 private:
+	struct RunQueue;
+
+	/* the number of wait-queues the waiting threads are distributed to */
+	static const size_t WAIT_QUEUE_COUNT	= 256;
+
+	struct WaitQueue {
+		SpinLock lock;
+		esc::DList<Thread> list;
+	};
+
 	/**
 	 * Adds the given thread as an idle-thread to the scheduler
 	 *
@@ -143,8 +155,10 @@ private:
 	 * Appends the given thread on the ready-queue and sets the state to Thread::READY
 	 *
 	 * @param t the thread
+	 * @param handoff whether to put it in front of the current CPU's ready-queue instead (which
+	 *  has to be locked as well)
 	 */
-	static void setReady(Thread *t);
+	static void setReady(Thread *t,bool handoff = false);
 
 	/**
 	 * Sets the thread in the blocked-state
@@ -160,28 +174,67 @@ private:
 	 */
 	static void removeThread(Thread *t);
 
-	static void enqueue(Thread *t);
-	static void dequeue(Thread *t);
+	/**
+	 * Locks the ready-queue the given thread belongs to. Since the thread might be stolen by
+	 * another CPU in the meantime, this retries until the queue is still the thread's one after
+	 * having locked it.
+	 *
+	 * @param t the thread
+	 * @return the locked queue
+	 */
+	static RunQueue *lockQueue(Thread *t);
+
+	/**
+	 * Locks the ready-queue of the given thread and the one of <cpu>, in a fixed order.
+	 *
+	 * @param t the thread
+	 * @param cpu the CPU
+	 * @return the locked queue of <t> (might be the one of <cpu>)
+	 */
+	static RunQueue *lockQueues(Thread *t,cpuid_t cpu);
+
+	/**
+	 * @param event the event
+	 * @param object the object
+	 * @return the wait-queue for threads that wait for given event and object
+	 */
+	static WaitQueue *getWaitQueue(uint event,evobj_t object);
+
+	/**
+	 * Locks the wait-queue the given thread is in (if any) and its ready-queue afterwards.
+	 *
+	 * @param t the thread
+	 * @param rq will be set to the locked ready-queue
+	 * @return the locked wait-queue or NULL if the thread does not wait
+	 */
+	static WaitQueue *lockWaitQueue(Thread *t,RunQueue **rq);
+
+	/**
+	 * Wakes up the threads in <wq> that wait for exactly the given event and object
+	 *
+	 * @param wq the wait-queue
+	 * @param event the event
+	 * @param object the object
+	 * @param all if true, all are waked up, otherwise only the first one
+	 * @param handoff whether to move the first thread to the current CPU (see wakeup)
+	 * @return the number of waked up threads
+	 */
+	static size_t wakeupIn(WaitQueue *wq,uint event,evobj_t object,bool all,bool handoff);
+
+	/**
+	 * Steals the thread with the highest priority from the busiest ready-queue other than <cpu>.
+	 *
+	 * @param cpu the CPU that wants to steal
+	 * @return the stolen thread or NULL
+	 */
+	static Thread *steal(cpuid_t cpu);
+
+	static void enqueue(RunQueue *rq,Thread *t,bool front = false);
+	static void dequeue(RunQueue *rq,Thread *t);
 	static void removeFromEventlist(Thread *t);
 	static bool setReadyState(Thread *t);
 	static void print(OStream &os,esc::DList<Thread> *q);
 
-	static SpinLock lock;
-	static ulong readyMask;
-	static esc::DList<Thread> rdyQueues[];
-	static esc::DList<Thread> evlists[EV_COUNT];
-	static size_t rdyCount;
-	static Thread **idleThreads;
+	static WaitQueue waitQueues[WAIT_QUEUE_COUNT];
+	static RunQueue *runQueues;
 };
-
-inline void Sched::block(Thread *t) {
-	assert(t != NULL);
-	LockGuard<SpinLock> g(&lock);
-	setBlocked(t);
-}
-
-inline void Sched::unblock(Thread *t) {
-	assert(t != NULL);
-	LockGuard<SpinLock> g(&lock);
-	setReady(t);
-}
@@ -127,16 +127,37 @@ public:
 	static void ensureTLBFlushed();
 
 	/**
-	 * Wakes up another CPU, so that it can run a thread
+	 * Wakes up CPU <id>, because its ready-queue received work. If it is busy or the current one,
+	 * another idle CPU is waked up instead, so that it can steal the work.
+	 *
+	 * @param id the CPU-id
 	 */
-	static void wakeupCPU();
+	static void wakeupCPU(cpuid_t id);
 
 	/**
-	 * If there is any CPU that uses the given pagedir, it is flushed
+	 * Requests all other CPUs that have the given pagedir loaded to flush the TLB entries for the
+	 * <count> pages at <addr>. Small ranges are flushed page by page, larger ones by flushing the
+	 * whole TLB. Within a batch (see beginTLBBatch()), the IPIs are sent when the batch ends.
 	 *
 	 * @param pdir the pagedir
+	 * @param addr the virtual address of the first page
+	 * @param count the number of pages
+	 */
+	static void flushTLB(PageDir *pdir,uintptr_t addr,size_t count);
+
+	/**
+	 * Starts a batch of TLB shootdowns on the current CPU. Until the corresponding endTLBBatch()
+	 * call, flushTLB() only records the pages to flush, so that every affected CPU receives at
+	 * most one IPI for the whole batch. Batches can be nested, but the current thread must not
+	 * block within a batch.
+	 */
+	static void beginTLBBatch();
+
+	/**
+	 * Ends the batch that has been started by beginTLBBatch() and sends the IPIs, if it is the
+	 * outermost one.
 	 */
-	static void flushTLB(PageDir *pdir);
+	static void endTLBBatch();
 
 	/**
 	 * Calls the callback for CPU <id>
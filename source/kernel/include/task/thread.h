@@ -95,6 +95,9 @@ class ThreadBase : public esc::DListItem {
 		int exitCode;
 	};
 
+	/* the number of frames that are allocated or freed at once by reserveFrames/discardFrames */
+	static const size_t RESERVE_BATCH	= 16;
+
 protected:
 	explicit ThreadBase(Proc *p,uint8_t flags);
 
@@ -285,6 +288,12 @@ public:
 	void setCPU(cpuid_t cpu) {
 		this->cpu = cpu;
 	}
+	/**
+	 * @return the CPU whose ready-queue this thread is put into
+	 */
+	cpuid_t getAffinity() const {
+		return affinity;
+	}
 
 	/**
 	 * @return the stack region with given number
@@ -314,7 +323,7 @@ public:
 	 * @return true if so
 	 */
 	bool haveHigherPrio() {
-		ulong mask = Sched::getReadyMask();
+		ulong mask = Sched::getReadyMask(cpu);
 		return mask & ~((1UL << (priority + 1)) - 1);
 	}
 
@@ -438,6 +447,15 @@ public:
 	 */
 	bool reserveFrames(size_t count,bool swap = true);
 
+	/**
+	 * Tries to reserve <count> additional frames without swapping. In contrast to reserveFrames(),
+	 * the already reserved frames are kept if not enough memory is available.
+	 *
+	 * @param count the number of frames
+	 * @return the number of frames that have been reserved
+	 */
+	size_t reserveMoreFrames(size_t count);
+
 	/**
 	 * Removes one frame from the collection of frames of this thread. This will always succeed,
 	 * because the function assumes that you have called reserveFrames() previously.
@@ -572,6 +590,8 @@ protected:
 	/* the next state it will receive on context-switch */
 	uint8_t newState;
 	cpuid_t cpu;
+	/* the CPU whose ready-queue we belong to; only changed by the scheduler */
+	cpuid_t affinity;
 	/* the stack-region(s) for this thread */
 	VMRegion *stackRegions[STACK_REG_COUNT];
 	/* thread-directory in VFS */
@@ -662,9 +682,18 @@ inline frameno_t ThreadBase::getFrame() {
 }
 
 inline void ThreadBase::discardFrames() {
+	frameno_t frames[RESERVE_BATCH];
+	size_t count = 0;
 	frameno_t frm;
-	while((frm = reqFrames.removeFirst()) != 0)
-		PhysMem::free(frm,PhysMem::USR);
+	while((frm = reqFrames.removeFirst()) != 0) {
+		frames[count++] = frm;
+		if(count == RESERVE_BATCH) {
+			PhysMem::free(frames,count,PhysMem::USR);
+			count = 0;
+		}
+	}
+	if(count > 0)
+		PhysMem::free(frames,count,PhysMem::USR);
 }
 
 /**
@@ -28,15 +28,28 @@ class OStream;
 class TimerBase {
 	TimerBase() = delete;
 
-	/* an entry in the listener-list */
+	/* the timing wheel has WHEEL_LEVELS levels with WHEEL_SLOTS slots each. the slots of level 0
+	 * are 1ms wide, the slots of level n are WHEEL_SLOTS times wider than the ones of level n-1 */
+	static const size_t WHEEL_BITS			= 6;
+	static const size_t WHEEL_SLOTS			= 1 << WHEEL_BITS;
+	static const size_t WHEEL_LEVELS		= 4;
+
+	/* an entry in the timing wheel */
 	struct Listener {
 		tid_t tid;
-		/* difference to the previous listener */
-		time_t time;
+		/* the CPU whose wheel we're in */
+		cpuid_t cpu;
 		/* if true, the thread is blocked during that time. otherwise it can run and will not be waked
 		 * up, but gets a signal (SIGALRM) */
 		bool block;
+		/* the time of our CPU at which we should fire */
+		time_t expires;
+		/* the slot we're in and our neighbours in that slot */
+		Listener **slot;
+		Listener *prev;
 		Listener *next;
+		/* the next listener of the same thread */
+		Listener *tidNext;
 	};
 
 	struct PerCPU {
@@ -44,9 +57,22 @@ class TimerBase {
 		time_t elapsedMsecs;
 		time_t lastResched;
 		size_t timerIntrpts;
+		/* the timestamp of the last timer-interrupt */
+		uint64_t lastTSC;
+		/* whether the timer is currently programmed to fire once */
+		bool oneshot;
+		/* whether the time since the last interrupt has not been a regular tick */
+		bool skipped;
+		/* if oneshot is true, the time at which the timer fires */
+		time_t deadline;
+		/* protects the wheel */
+		SpinLock lock;
+		Listener *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
 	};
 
 	static const size_t LISTENER_COUNT		= 1024;
+	/* the maximum time an idle CPU sleeps without a timer-interrupt */
+	static const time_t MAX_IDLE_TIME		= 1000;
 
 public:
 	/* timer period = 5ms */
@@ -124,6 +150,15 @@ public:
 	 */
 	static bool intrpt();
 
+	/**
+	 * Should be called if CPU <cpu> starts or stops to idle. Idling CPUs don't receive the regular
+	 * tick anymore, but only a timer-interrupt when the next listener of that CPU expires.
+	 *
+	 * @param cpu the CPU
+	 * @param idle whether it idles now
+	 */
+	static void setIdle(cpuid_t cpu,bool idle);
+
 	/**
 	 * Prints the timer-queue
 	 *
@@ -137,13 +172,48 @@ private:
 	 */
 	static void archInit();
 
+	/**
+	 * Lets the timer of the current CPU fire once after <msecs> milliseconds instead of
+	 * periodically.
+	 *
+	 * @param msecs the number of milliseconds
+	 * @return true if that is supported
+	 */
+	static bool archSetOneshot(time_t msecs);
+
+	/**
+	 * Lets the timer of the current CPU fire periodically again.
+	 */
+	static void archSetPeriodic();
+
+	/**
+	 * Locks the wheel that contains the listeners of thread <tid> or the one of the current CPU,
+	 * if there are none.
+	 *
+	 * @param tid the thread-id
+	 * @return the locked wheel
+	 */
+	static PerCPU *lockWheel(tid_t tid);
+
+	static void enqueue(PerCPU *pc,Listener *l);
+	static void dequeue(Listener *l);
+	static void cascade(PerCPU *pc,size_t level);
+	static void fire(Listener *l,bool *foundThread);
+	static void release(Listener *l);
+	static time_t nextExpiry(PerCPU *pc);
+	static time_t lag(PerCPU *pc);
+
+	/* protects the free-list */
 	static SpinLock lock;
 	static PerCPU *perCPU;
 	static time_t lastRuntimeUpdate;
+	/* whether every CPU receives timer-interrupts. if not, all listeners are put into the wheel
+	 * of CPU 0 */
+	static bool perCPUIntrpts;
 	static Listener listenObjs[LISTENER_COUNT];
 	static Listener *freeList;
-	/* processes that should be waked up to a specified time */
-	static Listener *listener;
+	/* the listeners per thread */
+	static Listener **tidListeners;
 };
 
 #if defined(__x86__)
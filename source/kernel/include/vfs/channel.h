@@ -28,8 +28,13 @@ class VFSDevice;
 class VFSChannel : public VFSNode {
 	friend class VFSDevice;
 
+	/* the number of concurrent reads whose response and data are delivered with one wakeup */
+	static const size_t REPLY_DATA_SLOTS	= 4;
+
 	struct Message : public esc::SListItem {
 		static const size_t MAX_SIZE	= 256 * 1024;
+		/* page-aligned messages with at least this size are lent instead of copied */
+		static const size_t LEND_SIZE	= 4 * PAGE_SIZE;
 
 		static void *operator new(size_t size, size_t msgSize) {
 			return Cache::alloc(size + msgSize);
@@ -38,11 +43,21 @@ class VFSChannel : public VFSNode {
 			Cache::free(ptr);
 		}
 
-		explicit Message(size_t _length) : esc::SListItem(), id(), length(_length) {
+		explicit Message(size_t _length) : esc::SListItem(), id(), length(_length), pages() {
+		}
+		~Message();
+
+		/**
+		 * @return the lent frames, if pages is not zero
+		 */
+		frameno_t *frames() {
+			return reinterpret_cast<frameno_t*>(this + 1);
 		}
 
 		msgid_t id;
 		size_t length;
+		/* the number of lent frames that follow the message (0 = the data follows) */
+		size_t pages;
 	};
 
 public:
@@ -96,7 +111,7 @@ public:
 	 * @param size2 the size of the second message
 	 * @return 0 on success
 	 */
-	int send(ushort flags,msgid_t id,USER const void *data1,size_t size1,
+	int send(uint flags,msgid_t id,USER const void *data1,size_t size1,
 	         USER const void *data2,size_t size2);
 
 	/**
@@ -159,6 +174,7 @@ protected:
 private:
 	pid_t getDeviceProc() const;
 	uint getReceiveFlags() const;
+	ssize_t receiveReply(OpenFile *file,msgid_t mid,USER void *buffer,size_t count,bool useshm);
 	int isSupported(int op) const;
 
 	int fd;
@@ -171,4 +187,10 @@ private:
 	esc::SList<Message> sendList;
 	/* a list for reading messages from the device */
 	esc::SList<Message> recvList;
+	/* the links in the ready-list of the device (channels with a non-empty sendList) */
+	VFSChannel *readyPrev;
+	VFSChannel *readyNext;
+	bool ready;
+	/* the pending read requests whose response is followed by the data (0 = free slot) */
+	msgid_t dataMids[REPLY_DATA_SLOTS];
 };
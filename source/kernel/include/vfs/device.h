@@ -74,12 +74,21 @@ public:
 	void bindto(tid_t tid);
 
 	/**
-	 * Tells the server that the given channel has been removed. This way, it can reset the internal
-	 * state that stores which channel will be served next.
+	 * Tells the server that the given channel has been removed. This way, it can remove the channel
+	 * from the list of channels that are waiting to be served.
 	 *
 	 * @param chan the channel
 	 */
-	void chanRemoved(const VFSChannel *chan);
+	void chanRemoved(VFSChannel *chan);
+
+	/**
+	 * Forgets that the response to the read request <mid> of <chan> is followed by data. This is
+	 * used if the client stops waiting for the response.
+	 *
+	 * @param chan the channel
+	 * @param mid the message-id of the request
+	 */
+	void dropReplyData(VFSChannel *chan,msgid_t mid);
 
 	/**
 	 * Searches for a channel of this device-node that should be served
@@ -92,7 +101,7 @@ public:
 	/**
 	 * Sends the given message to the channel <chan>, which belongs to this device.
 	 */
-	int send(VFSChannel *chan,ushort flags,msgid_t id,USER const void *data1,
+	int send(VFSChannel *chan,uint flags,msgid_t id,USER const void *data1,
              size_t size1,USER const void *data2,size_t size2);
 
 	/**
@@ -113,10 +122,16 @@ private:
 		msgCount -= count;
 	}
 
+	void addReady(VFSChannel *chan);
+	void remReady(VFSChannel *chan);
 	void wakeupClients();
 	int getClientFd(tid_t tid);
 
 	static uint buildMode(uint type);
+	static bool takeReplyData(VFSChannel *chan,msgid_t mid);
+	static bool hasReplyData(VFSChannel::Message *msg);
+	static VFSChannel::Message *createMsg(USER const void *data,size_t size,int *res);
+	static int readLent(VFSChannel::Message *msg,USER void *data);
 	static VFSChannel::Message *getMsg(esc::SList<VFSChannel::Message> *list,msgid_t mid,ushort flags);
 
 	/* the process that receives the file descriptors */
@@ -127,8 +142,10 @@ private:
 	uint funcs;
 	/* total number of messages in all channels (for the device, not the clients) */
 	ulong msgCount;
-	/* the last served client */
-	const VFSNode *lastClient;
-	static SpinLock msgLock;
-	static uint16_t nextRid;
+	/* the channels that have messages for the device, in the order they should be served */
+	VFSChannel *readyFirst;
+	VFSChannel *readyLast;
+	/* protects the message lists of all channels of this device and the ready-list */
+	SpinLock msgLock;
+	uint16_t nextRid;
 };
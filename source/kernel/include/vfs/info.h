@@ -58,6 +58,8 @@ class VFSInfo {
 	static void cpuReadCallback(VFSNode *node,size_t *dataSize,void **buffer);
 	static void statsReadCallback(VFSNode *node,size_t *dataSize,void **buffer);
 	static void memUsageReadCallback(VFSNode *node,size_t *dataSize,void **buffer);
+	static void cacheReadCallback(VFSNode *node,size_t *dataSize,void **buffer);
+	static void pageCacheReadCallback(VFSNode *node,size_t *dataSize,void **buffer);
 	static void selfLinkReadCallback(VFSNode *node,size_t *dataSize,void **buffer);
 	static void pidLinkReadCallback(VFSNode *node,size_t *dataSize,void **buffer);
 	static void mountsReadCallback(VFSNode *node,size_t *dataSize,void **buffer);
@@ -78,6 +80,8 @@ public:
 	GEN_INFO_FILECLASS(CPUFile,"cpu",cpuReadCallback);
 	GEN_INFO_FILECLASS(StatsFile,"stats",statsReadCallback);
 	GEN_INFO_FILECLASS(MemUsageFile,"memusage",memUsageReadCallback);
+	GEN_INFO_FILECLASS(CacheFile,"cache",cacheReadCallback);
+	GEN_INFO_FILECLASS(PageCacheFile,"pagecache",pageCacheReadCallback);
 	GEN_INFO_FILECLASS(SelfLinkFile,"",selfLinkReadCallback);
 	GEN_INFO_FILECLASS(PidLinkFile,"",pidLinkReadCallback);
 	GEN_INFO_FILECLASS(MountsFile,"info",mountsReadCallback);
@@ -50,6 +50,8 @@ enum {
 	VFS_DEVICE 		= 4096,		/* kernel-intern: whether the file was created for a device */
 	VFS_SIGNALS 	= 8192,		/* kernel-intern: allow signals during blocking */
 	VFS_BLOCK 		= 16384,	/* kernel-intern: force blocking */
+	VFS_HANDOFF		= 32768,	/* kernel-intern: the sender blocks for the response right away */
+	VFS_REPLYDATA	= 65536,	/* kernel-intern: a data message follows the response */
 
 	/* all flags that the user can use */
 	VFS_USER_FLAGS	= VFS_MSGS | VFS_WRITE | VFS_READ | VFS_CREATE | VFS_TRUNCATE |
@@ -352,9 +354,11 @@ public:
 	 * @param size1 the data-size
 	 * @param data2 for the device-messages: a second message (NULL = no second one)
 	 * @param size2 the size of the second message
+	 * @param flags additional flags (VFS_HANDOFF, VFS_REPLYDATA)
 	 * @return 0 on success
 	 */
-	int sendMsg(msgid_t id,USER const void *data1,size_t size1,USER const void *data2,size_t size2);
+	int sendMsg(msgid_t id,USER const void *data1,size_t size1,USER const void *data2,size_t size2,
+	            uint flags = 0);
 
 	/**
 	 * Receives a message from the corresponding device
@@ -116,10 +116,10 @@ void PageDirBase::destroy() {
 	PhysMem::free(pdir->pts.getRoot() >> PAGE_BITS,PhysMem::KERN);
 }
 
-frameno_t PageDirBase::demandLoad(const void *buffer,size_t loadCount,A_UNUSED ulong regFlags) {
-	frameno_t frame = Thread::getRunning()->getFrame();
-	memcpy((void*)(frame * PAGE_SIZE | DIR_MAP_AREA),buffer,loadCount);
-	return frame;
+void PageDirBase::demandLoad(frameno_t frame,const void *buffer,size_t loadCount,
+		A_UNUSED ulong regFlags) {
+	if(buffer)
+		memcpy((void*)(frame * PAGE_SIZE | DIR_MAP_AREA),buffer,loadCount);
 }
 
 void PageDirBase::zeroToUser(void *dst,size_t count) {
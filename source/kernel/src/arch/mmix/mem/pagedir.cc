@@ -96,15 +96,14 @@ void PageDirBase::destroy() {
 	PageDir::clearTC();
 }
 
-frameno_t PageDirBase::demandLoad(const void *buffer,size_t loadCount,ulong regFlags) {
-	/* copy into frame */
-	frameno_t frame = Thread::getRunning()->getFrame();
+void PageDirBase::demandLoad(frameno_t frame,const void *buffer,size_t loadCount,ulong regFlags) {
+	/* copy into frame, if not already done */
 	uintptr_t addr = frame * PAGE_SIZE | DIR_MAP_AREA;
-	memcpy((void*)addr,buffer,loadCount);
+	if(buffer)
+		memcpy((void*)addr,buffer,loadCount);
 	/* if its an executable region, we have to syncid the memory afterwards */
 	if(regFlags & RF_EXECUTABLE)
 		CPU::syncid(addr,addr + loadCount);
-	return frame;
 }
 
 void PageDirBase::zeroToUser(void *dst,size_t count) {
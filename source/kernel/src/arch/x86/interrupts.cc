@@ -99,7 +99,7 @@ InterruptsBase::Interrupt InterruptsBase::intrptList[] = {
 	/* 0x31 */	{Syscalls::handle,			"Ack-Signal",			0},
 	/* 0x32 */	{Interrupts::irqTimer,		"LAPIC",				0},
 	/* 0x33 */	{Interrupts::ipiWork,		"Work IPI",				0},
-	/* 0x34 */	{NULL,						"??",					0},	// Flush TLB
+	/* 0x34 */	{Interrupts::ipiFlushTLB,	"Flush TLB IPI",		0},
 	/* 0x35 */	{NULL,						"??",					0},	// Wait
 	/* 0x36 */	{NULL,						"??",					0},	// Halt
 	/* 0x37 */	{NULL,						"??",					0},	// Flush TLB-Ack
@@ -348,12 +348,17 @@ void Interrupts::ipiWork(Thread *t,A_UNUSED IntrptStackFrame *stack) {
 	/* this may happen if we're about to switch to a non-idle-thread and have idled previously,
 	 * while SMP::wakeupCPU() was called. */
 	if(!(t->getFlags() & T_IDLE))
-		SMP::wakeupCPU();
+		SMP::wakeupCPU(t->getCPU());
 	/* otherwise switch to non-idle-thread (if there is any) */
 	else
 		Thread::switchAway();
 }
 
+void Interrupts::ipiFlushTLB(Thread *t,A_UNUSED IntrptStackFrame *stack) {
+	SMP::flushPending(t->getCPU());
+	LAPIC::eoi();
+}
+
 void Interrupts::ipiCallback(Thread *t,A_UNUSED IntrptStackFrame *stack) {
 	SMP::callback(t->getCPU());
 	LAPIC::eoi();
@@ -49,6 +49,12 @@ void LAPIC::enableTimer() {
 	setLVT(REG_LVT_TIMER,Interrupts::IRQ_LAPIC,ICR_DELMODE_FIXED,UNMASKED,MODE_PERIODIC);
 }
 
+void LAPIC::oneshotTimer(uint msecs) {
+	/* change the mode first, because writing the initial count starts the timer */
+	setLVT(REG_LVT_TIMER,Interrupts::IRQ_LAPIC,ICR_DELMODE_FIXED,UNMASKED,MODE_ONESHOT);
+	setTimer(((CPU::getBusSpeed() / TIMER_DIVIDER) / 1000) * msecs);
+}
+
 void LAPIC::writeIPI(uint32_t high,uint32_t low) {
 	while((read(REG_ICR_LOW) & ICR_DELSTAT_PENDING))
 		CPU::pause();
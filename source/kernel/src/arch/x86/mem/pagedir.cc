@@ -112,12 +112,13 @@ void PageDir::unmapFromTemp() {
 	cur->lock.up();
 }
 
-frameno_t PageDirBase::demandLoad(const void *buffer,size_t loadCount,A_UNUSED ulong regFlags) {
-	frameno_t frame = Thread::getRunning()->getFrame();
-	uintptr_t addr = getAccess(frame);
-	memcpy((void*)addr,buffer,loadCount);
-	removeAccess(frame);
-	return frame;
+void PageDirBase::demandLoad(frameno_t frame,const void *buffer,size_t loadCount,
+		A_UNUSED ulong regFlags) {
+	if(buffer) {
+		uintptr_t addr = getAccess(frame);
+		memcpy((void*)addr,buffer,loadCount);
+		removeAccess(frame);
+	}
 }
 
 void PageDirBase::copyToFrame(frameno_t frame,const void *src) {
@@ -135,8 +136,9 @@ void PageDirBase::copyFromFrame(frameno_t frame,void *dst) {
 int PageDirBase::clone(PageDir *dst,uintptr_t virtSrc,uintptr_t virtDst,size_t count,bool share) {
 	PageDir *pdir = static_cast<PageDir*>(this);
 	int res = pdir->pts.clone(&dst->pts,virtSrc,virtDst,count,share);
-	if(res >= 0)
-		SMP::flushTLB(pdir);
+	/* only copy-on-write changes our own page-table entries */
+	if(res >= 0 && !share)
+		SMP::flushTLB(pdir,virtSrc,count);
 	return res;
 }
 
@@ -146,7 +148,7 @@ int PageDirBase::map(uintptr_t virt,size_t count,PageTables::Allocator &alloc,ui
 	if(res < 0)
 		return res;
 	if(res == 1)
-		SMP::flushTLB(pdir);
+		SMP::flushTLB(pdir,virt,count);
 	return 0;
 }
 
@@ -154,5 +156,5 @@ void PageDirBase::unmap(uintptr_t virt,size_t count,PageTables::Allocator &alloc
 	PageDir *pdir = static_cast<PageDir*>(this);
 	int res = pdir->pts.unmap(virt,count,alloc);
 	if(res == 1)
-		SMP::flushTLB(pdir);
+		SMP::flushTLB(pdir,virt,count);
 }
@@ -26,9 +26,11 @@
 #include <mem/pagedir.h>
 #include <task/smp.h>
 #include <task/timer.h>
+#include <assert.h>
 #include <common.h>
 #include <config.h>
 #include <cpu.h>
+#include <lockguard.h>
 #include <log.h>
 #include <spinlock.h>
 #include <string.h>
@@ -40,6 +42,8 @@ static const uintptr_t TRAMPOLINE_ADDR		= 0x7000;
 EXTERN_C void apEntry();
 
 cpuid_t *SMP::log2Phys;
+SMP::Shootdown *SMP::shootdowns;
+SMP::Batch *SMP::batches;
 
 static SpinLock smpLock;
 static volatile size_t seenAPs = 0;
@@ -68,6 +72,11 @@ bool SMPBase::initArch() {
 	cpuid_t id = LAPIC::getId();
 	SMP::log2Phys = (cpuid_t*)Cache::alloc(getCPUCount() * sizeof(cpuid_t));
 	SMP::log2Phys[0] = id;
+
+	SMP::shootdowns = (SMP::Shootdown*)Cache::calloc(getCPUCount(),sizeof(SMP::Shootdown));
+	SMP::batches = (SMP::Batch*)Cache::calloc(getCPUCount(),sizeof(SMP::Batch));
+	if(!SMP::shootdowns || !SMP::batches)
+		Util::panic("Not enough mem for TLB shootdowns");
 	return enabled;
 }
 
@@ -154,6 +163,113 @@ void SMPBase::ensureTLBFlushed() {
 	}
 }
 
+void SMPBase::flushTLB(PageDir *pdir,uintptr_t addr,size_t count) {
+	if(!SMP::shootdowns || cpuCount == 1)
+		return;
+
+	cpuid_t cur = getCurId();
+	SMP::Batch *batch = SMP::batches + cur;
+
+	/* if the mask can't hold all CPUs, we don't know who has the pagedir loaded */
+	if(cpuCount > SMP::MASK_CPUS) {
+		for(auto cpu = begin(); cpu != end(); ++cpu) {
+			if(cpu->id != cur && cpu->ready)
+				SMP::requestFlush(batch,cpu->id,addr,count);
+		}
+		return;
+	}
+
+	/* only the CPUs that have the pagedir loaded can have TLB entries for it. the others will
+	 * reload CR3 when switching to it, which flushes them anyway */
+	ulong targets = pdir->getCPUs() & ~(1UL << cur);
+	for(cpuid_t id = 0; targets != 0; ++id) {
+		ulong bit = 1UL << id;
+		if(targets & bit) {
+			targets &= ~bit;
+			if(cpus[id]->ready)
+				SMP::requestFlush(batch,id,addr,count);
+		}
+	}
+}
+
+void SMPBase::beginTLBBatch() {
+	if(SMP::batches)
+		SMP::batches[getCurId()].depth++;
+}
+
+void SMPBase::endTLBBatch() {
+	if(!SMP::batches)
+		return;
+
+	cpuid_t cur = getCurId();
+	SMP::Batch *batch = SMP::batches + cur;
+	assert(batch->depth > 0);
+	if(--batch->depth == 0) {
+		if(batch->all) {
+			/* CPUs without pending flushes simply ignore the IPI */
+			for(auto cpu = begin(); cpu != end(); ++cpu) {
+				if(cpu->id != cur && cpu->ready)
+					sendIPI(cpu->id,IPI_FLUSH_TLB);
+			}
+			batch->all = false;
+			batch->targets = 0;
+		}
+
+		for(cpuid_t id = 0; batch->targets != 0; ++id) {
+			ulong bit = 1UL << id;
+			if(batch->targets & bit) {
+				sendIPI(id,IPI_FLUSH_TLB);
+				batch->targets &= ~bit;
+			}
+		}
+	}
+}
+
+void SMP::requestFlush(Batch *batch,cpuid_t id,uintptr_t addr,size_t count) {
+	/* if there are already pending flushes, the IPI is on its way */
+	if(enqueueFlush(id,addr,count)) {
+		if(batch->depth == 0)
+			sendIPI(id,IPI_FLUSH_TLB);
+		else if(id < MASK_CPUS)
+			batch->targets |= 1UL << id;
+		else
+			batch->all = true;
+	}
+}
+
+bool SMP::enqueueFlush(cpuid_t id,uintptr_t addr,size_t count) {
+	Shootdown *sd = shootdowns + id;
+	LockGuard<SpinLock> g(&sd->lock);
+	bool first = sd->count == 0;
+	if(sd->count != FLUSH_ALL) {
+		if(count > FLUSH_PAGES - sd->count)
+			sd->count = FLUSH_ALL;
+		else {
+			for(size_t i = 0; i < count; ++i)
+				sd->addrs[sd->count++] = addr + i * PAGE_SIZE;
+		}
+	}
+	return first;
+}
+
+size_t SMP::getPendingFlushes(cpuid_t id) {
+	Shootdown *sd = shootdowns + id;
+	LockGuard<SpinLock> g(&sd->lock);
+	return sd->count;
+}
+
+void SMP::flushPending(cpuid_t id) {
+	Shootdown *sd = shootdowns + id;
+	LockGuard<SpinLock> g(&sd->lock);
+	if(sd->count == FLUSH_ALL)
+		PageDir::flushTLB();
+	else {
+		for(size_t i = 0; i < sd->count; ++i)
+			PageTables::flushAddr(sd->addrs[i],true);
+	}
+	sd->count = 0;
+}
+
 void SMP::apIsRunning() {
 	smpLock.down();
 	cpuid_t phys = LAPIC::getId();
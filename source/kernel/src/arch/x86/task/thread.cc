@@ -139,6 +139,7 @@ void Thread::initialSwitch() {
 	cur->setCPU(cpu);
 	FPU::lockFPU();
 	cur->stats.cycleStart = CPU::rdtsc();
+	cur->getProc()->getPageDir()->setLoaded(cpu,true);
 	Thread::resume(cur->getProc()->getPageDir()->getPhysAddr(),&cur->saveArea,&switchLock);
 }
 
@@ -178,7 +179,13 @@ void ThreadBase::doSwitch() {
 		FPU::lockFPU();
 
 		n->stats.cycleStart = CPU::rdtsc();
-		uintptr_t pdir = n->getProc() == old->getProc() ? 0 : n->getProc()->getPageDir()->getPhysAddr();
+		uintptr_t pdir = 0;
+		if(n->getProc() != old->getProc()) {
+			/* remember which CPUs use which pagedir to send TLB shootdowns only to them */
+			old->getProc()->getPageDir()->setLoaded(cpu,false);
+			n->getProc()->getPageDir()->setLoaded(cpu,true);
+			pdir = n->getProc()->getPageDir()->getPhysAddr();
+		}
 		if(!Thread::save(&old->saveArea))
 			Thread::resume(pdir,&n->saveArea,&switchLock);
 	}
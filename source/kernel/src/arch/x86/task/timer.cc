@@ -39,9 +39,22 @@ void TimerBase::archInit() {
 	Timer::bootTime = RTC::getTime();
 }
 
+bool TimerBase::archSetOneshot(time_t msecs) {
+	/* the PIT only interrupts the BSP and we don't want to lose the time-base */
+	if(!perCPUIntrpts)
+		return false;
+	LAPIC::oneshotTimer(msecs);
+	return true;
+}
+
+void TimerBase::archSetPeriodic() {
+	LAPIC::enableTimer();
+}
+
 void Timer::start(bool isBSP) {
 	if(!Config::get(Config::FORCE_PIT) && LAPIC::isAvailable()) {
 		Log::get().writef("CPU %d uses LAPIC as timer device\n",SMP::getCurId());
+		perCPUIntrpts = true;
 		if(isBSP) {
 			/* mask it as well */
 			if(IOAPIC::enabled())
@@ -20,6 +20,7 @@
 #include <mem/cache.h>
 #include <mem/kheap.h>
 #include <mem/pagedir.h>
+#include <task/smp.h>
 #include <assert.h>
 #include <common.h>
 #include <log.h>
@@ -38,19 +39,20 @@
 #define HEAP_THRESHOLD		512
 
 SpinLock Cache::lock;
-Cache::Entry Cache::caches[] = {
-	{16,0,0,NULL},
-	{32,0,0,NULL},
-	{64,0,0,NULL},
-	{128,0,0,NULL},
-	{256,0,0,NULL},
-	{512,0,0,NULL},
-	{1024,0,0,NULL},
-	{2048,0,0,NULL},
-	{4096,0,0,NULL},
-	{8192,0,0,NULL},
-	{16384,0,0,NULL},
+Cache::Entry Cache::caches[CACHE_COUNT] = {
+	{16,0,0,NULL,0},
+	{32,0,0,NULL,0},
+	{64,0,0,NULL,0},
+	{128,0,0,NULL,0},
+	{256,0,0,NULL,0},
+	{512,0,0,NULL,0},
+	{1024,0,0,NULL,0},
+	{2048,0,0,NULL,0},
+	{4096,0,0,NULL,0},
+	{8192,0,0,NULL,0},
+	{16384,0,0,NULL,0},
 };
+Cache::Magazine Cache::mags[MAX_CPUS][CACHE_COUNT];
 #if DEBUGGING
 bool Cache::aafEnabled = false;
 #endif
@@ -140,12 +142,7 @@ A_NOASAN void Cache::free(void *p) {
 	/* check guard */
 	assert(area[(objSize / sizeof(ulong)) + (16 / sizeof(ulong))] == GUARD_MAGIC);
 
-	/* put on freelist */
-	Entry *c = caches + area[0];
-	LockGuard<SpinLock> g(&lock);
-	area[0] = (ulong)c->freeList;
-	c->freeList = area;
-	c->freeObjs++;
+	put(caches + area[0],area[0],area);
 }
 
 size_t Cache::getOccMem() {
@@ -157,8 +154,12 @@ size_t Cache::getOccMem() {
 
 size_t Cache::getUsedMem() {
 	size_t count = 0;
-	for(size_t i = 0; i < ARRAY_SIZE(caches); i++)
-		count += (caches[i].totalObjs - caches[i].freeObjs) * totalObjSize(caches[i].objSize);
+	for(size_t i = 0; i < ARRAY_SIZE(caches); i++) {
+		size_t free = caches[i].freeObjs;
+		for(size_t cpu = 0; cpu < MAX_CPUS; cpu++)
+			free += mags[cpu][i].count;
+		count += (caches[i].totalObjs - free) * totalObjSize(caches[i].objSize);
+	}
 	return count;
 }
 
@@ -173,9 +174,16 @@ void Cache::print(OStream &os) {
 	os.writef("Total: %zu bytes\n",total);
 	for(size_t i = 0; i < ARRAY_SIZE(caches); i++) {
 		size_t mem = caches[i].totalObjs * totalObjSize(caches[i].objSize);
-		os.writef("Cache %zu [size=%zu, total=%zu, free=%zu, pages=%zu]:\n",i,caches[i].objSize,
-				caches[i].totalObjs,caches[i].freeObjs,BYTES_2_PAGES(mem));
-		printBar(os,mem,maxMem,caches[i].totalObjs,caches[i].freeObjs);
+		size_t cached = 0,hits = 0,misses = 0;
+		for(size_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+			cached += mags[cpu][i].count;
+			hits += mags[cpu][i].hits;
+			misses += mags[cpu][i].misses;
+		}
+		os.writef("Cache %zu [size=%zu, total=%zu, free=%zu, cached=%zu, pages=%zu]:\n",
+				i,caches[i].objSize,caches[i].totalObjs,caches[i].freeObjs,cached,BYTES_2_PAGES(mem));
+		os.writef("  hits=%zu, misses=%zu, contention=%zu\n",hits,misses,caches[i].contention);
+		printBar(os,mem,maxMem,caches[i].totalObjs,caches[i].freeObjs + cached);
 	}
 }
 
@@ -191,40 +199,135 @@ void Cache::printBar(OStream &os,size_t mem,size_t maxMem,size_t total,size_t fr
 	os.writef("\n");
 }
 
+Cache::Magazine *Cache::getMagazine(size_t i) {
+	cpuid_t cpu = SMP::getCurId();
+	return EXPECT_TRUE(cpu < MAX_CPUS) ? &mags[cpu][i] : NULL;
+}
+
+void Cache::acquire(Entry *c) {
+	if(EXPECT_FALSE(!lock.tryDown())) {
+		lock.down();
+		c->contention++;
+	}
+}
+
 A_NOASAN void *Cache::get(Entry *c,size_t i) {
-	LockGuard<SpinLock> g(&lock);
-	if(EXPECT_FALSE(!c->freeList)) {
-		size_t pageCount = BYTES_2_PAGES(MIN_OBJ_COUNT * c->objSize);
-		size_t bytes = pageCount * PAGE_SIZE;
-		size_t total = totalObjSize(c->objSize);
-		size_t objs = bytes / total;
-		size_t rem = bytes - objs * total;
-		ulong *space = (ulong*)KHeap::allocSpace(pageCount);
-		if(space == NULL)
-			return NULL;
-
-		/* if the remaining space is big enough (it won't bring advantages to add dozens e.g. 8
-		 * byte large areas to the heap), add it to the fallback-heap */
-		if(rem >= HEAP_THRESHOLD)
-			KHeap::addMemory((uintptr_t)space + bytes - rem,rem);
-
-		c->totalObjs += objs;
-		c->freeObjs += objs;
-		for(size_t j = 0; j < objs; j++) {
-			space[0] = (ulong)c->freeList;
-			c->freeList = space;
-			space += totalObjSize(c->objSize) / sizeof(ulong);
+	ulong *area = NULL;
+
+	/* we don't need a lock for the magazine, because we can't be interrupted in the kernel */
+	Magazine *m = getMagazine(i);
+	if(EXPECT_TRUE(m)) {
+		if(EXPECT_TRUE(m->count > 0))
+			m->hits++;
+		else {
+			m->misses++;
+			if(EXPECT_FALSE(!refill(c,m)))
+				return NULL;
 		}
+
+		area = (ulong*)m->objs;
+		m->objs = (void*)area[0];
+		m->count--;
+		return prepare(c,i,area);
+	}
+
+	acquire(c);
+	if(EXPECT_TRUE(c->freeList || grow(c))) {
+		area = (ulong*)c->freeList;
+		c->freeList = (void*)area[0];
+		c->freeObjs--;
 	}
+	lock.up();
+	return area ? prepare(c,i,area) : NULL;
+}
+
+A_NOASAN void Cache::put(Entry *c,size_t i,ulong *area) {
+	Magazine *m = getMagazine(i);
+	if(EXPECT_TRUE(m)) {
+		if(EXPECT_TRUE(m->count < MAG_SIZE))
+			m->hits++;
+		else {
+			m->misses++;
+			drain(c,m,MAG_SIZE / 2);
+		}
 
-	/* get first from freelist */
-	ulong *area = (ulong*)c->freeList;
-	c->freeList = (void*)area[0];
+		area[0] = (ulong)m->objs;
+		m->objs = area;
+		m->count++;
+		return;
+	}
+
+	acquire(c);
+	area[0] = (ulong)c->freeList;
+	c->freeList = area;
+	c->freeObjs++;
+	lock.up();
+}
+
+A_NOASAN bool Cache::refill(Entry *c,Magazine *m) {
+	acquire(c);
+	if(EXPECT_FALSE(!c->freeList && !grow(c))) {
+		lock.up();
+		return false;
+	}
+
+	/* move half a magazine at once to amortize the lock */
+	for(size_t j = 0; j < MAG_SIZE / 2 && c->freeList; j++) {
+		ulong *area = (ulong*)c->freeList;
+		c->freeList = (void*)area[0];
+		c->freeObjs--;
+
+		area[0] = (ulong)m->objs;
+		m->objs = area;
+		m->count++;
+	}
+	lock.up();
+	return true;
+}
+
+A_NOASAN void Cache::drain(Entry *c,Magazine *m,size_t count) {
+	acquire(c);
+	for(size_t j = 0; j < count && m->count > 0; j++) {
+		ulong *area = (ulong*)m->objs;
+		m->objs = (void*)area[0];
+		m->count--;
+
+		area[0] = (ulong)c->freeList;
+		c->freeList = area;
+		c->freeObjs++;
+	}
+	lock.up();
+}
+
+A_NOASAN bool Cache::grow(Entry *c) {
+	size_t pageCount = BYTES_2_PAGES(MIN_OBJ_COUNT * c->objSize);
+	size_t bytes = pageCount * PAGE_SIZE;
+	size_t total = totalObjSize(c->objSize);
+	size_t objs = bytes / total;
+	size_t rem = bytes - objs * total;
+	ulong *space = (ulong*)KHeap::allocSpace(pageCount);
+	if(space == NULL)
+		return false;
+
+	/* if the remaining space is big enough (it won't bring advantages to add dozens e.g. 8
+	 * byte large areas to the heap), add it to the fallback-heap */
+	if(rem >= HEAP_THRESHOLD)
+		KHeap::addMemory((uintptr_t)space + bytes - rem,rem);
+
+	c->totalObjs += objs;
+	c->freeObjs += objs;
+	for(size_t j = 0; j < objs; j++) {
+		space[0] = (ulong)c->freeList;
+		c->freeList = space;
+		space += totalObjSize(c->objSize) / sizeof(ulong);
+	}
+	return true;
+}
 
+A_NOASAN void *Cache::prepare(Entry *c,size_t i,ulong *area) {
 	/* store size and put guards in front and behind the area */
 	area[0] = i;
 	area[1] = GUARD_MAGIC;
 	area[(c->objSize / sizeof(ulong)) + (16 / sizeof(ulong))] = GUARD_MAGIC;
-	c->freeObjs--;
 	return (void*)((uintptr_t)area + 16);
 }
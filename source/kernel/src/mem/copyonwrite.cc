@@ -18,99 +18,68 @@
  */
 
 #include <esc/util.h>
-#include <mem/cache.h>
 #include <mem/copyonwrite.h>
 #include <mem/pagedir.h>
+#include <mem/physmem.h>
 #include <task/proc.h>
 #include <assert.h>
+#include <atomic.h>
 #include <common.h>
-#include <spinlock.h>
-#include <string.h>
 #include <util.h>
 #include <video.h>
 
-esc::SList<CopyOnWrite::Entry> CopyOnWrite::frames[HEAP_SIZE];
-SpinLock CopyOnWrite::lock;
+volatile size_t CopyOnWrite::frameCount = 0;
 
 size_t CopyOnWrite::pagefault(uintptr_t address,frameno_t frameNumber) {
-	LockGuard<SpinLock> g(&lock);
-	/* find the cow-entry */
-	Entry *cow = getByFrame(frameNumber,true);
-	vassert(cow != NULL,"No COW entry for frame %#x and address %p",frameNumber,address);
+	volatile uint32_t *refs = PhysMem::getRefCount(frameNumber);
+	vassert(*refs > 0,"No COW user for frame %#x and address %p",frameNumber,address);
 
-	/* if there is another process who wants to get the frame, we make a copy for us */
-	/* otherwise we keep the frame for ourself */
-	if(cow->refCount == 0) {
+	/* if we're the only user, we keep the frame. nobody can add users meanwhile, because that
+	 * would require to clone our region, which is locked. */
+	if(*refs == 1) {
+		Atomic::fetch_and_add(refs,-1);
+		Atomic::fetch_and_add(&frameCount,-1);
 		PageTables::NoAllocator noalloc;
 		PageDir::mapToCur(address,1,noalloc,PG_PRESENT | PG_WRITABLE);
+		return 1;
 	}
-	else {
-		PageTables::UAllocator ualloc;
-		/* can't fail, we've already allocated the frame */
-		PageDir::mapToCur(address,1,ualloc,PG_PRESENT | PG_WRITABLE);
-	}
 
-	/* copy? */
-	if(cow->refCount > 0)
-		PageDir::copyFromFrame(frameNumber,(void*)(esc::Util::round_page_dn(address)));
-	else
-		delete cow;
+	/* otherwise we make a copy for us. do that before we leave the frame, because the last one
+	 * might write to it as soon as we've left it */
+	PageTables::UAllocator ualloc;
+	/* can't fail, we've already allocated the frame */
+	PageDir::mapToCur(address,1,ualloc,PG_PRESENT | PG_WRITABLE);
+	PageDir::copyFromFrame(frameNumber,(void*)(esc::Util::round_page_dn(address)));
+
+	/* if all others have left it in the meantime, nobody uses the frame anymore */
+	if(Atomic::fetch_and_add(refs,-1) == 1) {
+		Atomic::fetch_and_add(&frameCount,-1);
+		PhysMem::free(frameNumber,PhysMem::USR);
+	}
 	return 1;
 }
 
 bool CopyOnWrite::add(frameno_t frameNo) {
-	LockGuard<SpinLock> g(&lock);
-	Entry *cow = getByFrame(frameNo,false);
-	if(!cow) {
-		cow = new Entry(frameNo);
-		if(cow == NULL)
-			return false;
-		frames[frameNo % HEAP_SIZE].append(cow);
-	}
-	cow->refCount++;
+	if(Atomic::fetch_and_add(PhysMem::getRefCount(frameNo),+1) == 0)
+		Atomic::fetch_and_add(&frameCount,+1);
 	return true;
 }
 
 size_t CopyOnWrite::remove(frameno_t frameNo,bool *foundOther) {
-	LockGuard<SpinLock> g(&lock);
-	/* find the cow-entry */
-	Entry *cow = getByFrame(frameNo,true);
-	vassert(cow != NULL,"For frameNo %#x",frameNo);
+	uint32_t old = Atomic::fetch_and_add(PhysMem::getRefCount(frameNo),-1);
+	vassert(old > 0,"For frameNo %#x",frameNo);
 
-	*foundOther = cow->refCount > 0;
-	if(cow->refCount == 0)
-		delete cow;
+	*foundOther = old > 1;
+	if(old == 1)
+		Atomic::fetch_and_add(&frameCount,-1);
 	return 1;
 }
 
-size_t CopyOnWrite::getFrmCount() {
-	LockGuard<SpinLock> g(&lock);
-	size_t count = 0;
-	for(size_t i = 0; i < HEAP_SIZE; i++)
-		count += frames[i].length();
-	return count;
-}
-
 void CopyOnWrite::print(OStream &os) {
 	os.writef("COW-Frames: (%zu frames)\n",getFrmCount());
-	for(size_t i = 0; i < HEAP_SIZE; i++) {
-		os.writef("\t%zu:\n",i);
-		for(auto it = frames[i].cbegin(); it != frames[i].cend(); ++it)
-			os.writef("\t\t%#x (%zu refs)\n",it->frameNumber,it->refCount);
-	}
-}
-
-CopyOnWrite::Entry *CopyOnWrite::getByFrame(frameno_t frameNo,bool dec) {
-	esc::SList<Entry> *list = frames + (frameNo % HEAP_SIZE);
-	Entry *p = NULL;
-	for(auto it = list->begin(); it != list->end(); p = &*it, ++it) {
-		if(it->frameNumber == frameNo) {
-			if(dec) {
-				if(--it->refCount == 0)
-					list->removeAt(p,&*it);
-			}
-			return &*it;
-		}
+	for(frameno_t f = 0; f < PhysMem::getFrameCount(); ++f) {
+		uint32_t refs = *PhysMem::getRefCount(f);
+		if(refs > 0)
+			os.writef("\t%#x (%u refs)\n",f,refs);
 	}
-	return NULL;
 }
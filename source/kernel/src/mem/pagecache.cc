@@ -0,0 +1,242 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <esc/util.h>
+#include <mem/cache.h>
+#include <mem/copyonwrite.h>
+#include <mem/pagecache.h>
+#include <mem/pagedir.h>
+#include <mem/physmem.h>
+#include <mem/useraccess.h>
+#include <assert.h>
+#include <common.h>
+#include <errno.h>
+#include <ostream.h>
+#include <spinlock.h>
+
+PageCache::Entry *PageCache::table[HASH_SIZE];
+size_t PageCache::filePages[HASH_SIZE];
+size_t PageCache::devPages[HASH_SIZE];
+esc::DList<PageCache::Entry> PageCache::lru;
+ulong PageCache::generation = 0;
+size_t PageCache::hits = 0;
+size_t PageCache::misses = 0;
+size_t PageCache::evictions = 0;
+SpinLock PageCache::lock;
+
+bool PageCache::get(dev_t dev,ino_t ino,off_t offset,void *dst) {
+	LockGuard<SpinLock> g(&lock);
+	Entry *e = find(dev,ino,offset);
+	if(!e) {
+		misses++;
+		return false;
+	}
+
+	hits++;
+	lru.remove(e);
+	lru.append(e);
+	/* copy it while holding the lock; the page could be evicted otherwise */
+	PageDir::copyFromFrame(e->frame,dst);
+	return true;
+}
+
+frameno_t PageCache::share(dev_t dev,ino_t ino,off_t offset) {
+	LockGuard<SpinLock> g(&lock);
+	Entry *e = find(dev,ino,offset);
+	if(!e) {
+		misses++;
+		return PhysMem::INVALID_FRAME;
+	}
+
+	hits++;
+	lru.remove(e);
+	lru.append(e);
+	/* add the user while holding the lock; the page could be evicted otherwise */
+	CopyOnWrite::add(e->frame);
+	return e->frame;
+}
+
+bool PageCache::insert(dev_t dev,ino_t ino,off_t offset,frameno_t frame,ulong gen) {
+	assert((offset & (PAGE_SIZE - 1)) == 0);
+	LockGuard<SpinLock> g(&lock);
+	/* somebody else might have been faster or the file might have changed meanwhile */
+	if(gen != generation || find(dev,ino,offset))
+		return false;
+
+	/* if the cache is full, drop the least recently used page */
+	Entry *e = NULL;
+	size_t max = PhysMem::getTotal() / (PAGE_SIZE * MAX_FRACTION);
+	if(lru.length() >= max) {
+		e = lru.removeFirst();
+		if(!e)
+			return false;
+		remove(e);
+		release(e->frame);
+		evictions++;
+		e->dev = dev;
+		e->ino = ino;
+		e->offset = offset;
+		e->frame = frame;
+	}
+	else {
+		e = new Entry(dev,ino,offset,frame);
+		if(!e)
+			return false;
+	}
+
+	/* one user for us and one for the caller; the caller can't do that, because the page could be
+	 * evicted as soon as we release the lock */
+	CopyOnWrite::add(frame);
+	CopyOnWrite::add(frame);
+	add(e);
+	return true;
+}
+
+ssize_t PageCache::read(dev_t dev,ino_t ino,off_t offset,USER void *buffer,size_t count) {
+	/* no lock; it's only a shortcut for the common case of an empty cache */
+	if(lru.length() == 0)
+		return 0;
+
+	char *page = (char*)Cache::alloc(PAGE_SIZE);
+	if(!page)
+		return 0;
+
+	/* we can't write to <buffer> while holding the lock, because that might cause a pagefault */
+	size_t total = 0;
+	while(count > 0) {
+		off_t pageOff = esc::Util::round_dn(offset,PAGE_SIZE);
+		size_t start = offset - pageOff;
+		size_t amount = esc::Util::min(count,PAGE_SIZE - start);
+		if(!get(dev,ino,pageOff,page))
+			break;
+		if(UserAccess::write((char*)buffer + total,page + start,amount) < 0) {
+			Cache::free(page);
+			return -EFAULT;
+		}
+
+		total += amount;
+		offset += amount;
+		count -= amount;
+	}
+
+	Cache::free(page);
+	return total;
+}
+
+void PageCache::invalidate(dev_t dev,ino_t ino) {
+	removeIf(dev,ino,false);
+}
+
+void PageCache::invalidateDev(dev_t dev) {
+	removeIf(dev,0,true);
+}
+
+size_t PageCache::evict(frameno_t *frames,size_t count) {
+	LockGuard<SpinLock> g(&lock);
+	size_t i = 0;
+	for(auto it = lru.begin(); i < count && it != lru.end(); ) {
+		Entry *e = &*it;
+		++it;
+		/* frames that are mapped somewhere wouldn't give us any memory */
+		if(*PhysMem::getRefCount(e->frame) > 1)
+			continue;
+
+		lru.remove(e);
+		remove(e);
+		/* nobody can add users meanwhile, because nobody else maps it */
+		bool other;
+		CopyOnWrite::remove(e->frame,&other);
+		frames[i++] = e->frame;
+		delete e;
+	}
+	evictions += i;
+	return i;
+}
+
+void PageCache::print(OStream &os) {
+	LockGuard<SpinLock> g(&lock);
+	os.writef("Pages: %zu of %zu\n",lru.length(),PhysMem::getTotal() / (PAGE_SIZE * MAX_FRACTION));
+	os.writef("Hits: %zu\n",hits);
+	os.writef("Misses: %zu\n",misses);
+	os.writef("Evictions: %zu\n",evictions);
+	os.writef("Generation: %lu\n",generation);
+}
+
+PageCache::Entry *PageCache::find(dev_t dev,ino_t ino,off_t offset) {
+	for(Entry *e = table[hash(dev,ino,offset)]; e != NULL; e = e->hashNext) {
+		if(e->dev == dev && e->ino == ino && e->offset == offset)
+			return e;
+	}
+	return NULL;
+}
+
+void PageCache::add(Entry *e) {
+	Entry **head = table + hash(e->dev,e->ino,e->offset);
+	e->hashNext = *head;
+	*head = e;
+	filePages[fileHash(e->dev,e->ino)]++;
+	devPages[static_cast<size_t>(e->dev) % HASH_SIZE]++;
+	lru.append(e);
+}
+
+void PageCache::remove(Entry *e) {
+	/* the caller has already removed it from the LRU list */
+	Entry **p = table + hash(e->dev,e->ino,e->offset);
+	while(*p != e)
+		p = &(*p)->hashNext;
+	*p = e->hashNext;
+	e->hashNext = NULL;
+	filePages[fileHash(e->dev,e->ino)]--;
+	devPages[static_cast<size_t>(e->dev) % HASH_SIZE]--;
+}
+
+void PageCache::removeIf(dev_t dev,ino_t ino,bool wholeDev) {
+	LockGuard<SpinLock> g(&lock);
+	if(wholeDev) {
+		/* this is only done if a new inode appears or the fs is gone. a page that is loaded at
+		 * the moment can't become outdated by that, so we don't need a new generation */
+		if(devPages[static_cast<size_t>(dev) % HASH_SIZE] == 0)
+			return;
+	}
+	else {
+		/* always start a new generation, because the file might be read at the moment */
+		generation++;
+		if(filePages[fileHash(dev,ino)] == 0)
+			return;
+	}
+
+	for(auto it = lru.begin(); it != lru.end(); ) {
+		Entry *e = &*it;
+		++it;
+		if(e->dev == dev && (wholeDev || e->ino == ino)) {
+			lru.remove(e);
+			remove(e);
+			release(e->frame);
+			delete e;
+		}
+	}
+}
+
+void PageCache::release(frameno_t frame) {
+	bool other;
+	CopyOnWrite::remove(frame,&other);
+	/* otherwise, the last user frees it */
+	if(!other)
+		PhysMem::free(frame,PhysMem::USR);
+}
@@ -17,6 +17,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <mem/copyonwrite.h>
 #include <mem/pagedir.h>
 #include <mem/pagetables.h>
 #include <task/proc.h>
@@ -27,6 +28,9 @@
 #include <util.h>
 
 bool PageTables::hasNXE = false;
+#if defined(__x86__)
+SpinLock PageTables::shareLock;
+#endif
 
 void PageTables::RangeAllocator::freePage(frameno_t) {
 	Util::panic("Not supported");
@@ -39,6 +43,16 @@ frameno_t PageTables::UAllocator::allocPage() {
 	return _thread->getFrame();
 }
 
+frameno_t PageTables::BatchAllocator::allocPT() {
+	if(_count == 0) {
+		_count = PhysMem::allocate(PhysMem::KERN,BATCH_SIZE,_frames);
+		if(_count == 0)
+			return PhysMem::INVALID_FRAME;
+	}
+	_pts++;
+	return _frames[--_count];
+}
+
 frameno_t PageTables::KAllocator::allocPT() {
 	Util::panic("Trying to allocate a page-table in kernel-area");
 	return 0;
@@ -50,19 +64,46 @@ void PageTables::KAllocator::freePT(frameno_t) {
 
 int PageTables::clone(PageTables *dst,uintptr_t virtSrc,uintptr_t virtDst,size_t count,bool share) {
 	NoAllocator noalloc;
+	/* a clone usually needs several page-tables; allocate them in batches */
+	BatchAllocator ptalloc;
 	PageTables *cur = Proc::getCurPageDir()->getPageTables();
 	uintptr_t base,orgVirtSrc = virtSrc,orgVirtDst = virtDst;
 	size_t orgCount = count;
+#if defined(__x86__)
+	bool sharedPTs = false;
+#endif
 	assert(this != dst && (this == cur || dst == cur));
 	while(count > 0) {
+#if defined(__x86__)
+		/* share complete page-tables instead of write-protecting all pages in them. the pages are
+		 * made copy-on-write when the page-table is unshared, which happens on the first change */
+		if(!share && virtSrc == virtDst && (virtSrc & (PT_SIZE - 1)) == 0 && count >= PT_ENTRY_COUNT) {
+			int res = sharePT(dst,virtSrc,ptalloc);
+			if(res < 0)
+				goto error;
+			if(res == 1) {
+				sharedPTs = true;
+				virtSrc += PT_SIZE;
+				virtDst += PT_SIZE;
+				count -= PT_ENTRY_COUNT;
+				continue;
+			}
+		}
+#endif
+
 		pte_t *spt = getPTE(virtSrc,&base);
 		pte_t pte = *spt;
+		/* the clone always gets small pages */
+		if(pte & PTE_LARGE) {
+			frameno_t frame = PTE_FRAMENO(pte) + (virtSrc - base) / PAGE_SIZE;
+			pte = (frame << PAGE_BITS) | (pte & ~(PTE_FRAMENO_MASK | PTE_LARGE));
+		}
 
 		/* when shared, simply copy the flags; otherwise: if present, we use copy-on-write */
 		if((pte & PTE_WRITABLE) && (!share && (pte & PTE_PRESENT)))
 			pte &= ~PTE_WRITABLE;
 
-		int res = dst->mapPage(virtDst,PTE_FRAMENO(pte),pte & ~PTE_FRAMENO_MASK,noalloc);
+		int res = dst->mapPage(virtDst,PTE_FRAMENO(pte),pte & ~PTE_FRAMENO_MASK,ptalloc);
 		if(res < 0)
 			goto error;
 		/* we never need a flush here because it was not present before */
@@ -79,14 +120,35 @@ int PageTables::clone(PageTables *dst,uintptr_t virtSrc,uintptr_t virtDst,size_t
 		virtDst += PAGE_SIZE;
 		count--;
 	}
-	return noalloc.pageTables();
+#if defined(__x86__)
+	/* the pages in the shared page-tables are no longer writable for us */
+	if(sharedPTs && this == cur)
+		PageDir::flushTLB();
+#endif
+	return ptalloc.pageTables();
 
 error:
+#if defined(__x86__)
+	/* the shared page-tables are ours again as soon as dst has left them */
+	for(uintptr_t virt = orgVirtDst; virt < virtDst; virt += PAGE_SIZE) {
+		if((virt & (PT_SIZE - 1)) == 0 && dst->isSharedPT(virt))
+			sassert(dst->releasePT(virt));
+	}
+	if(sharedPTs && this == cur)
+		PageDir::flushTLB();
+#endif
 	/* unmap from dest-pagedir; the frames are always owned by src */
 	dst->unmap(orgVirtDst,orgCount - count,noalloc);
 	/* make the cow-pages writable again */
 	while(orgCount > count) {
 		pte_t *pte = getPTE(orgVirtSrc,&base);
+#if defined(__x86__)
+		if(isSharedPT(orgVirtSrc)) {
+			orgVirtSrc += PAGE_SIZE;
+			orgCount--;
+			continue;
+		}
+#endif
 		if(!share && (*pte & PTE_PRESENT))
 			mapPage(orgVirtSrc,PTE_FRAMENO(*pte),PTE_PRESENT | PTE_WRITABLE | PTE_EXISTS,noalloc);
 		orgVirtSrc += PAGE_SIZE;
@@ -95,6 +157,113 @@ error:
 	return -ENOMEM;
 }
 
+#if defined(__x86__)
+bool PageTables::isSharedPT(uintptr_t virt) const {
+	pte_t *pte = getDirEntry(virt,NULL);
+	return pte && (*pte & PTE_PRESENT) && !(*pte & (PTE_WRITABLE | PTE_LARGE));
+}
+
+int PageTables::sharePT(PageTables *dst,uintptr_t virt,Allocator &alloc) {
+	pte_t *spte = getDirEntry(virt,NULL);
+	/* large pages are cloned page by page */
+	if(!spte || (~*spte & PTE_PRESENT) || (*spte & PTE_LARGE))
+		return 0;
+
+	pte_t *dpte = dst->getDirEntry(virt,&alloc);
+	if(!dpte)
+		return -ENOMEM;
+	assert((*dpte & PTE_EXISTS) == 0);
+
+	/* the reference count of the page-table's frame is the number of page-dirs that use it. the
+	 * write-permission in the directory is removed, so that the entries can't be changed */
+	LockGuard<SpinLock> g(&shareLock);
+	volatile uint32_t *refs = PhysMem::getRefCount(PTE_FRAMENO(*spte));
+	if(*spte & PTE_WRITABLE) {
+		Atomic::fetch_and_add(refs,+1);
+		*spte &= ~PTE_WRITABLE;
+	}
+	Atomic::fetch_and_add(refs,+1);
+	*dpte = *spte;
+	return 1;
+}
+
+int PageTables::unsharePT(uintptr_t virt,Allocator &alloc) {
+	pte_t *pte = getDirEntry(virt,NULL);
+	if(!pte || (~*pte & PTE_PRESENT) || (*pte & (PTE_WRITABLE | PTE_LARGE)))
+		return 0;
+
+	LockGuard<SpinLock> g(&shareLock);
+	frameno_t frame = PTE_FRAMENO(*pte);
+	volatile uint32_t *refs = PhysMem::getRefCount(frame);
+	int res = 1;
+	/* the last user simply takes it back */
+	if(*refs == 1)
+		*refs = 0;
+	else {
+		frameno_t copy = alloc.allocPT();
+		if(copy == PhysMem::INVALID_FRAME)
+			return -ENOMEM;
+
+		/* we become an additional user of all present frames. those that are not copy-on-write
+		 * yet were only used by the shared page-table so far, which stays a user of them */
+		pte_t *spt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + (frame << PAGE_BITS));
+		pte_t *dpt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + (copy << PAGE_BITS));
+		for(size_t i = 0; i < PT_ENTRY_COUNT; ++i) {
+			dpt[i] = spt[i] & ~PTE_WRITABLE;
+			if(spt[i] & PTE_PRESENT) {
+				if(*PhysMem::getRefCount(PTE_FRAMENO(spt[i])) == 0)
+					CopyOnWrite::add(PTE_FRAMENO(spt[i]));
+				CopyOnWrite::add(PTE_FRAMENO(spt[i]));
+			}
+		}
+
+		*pte = (copy << PAGE_BITS) | (*pte & ~PTE_FRAMENO_MASK);
+		Atomic::fetch_and_add(refs,-1);
+		res = 2;
+	}
+
+	/* the TLB entries for the pages are still valid, because they are write-protected */
+	*pte |= PTE_WRITABLE;
+	if(this == Proc::getCurPageDir()->getPageTables())
+		flushAddr(virt & ~(PT_SIZE - 1),true);
+	return res;
+}
+
+bool PageTables::releasePT(uintptr_t virt) {
+	if(!isSharedPT(virt))
+		return false;
+
+	LockGuard<SpinLock> g(&shareLock);
+	pte_t *pte = getDirEntry(virt,NULL);
+	volatile uint32_t *refs = PhysMem::getRefCount(PTE_FRAMENO(*pte));
+	if(*refs == 1)
+		return false;
+
+	Atomic::fetch_and_add(refs,-1);
+	*pte = 0;
+	if(this == Proc::getCurPageDir()->getPageTables())
+		PageDir::flushTLB();
+	return true;
+}
+
+pte_t *PageTables::getDirEntry(uintptr_t virt,Allocator *alloc) const {
+	pte_t *pt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + root);
+	uint bits = PT_BITS - PT_BPL;
+	for(int i = 0; i < PT_LEVELS - 2; ++i) {
+		uintptr_t idx = (virt >> bits) & (PT_ENTRY_COUNT - 1);
+		if(pt[idx] == 0) {
+			if(!alloc || crtPageTable(pt + idx,0,*alloc) < 0)
+				return NULL;
+		}
+		else if((~pt[idx] & PTE_PRESENT) || (pt[idx] & PTE_LARGE))
+			return NULL;
+		pt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + (pt[idx] & PTE_FRAMENO_MASK));
+		bits -= PT_BPL;
+	}
+	return pt + ((virt >> bits) & (PT_ENTRY_COUNT - 1));
+}
+#endif
+
 int PageTables::crtPageTable(pte_t *pte,uint flags,Allocator &alloc) {
 	frameno_t frame = alloc.allocPT();
 	if(frame == PhysMem::INVALID_FRAME)
@@ -118,6 +287,11 @@ int PageTables::mapPage(uintptr_t virt,frameno_t frame,pte_t flags,Allocator &al
 			if(crtPageTable(pt + idx,flags,alloc) < 0)
 				return -ENOMEM;
 		}
+		/* if only one page of a large page is changed, we need a page-table for it */
+		else if(pt[idx] & PTE_LARGE) {
+			if(splitLarge(pt + idx,virt,alloc) < 0)
+				return -ENOMEM;
+		}
 		pt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + (pt[idx] & PTE_FRAMENO_MASK));
 		bits -= PT_BPL;
 	}
@@ -131,6 +305,59 @@ int PageTables::mapPage(uintptr_t virt,frameno_t frame,pte_t flags,Allocator &al
 	return wasPresent;
 }
 
+int PageTables::mapLarge(uintptr_t virt,pte_t flags,Allocator &alloc) {
+	pte_t *pt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + root);
+	uint bits = PT_BITS - PT_BPL;
+	for(int i = 0; i < PT_LEVELS - 2; ++i) {
+		uintptr_t idx = (virt >> bits) & (PT_ENTRY_COUNT - 1);
+		if(pt[idx] == 0) {
+			if(crtPageTable(pt + idx,flags,alloc) < 0)
+				return -ENOMEM;
+		}
+		else if(pt[idx] & PTE_LARGE)
+			return -ENOTSUP;
+		pt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + (pt[idx] & PTE_FRAMENO_MASK));
+		bits -= PT_BPL;
+	}
+
+	/* don't replace a page-table, because we don't know whether it is still in use */
+	uintptr_t idx = (virt >> bits) & (PT_ENTRY_COUNT - 1);
+	if((pt[idx] & PTE_EXISTS) && !(pt[idx] & PTE_LARGE))
+		return -ENOTSUP;
+
+	frameno_t frame = alloc.allocLargePage();
+	if(frame == PhysMem::INVALID_FRAME)
+		return -ENOTSUP;
+
+	bool wasPresent = pt[idx] & PTE_PRESENT;
+	if(frame)
+		pt[idx] = (frame << PAGE_BITS) | flags | PTE_LARGE;
+	/* keep the frames, but only if there is a large page yet */
+	else if(pt[idx] & PTE_LARGE)
+		pt[idx] = (pt[idx] & PTE_FRAMENO_MASK) | flags | PTE_LARGE;
+	else
+		return -ENOTSUP;
+	return wasPresent;
+}
+
+int PageTables::splitLarge(pte_t *pte,uintptr_t virt,Allocator &alloc) {
+	frameno_t frame = alloc.allocPT();
+	if(frame == PhysMem::INVALID_FRAME)
+		return -ENOMEM;
+
+	/* map the same frames with small pages */
+	pte_t *pt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + (frame << PAGE_BITS));
+	pte_t flags = *pte & ~(PTE_FRAMENO_MASK | PTE_LARGE);
+	frameno_t first = PTE_FRAMENO(*pte);
+	for(size_t i = 0; i < PT_ENTRY_COUNT; ++i)
+		pt[i] = ((first + i) << PAGE_BITS) | flags;
+
+	*pte = (frame << PAGE_BITS) | PTE_PRESENT | PTE_WRITABLE | PTE_EXISTS | (flags & PTE_NOTSUPER);
+	if(this == Proc::getCurPageDir()->getPageTables())
+		flushAddr(virt & ~(PT_SIZE - 1),true);
+	return 0;
+}
+
 pte_t *PageTables::getPTE(uintptr_t virt,uintptr_t *base) const {
 	pte_t *pt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + root);
 	uint bits = PT_BITS - PT_BPL;
@@ -150,10 +377,17 @@ pte_t *PageTables::getPTE(uintptr_t virt,uintptr_t *base) const {
 	return pt + idx;
 }
 
-frameno_t PageTables::unmapPage(uintptr_t virt) {
+frameno_t PageTables::unmapPage(uintptr_t virt,Allocator &alloc) {
 	uintptr_t base = virt;
 	pte_t *pte = getPTE(virt,&base);
 	frameno_t frame = 0;
+	/* we remove only a part of a large page; split it first */
+	if(pte && (*pte & PTE_LARGE)) {
+		if(splitLarge(pte,virt,alloc) < 0)
+			Util::panic("Unable to split large page at %p",virt);
+		base = virt;
+		pte = getPTE(virt,&base);
+	}
 	if(pte) {
 		assert(base == virt);
 		frame = (*pte & PTE_PRESENT) ? PTE_FRAMENO(*pte) : 0;
@@ -165,8 +399,13 @@ frameno_t PageTables::unmapPage(uintptr_t virt) {
 bool PageTables::gc(uintptr_t virt,pte_t pte,int level,uint bits,Allocator &alloc) {
 	if(~pte & PTE_EXISTS)
 		return true;
-	if(level == 0)
+	if(level == 0 || (pte & PTE_LARGE))
+		return false;
+#if defined(__x86__)
+	/* shared page-tables are freed by their last user */
+	if(level == 1 && !(pte & PTE_WRITABLE))
 		return false;
+#endif
 
 	pte_t *pt = reinterpret_cast<pte_t*>(DIR_MAP_AREA + (pte & PTE_FRAMENO_MASK));
 	size_t idx = (virt >> bits) & (PT_ENTRY_COUNT - 1);
@@ -214,6 +453,23 @@ int PageTables::map(uintptr_t virt,size_t count,Allocator &alloc,uint flags) {
 
 	bool needShootdown = false;
 	while(count > 0) {
+#if defined(__x86_64__)
+		/* use a large page, if possible */
+		if((flags & PG_PRESENT) && count >= PT_ENTRY_COUNT && (virt & (PT_SIZE - 1)) == 0) {
+			int res = mapLarge(virt,pteFlags,alloc);
+			if(res == -ENOMEM)
+				goto error;
+			if(res >= 0) {
+				needShootdown |= res == 1;
+				if(this == cur)
+					flushAddr(virt,res == 1);
+				virt += PT_SIZE;
+				count -= PT_ENTRY_COUNT;
+				continue;
+			}
+		}
+#endif
+
 		frameno_t frame = 0;
 		if(flags & PG_PRESENT) {
 			frame = alloc.allocPage();
@@ -246,7 +502,7 @@ int PageTables::unmap(uintptr_t virt,size_t count,Allocator &alloc) {
 	size_t pti = PT_ENTRY_COUNT;
 	size_t lastPti = PT_ENTRY_COUNT;
 	bool needShootdown = false;
-	while(count-- > 0) {
+	while(count > 0) {
 		/* remove and free page-table, if necessary */
 		pti = index(virt,1);
 		if(pti != lastPti) {
@@ -255,8 +511,24 @@ int PageTables::unmap(uintptr_t virt,size_t count,Allocator &alloc) {
 			lastPti = pti;
 		}
 
+		/* remove large pages at once, if they are removed completely */
+		uintptr_t base = virt;
+		pte_t *pte = getPTE(virt,&base);
+		if(pte && (*pte & PTE_LARGE) && base == virt && count >= PT_ENTRY_COUNT) {
+			frameno_t first = PTE_FRAMENO(*pte);
+			*pte = 0;
+			for(size_t i = 0; i < PT_ENTRY_COUNT; ++i)
+				alloc.freePage(first + i);
+			if(this == cur)
+				flushAddr(virt,true);
+			needShootdown = true;
+			virt += PT_SIZE;
+			count -= PT_ENTRY_COUNT;
+			continue;
+		}
+
 		/* remove page and free if necessary */
-		frameno_t frame = unmapPage(virt);
+		frameno_t frame = unmapPage(virt,alloc);
 		if(frame) {
 			alloc.freePage(frame);
 			/* invalidate TLB-entry */
@@ -267,6 +539,7 @@ int PageTables::unmap(uintptr_t virt,size_t count,Allocator &alloc) {
 
 		/* to next page */
 		virt += PAGE_SIZE;
+		count--;
 	}
 	/* check if the last changed pagetable is empty */
 	if(pti != PT_ENTRY_COUNT && (virt < KERNEL_AREA || virt >= KSTACK_AREA))
@@ -282,6 +555,8 @@ size_t PageTables::countEntries(pte_t pte,int level) const {
 		if(pt[i] & PTE_PRESENT) {
 			if(level == 1)
 				count++;
+			else if(pt[i] & PTE_LARGE)
+				count += (size_t)1 << (PT_BPL * (level - 1));
 			else if(level > 1)
 				count += countEntries(pt[i],level - 1);
 		}
@@ -19,6 +19,7 @@
 
 #include <esc/ipc/ipcbuf.h>
 #include <esc/util.h>
+#include <mem/pagecache.h>
 #include <mem/pagedir.h>
 #include <mem/physmem.h>
 #include <mem/physmemareas.h>
@@ -26,6 +27,7 @@
 #include <mem/virtmem.h>
 #include <sys/messages.h>
 #include <task/proc.h>
+#include <task/smp.h>
 #include <task/thread.h>
 #include <vfs/openfile.h>
 #include <vfs/vfs.h>
@@ -51,17 +53,25 @@
 
 size_t PhysMem::totalMem = 0;
 
+/* one reference counter per frame */
+volatile uint32_t *PhysMem::frameRefs;
+size_t PhysMem::totalFrames = 0;
+size_t PhysMem::refPages = 0;
+
 /* the bitmap for the frames of the lowest few MB; 0 = free, 1 = used */
 tBitmap *PhysMem::bitmap;
 uintptr_t PhysMem::bitmapStart;
 size_t PhysMem::freeCont = 0;
 SpinLock PhysMem::contLock;
+PhysMem::ContFrame PhysMem::contFrames[BITMAP_PAGE_COUNT];
+uint16_t PhysMem::contFree[CONT_ORDERS];
 
 /* We use a stack for the remaining memory
  * TODO Currently we don't free the frames for the stack */
 PhysMem::StackFrames PhysMem::lower;
 PhysMem::StackFrames PhysMem::upper;
 SpinLock PhysMem::defLock;
+PhysMem::FrameCache PhysMem::frameCaches[MAX_CPUS];
 
 bool PhysMem::initialized = false;
 
@@ -87,6 +97,9 @@ extern void *_ebss;
 uintptr_t PhysMem::bitmapStartFrame() {
 	return PhysMem::bitmapStart / PAGE_SIZE;
 }
+bool PhysMem::isContFrame(frameno_t frame) {
+	return frame >= bitmapStartFrame() && frame < bitmapStartFrame() + BITMAP_PAGE_COUNT;
+}
 uintptr_t PhysMem::lowerStart() {
 	return (bitmapStartFrame() + BITMAP_PAGE_COUNT) * PAGE_SIZE;
 }
@@ -115,6 +128,12 @@ void PhysMem::init() {
 	}
 	totalMem = PhysMemAreas::getAvailable();
 
+	/* determine the highest frame number for the reference counters */
+	uintptr_t memEnd = 0;
+	for(const PhysMemAreas::MemArea *area = PhysMemAreas::get(); area != NULL; area = area->next)
+		memEnd = esc::Util::max(memEnd,area->addr + area->size);
+	totalFrames = memEnd / PAGE_SIZE;
+
 	/* remove kernel and the first MB */
 	PhysMemAreas::rem(0,(uintptr_t)&_ebss - KERNEL_BEGIN);
 
@@ -141,6 +160,15 @@ void PhysMem::init() {
 	freeCont = BITMAP_PAGE_COUNT;
 	/* remove it from phys mem areas */
 	PhysMemAreas::rem(first->addr,first->addr + BITMAP_PAGE_COUNT * PAGE_SIZE);
+	/* put it into the buddy-allocator */
+	for(size_t i = 0; i < CONT_ORDERS; ++i)
+		contFree[i] = CONT_NONE;
+	releaseRange(bitmapStartFrame(),BITMAP_PAGE_COUNT);
+
+	/* the reference counters are all zero at the beginning */
+	refPages = BYTES_2_PAGES(totalFrames * sizeof(uint32_t));
+	frameRefs = (volatile uint32_t*)PageDir::makeAccessible(0,refPages);
+	memclear((void*)frameRefs,totalFrames * sizeof(uint32_t));
 
 	/* determine which of the memory areas becomes lower and which upper memory */
 	size_t lowerPages = 0,upperPages = 0;
@@ -200,12 +228,48 @@ size_t PhysMem::getFreeFrames(uint types) {
 	if(types & CONT)
 		count += freeCont;
 	if(types & DEF)
-		count += getFreeDef();
+		count += getFreeDef() + getCachedFrames();
 	return count;
 }
 
 ssize_t PhysMem::allocateContiguous(size_t count,size_t align) {
 	LockGuard<SpinLock> g(&contLock);
+	frameno_t first = INVALID_FRAME;
+
+	/* a block of order n is aligned to 2^n frames. thus, we can only use it for power-of-2 alignments */
+	if((align & (align - 1)) == 0) {
+		size_t order = 0;
+		while(order < CONT_ORDERS && (1UL << order) < esc::Util::max(count,align))
+			order++;
+		if(order < CONT_ORDERS)
+			first = takeBlock(order);
+		/* give the part that we don't need back */
+		if(first != INVALID_FRAME)
+			releaseRange(first + count,(1UL << order) - count);
+	}
+
+	/* the frames might still be available, spread over multiple blocks */
+	if(first == INVALID_FRAME) {
+		ssize_t res = scanContiguous(count,align);
+		if(res < 0)
+			return res;
+		first = res;
+		claimRange(first,count);
+	}
+
+	doMarkRangeUsed(first * PAGE_SIZE,(first + count) * PAGE_SIZE,true);
+	printAllocFree("[AC] %x:%zu ",first,count);
+	return first;
+}
+
+void PhysMem::freeContiguous(frameno_t first,size_t count) {
+	LockGuard<SpinLock> g(&contLock);
+	printAllocFree("[FC] %x:%zu ",first,count);
+	doMarkRangeUsed(first * PAGE_SIZE,(first + count) * PAGE_SIZE,false);
+	releaseRange(first,count);
+}
+
+ssize_t PhysMem::scanContiguous(size_t count,size_t align) {
 	size_t c = 0;
 	/* align in physical memory */
 	size_t i = esc::Util::round_up(bitmapStartFrame(),align);
@@ -213,7 +277,7 @@ ssize_t PhysMem::allocateContiguous(size_t count,size_t align) {
 	for(; i < BITMAP_PAGE_COUNT; ) {
 		/* walk forward until we find an occupied frame */
 		size_t j = i;
-		for(c = 0; c < count; j++,c++) {
+		for(c = 0; c < count && j < BITMAP_PAGE_COUNT; j++,c++) {
 			tBitmap dword = bitmap[j / BITS_PER_BMWORD];
 			tBitmap bit = (BITS_PER_BMWORD - 1) - (j % BITS_PER_BMWORD);
 			if(dword & (1UL << bit))
@@ -229,18 +293,100 @@ ssize_t PhysMem::allocateContiguous(size_t count,size_t align) {
 
 	if(c != count)
 		return -ENOMEM;
-
 	/* the bitmap starts managing the memory at itself */
-	i += bitmapStartFrame();
-	doMarkRangeUsed(i * PAGE_SIZE,(i + count) * PAGE_SIZE,true);
-	printAllocFree("[AC] %x:%zu ",i,count);
-	return i;
+	return i + bitmapStartFrame();
 }
 
-void PhysMem::freeContiguous(frameno_t first,size_t count) {
-	LockGuard<SpinLock> g(&contLock);
-	printAllocFree("[FC] %x:%zu ",first,count);
-	doMarkRangeUsed(first * PAGE_SIZE,(first + count) * PAGE_SIZE,false);
+frameno_t PhysMem::takeBlock(size_t order) {
+	size_t o = order;
+	while(o < CONT_ORDERS && contFree[o] == CONT_NONE)
+		o++;
+	if(o == CONT_ORDERS)
+		return INVALID_FRAME;
+
+	frameno_t frame = bitmapStartFrame() + contFree[o];
+	contRem(frame,o);
+	/* split it until it has the requested size */
+	while(o > order) {
+		o--;
+		contAdd(frame + (1UL << o),o);
+	}
+	return frame;
+}
+
+void PhysMem::claimRange(frameno_t frame,size_t count) {
+	frameno_t base = bitmapStartFrame();
+	frameno_t end = frame + count;
+	while(frame < end) {
+		/* search the free block that contains <frame> */
+		frameno_t head = frame;
+		size_t o;
+		for(o = 0; o < CONT_ORDERS; o++) {
+			head = frame & ~((1UL << o) - 1);
+			if(head >= base && contFrames[head - base].order == o + 1)
+				break;
+		}
+		assert(o < CONT_ORDERS);
+
+		/* take it and give the parts before and behind the range back */
+		frameno_t blockEnd = head + (1UL << o);
+		contRem(head,o);
+		releaseRange(head,frame - head);
+		if(blockEnd > end)
+			releaseRange(end,blockEnd - end);
+		frame = blockEnd;
+	}
+}
+
+void PhysMem::releaseRange(frameno_t frame,size_t count) {
+	/* split the range into the largest blocks that are naturally aligned */
+	while(count > 0) {
+		size_t order = 0;
+		while(order < CONT_ORDERS - 1 && (frame & (1UL << order)) == 0 && (2UL << order) <= count)
+			order++;
+		releaseBlock(frame,order);
+		frame += 1UL << order;
+		count -= 1UL << order;
+	}
+}
+
+void PhysMem::releaseBlock(frameno_t frame,size_t order) {
+	frameno_t base = bitmapStartFrame();
+	/* merge it with its buddy as long as that is free as well */
+	while(order < CONT_ORDERS - 1) {
+		frameno_t buddy = frame ^ (1UL << order);
+		if(buddy < base || buddy - base >= BITMAP_PAGE_COUNT ||
+				contFrames[buddy - base].order != order + 1)
+			break;
+		contRem(buddy,order);
+		frame = esc::Util::min(frame,buddy);
+		order++;
+	}
+	contAdd(frame,order);
+}
+
+void PhysMem::contAdd(frameno_t frame,size_t order) {
+	uint16_t idx = frame - bitmapStartFrame();
+	ContFrame *f = contFrames + idx;
+	f->order = order + 1;
+	f->prev = CONT_NONE;
+	f->next = contFree[order];
+	if(f->next != CONT_NONE)
+		contFrames[f->next].prev = idx;
+	contFree[order] = idx;
+}
+
+void PhysMem::contRem(frameno_t frame,size_t order) {
+	uint16_t idx = frame - bitmapStartFrame();
+	ContFrame *f = contFrames + idx;
+	assert(f->order == order + 1);
+	if(f->prev != CONT_NONE)
+		contFrames[f->prev].next = f->next;
+	else
+		contFree[order] = f->next;
+	if(f->next != CONT_NONE)
+		contFrames[f->next].prev = f->prev;
+	f->order = 0;
 }
 
 bool PhysMem::reserve(size_t frameCount,bool swap) {
@@ -253,6 +399,31 @@ bool PhysMem::reserve(size_t frameCount,bool swap) {
 		return true;
 	}
 
+	/* maybe the frame caches of the CPUs have enough */
+	if(getCachedFrames() > 0) {
+		defLock.up();
+		drainCaches();
+		defLock.down();
+		free = getFreeDef();
+		if(free >= frameCount && free - frameCount >= kframes + cframes) {
+			defLock.up();
+			return true;
+		}
+	}
+
+	/* drop clean pages from the page cache before we swap something out */
+	if(PageCache::getPageCount() > 0) {
+		size_t needed = frameCount + kframes + cframes - free;
+		defLock.up();
+		shrinkPageCache(needed);
+		defLock.down();
+		free = getFreeDef();
+		if(free >= frameCount && free - frameCount >= kframes + cframes) {
+			defLock.up();
+			return true;
+		}
+	}
+
 	/* swapping not possible? */
 	Thread *t = Thread::getRunning();
 	if(!swap || !swapEnabled || !swapperThread || t->getTid() == swapperThread->getTid()) {
@@ -300,8 +471,7 @@ void PhysMem::freeFrame(frameno_t frame) {
 	}
 }
 
-frameno_t PhysMem::allocate(FrameType type) {
-	LockGuard<SpinLock> g(&defLock);
+frameno_t PhysMem::allocOne(FrameType type) {
 	/* remove the memory from the available one when we're not yet initialized */
 	frameno_t frame = PhysMem::INVALID_FRAME;
 	if(!initialized)
@@ -345,14 +515,162 @@ frameno_t PhysMem::allocate(FrameType type) {
 	return frame;
 }
 
-void PhysMem::free(frameno_t frame,FrameType type) {
+frameno_t PhysMem::allocate(FrameType type) {
 	LockGuard<SpinLock> g(&defLock);
-	printAllocFree("[F] %x 1 ",frame);
-	if(type == CRIT)
-		cframes++;
-	else if(type == KERN)
-		kframes++;
-	markUsed(frame,false);
+	return allocOne(type);
+}
+
+size_t PhysMem::allocate(FrameType type,size_t count,frameno_t *frames) {
+	frameno_t cached[FRAME_CACHE_BATCH];
+	size_t i,refill = 0;
+
+	{
+		LockGuard<SpinLock> g(&defLock);
+		for(i = 0; i < count; ++i) {
+			frames[i] = allocOne(type);
+			if(frames[i] == INVALID_FRAME)
+				break;
+		}
+
+		/* if the frame cache of this CPU runs low, take a few more, but only as long as we don't
+		 * need them for reservations and the kernel */
+		FrameCache *fc = getFrameCache();
+		if(type == USR && i == count && fc && fc->count < FRAME_CACHE_BATCH) {
+			while(refill < FRAME_CACHE_BATCH && getFreeDef() > kframes + cframes + uframes) {
+				cached[refill] = allocFrame(false);
+				if(cached[refill] == INVALID_FRAME)
+					break;
+				refill++;
+			}
+		}
+	}
+
+	/* we can't hold both locks at once; if the cache filled up meanwhile, the rest goes back */
+	size_t n = putCached(cached,refill);
+	if(n < refill)
+		freeDef(cached + n,refill - n);
+	return i;
+}
+
+size_t PhysMem::allocateCached(size_t count,frameno_t *frames) {
+	FrameCache *fc = getFrameCache();
+	if(!fc)
+		return 0;
+
+	LockGuard<SpinLock> g(&fc->lock);
+	size_t n = esc::Util::min(count,fc->count);
+	for(size_t i = 0; i < n; ++i)
+		frames[i] = fc->frames[--fc->count];
+	return n;
+}
+
+void PhysMem::free(const frameno_t *frames,size_t count,FrameType type) {
+	if(type == USR) {
+		/* only cache frames of the default memory. the contiguous memory should stay available
+		 * for allocateContiguous and is given back to the buddy allocator below */
+		size_t n = 0;
+		while(n < count && !isContFrame(frames[n]))
+			n++;
+		n = putCached(frames,n);
+		frames += n;
+		count -= n;
+		if(count == 0)
+			return;
+	}
+
+	LockGuard<SpinLock> g(&defLock);
+	for(size_t i = 0; i < count; ++i) {
+		printAllocFree("[F] %x 1 ",frames[i]);
+		if(type == CRIT)
+			cframes++;
+		else if(type == KERN)
+			kframes++;
+		freeOne(frames[i]);
+	}
+}
+
+void PhysMem::freeDef(const frameno_t *frames,size_t count) {
+	LockGuard<SpinLock> g(&defLock);
+	for(size_t i = 0; i < count; ++i)
+		freeOne(frames[i]);
+}
+
+void PhysMem::freeOne(frameno_t frame) {
+	/* contiguous memory (e.g. from mapphys) might be unmapped frame by frame. it has to go back to
+	 * the buddy allocator, which merges it with its free neighbours again */
+	if(EXPECT_FALSE(isContFrame(frame)))
+		freeContiguous(frame,1);
+	else
+		markUsed(frame,false);
+}
+
+PhysMem::FrameCache *PhysMem::getFrameCache() {
+	cpuid_t cpu = SMP::getCurId();
+	return (EXPECT_TRUE(initialized && cpu < MAX_CPUS)) ? frameCaches + cpu : NULL;
+}
+
+size_t PhysMem::putCached(const frameno_t *frames,size_t count) {
+	FrameCache *fc = getFrameCache();
+	if(!fc || count == 0)
+		return 0;
+
+	frameno_t drained[FRAME_CACHE_SIZE / 2];
+	size_t n,d = 0;
+	{
+		LockGuard<SpinLock> g(&fc->lock);
+		/* if it's full, make room by giving the older half back */
+		if(fc->count == FRAME_CACHE_SIZE) {
+			d = FRAME_CACHE_SIZE / 2;
+			memcpy(drained,fc->frames,d * sizeof(frameno_t));
+			memmove(fc->frames,fc->frames + d,(fc->count - d) * sizeof(frameno_t));
+			fc->count -= d;
+		}
+
+		n = esc::Util::min(count,FRAME_CACHE_SIZE - fc->count);
+		memcpy(fc->frames + fc->count,frames,n * sizeof(frameno_t));
+		fc->count += n;
+	}
+
+	if(d > 0)
+		freeDef(drained,d);
+	return n;
+}
+
+size_t PhysMem::getCachedFrames() {
+	/* no lock; it's only used as a hint */
+	size_t count = 0;
+	for(size_t i = 0; i < MAX_CPUS; ++i)
+		count += frameCaches[i].count;
+	return count;
+}
+
+void PhysMem::drainCaches() {
+	frameno_t frames[FRAME_CACHE_SIZE];
+	for(size_t i = 0; i < MAX_CPUS; ++i) {
+		size_t count;
+		{
+			LockGuard<SpinLock> g(&frameCaches[i].lock);
+			count = frameCaches[i].count;
+			memcpy(frames,frameCaches[i].frames,count * sizeof(frameno_t));
+			frameCaches[i].count = 0;
+		}
+		if(count > 0)
+			freeDef(frames,count);
+	}
+}
+
+size_t PhysMem::shrinkPageCache(size_t count) {
+	frameno_t frames[FRAME_CACHE_BATCH];
+	size_t total = 0;
+	while(total < count) {
+		size_t n = PageCache::evict(frames,esc::Util::min(count - total,FRAME_CACHE_BATCH));
+		if(n == 0)
+			break;
+		/* directly to the default pool, because the caller waits for them */
+		freeDef(frames,n);
+		total += n;
+	}
+	return total;
 }
 
 int PhysMem::swapIn(uintptr_t addr) {
@@ -447,8 +765,12 @@ void PhysMem::swapper() {
 			swapping = true;
 			defLock.up();
 
-			VirtMem::swapOut(swapFile,amount);
-			swappedOut += amount;
+			/* cached file pages can simply be dropped; swap out only the rest */
+			amount -= shrinkPageCache(amount);
+			if(amount > 0) {
+				VirtMem::swapOut(swapFile,amount);
+				swappedOut += amount;
+			}
 
 			defLock.down();
 			swapping = false;
@@ -462,8 +784,7 @@ void PhysMem::swapper() {
 			swapping = true;
 			defLock.up();
 
-			if(VirtMem::swapIn(swapFile,job->thread,job->addr))
-				swappedIn++;
+			swappedIn += VirtMem::swapIn(swapFile,job->thread,job->addr);
 
 			defLock.down();
 			job->thread->unblock();
@@ -491,6 +812,8 @@ error:
 void PhysMem::print(OStream &os) {
 	const char *dev = Config::getStr(Config::SWAP_DEVICE);
 	os.writef("Default: %zu\n",getFreeDef());
+	os.writef("Cached: %zu\n",getCachedFrames());
+	os.writef("Page cache: %zu\n",PageCache::getPageCount());
 	os.writef("Contiguous: %zu\n",freeCont);
 	os.writef("Swap-Device: %s\n",dev ? dev : "-none-");
 	os.writef("Swap enabled: %d\n",swapEnabled);
@@ -531,6 +854,13 @@ void PhysMem::printStack(OStream &os) {
 }
 
 void PhysMem::printCont(OStream &os) {
+	os.writef("Free blocks:\n");
+	for(size_t o = 0; o < CONT_ORDERS; o++) {
+		size_t count = 0;
+		for(uint16_t idx = contFree[o]; idx != CONT_NONE; idx = contFrames[idx].next)
+			count++;
+		os.writef("\t%4zu frames: %zu\n",(size_t)1 << o,count);
+	}
 	os.writef("Bitmap: (frame numbers)\n");
 	size_t pos = bitmapStart;
 	for(size_t i = 0; i < BITMAP_PAGE_COUNT / BITS_PER_BMWORD; i++) {
@@ -33,7 +33,7 @@
 size_t SwapMap::totalBlocks = 0;
 size_t SwapMap::freeBlocks = 0;
 SwapMap::Block *SwapMap::swapBlocks = NULL;
-SwapMap::Block *SwapMap::freeList = NULL;
+size_t SwapMap::nextBlock = 0;
 SpinLock SwapMap::lock;
 
 bool SwapMap::init(size_t swapSize) {
@@ -43,37 +43,38 @@ bool SwapMap::init(size_t swapSize) {
 	if(swapBlocks == NULL)
 		return false;
 
-	/* build freelist */
-	freeList = swapBlocks + 0;
-	swapBlocks[0].refCount = 0;
-	swapBlocks[0].next = NULL;
-	for(size_t i = 1; i < totalBlocks; i++) {
-		swapBlocks[i].next = freeList;
+	for(size_t i = 0; i < totalBlocks; i++)
 		swapBlocks[i].refCount = 0;
-		freeList = swapBlocks + i;
-	}
+	nextBlock = 0;
 	return true;
 }
 
-ulong SwapMap::alloc() {
+ulong SwapMap::alloc(size_t count,size_t *allocated) {
 	LockGuard<SpinLock> g(&lock);
-	if(!freeList)
+	*allocated = 0;
+	if(freeBlocks == 0)
 		return INVALID;
-	Block *block = freeList;
-	freeList = freeList->next;
-	block->refCount = 1;
-	freeBlocks--;
-	return block - swapBlocks;
+
+	/* continue where we stopped last time (next-fit). this way, pages that are swapped out one
+	 * after another end up in consecutive blocks and can be written and read together */
+	size_t start = nextBlock;
+	while(swapBlocks[start].refCount > 0)
+		start = (start + 1) % totalBlocks;
+
+	size_t n = 0;
+	while(n < count && start + n < totalBlocks && swapBlocks[start + n].refCount == 0)
+		swapBlocks[start + n++].refCount = 1;
+	freeBlocks -= n;
+	nextBlock = (start + n) % totalBlocks;
+	*allocated = n;
+	return start;
 }
 
 void SwapMap::free(ulong block) {
 	LockGuard<SpinLock> g(&lock);
 	assert(block < totalBlocks);
-	if(--swapBlocks[block].refCount == 0) {
-		swapBlocks[block].next = freeList;
-		freeList = swapBlocks + block;
+	if(--swapBlocks[block].refCount == 0)
 		freeBlocks++;
-	}
 }
 
 void SwapMap::print(OStream &os) {
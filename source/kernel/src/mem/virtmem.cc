@@ -20,7 +20,9 @@
 #include <esc/util.h>
 #include <mem/cache.h>
 #include <mem/copyonwrite.h>
+#include <mem/pagecache.h>
 #include <mem/pagedir.h>
+#include <mem/physmem.h>
 #include <mem/region.h>
 #include <mem/shfiles.h>
 #include <mem/swapmap.h>
@@ -49,7 +51,7 @@
 
 #define DEBUG_SWAP			0
 
-static uint8_t buffer[PAGE_SIZE];
+uint8_t VirtMem::swapBuffer[PAGE_SIZE * SWAP_CLUSTER_PAGES];
 
 void VirtMem::acquire() const {
 	proc->lock(PLOCK_PROG);
@@ -85,6 +87,12 @@ uintptr_t VirtMem::mapphys(uintptr_t *phys,size_t bCount,size_t align,int flags)
 		firstFrame = *phys / PAGE_SIZE;
 	}
 
+#if defined(__x86_64__)
+	/* if the frames are suitable for large pages, place the region accordingly */
+	if(firstFrame != (frameno_t)-1 && pages >= PT_ENTRY_COUNT && firstFrame % PT_ENTRY_COUNT == 0)
+		mapflags |= MAP_LARGEPAGES;
+#endif
+
 	/* create region */
 	VMRegion *vm;
 	res = map(0,bCount,0,PROT_READ | PROT_WRITE,mapflags,NULL,0,&vm);
@@ -202,8 +210,15 @@ int VirtMem::map(uintptr_t *addr,size_t length,size_t loadCount,int prot,int fla
 		/* find a suitable place */
 		if(rflags & MAP_STACK)
 			virt = findFreeStack(length,rflags);
-		else
-			virt = freemap.allocate(esc::Util::round_page_up(length));
+		else {
+			virt = 0;
+#if defined(__x86_64__)
+			if(rflags & MAP_LARGEPAGES)
+				virt = freemap.allocate(esc::Util::round_page_up(length),PT_SIZE);
+#endif
+			if(virt == 0)
+				virt = freemap.allocate(esc::Util::round_page_up(length));
+		}
 		if(virt == 0)
 			goto errProc;
 	}
@@ -290,11 +305,20 @@ int VirtMem::protect(uintptr_t addr,ulong flags) {
 		if(vmreg->reg->getPageFlags(i) & PF_COPYONWRITE)
 			goto error;
 	}
+#if defined(__x86__)
+	/* the same holds for pages in page-tables that are still shared after a fork */
+	for(uintptr_t virt = vmreg->virt() & ~(PT_SIZE - 1); virt < vmreg->virt() + pgcount * PAGE_SIZE;
+			virt += PT_SIZE) {
+		if(getPageDir()->getPageTables()->isSharedPT(virt))
+			goto error;
+	}
+#endif
 
 	/* change reg flags */
 	vmreg->reg->setFlags((vmreg->reg->getFlags() & ~(RF_WRITABLE | RF_EXECUTABLE)) | flags);
 
-	/* change mapping */
+	/* change mapping; send the shootdowns for all pages at once */
+	SMP::beginTLBBatch();
 	for(auto mp = vmreg->reg->vmbegin(); mp != vmreg->reg->vmend(); ++mp) {
 		/* the region may be mapped to a different virtual address */
 		VMRegion *mpreg = (*mp)->regtree.getByReg(vmreg->reg);
@@ -312,6 +336,7 @@ int VirtMem::protect(uintptr_t addr,ulong flags) {
 			sassert((*mp)->getPageDir()->map(mpreg->virt() + i * PAGE_SIZE,1,alloc,mapFlags) == 0);
 		}
 	}
+	SMP::endTLBBatch();
 	res = 0;
 
 error:
@@ -372,13 +397,25 @@ int VirtMem::lockRegion(VMRegion *vm,int flags) {
 	vm->reg->setFlags(vm->reg->getFlags() | RF_LOCKED);
 error:
 	vm->reg->release();
-	if(flags & MAP_NOSWAP)
-		t->discardFrames();
+	t->discardFrames();
 	return res;
 }
 
 int VirtMem::populatePages(VMRegion *vm,size_t count) {
+	Thread *t = Thread::getRunning();
 	bool write = !!(vm->reg->getFlags() & PROT_WRITE);
+
+	/* reserve the frames for all pages at once, if the caller hasn't already done that. we can't
+	 * swap here, because we hold the region-lock */
+	size_t needed = 0;
+	for(size_t i = 0; i < count; i++) {
+		if(vm->reg->getPageFlags(i) & (PF_DEMANDLOAD | PF_COPYONWRITE))
+			needed++;
+	}
+	size_t reserved = t->getReservedFrmCnt();
+	if(needed > reserved && !t->reserveFrames(needed - reserved,false))
+		return -ENOMEM;
+
 	for(size_t i = 0; i < count; i++) {
 		if(vm->reg->getPageFlags(i) & (PF_DEMANDLOAD | PF_COPYONWRITE | PF_SWAPPED)) {
 			int res;
@@ -390,98 +427,120 @@ int VirtMem::populatePages(VMRegion *vm,size_t count) {
 }
 
 void VirtMem::swapOut(OpenFile *file,size_t count) {
+	size_t pages[SWAP_CLUSTER_PAGES];
+	frameno_t frames[SWAP_CLUSTER_PAGES];
 	while(count > 0) {
 		Region *reg = getLRURegion();
 		if(reg == NULL)
 			Util::panic("No pages to swap out");
 
-		/* the list of processes may have changed in the meantime; we can't swap out in this case */
-		while(count > 0) {
-			/* get page to swap out */
-			ssize_t index = getPgIdxForSwap(reg);
-			if(index < 0)
-				break;
+		/* get VM-region of first process */
+		VirtMem *vm = *reg->vmbegin();
+		VMRegion *vmreg = vm->regtree.getByReg(reg);
 
-			/* get VM-region of first process */
-			VirtMem *vm = *reg->vmbegin();
-			VMRegion *vmreg = vm->regtree.getByReg(reg);
+		/* get pages to swap out */
+		size_t n = getPagesForSwap(reg,pages,esc::Util::min(count,SWAP_CLUSTER_PAGES));
 
-			/* find swap-block */
-			ulong block = SwapMap::alloc();
+		/* get the frames first, because the pages have to be present */
+		SMP::beginTLBBatch();
+		for(size_t i = 0; i < n; i++) {
+			frames[i] = vm->getPageDir()->getFrameNo(vmreg->virt() + pages[i] * PAGE_SIZE);
+			/* unmap the page in all processes. if someone tries to access it, he will cause a
+			 * page-fault and will wait until we release the region-mutex */
+			setSwappedOut(reg,pages[i]);
+		}
+		/* the batch is just to avoid an IPI per page; we need the TLBs to be flushed now */
+		SMP::endTLBBatch();
+		SMP::ensureTLBFlushed();
+
+		/* write them out with as few requests as possible */
+		for(size_t i = 0; i < n; ) {
+			size_t blocks;
+			ulong block = SwapMap::alloc(n - i,&blocks);
 			assert(block != SwapMap::INVALID);
 
-			/* get the frame first, because the page has to be present */
-			frameno_t frameNo = vm->getPageDir()->getFrameNo(vmreg->virt() + index * PAGE_SIZE);
-
+			for(size_t j = 0; j < blocks; j++) {
 #if DEBUG_SWAP
-			Log::get().writef("OUT: %d of region %x (frame %#x, block %d)\n",index,vmreg->reg,frameNo,block);
-			for(auto mp = reg->vmbegin(); mp != reg->vmend(); ++mp) {
-				VMRegion *mpreg = (*mp)->regtree.getByReg(reg);
-				Log::get().writef("\tProcess %d:%s -> page %p\n",(*mp)->getProc()->getPid(),
-						(*mp)->getProc()->getProgram(),mpreg->virt() + index * PAGE_SIZE);
-			}
-			Log::get().writef("\n");
+				Log::get().writef("OUT: %d of region %x (frame %#x, block %d)\n",
+					pages[i + j],reg,frames[i + j],block + j);
 #endif
-
-			/* unmap the page in all processes and ensure that all CPUs have flushed their TLB */
-			/* this way we know that nobody can still access the page; if someone tries, he will
-			 * cause a page-fault and will wait until we release the region-mutex */
-			setSwappedOut(reg,index);
-			reg->setSwapBlock(index,block);
-			SMP::ensureTLBFlushed();
-
-			/* copy to a temporary buffer because we can't use the temp-area when switching threads */
-			PageDir::copyFromFrame(frameNo,buffer);
-			PhysMem::free(frameNo,PhysMem::USR);
+				reg->setSwapBlock(pages[i + j],block + j);
+				/* copy to a temporary buffer because we can't use the temp-area when switching
+				 * threads */
+				PageDir::copyFromFrame(frames[i + j],swapBuffer + j * PAGE_SIZE);
+			}
+			PhysMem::free(frames + i,blocks,PhysMem::USR);
 
 			/* write out on disk */
 			sassert(file->seek(block * PAGE_SIZE,SEEK_SET) >= 0);
-			sassert(file->write(buffer,PAGE_SIZE) == PAGE_SIZE);
-
-			count--;
+			sassert(file->write(swapBuffer,blocks * PAGE_SIZE) == (ssize_t)(blocks * PAGE_SIZE));
+			i += blocks;
 		}
+
+		count -= n;
 		reg->release();
 	}
 }
 
-bool VirtMem::swapIn(OpenFile *file,Thread *t,uintptr_t addr) {
+size_t VirtMem::swapIn(OpenFile *file,Thread *t,uintptr_t addr) {
+	frameno_t frames[SWAP_CLUSTER_PAGES];
 	VMRegion *vmreg = t->getProc()->getVM()->regtree.getByAddr(addr);
 	if(!vmreg)
-		return false;
+		return 0;
 
 	addr &= ~(PAGE_SIZE - 1);
 	size_t index = (addr - vmreg->virt()) / PAGE_SIZE;
 
 	/* not swapped anymore? so probably another process has already swapped it in */
 	if(!(vmreg->reg->getPageFlags(index) & PF_SWAPPED))
-		return false;
+		return 0;
 
 	ulong block = vmreg->reg->getSwapBlock(index);
 
+	/* the following pages are likely to be needed as well, if they have been swapped out together
+	 * with this one. we read them in the same request, if we can get the memory without swapping */
+	size_t pages = BYTES_2_PAGES(vmreg->reg->getByteCount());
+	size_t count = 1;
+	while(count < SWAP_CLUSTER_PAGES && index + count < pages &&
+			(vmreg->reg->getPageFlags(index + count) & PF_SWAPPED) &&
+			vmreg->reg->getSwapBlock(index + count) == block + count) {
+#if defined(__x86__)
+		/* only the page-table of the faulting page has been unshared. mapping a page into a
+		 * page-table that is still shared with another process would make it visible there */
+		if(isInSharedPT(vmreg->reg,index + count))
+			break;
+#endif
+		count++;
+	}
+
+	frames[0] = t->getFrame();
+	if(count > 1) {
+		size_t extra = PhysMem::allocateCached(count - 1,frames + 1);
+		if(extra < count - 1 && PhysMem::reserve(count - 1 - extra,false))
+			extra += PhysMem::allocate(PhysMem::USR,count - 1 - extra,frames + 1 + extra);
+		count = 1 + extra;
+	}
+
 	/* read into buffer (note that we can use the same for swap-in and swap-out because its both
 	 * done by the swapper-thread) */
 	sassert(file->seek(block * PAGE_SIZE,SEEK_SET) >= 0);
-	sassert(file->read(buffer,PAGE_SIZE) == PAGE_SIZE);
+	sassert(file->read(swapBuffer,count * PAGE_SIZE) == (ssize_t)(count * PAGE_SIZE));
 
-	/* copy into a new frame */
-	frameno_t frame = t->getFrame();
-	PageDir::copyToFrame(frame,buffer);
+	for(size_t i = 0; i < count; i++) {
+		/* copy into the new frame */
+		PageDir::copyToFrame(frames[i],swapBuffer + i * PAGE_SIZE);
 
 #if DEBUG_SWAP
-	Log::get().writef("IN: %d of region %x (frame %#x, block %d)\n",index,vmreg->reg,frame,block);
-	for(auto mp = vmreg->reg->vmbegin(); mp != vmreg->reg->vmend(); ++mp) {
-		VMRegion *mpreg = (*mp)->regtree.getByReg(vmreg->reg);
-		Log::get().writef("\tProcess %d:%s -> page %p\n",(*mp)->getProc()->getPid(),
-				(*mp)->getProc()->getProgram(),mpreg->virt() + index * PAGE_SIZE);
-	}
-	Log::get().writef("\n");
+		Log::get().writef("IN: %d of region %x (frame %#x, block %d)\n",
+			index + i,vmreg->reg,frames[i],block + i);
 #endif
 
-	/* mark as not-swapped and map into all affected processes */
-	setSwappedIn(vmreg->reg,index,frame);
-	/* free swap-block */
-	SwapMap::free(block);
-	return true;
+		/* mark as not-swapped and map into all affected processes */
+		setSwappedIn(vmreg->reg,index + i,frames[i]);
+		/* free swap-block */
+		SwapMap::free(block + i);
+	}
+	return count;
 }
 
 void VirtMem::setTimestamp(Thread *t,uint64_t timestamp) {
@@ -571,15 +630,24 @@ int VirtMem::pagefault(uintptr_t addr,bool write) {
 int VirtMem::doPagefault(uintptr_t addr,VMRegion *vm,bool write) {
 	int res;
 	size_t page = (addr - vm->virt()) / PAGE_SIZE;
-	ulong flags = vm->reg->getPageFlags(page);
 	addr &= ~(PAGE_SIZE - 1);
+#if defined(__x86__)
+	/* a page-table that is shared since a fork can't be changed; get our own first */
+	if((res = unsharePTs(vm,addr,1)) < 0)
+		return res;
+#endif
+	ulong flags = vm->reg->getPageFlags(page);
 	if(flags & PF_DEMANDLOAD) {
 		res = demandLoad(vm,addr);
+		/* the page might be shared with the page cache now */
 		if(res == 0)
-			vm->reg->setPageFlags(page,flags & ~PF_DEMANDLOAD);
+			vm->reg->setPageFlags(page,vm->reg->getPageFlags(page) & ~PF_DEMANDLOAD);
 	}
 	else if(flags & PF_SWAPPED)
 		res = PhysMem::swapIn(addr);
+	/* pages of the page cache are shared copy-on-write with read-only regions as well */
+	else if((flags & PF_COPYONWRITE) && (!write || !(vm->reg->getFlags() & RF_WRITABLE)))
+		res = write ? -EFAULT : 0;
 	else if(flags & PF_COPYONWRITE) {
 		frameno_t frameNumber = getPageDir()->getFrameNo(addr);
 		size_t frmCount = CopyOnWrite::pagefault(addr,frameNumber);
@@ -670,23 +738,38 @@ void VirtMem::doUnmap(VMRegion *vm) {
 		/* remove us from cow and unmap the pages (and free frames, if necessary) */
 		for(size_t i = 0; i < pcount; i++) {
 			bool freeFrame = !(vm->reg->getFlags() & RF_NOFREE);
-			frameno_t frameNo = 0;
+#if defined(__x86__)
+			if((virt & (PT_SIZE - 1)) == 0) {
+				/* if other processes still use the page-table, the pages are theirs */
+				if(getPageDir()->getPageTables()->releasePT(virt)) {
+					SMP::flushTLB(getPageDir(),virt,PT_ENTRY_COUNT);
+					for(size_t j = 0; j < PT_ENTRY_COUNT; ++j) {
+						if(vm->reg->getPageFlags(i + j) & PF_SWAPPED)
+							addSwap(-1);
+						else if(!(vm->reg->getPageFlags(i + j) & PF_DEMANDLOAD))
+							addShared(-1);
+					}
+					i += PT_ENTRY_COUNT - 1;
+					virt += PT_SIZE;
+					continue;
+				}
+				/* otherwise, we're the last user and take it back; that can't fail */
+				sassert(unsharePTs(vm,virt,1) == 0);
+			}
+#endif
 			if(vm->reg->getPageFlags(i) & PF_COPYONWRITE) {
 				bool foundOther;
-				frameNo = getPageDir()->getFrameNo(virt);
+				frameno_t frameNo = getPageDir()->getFrameNo(virt);
 				/* we can free the frame if there is no other user */
 				addShared(-CopyOnWrite::remove(frameNo,&foundOther));
-				freeFrame = !foundOther;
+				if(freeFrame && !foundOther)
+					PhysMem::free(frameNo,PhysMem::USR);
 			}
-
-			if(vm->reg->getPageFlags(i) & PF_SWAPPED)
+			else if(vm->reg->getPageFlags(i) & PF_SWAPPED)
 				addSwap(-1);
-			else if(!(vm->reg->getPageFlags(i) & (PF_COPYONWRITE | PF_DEMANDLOAD))) {
-				if(freeFrame) {
-					if(frameNo == 0)
-						frameNo = getPageDir()->getFrameNo(virt);
-					PhysMem::free(frameNo,PhysMem::USR);
-				}
+			else if(!(vm->reg->getPageFlags(i) & PF_DEMANDLOAD)) {
+				if(freeFrame)
+					PhysMem::free(getPageDir()->getFrameNo(virt),PhysMem::USR);
 
 				if(vm->reg->getFlags() & (RF_NOFREE | RF_SHAREABLE))
 					addShared(-1);
@@ -849,7 +932,7 @@ errProc:
 	return res;
 }
 
-int VirtMem::cloneAll(VirtMem *dst) {
+int VirtMem::cloneAll(VirtMem *dst,bool stackOnly) {
 	Thread *t = Thread::getRunning();
 	VMTree::iterator vm;
 	VMRegion *nvm;
@@ -864,11 +947,13 @@ int VirtMem::cloneAll(VirtMem *dst) {
 		return -ESRCH;
 	}
 
-	dst->dataAddr = dataAddr;
+	/* the data-region is not cloned when spawning; the exec will set it again */
+	dst->dataAddr = stackOnly ? 0 : dataAddr;
 
 	for(vm = regtree.begin(); vm != regtree.end(); ++vm) {
 		/* just clone the tls- and stack-region of the current thread */
-		if(!(vm->reg->getFlags() & RF_STACK) || t->hasStackRegion(&*vm)) {
+		bool stack = t->hasStackRegion(&*vm);
+		if(stack || (!stackOnly && !(vm->reg->getFlags() & RF_STACK))) {
 			vm->reg->acquire();
 			/* TODO ?? better don't share the file; they may have to read in parallel */
 			if(vm->reg->getFlags() & RF_SHAREABLE) {
@@ -891,10 +976,11 @@ int VirtMem::cloneAll(VirtMem *dst) {
 					goto errorRem;
 			}
 
-			/* now copy the pages */
+			/* now copy the pages. mapped physical memory (e.g., device memory) is not ours and
+			 * can't be copied on write, so share it as well */
 			size_t pageCount = BYTES_2_PAGES(nvm->reg->getByteCount());
 			ssize_t res = getPageDir()->clone(dst->getPageDir(),vm->virt(),nvm->virt(),pageCount,
-					vm->reg->getFlags() & RF_SHAREABLE);
+					vm->reg->getFlags() & (RF_SHAREABLE | RF_NOFREE));
 			if(res < 0)
 				goto errorFreeArea;
 			dst->addOwn(res);
@@ -907,12 +993,33 @@ int VirtMem::cloneAll(VirtMem *dst) {
 				/* ignore it here if it fails */
 				ShFiles::add(nvm,dst->getProc()->getPid());
 			}
+			else if(vm->reg->getFlags() & RF_NOFREE) {
+				size_t sw,cow;
+				dst->addShared(nvm->reg->pageCount(&sw,&cow));
+			}
 			/* add frames to copy-on-write, if not shared */
 			else {
 				virt = nvm->virt();
+#if defined(__x86__)
+				bool sharedPT = false;
+#endif
 				for(j = 0; j < pageCount; j++) {
+#if defined(__x86__)
+					if(j == 0 || (virt & (PT_SIZE - 1)) == 0)
+						sharedPT = getPageDir()->getPageTables()->isSharedPT(virt);
+#endif
 					if(vm->reg->getPageFlags(j) & PF_SWAPPED)
 						dst->addSwap(1);
+#if defined(__x86__)
+					/* the pages in shared page-tables are made copy-on-write when unsharing them */
+					else if(sharedPT && !(vm->reg->getPageFlags(j) & PF_DEMANDLOAD)) {
+						if(!(vm->reg->getPageFlags(j) & PF_COPYONWRITE)) {
+							addShared(1);
+							addOwn(-1);
+						}
+						dst->addShared(1);
+					}
+#endif
 					/* not when demand-load or swapping is outstanding since we've not loaded it
 					 * from disk yet */
 					else if(!(vm->reg->getPageFlags(j) & (PF_DEMANDLOAD | PF_SWAPPED))) {
@@ -956,6 +1063,10 @@ errorPages:
 	/* undo the stats-change for this and remove the frames from copy-on-write */
 	for(; j-- > 0; ) {
 		virt -= PAGE_SIZE;
+#if defined(__x86__)
+		if(getPageDir()->getPageTables()->isSharedPT(virt))
+			continue;
+#endif
 		if(!(vm->reg->getPageFlags(j) & (PF_DEMANDLOAD | PF_SWAPPED))) {
 			bool other;
 			frameno_t frameNo = getPageDir()->getFrameNo(virt);
@@ -995,6 +1106,149 @@ errorRel:
 	return -ENOMEM;
 }
 
+VMRegion *VirtMem::getLendRegion(uintptr_t addr,size_t count) {
+	VMRegion *vm = regtree.getByAddr(addr);
+	/* shared regions would see changes of the frames and locked ones might be used for DMA */
+	if(vm == NULL || (vm->reg->getFlags() & (RF_SHAREABLE | RF_NOFREE | RF_LOCKED)))
+		return NULL;
+
+	size_t first = (addr - vm->virt()) / PAGE_SIZE;
+	if(first + count > BYTES_2_PAGES(vm->reg->getByteCount()))
+		return NULL;
+
+	vm->reg->acquire();
+	/* all pages have to be present; we don't want to load or swap them in here */
+	for(size_t i = 0; i < count; i++) {
+		if((vm->reg->getPageFlags(first + i) & (PF_DEMANDLOAD | PF_SWAPPED)) ||
+				!getPageDir()->isPresent(addr + i * PAGE_SIZE)) {
+			vm->reg->release();
+			return NULL;
+		}
+	}
+#if defined(__x86__)
+	/* the pages are remapped by our callers */
+	if(unsharePTs(vm,addr,count) < 0) {
+		vm->reg->release();
+		return NULL;
+	}
+#endif
+	return vm;
+}
+
+int VirtMem::lendPages(uintptr_t addr,size_t count,frameno_t *frames) {
+	acquire();
+	VMRegion *vm = getLendRegion(addr,count);
+	if(vm == NULL) {
+		release();
+		return -EFAULT;
+	}
+
+	/* <marked> is the number of pages that are copy-on-write, <lent> the number of references */
+	size_t marked,lent,first = (addr - vm->virt()) / PAGE_SIZE;
+	for(lent = 0, marked = 0; lent < count; lent++) {
+		ulong pgflags = vm->reg->getPageFlags(first + lent);
+		frames[lent] = getPageDir()->getFrameNo(addr + lent * PAGE_SIZE);
+		/* the owner needs a reference as well, if it hasn't one yet */
+		if(!(pgflags & PF_COPYONWRITE)) {
+			if(!CopyOnWrite::add(frames[lent]))
+				break;
+			vm->reg->setPageFlags(first + lent,pgflags | PF_COPYONWRITE);
+			addShared(1);
+			addOwn(-1);
+		}
+		marked++;
+		if(!CopyOnWrite::add(frames[lent]))
+			break;
+	}
+
+	/* write-protect the pages; the owner gets them back on the next write-access */
+	uint flags = PG_PRESENT;
+	if(vm->reg->getFlags() & RF_EXECUTABLE)
+		flags |= PG_EXECUTABLE;
+	PageTables::NoAllocator noalloc;
+	sassert(getPageDir()->map(addr,marked,noalloc,flags) == 0);
+
+	vm->reg->release();
+	release();
+
+	if(lent < count) {
+		releasePages(frames,lent);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+int VirtMem::adoptPages(uintptr_t addr,size_t count,const frameno_t *frames) {
+	acquire();
+	VMRegion *vm = getLendRegion(addr,count);
+	if(vm == NULL) {
+		release();
+		return -EFAULT;
+	}
+	if(!(vm->reg->getFlags() & RF_WRITABLE)) {
+		vm->reg->release();
+		release();
+		return -EFAULT;
+	}
+
+	/* first get our references, so that we don't have to undo the mapping */
+	size_t i;
+	for(i = 0; i < count; i++) {
+		if(!CopyOnWrite::add(frames[i])) {
+			while(i-- > 0) {
+				bool other;
+				CopyOnWrite::remove(frames[i],&other);
+			}
+			vm->reg->release();
+			release();
+			return -ENOMEM;
+		}
+	}
+
+	uint flags = PG_PRESENT;
+	if(vm->reg->getFlags() & RF_EXECUTABLE)
+		flags |= PG_EXECUTABLE;
+
+	size_t first = (addr - vm->virt()) / PAGE_SIZE;
+	for(i = 0; i < count; i++) {
+		uintptr_t virt = addr + i * PAGE_SIZE;
+		ulong pgflags = vm->reg->getPageFlags(first + i);
+		frameno_t old = getPageDir()->getFrameNo(virt);
+
+		/* replace the frame before we free the old one */
+		PageTables::RangeAllocator alloc(frames[i]);
+		sassert(getPageDir()->map(virt,1,alloc,flags) == 0);
+
+		if(pgflags & PF_COPYONWRITE) {
+			bool other;
+			addShared(-CopyOnWrite::remove(old,&other));
+			if(!other)
+				PhysMem::free(old,PhysMem::USR);
+		}
+		else {
+			PhysMem::free(old,PhysMem::USR);
+			addOwn(-1);
+		}
+
+		vm->reg->setPageFlags(first + i,pgflags | PF_COPYONWRITE);
+		addShared(1);
+	}
+
+	vm->reg->release();
+	release();
+	return 0;
+}
+
+void VirtMem::releasePages(const frameno_t *frames,size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		bool other;
+		CopyOnWrite::remove(frames[i],&other);
+		/* if the owner doesn't use it anymore, it's up to us to free it */
+		if(!other)
+			PhysMem::free(frames[i],PhysMem::USR);
+	}
+}
+
 int VirtMem::growStackTo(VMRegion *vm,uintptr_t addr) {
 	int res = -EFAULT;
 	acquire();
@@ -1079,6 +1333,17 @@ size_t VirtMem::doGrow(VMRegion *vm,ssize_t amount) {
 				}
 			}
 		}
+#if defined(__x86__)
+		/* the removed pages are unmapped below */
+		if(amount < 0) {
+			uintptr_t start = (vm->reg->getFlags() & RF_GROWS_DOWN)
+				? oldVirt : oldVirt + esc::Util::round_page_up(oldSize) + amount * PAGE_SIZE;
+			if(unsharePTs(vm,start,-amount) < 0) {
+				vm->reg->release();
+				return 0;
+			}
+		}
+#endif
 		size_t own = 0;
 		if((res = vm->reg->grow(amount,&own)) < 0) {
 			vm->reg->release();
@@ -1255,65 +1520,233 @@ int VirtMem::demandLoad(VMRegion *vm,uintptr_t addr) {
 }
 
 int VirtMem::loadFromFile(VMRegion *vm,uintptr_t addr,size_t loadCount) {
-	uint mapFlags;
-	frameno_t frame;
-	void *tempBuf;
+	Thread *t = Thread::getRunning();
+	Region *reg = vm->reg;
+	size_t page = (addr - vm->virt()) / PAGE_SIZE;
+	size_t start,count = getLoadWindow(vm,page,&start);
+#if defined(__x86__)
+	/* the window might reach into the next page-table, which might still be shared */
+	if(unsharePTs(vm,vm->virt() + start * PAGE_SIZE,count) < 0)
+		return -ENOMEM;
+#endif
+
 	/* note that we currently ignore that the file might have changed in the meantime */
 	ssize_t err;
-	off_t pos = vm->reg->getOffset() + (addr - vm->virt());
-	if((err = vm->reg->getFile()->seek(pos,SEEK_SET)) < 0)
-		goto error;
+	ulong gen;
+	OpenFile *file = reg->getFile();
+	off_t pos = reg->getOffset() + start * PAGE_SIZE;
+	/* pages of files in userspace filesystems can be cached, if they are page aligned in the file.
+	 * the cached frames are shared copy-on-write, which doesn't work for shared writable regions */
+	bool cacheable = file->getDev() != VFS_DEV_NO && (reg->getOffset() & (PAGE_SIZE - 1)) == 0 &&
+		(reg->getFlags() & (RF_SHAREABLE | RF_WRITABLE)) != (RF_SHAREABLE | RF_WRITABLE);
+
+	/* if the faulting page is in the page cache, share the window with it as far as possible */
+	if(cacheable && loadCount == PAGE_SIZE) {
+		frameno_t first = PageCache::share(file->getDev(),file->getNodeNo(),
+			pos + (page - start) * PAGE_SIZE);
+		if(first != PhysMem::INVALID_FRAME) {
+			for(size_t i = 0; i < count; ++i) {
+				frameno_t frame = first;
+				ulong pflags = reg->getPageFlags(start + i);
+				if(start + i != page) {
+					frame = PageCache::share(file->getDev(),file->getNodeNo(),pos + i * PAGE_SIZE);
+					/* pages that are not cached stay unloaded; they will be read by the next fault */
+					if(frame == PhysMem::INVALID_FRAME)
+						continue;
+					/* the flags of the faulting page are changed by the caller */
+					pflags &= ~PF_DEMANDLOAD;
+				}
 
-	/* first read into a temp-buffer because we can't mark the page as present until
-	 * its read from disk. and we can't use a temporary mapping when switching
-	 * threads. */
-	tempBuf = Cache::alloc(PAGE_SIZE);
-	if(tempBuf == NULL) {
-		err = -ENOMEM;
-		goto error;
+				PageDir::demandLoad(frame,NULL,PAGE_SIZE,reg->getFlags());
+				mapLoaded(vm,vm->virt() + (start + i) * PAGE_SIZE,frame,true);
+				reg->setPageFlags(start + i,pflags | PF_COPYONWRITE);
+			}
+			return 0;
+		}
 	}
-	err = vm->reg->getFile()->read(tempBuf,loadCount);
-	if(err != (ssize_t)loadCount) {
-		if(err >= 0)
-			err = -ENOMEM;
-		goto errorFree;
-	}
-
-	/* copy into frame */
-	frame = PageDir::demandLoad(tempBuf,loadCount,vm->reg->getFlags());
-
-	/* free resources not needed anymore */
-	Cache::free(tempBuf);
-
-	/* map into all pagedirs */
-	{
-		mapFlags = PG_PRESENT;
-		if(vm->reg->getFlags() & RF_WRITABLE)
-			mapFlags |= PG_WRITABLE;
-		if(vm->reg->getFlags() & RF_EXECUTABLE)
-			mapFlags |= PG_EXECUTABLE;
-		for(auto mp = vm->reg->vmbegin(); mp != vm->reg->vmend(); ++mp) {
-			PageTables::RangeAllocator alloc(frame);
-			/* the region may be mapped to a different virtual address */
-			VMRegion *mpreg = (*mp)->regtree.getByReg(vm->reg);
-			/* can't fail */
-			sassert((*mp)->getPageDir()->map(mpreg->virt() + (addr - vm->virt()),1,alloc,mapFlags) == 0);
-			if(vm->reg->getFlags() & RF_SHAREABLE)
-				(*mp)->addShared(1);
-			else
-				(*mp)->addOwn(1);
+
+	/* we need a frame for every page. don't swap for the additional ones; just load less */
+	size_t reserved = t->getReservedFrmCnt();
+	if(count > reserved)
+		reserved += t->reserveMoreFrames(count - reserved);
+	if(count > reserved) {
+		start = page;
+		count = 1;
+		pos = reg->getOffset() + start * PAGE_SIZE;
+	}
+
+	/* take the frames first, so that we can read the file contents directly into them. frames
+	 * that we can access permanently (which are all on x86_64) and that are physically contiguous
+	 * are read with one request. the others (e.g., above the direct map on i586) can't be accessed
+	 * over a thread switch, so that they are read page by page into a temporary page. */
+	frameno_t frames[esc::Util::max(FAULT_AROUND_PAGES,READAHEAD_MAX_PAGES)];
+	char *tmp = NULL;
+	size_t taken = 0;
+	for(; taken < count; ++taken)
+		frames[taken] = t->getFrame();
+
+	gen = PageCache::getGeneration();
+	if((err = file->seek(pos,SEEK_SET)) < 0)
+		goto error;
+	for(size_t i = 0; i < count; ) {
+		/* only the page that caused the fault might not be a full one, and it's the last one */
+		size_t n = 1;
+		bool direct = PageDir::hasDirectAccess(frames[i]);
+		while(direct && i + n < count && frames[i + n] == frames[i] + n &&
+				PageDir::hasDirectAccess(frames[i + n]))
+			n++;
+		size_t bytes = (n - 1) * PAGE_SIZE + (start + i + n - 1 == page ? loadCount : PAGE_SIZE);
+
+		char *dst;
+		if(direct)
+			dst = (char*)PageDir::getAccess(frames[i]);
+		else {
+			if(tmp == NULL && (tmp = (char*)Cache::alloc(PAGE_SIZE)) == NULL) {
+				err = -ENOMEM;
+				goto error;
+			}
+			dst = tmp;
 		}
+
+		err = file->read(dst,bytes);
+		if(direct)
+			PageDir::removeAccess(frames[i]);
+		if(err != (ssize_t)bytes) {
+			if(err >= 0)
+				err = -ENOMEM;
+			goto error;
+		}
+
+		for(size_t j = 0; j < n; ++j) {
+			size_t amount = start + i + j == page ? loadCount : PAGE_SIZE;
+			PageDir::demandLoad(frames[i + j],direct ? NULL : tmp,amount,reg->getFlags());
+		}
+		i += n;
+	}
+	Cache::free(tmp);
+
+	/* map them into all pagedirs */
+	for(size_t i = 0; i < count; ++i) {
+		size_t amount = start + i == page ? loadCount : PAGE_SIZE;
+
+		/* only full pages can be cached. the cache shares the frame with us copy-on-write */
+		bool cow = cacheable && amount == PAGE_SIZE &&
+			PageCache::insert(file->getDev(),file->getNodeNo(),pos + i * PAGE_SIZE,frames[i],gen);
+		mapLoaded(vm,vm->virt() + (start + i) * PAGE_SIZE,frames[i],cow);
+
+		/* the flags of the faulting page are changed by the caller */
+		ulong pflags = reg->getPageFlags(start + i);
+		if(start + i != page)
+			pflags &= ~PF_DEMANDLOAD;
+		reg->setPageFlags(start + i,pflags | (cow ? PF_COPYONWRITE : 0));
 	}
 	return 0;
 
-errorFree:
-	Cache::free(tempBuf);
 error:
+	Cache::free(tmp);
+	for(size_t i = 0; i < taken; ++i)
+		PhysMem::free(frames[i],PhysMem::USR);
+	reg->setReadAhead(0,0);
 	Log::get().writef("Demandload page @ %p for proc %s: %s (%d)\n",addr,
 		proc->getProgram(),strerror(err),err);
 	return err;
 }
 
+size_t VirtMem::getLoadWindow(VMRegion *vm,size_t page,size_t *start) {
+	Region *reg = vm->reg;
+	/* only full pages that are loaded from the file can be loaded in addition */
+	size_t filePages = reg->getLoadCount() / PAGE_SIZE;
+	size_t end;
+
+	/* if the region is accessed sequentially, double the number of pages each time */
+	size_t pages = FAULT_AROUND_PAGES;
+	if(reg->getRAPages() > 0 && page == reg->getRANext()) {
+		pages = esc::Util::min(reg->getRAPages() * 2,READAHEAD_MAX_PAGES);
+		*start = page;
+	}
+	/* otherwise load the surrounding pages, if they haven't been loaded yet */
+	else {
+		*start = page;
+		size_t first = esc::Util::round_dn(page,FAULT_AROUND_PAGES);
+		while(*start > first && (reg->getPageFlags(*start - 1) & PF_DEMANDLOAD))
+			(*start)--;
+	}
+
+	end = page + 1;
+	while(end < *start + pages && end < filePages && (reg->getPageFlags(end) & PF_DEMANDLOAD))
+		end++;
+
+	reg->setReadAhead(end,pages);
+	return end - *start;
+}
+
+void VirtMem::mapLoaded(VMRegion *vm,uintptr_t addr,frameno_t frame,bool cow) {
+	uint mapFlags = PG_PRESENT;
+	if(!cow && (vm->reg->getFlags() & RF_WRITABLE))
+		mapFlags |= PG_WRITABLE;
+	if(vm->reg->getFlags() & RF_EXECUTABLE)
+		mapFlags |= PG_EXECUTABLE;
+	for(auto mp = vm->reg->vmbegin(); mp != vm->reg->vmend(); ++mp) {
+		PageTables::RangeAllocator alloc(frame);
+		/* the region may be mapped to a different virtual address */
+		VMRegion *mpreg = (*mp)->regtree.getByReg(vm->reg);
+		/* can't fail */
+		sassert((*mp)->getPageDir()->map(mpreg->virt() + (addr - vm->virt()),1,alloc,mapFlags) == 0);
+		if(cow || (vm->reg->getFlags() & RF_SHAREABLE))
+			(*mp)->addShared(1);
+		else
+			(*mp)->addOwn(1);
+	}
+}
+
+#if defined(__x86__)
+int VirtMem::unsharePTs(VMRegion *vm,uintptr_t addr,size_t count) {
+	uintptr_t end = addr + count * PAGE_SIZE;
+	SMP::beginTLBBatch();
+	for(uintptr_t base = addr & ~(PT_SIZE - 1); base < end; base += PT_SIZE) {
+		PageTables::NoAllocator alloc;
+		int res = getPageDir()->getPageTables()->unsharePT(base,alloc);
+		if(res < 0) {
+			SMP::endTLBBatch();
+			return res;
+		}
+		if(res == 0)
+			continue;
+
+		/* other CPUs might still use the shared page-table */
+		SMP::flushTLB(getPageDir(),base,1);
+		addOwn(alloc.pageTables());
+
+		/* shared page-tables are always completely covered by the region */
+		size_t first = (base - vm->virt()) / PAGE_SIZE;
+		for(size_t i = 0; i < PT_ENTRY_COUNT; ++i) {
+			uintptr_t virt = base + i * PAGE_SIZE;
+			ulong pgflags = vm->reg->getPageFlags(first + i);
+			if((pgflags & (PF_COPYONWRITE | PF_DEMANDLOAD | PF_SWAPPED)) || !getPageDir()->isPresent(virt))
+				continue;
+
+			/* if we got the page-table back and nobody else took the frame, it's ours again */
+			if(res == 1 && *PhysMem::getRefCount(getPageDir()->getFrameNo(virt)) == 0) {
+				addShared(-1);
+				addOwn(1);
+				continue;
+			}
+
+			/* otherwise, it's copy-on-write now. the copy has been write-protected already */
+			vm->reg->setPageFlags(first + i,pgflags | PF_COPYONWRITE);
+			if(res == 1) {
+				uint flags = PG_PRESENT;
+				if(vm->reg->getFlags() & RF_EXECUTABLE)
+					flags |= PG_EXECUTABLE;
+				sassert(getPageDir()->map(virt,1,alloc,flags) == 0);
+			}
+		}
+	}
+	SMP::endTLBBatch();
+	return 0;
+}
+#endif
+
 Region *VirtMem::getLRURegion() {
 	Region *lru = NULL;
 	uint64_t ts = (uint64_t)-1;
@@ -1358,25 +1791,64 @@ Region *VirtMem::getLRURegion() {
 	return lru;
 }
 
-ssize_t VirtMem::getPgIdxForSwap(const Region *reg) {
-	size_t pages = BYTES_2_PAGES(reg->getByteCount());
-	size_t count = 0;
-	for(size_t i = 0; i < pages; i++) {
-		if(!(reg->getPageFlags(i) & (PF_SWAPPED | PF_COPYONWRITE | PF_DEMANDLOAD)))
-			count++;
-	}
-	if(count > 0) {
-		size_t index = Util::rand() % count;
-		for(size_t i = 0; i < pages; i++) {
-			if(!(reg->getPageFlags(i) & (PF_SWAPPED | PF_COPYONWRITE | PF_DEMANDLOAD))) {
-				if(index-- == 0)
-					return i;
+size_t VirtMem::getPagesForSwap(Region *reg,size_t *pages,size_t count) {
+	size_t total = BYTES_2_PAGES(reg->getByteCount());
+	size_t hand = reg->getClockHand() % total;
+	size_t n = 0;
+
+	/* CLOCK: walk over the pages, starting where we stopped last time. pages that have been
+	 * accessed since the last round get a second chance; their accessed-bit is cleared. in the
+	 * second round, we take what we haven't taken yet, so that we always find something if the
+	 * region has any pages to swap out (and on architectures without accessed-bits, its FIFO) */
+	for(int pass = 0; pass < 2 && n < count; ++pass) {
+		for(size_t i = 0; i < total && n < count; ++i) {
+			size_t idx = (hand + i) % total;
+			if(reg->getPageFlags(idx) & (PF_SWAPPED | PF_COPYONWRITE | PF_DEMANDLOAD))
+				continue;
+#if defined(__x86__)
+			/* these are used by other processes as well */
+			if(isInSharedPT(reg,idx))
+				continue;
+#endif
+			if(pass == 0 && clearAccessed(reg,idx))
+				continue;
+			if(pass == 1) {
+				bool taken = false;
+				for(size_t j = 0; j < n; ++j)
+					taken |= pages[j] == idx;
+				if(taken)
+					continue;
 			}
+			pages[n++] = idx;
+			reg->setClockHand(idx + 1);
 		}
 	}
-	return -1;
+	return n;
 }
 
+bool VirtMem::clearAccessed(Region *reg,size_t index) {
+	bool accessed = false;
+	for(auto mp = reg->vmbegin(); mp != reg->vmend(); ++mp) {
+		/* the region may be mapped to a different virtual address */
+		VMRegion *mpreg = (*mp)->regtree.getByReg(reg);
+		if((*mp)->getPageDir()->clearAccessed(mpreg->virt() + index * PAGE_SIZE))
+			accessed = true;
+	}
+	return accessed;
+}
+
+#if defined(__x86__)
+bool VirtMem::isInSharedPT(Region *reg,size_t index) {
+	for(auto mp = reg->vmbegin(); mp != reg->vmend(); ++mp) {
+		/* the region may be mapped to a different virtual address */
+		VMRegion *mpreg = (*mp)->regtree.getByReg(reg);
+		if((*mp)->getPageDir()->getPageTables()->isSharedPT(mpreg->virt() + index * PAGE_SIZE))
+			return true;
+	}
+	return false;
+}
+#endif
+
 void VirtMem::setSwappedOut(Region *reg,size_t index) {
 	uintptr_t offset = index * PAGE_SIZE;
 	PageTables::NoAllocator alloc;
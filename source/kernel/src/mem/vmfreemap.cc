@@ -45,10 +45,21 @@ void VMFreeMap::clear() {
 	list = NULL;
 }
 
-uintptr_t VMFreeMap::allocate(size_t size) {
+uintptr_t VMFreeMap::allocate(size_t size,size_t align) {
 	Area *a;
 	/* TODO is that correct on archs with page-size != 0x1000? */
 	assert((size & 0xFFF) == 0);
+
+	/* for aligned areas, take the first area that has enough space behind the aligned address */
+	if(align > PAGE_SIZE) {
+		for(a = list; a != NULL; a = a->next) {
+			uintptr_t start = (a->addr + align - 1) & ~(align - 1);
+			if(start >= a->addr && start + size <= a->addr + a->size)
+				return allocateAt(start,size) ? start : 0;
+		}
+		return 0;
+	}
+
 	Area *p = NULL;
 	for(a = list; a != NULL; p = a, a = a->next) {
 		if(a->size >= size)
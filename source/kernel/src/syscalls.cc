@@ -123,6 +123,7 @@ const Syscalls::handler_func Syscalls::syscalls[] = {
 	utime,
 	truncate,
 	symlink,
+	spawn,
 #if defined(__x86__)
 	reqports,
 	relports,
@@ -292,8 +292,8 @@ int Syscalls::sendrecv(Thread *t,IntrptStackFrame *stack) {
 	if(EXPECT_FALSE(!file->isDevice() && isDeviceMsg(mid & 0xFFFF)))
 		SYSC_ERROR(stack,-EPERM);
 
-	/* send msg */
-	ssize_t res = file->sendMsg(mid,data,size,NULL,0);
+	/* send msg and hand the CPU over to the receiver, since we'll wait for the response anyway */
+	ssize_t res = file->sendMsg(mid,data,size,NULL,0,VFS_HANDOFF);
 	if(EXPECT_FALSE(res < 0))
 		SYSC_ERROR(stack,res);
 
@@ -144,3 +144,22 @@ int Syscalls::exec(Thread *t,IntrptStackFrame *stack) {
 	int res = Proc::exec(&*file,fd,args,env);
 	SYSC_RESULT(stack,res);
 }
+
+int Syscalls::spawn(Thread *t,IntrptStackFrame *stack) {
+	int fd = (int)SYSC_ARG1(stack);
+	const char *const *args = (const char *const *)SYSC_ARG2(stack);
+	const char *const *env = (const char *const *)SYSC_ARG3(stack);
+	Proc *p = t->getProc();
+
+	{
+		/* don't hold the file during the clone; the child requests it again */
+		ScopedFile file(p,fd);
+		if(!file)
+			SYSC_ERROR(stack,-EBADF);
+		if((file->getFlags() & (VFS_EXEC | VFS_READ)) != (VFS_EXEC | VFS_READ))
+			SYSC_ERROR(stack,-EACCES);
+	}
+
+	int res = Proc::spawn(fd,args,env);
+	SYSC_RESULT(stack,res);
+}
@@ -238,7 +238,7 @@ void ProcBase::getMemUsage(size_t *dataShared,size_t *dataOwn,size_t *dataReal)
 	*dataReal = dReal + (CopyOnWrite::getFrmCount() * PAGE_SIZE);
 }
 
-int ProcBase::clone(uint8_t flags) {
+int ProcBase::clone(uint8_t flags,bool stackOnly) {
 	int newPid,res = 0;
 	Proc *p,*cur;
 	Thread *nt,*curThread = Thread::getRunning();
@@ -318,7 +318,7 @@ int ProcBase::clone(uint8_t flags) {
 
 	/* clone regions */
 	p->virtmem.init();
-	if((res = cur->virtmem.cloneAll(&p->virtmem)) < 0)
+	if((res = cur->virtmem.cloneAll(&p->virtmem,stackOnly)) < 0)
 		goto errorGroups;
 
 	/* clone current thread */
@@ -441,56 +441,131 @@ errorReqProc:
 
 int ProcBase::exec(OpenFile *file,int fd,USER const char *const *args,USER const char *const *env) {
 	char *argBuffer;
-	ELF::StartupInfo info;
-	Thread *t = Thread::getRunning();
-	Proc *p = request(t->getProc()->pid,PLOCK_PROG);
-	size_t argSize = EXEC_MAX_ARGSIZE;
-	int argc,envc,res;
-	if(!p)
-		return -ESRCH;
-	/* don't allow exec when the process should die */
-	if(p->flags & (P_ZOMBIE | P_PREZOMBIE)) {
-		res = -EINVAL;
-		goto error;
+	size_t argSize;
+	int argc,envc;
+	int res = copyArgs(args,env,&argBuffer,&argSize,&argc,&envc);
+	if(res < 0)
+		return res;
+	return doExec(file,fd,argBuffer,argSize,argc,envc);
+}
+
+int ProcBase::spawn(int fd,USER const char *const *args,USER const char *const *env) {
+	char *argBuffer;
+	size_t argSize;
+	int argc,envc;
+	/* copy the arguments now, because the child can't access our address space */
+	int res = copyArgs(args,env,&argBuffer,&argSize,&argc,&envc);
+	if(res < 0)
+		return res;
+
+	/* the child tells us whether the exec succeeded, so that we can report errors to our caller */
+	SpawnResult *result = new SpawnResult();
+	if(!result) {
+		Cache::free(argBuffer);
+		return -ENOMEM;
 	}
-	/* we can't do an exec if we have multiple threads (init can do that, because the threads are
-	 * "kernel-threads") */
-	if(p->pid != 0 && p->threads.length() > 1) {
-		res = -EINVAL;
-		goto error;
+
+	res = clone(0,true);
+	if(res != 0) {
+		/* if the child has been created, it owns the arguments */
+		if(res < 0) {
+			Cache::free(argBuffer);
+			delete result;
+			return res;
+		}
+
+		pid_t pid = res;
+		result->sem.down();
+		res = result->res;
+		delete result;
+		/* the child is dying in this case. since our caller never got its pid, collect it here */
+		if(res < 0) {
+			waitChild(NULL,pid,0);
+			return res;
+		}
+		return pid;
 	}
 
-	argc = 0;
-	envc = 0;
-	argBuffer = NULL;
+	/* we're the child. we got the file descriptors of our parent, but nothing we could return to */
+	Proc *p = Thread::getRunning()->getProc();
+	OpenFile *file = FileDesc::request(p,fd);
+	if(file) {
+		res = doExec(file,fd,argBuffer,argSize,argc,envc);
+		FileDesc::release(file);
+	}
+	else {
+		Cache::free(argBuffer);
+		res = -EBADF;
+	}
+
+	/* our parent frees the result as soon as we've signaled it; so, don't touch it afterwards */
+	result->res = res;
+	result->sem.up();
+	if(res < 0)
+		terminate(SIG_COUNT);
+	return 0;
+}
+
+int ProcBase::copyArgs(USER const char *const *args,USER const char *const *env,char **argBuffer,
+		size_t *argSize,int *argc,int *envc) {
+	size_t rem = EXEC_MAX_ARGSIZE;
+	int res;
+	*argc = 0;
+	*envc = 0;
+	*argBuffer = NULL;
 	if(args != NULL || env != NULL) {
 		/* alloc space for the arguments */
-		argBuffer = (char*)Cache::alloc(EXEC_MAX_ARGSIZE);
-		if(argBuffer == NULL) {
-			res = -ENOMEM;
-			goto error;
-		}
+		*argBuffer = (char*)Cache::alloc(EXEC_MAX_ARGSIZE);
+		if(*argBuffer == NULL)
+			return -ENOMEM;
 
 		/* copy arguments into buffer */
 		if(args != NULL) {
-			argc = buildArgs(args,argBuffer,&argSize);
-			if(argc < 0) {
-				res = argc;
-				goto errorFree;
+			*argc = buildArgs(args,*argBuffer,&rem);
+			if(*argc < 0) {
+				res = *argc;
+				goto error;
 			}
 		}
 
 		/* copy env into buffer */
 		if(env != NULL) {
-			size_t current = EXEC_MAX_ARGSIZE - argSize;
-			envc = buildArgs(env,argBuffer + current,&argSize);
-			if(envc < 0) {
-				res = envc;
-				goto errorFree;
+			size_t current = EXEC_MAX_ARGSIZE - rem;
+			*envc = buildArgs(env,*argBuffer + current,&rem);
+			if(*envc < 0) {
+				res = *envc;
+				goto error;
 			}
 		}
 	}
-	argSize = EXEC_MAX_ARGSIZE - argSize;
+	*argSize = EXEC_MAX_ARGSIZE - rem;
+	return 0;
+
+error:
+	Cache::free(*argBuffer);
+	return res;
+}
+
+int ProcBase::doExec(OpenFile *file,int fd,char *argBuffer,size_t argSize,int argc,int envc) {
+	ELF::StartupInfo info;
+	Thread *t = Thread::getRunning();
+	Proc *p = request(t->getProc()->pid,PLOCK_PROG);
+	int res;
+	if(!p) {
+		Cache::free(argBuffer);
+		return -ESRCH;
+	}
+	/* don't allow exec when the process should die */
+	if(p->flags & (P_ZOMBIE | P_PREZOMBIE)) {
+		res = -EINVAL;
+		goto error;
+	}
+	/* we can't do an exec if we have multiple threads (init can do that, because the threads are
+	 * "kernel-threads") */
+	if(p->pid != 0 && p->threads.length() > 1) {
+		res = -EINVAL;
+		goto error;
+	}
 
 	/* remove all except stack */
 	doRemoveRegions(p,false);
@@ -533,10 +608,9 @@ int ProcBase::exec(OpenFile *file,int fd,USER const char *const *args,USER const
 	Cache::free(argBuffer);
 	return 0;
 
-errorFree:
-	Cache::free(argBuffer);
 error:
 	release(p,PLOCK_PROG);
+	Cache::free(argBuffer);
 	return res;
 
 errorTerm:
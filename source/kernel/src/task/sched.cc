@@ -41,49 +41,162 @@
  * the beginning and end. Therefore we can dequeue the first, prepend, append and remove a thread
  * in O(1). Additionally the number of threads is limited by the kernel-heap (i.e. we don't need
  * a static storage of nodes for the linked list; we use the threads itself)
+ *
+ * Every CPU has its own ready-queues, protected by its own lock. A thread is always put into the
+ * queues of the CPU it has affinity to, which is the CPU that executed it last. Thus, it stays on
+ * that CPU as long as possible. Only if a CPU has nothing to do, it steals a thread from the
+ * busiest other CPU, which changes the affinity of the thread to the stealing CPU.
+ *
+ * The state of a thread is protected by the lock of its ready-queue. Waiting threads are put into
+ * wait-queues, which are selected by hashing the event and object. Thus, a wakeup only has to
+ * look at the threads that wait for something that lands in the same wait-queue instead of all
+ * threads that wait for this event. Every wait-queue has its own lock, which always has to be
+ * acquired before the lock of a ready-queue. To change the event of a thread, both locks are
+ * required.
  */
 
-SpinLock Sched::lock;
-ulong Sched::readyMask = 0;
-esc::DList<Thread> Sched::rdyQueues[MAX_PRIO + 1];
-esc::DList<Thread> Sched::evlists[EV_COUNT];
-size_t Sched::rdyCount;
-Thread **Sched::idleThreads;
+struct Sched::RunQueue {
+	SpinLock lock;
+	ulong readyMask;
+	size_t count;
+	esc::DList<Thread> queues[MAX_PRIO + 1];
+	Thread *idle;
+	/* the thread that got this CPU from a thread that is about to block (and its priority) */
+	Thread *handoff;
+	uint8_t handoffPrio;
+};
+
+Sched::WaitQueue Sched::waitQueues[WAIT_QUEUE_COUNT];
+Sched::RunQueue *Sched::runQueues;
 
 void Sched::init() {
-	idleThreads = (Thread**)Cache::calloc(SMP::getCPUCount(),sizeof(Thread*));
-	if(!idleThreads)
-		Util::panic("Unable to allocate idle-threads array");
-	rdyCount = 0;
+	runQueues = (RunQueue*)Cache::calloc(SMP::getCPUCount(),sizeof(RunQueue));
+	if(!runQueues)
+		Util::panic("Unable to allocate ready-queues");
+}
+
+ulong Sched::getReadyMask(cpuid_t cpu) {
+	return runQueues[cpu].readyMask;
 }
 
 void Sched::addIdleThread(Thread *t) {
-	LockGuard<SpinLock> g(&lock);
 	for(size_t i = 0; i < SMP::getCPUCount(); ++i) {
-		if(idleThreads[i] == NULL) {
-			idleThreads[i] = t;
+		LockGuard<SpinLock> g(&runQueues[i].lock);
+		if(runQueues[i].idle == NULL) {
+			runQueues[i].idle = t;
 			break;
 		}
 	}
 }
 
-void Sched::enqueue(Thread *t) {
+Sched::RunQueue *Sched::lockQueue(Thread *t) {
+	while(true) {
+		cpuid_t cpu = t->affinity;
+		RunQueue *rq = runQueues + cpu;
+		rq->lock.down();
+		if(EXPECT_TRUE(t->affinity == cpu))
+			return rq;
+		rq->lock.up();
+	}
+}
+
+Sched::RunQueue *Sched::lockQueues(Thread *t,cpuid_t cpu) {
+	RunQueue *own = runQueues + cpu;
+	while(true) {
+		cpuid_t tcpu = t->affinity;
+		RunQueue *rq = runQueues + tcpu;
+		/* always lock the queue of the lower CPU first to prevent deadlocks */
+		if(tcpu < cpu)
+			rq->lock.down();
+		own->lock.down();
+		if(tcpu > cpu)
+			rq->lock.down();
+		if(EXPECT_TRUE(t->affinity == tcpu))
+			return rq;
+		if(tcpu != cpu)
+			rq->lock.up();
+		own->lock.up();
+	}
+}
+
+Sched::WaitQueue *Sched::getWaitQueue(uint event,evobj_t object) {
+	/* the objects are heap-pointers, so that the lowest bits don't tell us much */
+	size_t hash = ((object >> 4) ^ (object >> 12)) + event * 31;
+	return waitQueues + (hash % WAIT_QUEUE_COUNT);
+}
+
+Sched::WaitQueue *Sched::lockWaitQueue(Thread *t,RunQueue **rq) {
+	while(true) {
+		WaitQueue *wq = t->event ? getWaitQueue(t->event,t->evobject) : NULL;
+		if(wq)
+			wq->lock.down();
+		*rq = lockQueue(t);
+		/* the event can't change anymore, because we hold the lock of the ready-queue */
+		if(EXPECT_TRUE(t->event == 0 || getWaitQueue(t->event,t->evobject) == wq))
+			return wq;
+		(*rq)->lock.up();
+		if(wq)
+			wq->lock.up();
+	}
+}
+
+void Sched::enqueue(RunQueue *rq,Thread *t,bool front) {
 	uint8_t prio = t->getPriority();
-	rdyQueues[prio].append(t);
-	readyMask |= 1UL << prio;
-	rdyCount++;
+	if(front)
+		rq->queues[prio].prepend(t);
+	else
+		rq->queues[prio].append(t);
+	rq->readyMask |= 1UL << prio;
+	rq->count++;
 }
 
-void Sched::dequeue(Thread *t) {
+void Sched::dequeue(RunQueue *rq,Thread *t) {
 	uint8_t prio = t->getPriority();
-	rdyQueues[prio].remove(t);
-	if(rdyQueues[prio].length() == 0)
-		readyMask &= ~(1UL << prio);
-	rdyCount--;
+	rq->queues[prio].remove(t);
+	if(rq->queues[prio].length() == 0)
+		rq->readyMask &= ~(1UL << prio);
+	rq->count--;
+}
+
+Thread *Sched::steal(cpuid_t cpu) {
+	/* search for the CPU with the most ready threads; we don't need the locks for that */
+	RunQueue *victim = NULL;
+	size_t max = 0;
+	for(size_t i = 0; i < SMP::getCPUCount(); ++i) {
+		if(i != cpu && runQueues[i].count > max) {
+			victim = runQueues + i;
+			max = victim->count;
+		}
+	}
+	/* we're holding our own lock, so don't wait for the other one to prevent deadlocks */
+	if(!victim || !victim->lock.tryDown())
+		return NULL;
+
+	Thread *t = NULL;
+	for(ssize_t i = MAX_PRIO; i >= 0; i--) {
+		t = victim->queues[i].removeFirst();
+		if(t) {
+			if(victim->queues[i].length() == 0)
+				victim->readyMask &= ~(1UL << i);
+			victim->count--;
+			/* from now on, it belongs to us */
+			t->affinity = cpu;
+			break;
+		}
+	}
+	victim->lock.up();
+	return t;
 }
 
 Thread *Sched::perform(Thread *old,cpuid_t cpu) {
-	LockGuard<SpinLock> g(&lock);
+	/* we only need the lock of the wait-queue if the old thread is still in one. nobody else can
+	 * put it into one, because it's running, i.e. if it's not in one now, it won't be later. */
+	WaitQueue *wq = old && old->event != 0 ? getWaitQueue(old->event,old->evobject) : NULL;
+	if(wq)
+		wq->lock.down();
+	RunQueue *rq = runQueues + cpu;
+	rq->lock.down();
+
 	/* give the old thread a new state */
 	if(old) {
 		if(old->getFlags() & T_IDLE)
@@ -98,38 +211,61 @@ Thread *Sched::perform(Thread *old,cpuid_t cpu) {
 				old->setNewState(Thread::READY);
 				old->waitstart = 0;
 				removeFromEventlist(old);
+				rq->lock.up();
+				if(wq)
+					wq->lock.up();
 				return old;
 			}
 
 			old->setState(old->getNewState());
 			if(old->getNewState() == Thread::READY) {
 				assert(old->event == 0);
-				enqueue(old);
+				enqueue(rq,old);
 			}
 		}
 	}
+	if(wq)
+		wq->lock.up();
 
-	/* get new thread */
-	Thread *t;
-	for(ssize_t i = MAX_PRIO; i >= 0; i--) {
-		t = rdyQueues[i].removeFirst();
-		if(t) {
-			/* if its the old thread again and we have more ready threads, don't take this one again.
-			 * because we assume that Thread::switchAway() has been called for a reason. therefore, it
-			 * should be better to take a thread with a lower priority than taking the same again */
-			if(rdyCount > 1 && t == old) {
-				rdyQueues[i].append(t);
-				continue;
+	/* if the old thread blocked after handing the CPU over, switch to the receiver directly, even
+	 * if there are threads with a higher priority. that is, it runs in the time of the sender, as
+	 * if it were called by it. the thread might have been dequeued meanwhile, so check whether it
+	 * is still at the front, without touching it */
+	Thread *t = NULL;
+	Thread *ho = rq->handoff;
+	rq->handoff = NULL;
+	if(ho && old && old->getState() == Thread::BLOCKED &&
+			rq->queues[rq->handoffPrio].length() > 0 && &*rq->queues[rq->handoffPrio].begin() == ho) {
+		dequeue(rq,ho);
+		t = ho;
+	}
+	/* otherwise, get the next thread by priority */
+	else {
+		for(ssize_t i = MAX_PRIO; i >= 0; i--) {
+			t = rq->queues[i].removeFirst();
+			if(t) {
+				/* if its the old thread again and we have more ready threads, don't take this one
+				 * again. because we assume that Thread::switchAway() has been called for a reason.
+				 * therefore, it should be better to take a thread with a lower priority than taking
+				 * the same again */
+				if(rq->count > 1 && t == old) {
+					rq->queues[i].append(t);
+					continue;
+				}
+				if(rq->queues[i].length() == 0)
+					rq->readyMask &= ~(1UL << i);
+				rq->count--;
+				break;
 			}
-			if(rdyQueues[i].length() == 0)
-				readyMask &= ~(1UL << i);
-			rdyCount--;
-			break;
 		}
 	}
+	/* if we have nothing to do, help the busiest CPU */
+	if(t == NULL)
+		t = steal(cpu);
+
 	if(t == NULL) {
 		/* choose an idle-thread */
-		t = idleThreads[cpu];
+		t = rq->idle;
 		t->setState(Thread::RUNNING);
 	}
 	else {
@@ -137,14 +273,18 @@ Thread *Sched::perform(Thread *old,cpuid_t cpu) {
 		t->setNewState(Thread::READY);
 	}
 
-	/* if there is another thread ready, check if we have another cpu that we can start for it */
-	if(rdyCount > 0)
-		SMP::wakeupCPU();
+	/* if there is another thread ready, check if we have another cpu that can steal it */
+	if(rq->count > 0)
+		SMP::wakeupCPU(cpu);
+	rq->lock.up();
+
+	/* stop the regular tick if we're idling */
+	Timer::setIdle(cpu,t->getFlags() & T_IDLE);
 	return t;
 }
 
 void Sched::adjustPrio(Thread *t,uint64_t total) {
-	LockGuard<SpinLock> g(&lock);
+	RunQueue *rq = lockQueue(t);
 	/* if it is still blocked, add the time to the blocked time */
 	if(t->waitstart > 0) {
 		uint64_t now = CPU::rdtsc();
@@ -175,10 +315,10 @@ void Sched::adjustPrio(Thread *t,uint64_t total) {
 	if(t->stats.blocked < BAD_BLOCK_TIME(total)) {
 		if(t->getPriority() > 0) {
 			if(t->getState() == Thread::READY)
-				dequeue(t);
+				dequeue(rq,t);
 			t->setPriority(t->getPriority() - 1);
 			if(t->getState() == Thread::READY)
-				enqueue(t);
+				enqueue(rq,t);
 		}
 		t->prioGoodCnt = 0;
 	}
@@ -188,10 +328,10 @@ void Sched::adjustPrio(Thread *t,uint64_t total) {
 			/* but don't do that immediately, but only if it happened multiple times */
 			if(++t->prioGoodCnt == PRIO_FORGIVE_CNT) {
 				if(t->getState() == Thread::READY)
-					dequeue(t);
+					dequeue(rq,t);
 				t->setPriority(t->getPriority() + 1);
 				if(t->getState() == Thread::READY)
-					enqueue(t);
+					enqueue(rq,t);
 				t->prioGoodCnt = 0;
 			}
 		}
@@ -199,44 +339,86 @@ void Sched::adjustPrio(Thread *t,uint64_t total) {
 
 	/* reset blocked time */
 	t->stats.blocked = 0;
+	rq->lock.up();
 }
 
 void Sched::wait(Thread *t,uint event,evobj_t object) {
-	LockGuard<SpinLock> g(&lock);
 	assert(t->event == 0);
 	assert(Thread::getRunning() == t);
+	WaitQueue *wq = event ? getWaitQueue(event,object) : NULL;
+	if(wq)
+		wq->lock.down();
+	RunQueue *rq = lockQueue(t);
 	t->event = event;
 	t->evobject = object;
 	setBlocked(t);
-	if(event)
-		evlists[event - 1].append(t);
+	if(wq)
+		wq->list.append(t);
+	rq->lock.up();
+	if(wq)
+		wq->lock.up();
 }
 
-void Sched::wakeup(uint event,evobj_t object,bool all) {
+void Sched::wakeup(uint event,evobj_t object,bool all,bool handoff) {
 	assert(event >= 1 && event <= EV_COUNT);
-	esc::DList<Thread> *list = evlists + event - 1;
-	LockGuard<SpinLock> g(&lock);
-	for(auto it = list->begin(); it != list->end(); ) {
+	/* first the threads that wait for exactly this object, afterwards the ones that ignore it */
+	size_t count = wakeupIn(getWaitQueue(event,object),event,object,all,handoff);
+	if(count > 0 && !all)
+		return;
+	/* only one thread can get the CPU of the caller */
+	if(object != 0)
+		wakeupIn(getWaitQueue(event,0),event,0,all,handoff && count == 0);
+}
+
+size_t Sched::wakeupIn(WaitQueue *wq,uint event,evobj_t object,bool all,bool handoff) {
+	size_t count = 0;
+	cpuid_t cpu = SMP::getCurId();
+	LockGuard<SpinLock> g(&wq->lock);
+	for(auto it = wq->list.begin(); it != wq->list.end(); ) {
 		auto old = it++;
-		assert(old->event == event);
-		if(old->evobject == 0 || old->evobject == object) {
+		if(old->event == event && old->evobject == object) {
+			/* hand the CPU over to the first one only; the others are waked up as usual */
+			bool ho = handoff && count == 0;
+			RunQueue *rq = ho ? lockQueues(&*old,cpu) : lockQueue(&*old);
 			removeFromEventlist(&*old);
-			setReady(&*old);
+			setReady(&*old,ho);
+			if(ho && rq != runQueues + cpu)
+				runQueues[cpu].lock.up();
+			rq->lock.up();
+			count++;
 			if(!all)
 				break;
 		}
 	}
+	return count;
+}
+
+void Sched::block(Thread *t) {
+	assert(t != NULL);
+	RunQueue *rq = lockQueue(t);
+	setBlocked(t);
+	rq->lock.up();
+}
+
+void Sched::unblock(Thread *t) {
+	assert(t != NULL);
+	RunQueue *rq;
+	WaitQueue *wq = lockWaitQueue(t,&rq);
+	setReady(t);
+	rq->lock.up();
+	if(wq)
+		wq->lock.up();
 }
 
 void Sched::removeFromEventlist(Thread *t) {
 	if(t->event) {
-		/* important: remove it first from the event-list and set event to 0 */
-		evlists[t->event - 1].remove(t);
+		/* important: remove it first from the wait-queue and set event to 0 */
+		getWaitQueue(t->event,t->evobject)->list.remove(t);
 		t->event = 0;
 	}
 }
 
-void Sched::setReady(Thread *t) {
+void Sched::setReady(Thread *t,bool handoff) {
 	if(t->getFlags() & T_IDLE)
 		return;
 
@@ -251,7 +433,20 @@ void Sched::setReady(Thread *t) {
 	}
 	else if(setReadyState(t)) {
 		assert(t->event == 0);
-		enqueue(t);
+		/* the waker blocks soon, so let the thread run on this CPU without any IPI */
+		if(handoff) {
+			RunQueue *rq = runQueues + SMP::getCurId();
+			t->affinity = SMP::getCurId();
+			enqueue(rq,t,true);
+			rq->handoff = t;
+			rq->handoffPrio = t->getPriority();
+		}
+		else {
+			enqueue(runQueues + t->affinity,t);
+			/* let the CPU that got the work know about it */
+			if(t->affinity != SMP::getCurId())
+				SMP::wakeupCPU(t->affinity);
+		}
 	}
 }
 
@@ -265,7 +460,7 @@ void Sched::setBlocked(Thread *t) {
 			break;
 		case Thread::READY:
 			t->setState(Thread::BLOCKED);
-			dequeue(t);
+			dequeue(runQueues + t->affinity,t);
 			break;
 		default:
 			vassert(false,"Invalid state for setBlocked (%d)",t->getState());
@@ -275,7 +470,8 @@ void Sched::setBlocked(Thread *t) {
 }
 
 void Sched::removeThread(Thread *t) {
-	LockGuard<SpinLock> g(&lock);
+	RunQueue *rq;
+	WaitQueue *wq = lockWaitQueue(t,&rq);
 	switch(t->getState()) {
 		case Thread::RUNNING:
 			break;
@@ -283,7 +479,7 @@ void Sched::removeThread(Thread *t) {
 			removeFromEventlist(t);
 			break;
 		case Thread::READY:
-			dequeue(t);
+			dequeue(rq,t);
 			break;
 		default:
 			/* TODO threads can die during swap, right? */
@@ -291,6 +487,9 @@ void Sched::removeThread(Thread *t) {
 			break;
 	}
 	t->setNewState(Thread::ZOMBIE);
+	rq->lock.up();
+	if(wq)
+		wq->lock.up();
 }
 
 bool Sched::setReadyState(Thread *t) {
@@ -310,26 +509,33 @@ bool Sched::setReadyState(Thread *t) {
 }
 
 void Sched::print(OStream &os) {
-	os.writef("Ready queues:\n");
-	for(size_t i = 0; i < ARRAY_SIZE(rdyQueues); i++) {
-		os.writef("\t[%d]:\n",i);
-		print(os,rdyQueues + i);
-		os.writef("\n");
+	for(size_t cpu = 0; cpu < SMP::getCPUCount(); cpu++) {
+		RunQueue *rq = runQueues + cpu;
+		os.writef("Ready queues of CPU %zu (%zu threads, mask=%#lx):\n",cpu,rq->count,rq->readyMask);
+		for(size_t i = 0; i < ARRAY_SIZE(rq->queues); i++) {
+			os.writef("\t[%d]:\n",i);
+			print(os,rq->queues + i);
+			os.writef("\n");
+		}
 	}
 }
 
 void Sched::printEventLists(OStream &os) {
 	os.writef("Eventlists:\n");
 	for(size_t e = 0; e < EV_COUNT; e++) {
-		esc::DList<Thread> *list = evlists + e;
 		os.writef("\t%s:\n",getEventName(e + 1));
-		for(auto t = list->cbegin(); t != list->cend(); ++t) {
-			os.writef("\t\tthread=%d (%d:%s), object=%x",
-					t->getTid(),t->getProc()->getPid(),t->getProc()->getProgram(),t->evobject);
-			ino_t nodeNo = ((VFSNode*)t->evobject)->getNo();
-			if(VFSNode::isValid(nodeNo))
-				os.writef("(%s)",((VFSNode*)t->evobject)->getPath());
-			os.writef("\n");
+		for(size_t i = 0; i < WAIT_QUEUE_COUNT; i++) {
+			esc::DList<Thread> *list = &waitQueues[i].list;
+			for(auto t = list->cbegin(); t != list->cend(); ++t) {
+				if(t->event != e + 1)
+					continue;
+				os.writef("\t\tthread=%d (%d:%s), object=%x, queue=%zu",
+						t->getTid(),t->getProc()->getPid(),t->getProc()->getProgram(),t->evobject,i);
+				ino_t nodeNo = ((VFSNode*)t->evobject)->getNo();
+				if(VFSNode::isValid(nodeNo))
+					os.writef("(%s)",((VFSNode*)t->evobject)->getPath());
+				os.writef("\n");
+			}
 		}
 	}
 }
@@ -92,9 +92,17 @@ void SMPBase::updateRuntimes() {
 	}
 }
 
-void SMPBase::wakeupCPU() {
+void SMPBase::wakeupCPU(cpuid_t id) {
 	if(cpuCount > 1) {
 		cpuid_t cur = getCurId();
+		/* prefer the CPU that got the work to keep its cache warm */
+		CPU *target = cpus[id];
+		if(id != cur && target->ready && (!target->thread ||
+				(target->thread->getFlags() & T_IDLE))) {
+			sendIPI(id,IPI_WORK);
+			return;
+		}
+
 		for(auto cpu = cpuList.cbegin(); cpu != cpuList.cend(); ++cpu) {
 			if(cpu->id != cur && cpu->ready && (!cpu->thread ||
 					(cpu->thread->getFlags() & T_IDLE))) {
@@ -105,20 +113,6 @@ void SMPBase::wakeupCPU() {
 	}
 }
 
-void SMPBase::flushTLB(PageDir *pdir) {
-	if(!cpus || cpuCount == 1)
-		return;
-
-	cpuid_t cur = getCurId();
-	for(auto cpu = cpuList.cbegin(); cpu != cpuList.cend(); ++cpu) {
-		if(cpu->ready && cpu->id != cur) {
-			Thread *t = cpu->thread;
-			if(t && t->getProc()->getPageDir() == pdir)
-				sendIPI(cpu->id,IPI_FLUSH_TLB);
-		}
-	}
-}
-
 void SMPBase::callback(cpuid_t id) {
 	CPU *c = cpus[id];
 	assert(c->callback);
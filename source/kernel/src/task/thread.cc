@@ -72,7 +72,7 @@ void ThreadBase::relRef(const Thread *t) {
 ThreadBase::ThreadBase(Proc *p,uint8_t flags)
 	: esc::DListItem(), tid(), refs(1), proc(p), sigHandler(), sigmask(), event(), evobject(),
 	  waitstart(), prioGoodCnt(), flags(flags), priority(MAX_PRIO), state(BLOCKED), newState(READY),
-	  cpu(), stackRegions(), threadDir(), threadListItem(static_cast<Thread*>(this)),
+	  cpu(), affinity(), stackRegions(), threadDir(), threadListItem(static_cast<Thread*>(this)),
 	  signalListItem(static_cast<Thread*>(this)), reqFrames(), stats() {
 	stats.cycleStart = CPU::rdtsc();
 	stats.signal = SIG_COUNT;
@@ -179,22 +179,57 @@ void ThreadBase::updateRuntimes() {
 }
 
 bool ThreadBase::reserveFrames(size_t count,bool swap) {
+	frameno_t frames[RESERVE_BATCH];
+
+	/* take what the frame cache of this CPU has first; these don't need to be reserved */
+	while(count > 0) {
+		size_t n = PhysMem::allocateCached(esc::Util::min(count,RESERVE_BATCH),frames);
+		if(n == 0)
+			break;
+		for(size_t i = 0; i < n; i++)
+			reqFrames.append(frames[i]);
+		count -= n;
+	}
+
 	while(count > 0) {
 		if(!PhysMem::reserve(count,swap)) {
 			discardFrames();
 			return false;
 		}
-		for(size_t i = count; i > 0; i--) {
-			frameno_t frm = PhysMem::allocate(PhysMem::USR);
-			if(frm == PhysMem::INVALID_FRAME)
+		while(count > 0) {
+			size_t req = esc::Util::min(count,RESERVE_BATCH);
+			size_t n = PhysMem::allocate(PhysMem::USR,req,frames);
+			for(size_t i = 0; i < n; i++)
+				reqFrames.append(frames[i]);
+			count -= n;
+			if(n < req)
 				break;
-			reqFrames.append(frm);
-			count--;
 		}
 	}
 	return true;
 }
 
+size_t ThreadBase::reserveMoreFrames(size_t count) {
+	frameno_t frames[RESERVE_BATCH];
+	size_t total = 0;
+	while(count > 0) {
+		size_t req = esc::Util::min(count,RESERVE_BATCH);
+		size_t n = PhysMem::allocateCached(req,frames);
+		if(n == 0) {
+			if(!PhysMem::reserve(req,false))
+				break;
+			n = PhysMem::allocate(PhysMem::USR,req,frames);
+			if(n == 0)
+				break;
+		}
+		for(size_t i = 0; i < n; i++)
+			reqFrames.append(frames[i]);
+		total += n;
+		count -= n;
+	}
+	return total;
+}
+
 int ThreadBase::create(Thread *src,Thread **dst,Proc *p,uint8_t tflags,bool cloneProc) {
 	int err = -ENOMEM;
 	Thread *t = new Thread(p,tflags);
@@ -213,6 +248,8 @@ int ThreadBase::create(Thread *src,Thread **dst,Proc *p,uint8_t tflags,bool clon
 		/* do that here to prevent that one see's a temporary priority, i.e. during the update-phase */
 		t->priority = p->getPriority();
 	}
+	/* start on the CPU of our creator; other CPUs will steal it if they have nothing to do */
+	t->affinity = src->getCPU();
 
 	/* we don't want to destroy the process first because we have a pointer to it */
 	Proc::getRef(p->getPid());
@@ -322,6 +359,7 @@ void ThreadBase::print(OStream &os) const {
 	os.writef("\n");
 	Signals::print(static_cast<const Thread*>(this),os);
 	os.writef("LastCPU = %d\n",cpu);
+	os.writef("Affinity = %d\n",affinity);
 	for(size_t i = 0; i < STACK_REG_COUNT; i++) {
 		os.writef("stackRegion%zu = %p",i,stackRegions[i] ? stackRegions[i]->virt() : 0);
 		if(i + 1 < STACK_REG_COUNT)
@@ -27,14 +27,25 @@
 #include <util.h>
 #include <video.h>
 
-/* total elapsed milliseconds */
+/**
+ * Every CPU has its own hierarchical timing wheel, which contains the listeners of the threads that
+ * called sleepFor() on that CPU. A listener is put into the slot that corresponds to its expiration
+ * time, so that it can be added and removed in O(1). The slots of level 0 hold the listeners that
+ * expire within the next WHEEL_SLOTS milliseconds. Whenever level 0 wraps around, the next slot of
+ * level 1 is cascaded, i.e. its listeners are redistributed to level 0, and so on.
+ *
+ * CPUs that idle don't receive the regular tick, but program their timer to fire when the next
+ * listener expires, if the architecture supports that.
+ */
+
 TimerBase::PerCPU *TimerBase::perCPU = NULL;
 time_t TimerBase::lastRuntimeUpdate = 0;
+bool TimerBase::perCPUIntrpts = false;
 
 SpinLock TimerBase::lock;
 TimerBase::Listener TimerBase::listenObjs[LISTENER_COUNT];
 TimerBase::Listener *TimerBase::freeList;
-TimerBase::Listener *TimerBase::listener = NULL;
+TimerBase::Listener **TimerBase::tidListeners;
 
 void TimerBase::init() {
 	archInit();
@@ -42,6 +53,9 @@ void TimerBase::init() {
 	perCPU = (PerCPU*)Cache::calloc(SMP::getCPUCount(),sizeof(PerCPU));
 	if(!perCPU)
 		Util::panic("Unable to create per-cpu-array");
+	tidListeners = (Listener**)Cache::calloc(MAX_THREAD_COUNT,sizeof(Listener*));
+	if(!tidListeners)
+		Util::panic("Unable to create thread-listener-array");
 
 	/* init objects */
 	listenObjs->next = NULL;
@@ -52,126 +66,249 @@ void TimerBase::init() {
 	}
 }
 
-int TimerBase::sleepFor(tid_t tid,time_t msecs,bool block) {
+TimerBase::PerCPU *TimerBase::lockWheel(tid_t tid) {
+	while(true) {
+		Listener *l = tidListeners[tid];
+		cpuid_t cpu = l ? l->cpu : (perCPUIntrpts ? SMP::getCurId() : 0);
+		PerCPU *pc = perCPU + cpu;
+		pc->lock.down();
+		/* all listeners of one thread are in the same wheel */
+		l = tidListeners[tid];
+		if(EXPECT_TRUE(l == NULL || l->cpu == cpu))
+			return pc;
+		pc->lock.up();
+	}
+}
+
+void TimerBase::enqueue(PerCPU *pc,Listener *l) {
+	time_t delta = l->expires - pc->elapsedMsecs;
+	size_t level = 0;
+	while(level < WHEEL_LEVELS - 1 && delta >= (time_t)1 << (WHEEL_BITS * (level + 1)))
+		level++;
+	/* if it's too far away, put it into the last slot and cascade it again later. note that we
+	 * keep the real expiration time, so that it's put into the right slot when cascading */
+	time_t at = l->expires;
+	if(level == WHEEL_LEVELS - 1 && delta >= (time_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+		at = pc->elapsedMsecs + ((time_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+	size_t idx = (at >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+	l->slot = &pc->wheel[level][idx];
+	l->prev = NULL;
+	l->next = *l->slot;
+	if(l->next)
+		l->next->prev = l;
+	*l->slot = l;
+}
+
+void TimerBase::dequeue(Listener *l) {
+	if(l->prev)
+		l->prev->next = l->next;
+	else
+		*l->slot = l->next;
+	if(l->next)
+		l->next->prev = l->prev;
+}
+
+void TimerBase::cascade(PerCPU *pc,size_t level) {
+	size_t idx = (pc->elapsedMsecs >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+	Listener *l = pc->wheel[level][idx];
+	pc->wheel[level][idx] = NULL;
+	while(l) {
+		Listener *next = l->next;
+		enqueue(pc,l);
+		l = next;
+	}
+	/* if this level wrapped around as well, continue with the next one */
+	if(idx == 0 && level + 1 < WHEEL_LEVELS)
+		cascade(pc,level + 1);
+}
+
+void TimerBase::release(Listener *l) {
 	LockGuard<SpinLock> g(&lock);
-	Listener *l = freeList;
-	if(l == NULL)
-		return -ENOMEM;
+	l->next = freeList;
+	freeList = l;
+}
 
-	/* remove from freelist */
-	freeList = freeList->next;
-	/* find place and calculate time */
-	l->tid = tid;
-	time_t msecDiff = 0;
-	Listener *p = NULL;
-	Listener *nl;
-	for(nl = listener; nl != NULL; p = nl, nl = nl->next) {
-		if(msecDiff + nl->time > msecs)
-			break;
-		msecDiff += nl->time;
+int TimerBase::sleepFor(tid_t tid,time_t msecs,bool block) {
+	Listener *l;
+	{
+		LockGuard<SpinLock> g(&lock);
+		l = freeList;
+		if(l == NULL)
+			return -ENOMEM;
+		/* remove from freelist */
+		freeList = freeList->next;
 	}
 
-	l->time = msecs - msecDiff;
+	PerCPU *pc = lockWheel(tid);
+	cpuid_t cpu = pc - perCPU;
+	l->tid = tid;
+	l->cpu = cpu;
 	l->block = block;
-	/* insert entry */
-	l->next = nl;
-	if(p)
-		p->next = l;
-	else
-		listener = l;
+	/* the slot for the current time has already been handled */
+	l->expires = pc->elapsedMsecs + lag(pc) + esc::Util::max(msecs,(time_t)1);
+	enqueue(pc,l);
+	l->tidNext = tidListeners[tid];
+	tidListeners[tid] = l;
 
-	/* now change time of next one */
-	if(nl)
-		nl->time -= l->time;
+	/* if the wheel belongs to another CPU that idles, its timer fires too late. let it program
+	 * the timer again */
+	bool notify = pc->oneshot && l->expires < pc->deadline && cpu != SMP::getCurId();
 
 	/* put process to sleep */
 	if(block)
 		Thread::getById(tid)->block();
+	pc->lock.up();
+
+	if(notify)
+		SMP::sendIPI(cpu,IPI_WORK);
 	return 0;
 }
 
 void TimerBase::removeThread(tid_t tid) {
-	LockGuard<SpinLock> g(&lock);
-	Listener *p = NULL;
-	for(Listener *l = listener; l != NULL; p = l, l = l->next) {
-		if(l->tid == tid) {
-			/* increase time of next */
-			if(l->next)
-				l->next->time += l->time;
-			/* remove from list */
-			if(p)
-				p->next = l->next;
-			else
-				listener = l->next;
-			/* put on freelist */
-			l->next = freeList;
-			freeList = l;
-			/* it's not possible to be in the list twice */
-			break;
+	PerCPU *pc = lockWheel(tid);
+	Listener *l = tidListeners[tid];
+	tidListeners[tid] = NULL;
+	for(Listener *it = l; it != NULL; it = it->tidNext)
+		dequeue(it);
+	pc->lock.up();
+
+	while(l) {
+		Listener *next = l->tidNext;
+		release(l);
+		l = next;
+	}
+}
+
+void TimerBase::fire(Listener *l,bool *foundThread) {
+	/* remove it from the listeners of the thread */
+	Listener **prev = tidListeners + l->tid;
+	while(*prev != l)
+		prev = &(*prev)->tidNext;
+	*prev = l->tidNext;
+
+	/* wake up thread */
+	Thread *t = Thread::getById(l->tid);
+	if(l->block) {
+		t->unblock();
+		*foundThread = true;
+	}
+	else
+		Signals::addSignalFor(t,SIGALRM);
+}
+
+time_t TimerBase::nextExpiry(PerCPU *pc) {
+	for(size_t level = 0; level < WHEEL_LEVELS; ++level) {
+		size_t shift = WHEEL_BITS * level;
+		size_t cur = (pc->elapsedMsecs >> shift) & (WHEEL_SLOTS - 1);
+		for(size_t i = 1; i <= WHEEL_SLOTS; ++i) {
+			if(pc->wheel[level][(cur + i) & (WHEEL_SLOTS - 1)]) {
+				/* for higher levels, that's the time at which the slot is cascaded */
+				time_t at = ((pc->elapsedMsecs >> shift) + i) << shift;
+				return at - pc->elapsedMsecs;
+			}
 		}
 	}
+	return MAX_IDLE_TIME;
+}
+
+time_t TimerBase::lag(PerCPU *pc) {
+	/* without the regular tick, elapsedMsecs is only brought up to date by the next interrupt */
+	if(!pc->skipped)
+		return 0;
+	return cyclesToTime(CPU::rdtsc() - pc->lastTSC) / 1000;
+}
+
+void TimerBase::setIdle(cpuid_t cpu,bool idle) {
+	PerCPU *pc = perCPU + cpu;
+	/* hold the lock while programming the timer, so that sleepFor() sees the deadline we use */
+	LockGuard<SpinLock> g(&pc->lock);
+	if(idle) {
+		time_t behind = lag(pc);
+		time_t next = nextExpiry(pc);
+		time_t msecs = next > behind ? esc::Util::min(next - behind,MAX_IDLE_TIME) : 1;
+		/* CPU 0 has to update the runtimes regularly */
+		if(cpu == 0) {
+			time_t since = pc->elapsedMsecs + behind - lastRuntimeUpdate;
+			msecs = esc::Util::min(msecs,since < RUNTIME_UPDATE_INTVAL ? RUNTIME_UPDATE_INTVAL - since : 1);
+		}
+		msecs = esc::Util::max(msecs,(time_t)1);
+		if(archSetOneshot(msecs)) {
+			pc->oneshot = pc->skipped = true;
+			pc->deadline = pc->elapsedMsecs + behind + msecs;
+		}
+	}
+	else if(pc->oneshot) {
+		archSetPeriodic();
+		pc->oneshot = false;
+	}
 }
 
 bool TimerBase::intrpt() {
-	bool res,foundThread = false;
-	time_t timeInc = 1000 / FREQUENCY_DIV;
+	bool foundThread = false;
 	cpuid_t cpu = Thread::getRunning()->getCPU();
+	PerCPU *pc = perCPU + cpu;
 
-	perCPU[cpu].timerIntrpts++;
-	perCPU[cpu].elapsedMsecs += timeInc;
+	/* if we did not receive a regular tick, determine the elapsed time by the timestamp counter */
+	uint64_t now = CPU::rdtsc();
+	time_t timeInc = 1000 / FREQUENCY_DIV;
+	if(pc->skipped) {
+		timeInc = (cyclesToTime(now - pc->lastTSC) + 500) / 1000;
+		pc->skipped = pc->oneshot;
+	}
+	pc->lastTSC = now;
+	pc->timerIntrpts++;
 
-	if(cpu == 0) {
-		if((perCPU[cpu].elapsedMsecs - lastRuntimeUpdate) >= RUNTIME_UPDATE_INTVAL) {
-			Thread::updateRuntimes();
-			SMP::updateRuntimes();
-			lastRuntimeUpdate = perCPU[cpu].elapsedMsecs;
-		}
+	/* look if there are threads to wakeup */
+	{
+		LockGuard<SpinLock> g(&pc->lock);
+		for(time_t i = 0; i < timeInc; ++i) {
+			pc->elapsedMsecs++;
+			size_t idx = pc->elapsedMsecs & (WHEEL_SLOTS - 1);
+			if(idx == 0)
+				cascade(pc,1);
 
-		/* look if there are threads to wakeup */
-		LockGuard<SpinLock> g(&lock);
-		for(Listener *l = listener; l != NULL; ) {
-			/* stop if we have to continue waiting for this one */
-			/* note that multiple listeners may have l->time = 0 */
-			if(l->time > timeInc) {
-				l->time -= timeInc;
-				break;
+			Listener *l = pc->wheel[0][idx];
+			pc->wheel[0][idx] = NULL;
+			while(l) {
+				Listener *next = l->next;
+				fire(l,&foundThread);
+				release(l);
+				l = next;
 			}
+		}
+	}
 
-			timeInc -= l->time;
-			/* wake up thread */
-			Thread *t = Thread::getById(l->tid);
-			if(l->block) {
-				t->unblock();
-				foundThread = true;
-			}
-			else
-				Signals::addSignalFor(t,SIGALRM);
-			/* remove from list */
-			listener = l->next;
-			Listener *tl = l->next;
-			/* put on freelist */
-			l->next = freeList;
-			freeList = l;
-			/* to next */
-			l = tl;
+	if(cpu == 0) {
+		if((pc->elapsedMsecs - lastRuntimeUpdate) >= RUNTIME_UPDATE_INTVAL) {
+			Thread::updateRuntimes();
+			SMP::updateRuntimes();
+			lastRuntimeUpdate = pc->elapsedMsecs;
 		}
 	}
 
-	/* if a process has been waked up or the time-slice is over, reschedule */
-	res = false;
-	if(foundThread || (perCPU[cpu].elapsedMsecs - perCPU[cpu].lastResched) >= TIMESLICE) {
-		perCPU[cpu].lastResched = perCPU[cpu].elapsedMsecs;
-		res = true;
+	/* if a process has been waked up or the time-slice is over, reschedule. if we're idling, do
+	 * that as well to program the timer for the next listener */
+	if(foundThread || pc->oneshot || (pc->elapsedMsecs - pc->lastResched) >= TIMESLICE) {
+		pc->lastResched = pc->elapsedMsecs;
+		return true;
 	}
-	return res;
+	return false;
 }
 
 void TimerBase::print(OStream &os) {
 	os.writef("Timer-Listener:\n");
-	time_t time = 0;
-	for(Listener *l = listener; l != NULL; l = l->next) {
-		time += l->time;
-		os.writef("	diff=%u ms, rem=%u ms, thread=%d(%s), block=%d\n",l->time,time,l->tid,
-				Thread::getById(l->tid)->getProc()->getProgram(),l->block);
+	for(size_t cpu = 0; cpu < SMP::getCPUCount(); ++cpu) {
+		PerCPU *pc = perCPU + cpu;
+		os.writef("  CPU %zu: now=%u ms, oneshot=%d\n",cpu,pc->elapsedMsecs,pc->oneshot);
+		for(size_t level = 0; level < WHEEL_LEVELS; ++level) {
+			for(size_t i = 0; i < WHEEL_SLOTS; ++i) {
+				for(Listener *l = pc->wheel[level][i]; l != NULL; l = l->next) {
+					os.writef("	level=%zu, slot=%zu, rem=%u ms, thread=%d(%s), block=%d\n",
+						level,i,l->expires - pc->elapsedMsecs,l->tid,
+						Thread::getById(l->tid)->getProc()->getProgram(),l->block);
+				}
+			}
+		}
 	}
 }
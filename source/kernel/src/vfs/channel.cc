@@ -21,6 +21,7 @@
 #include <esc/proto/file.h>
 #include <esc/proto/device.h>
 #include <mem/cache.h>
+#include <mem/pagecache.h>
 #include <mem/useraccess.h>
 #include <mem/virtmem.h>
 #include <sys/messages.h>
@@ -46,7 +47,8 @@ VFSChannel::VFSChannel(const fs::User &u,VFSNode *p,bool &success)
 		/* otherwise, if root uses that device, the driver is unable to open this channel. */
 		: VFSNode(u,generateId(),MODE_TYPE_CHANNEL | 0777,success), fd(-1),
 		  handler(), closed(false), driver_gone(false),
-		  shmem(NULL), shmemSize(0), sendList(), recvList() {
+		  shmem(NULL), shmemSize(0), sendList(), recvList(),
+		  readyPrev(), readyNext(), ready(), dataMids() {
 	if(!success)
 		return;
 
@@ -65,6 +67,10 @@ void VFSChannel::invalidate() {
 	// this is okay, because we have the treelock acquired here
 	static_cast<VFSDevice*>(getParent())->chanRemoved(this);
 
+	/* files of a filesystem are identified by the channel to it. so, forget their pages */
+	if(IS_FS(getParent()->getMode()))
+		PageCache::invalidateDev(getNo());
+
 	// we only get here if the node has no references left. so it's safe to access the lists.
 	recvList.deleteAll();
 	sendList.deleteAll();
@@ -227,14 +233,29 @@ ssize_t VFSChannel::read(OpenFile *file,USER void *buffer,off_t offset,size_t co
 	if((res = isSupported(DEV_READ)) < 0)
 		return res;
 
-	/* send msg to driver */
+	/* send msg to driver. if the data is not transferred via shared memory, the driver sends it
+	 * after the response, so that we want to be waked up only once, when both are there */
 	bool useshm = useSharedMem(shmem,shmemSize,buffer,count);
 	ib << esc::FileRead::Request(offset,count,useshm ? ((uintptr_t)buffer - (uintptr_t)shmem) : -1);
-	res = file->sendMsg(esc::FileRead::MSG,ib.buffer(),ib.pos(),NULL,0);
+	uint sflags = VFS_HANDOFF | ((!useshm && count > 0) ? VFS_REPLYDATA : 0);
+	res = file->sendMsg(esc::FileRead::MSG,ib.buffer(),ib.pos(),NULL,0,sflags);
 	if(res < 0)
 		return res;
 
 	msgid_t mid = res;
+	res = receiveReply(file,mid,buffer,count,useshm);
+	/* in case the driver didn't respond (e.g., canceled), don't delay other messages with that id */
+	if(sflags & VFS_REPLYDATA)
+		static_cast<VFSDevice*>(parent)->dropReplyData(this,mid);
+	return res;
+}
+
+ssize_t VFSChannel::receiveReply(OpenFile *file,msgid_t mid,USER void *buffer,size_t count,
+		bool useshm) {
+	ulong ibuffer[IPC_DEF_SIZE / sizeof(ulong)];
+	esc::IPCBuf ib(ibuffer,sizeof(ibuffer));
+	ssize_t res;
+
 	uint flags = getReceiveFlags();
 	while(1) {
 		/* read response and ensure that we don't get killed until we've received both messages
@@ -281,7 +302,8 @@ ssize_t VFSChannel::write(OpenFile *file,USER const void *buffer,off_t offset,si
 
 	/* send msg and data to driver */
 	ib << esc::FileWrite::Request(offset,count,useshm ? ((uintptr_t)buffer - (uintptr_t)shmem) : -1);
-	res = file->sendMsg(esc::FileWrite::MSG,ib.buffer(),ib.pos(),useshm ? NULL : buffer,count);
+	res = file->sendMsg(esc::FileWrite::MSG,ib.buffer(),ib.pos(),useshm ? NULL : buffer,count,
+		VFS_HANDOFF);
 	if(res < 0)
 		return res;
 
@@ -491,7 +513,7 @@ errorProc:
 	return res;
 }
 
-int VFSChannel::send(ushort flags,msgid_t id,USER const void *data1,
+int VFSChannel::send(uint flags,msgid_t id,USER const void *data1,
 						 size_t size1,USER const void *data2,size_t size2) {
 	return static_cast<VFSDevice*>(parent)->send(this,flags,id,data1,size1,data2,size2);
 }
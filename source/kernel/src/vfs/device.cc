@@ -17,8 +17,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <esc/ipc/ipcbuf.h>
+#include <esc/proto/file.h>
 #include <mem/cache.h>
 #include <mem/useraccess.h>
+#include <mem/virtmem.h>
 #include <sys/messages.h>
 #include <task/proc.h>
 #include <vfs/channel.h>
@@ -34,14 +37,16 @@
 
 #define PRINT_MSGS			0
 
-SpinLock VFSDevice::msgLock;
-uint16_t VFSDevice::nextRid = 1;
+VFSChannel::Message::~Message() {
+	if(pages)
+		VirtMem::releasePages(frames(),pages);
+}
 
 /* block- and file-devices are none-empty by default, because their data is always available */
 VFSDevice::VFSDevice(const fs::User &u,VFSNode *p,char *n,uint m,uint type,uint ops,bool &success)
 		: VFSNode(u,n,buildMode(type) | (m & MODE_PERM),success),
 		  owner(Proc::getRunning()), creator(Thread::getRunning()->getTid()),
-		  funcs(ops), msgCount(0), lastClient() {
+		  funcs(ops), msgCount(0), readyFirst(), readyLast(), msgLock(), nextRid(1) {
 	if(!success)
 		return;
 
@@ -84,14 +89,40 @@ void VFSDevice::close(OpenFile *file,A_UNUSED int msgid) {
 		unref();
 }
 
-void VFSDevice::chanRemoved(const VFSChannel *chan) {
-	/* we don't have to lock this, because its only called in unref(), which can only
-	 * be called when the treelock is held. i.e. it is not possible during getwork() */
-	if(lastClient == chan)
-		lastClient = chan->next;
+void VFSDevice::chanRemoved(VFSChannel *chan) {
+	/* the ready-list is not protected by the treelock, so getwork() might look at it right now */
+	LockGuard<SpinLock> g(&msgLock);
+	if(chan->ready)
+		remReady(chan);
 	remMsgs(chan->sendList.length());
 }
 
+void VFSDevice::addReady(VFSChannel *chan) {
+	assert(!chan->ready);
+	chan->readyPrev = readyLast;
+	chan->readyNext = NULL;
+	if(readyLast)
+		readyLast->readyNext = chan;
+	else
+		readyFirst = chan;
+	readyLast = chan;
+	chan->ready = true;
+}
+
+void VFSDevice::remReady(VFSChannel *chan) {
+	assert(chan->ready);
+	if(chan->readyPrev)
+		chan->readyPrev->readyNext = chan->readyNext;
+	else
+		readyFirst = chan->readyNext;
+	if(chan->readyNext)
+		chan->readyNext->readyPrev = chan->readyPrev;
+	else
+		readyLast = chan->readyPrev;
+	chan->readyPrev = chan->readyNext = NULL;
+	chan->ready = false;
+}
+
 void VFSDevice::bindto(tid_t tid) {
 	bool valid;
 	const VFSNode *n = openDir(true,&valid);
@@ -130,48 +161,21 @@ int VFSDevice::getWork(uint flags) {
 }
 
 int VFSDevice::getClientFd(tid_t tid) {
-	/* search for a slot that needs work */
-	bool valid;
-	const VFSNode *n = openDir(true,&valid);
-
 	/* if there are no messages at all or the node is invalid, stop right now */
-	if(!valid || msgCount == 0) {
-		closeDir(true);
+	if(!isAlive() || msgCount == 0)
 		return -ENOCLIENT;
-	}
-
-	/* this is a bit more complicated because we want to do it in a fair way. that means every
-	 * process that requests something should be served at some time. therefore we store the last
-	 * served client and continue from the next one. */
-	const VFSNode *first = n;
-	const VFSNode *last = lastClient;
-	n = last ? last->next : first;
-
-searchBegin:
-	while(n != NULL && n != last) {
-		/* data available? */
-		const VFSChannel *chan = static_cast<const VFSChannel*>(n);
-		if(chan->getHandler() == tid && chan->sendList.length() > 0) {
-			lastClient = const_cast<VFSNode*>(n);
-			closeDir(true);
-			return static_cast<const VFSChannel*>(lastClient)->getFd();
-		}
-
-		n = n->next;
-	}
 
-	if(lastClient) {
-		lastClient = NULL;
-		last = last->next;
-		n = first;
-		goto searchBegin;
+	/* the ready-list contains only channels with pending messages. a channel is moved to the end
+	 * whenever a message has been taken from it, so that every client is served at some time.
+	 * usually, all channels are handled by the same thread, so that we take the first one. */
+	for(VFSChannel *chan = readyFirst; chan != NULL; chan = chan->readyNext) {
+		if(chan->getHandler() == tid)
+			return chan->getFd();
 	}
-
-	closeDir(true);
 	return -ENOCLIENT;
 }
 
-int VFSDevice::send(VFSChannel *chan,ushort flags,msgid_t id,USER const void *data1,
+int VFSDevice::send(VFSChannel *chan,uint flags,msgid_t id,USER const void *data1,
                     size_t size1,USER const void *data2,size_t size2) {
 	esc::SList<VFSChannel::Message> *list;
 	VFSChannel::Message *msg1,*msg2 = NULL;
@@ -192,14 +196,9 @@ int VFSDevice::send(VFSChannel *chan,ushort flags,msgid_t id,USER const void *da
 		list = &chan->sendList;
 
 	/* create message and copy data to it */
-	msg1 = new (size1) VFSChannel::Message(size1);
+	msg1 = createMsg(data1,size1,&res);
 	if(EXPECT_FALSE(msg1 == NULL))
-		return -ENOMEM;
-
-	if(EXPECT_TRUE(data1)) {
-		if(EXPECT_FALSE((res = UserAccess::read(msg1 + 1,data1,size1)) < 0))
-			goto errorMsg1;
-	}
+		return res;
 
 	if(EXPECT_FALSE(data2)) {
 		if(EXPECT_FALSE(size2 > VFSChannel::Message::MAX_SIZE)) {
@@ -207,14 +206,9 @@ int VFSDevice::send(VFSChannel *chan,ushort flags,msgid_t id,USER const void *da
 			goto errorMsg1;
 		}
 
-		msg2 = new (size2) VFSChannel::Message(size2);
-		if(EXPECT_FALSE(msg2 == NULL)) {
-			res = -ENOMEM;
+		msg2 = createMsg(data2,size2,&res);
+		if(EXPECT_FALSE(msg2 == NULL))
 			goto errorMsg1;
-		}
-
-		if(EXPECT_FALSE((res = UserAccess::read(msg2 + 1,data2,size2)) < 0))
-			goto errorMsg2;
 	}
 
 	{
@@ -235,15 +229,36 @@ int VFSDevice::send(VFSChannel *chan,ushort flags,msgid_t id,USER const void *da
 			addMsgs(1);
 			if(EXPECT_FALSE(msg2))
 				addMsgs(1);
-			Sched::wakeup(EV_CLIENT,(evobj_t)this,true);
+			Sched::wakeup(EV_CLIENT,(evobj_t)this,true,flags & VFS_HANDOFF);
+
+			/* if all slots are taken, the client is simply waked up twice */
+			if(flags & VFS_REPLYDATA) {
+				for(size_t i = 0; i < VFSChannel::REPLY_DATA_SLOTS; ++i) {
+					if(chan->dataMids[i] == 0) {
+						chan->dataMids[i] = id;
+						break;
+					}
+				}
+			}
 		}
 		else {
 			/* for devices, we just use whatever the driver gave us */
 
+			/* if the data follows the response, the client can't do anything with the response
+			 * alone. so, deliver both with one wakeup */
+			bool notify = true;
+			if(takeReplyData(chan,id))
+				notify = !hasReplyData(msg1);
+
 			/* notify receivers */
-			Sched::wakeup(EV_RECEIVED_MSG,(evobj_t)chan,true);
+			if(notify)
+				Sched::wakeup(EV_RECEIVED_MSG,(evobj_t)chan,true,flags & VFS_HANDOFF);
 		}
 
+		/* the channel needs to be served now */
+		if((~flags & VFS_DEVICE) && !chan->ready)
+			addReady(chan);
+
 		/* append to list */
 		msg1->id = id;
 		list->append(msg1);
@@ -267,8 +282,6 @@ int VFSDevice::send(VFSChannel *chan,ushort flags,msgid_t id,USER const void *da
 #endif
 	return id;
 
-errorMsg2:
-	delete msg2;
 errorMsg1:
 	delete msg1;
 	return res;
@@ -325,8 +338,15 @@ ssize_t VFSDevice::receive(VFSChannel *chan,ushort flags,msgid_t *id,USER void *
 		}
 	}
 
-	if(event == EV_CLIENT)
+	if(event == EV_CLIENT) {
 		remMsgs(1);
+		/* serve the other clients first, if there are any */
+		if(chan->ready) {
+			remReady(chan);
+			if(chan->sendList.length() > 0)
+				addReady(chan);
+		}
+	}
 	msgLock.up();
 
 #if PRINT_MSGS
@@ -344,8 +364,14 @@ ssize_t VFSDevice::receive(VFSChannel *chan,ushort flags,msgid_t *id,USER void *
 
 	/* copy data and id */
 	if(EXPECT_TRUE(data)) {
-		if(EXPECT_FALSE((res = UserAccess::write(data,msg + 1,msg->length)) < 0))
+		if(msg->pages)
+			res = readLent(msg,data);
+		else
+			res = UserAccess::write(data,msg + 1,msg->length);
+		if(EXPECT_FALSE(res < 0)) {
+			delete msg;
 			return res;
+		}
 	}
 	if(EXPECT_TRUE(id))
 		*id = msg->id;
@@ -355,6 +381,99 @@ ssize_t VFSDevice::receive(VFSChannel *chan,ushort flags,msgid_t *id,USER void *
 	return res;
 }
 
+void VFSDevice::dropReplyData(VFSChannel *chan,msgid_t mid) {
+	LockGuard<SpinLock> g(&msgLock);
+	takeReplyData(chan,mid);
+}
+
+bool VFSDevice::takeReplyData(VFSChannel *chan,msgid_t mid) {
+	/* 0 marks a free slot */
+	if(mid == 0)
+		return false;
+	for(size_t i = 0; i < VFSChannel::REPLY_DATA_SLOTS; ++i) {
+		if(chan->dataMids[i] == mid) {
+			chan->dataMids[i] = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool VFSDevice::hasReplyData(VFSChannel::Message *msg) {
+	if(msg->pages != 0)
+		return false;
+
+	esc::IPCBuf ib(reinterpret_cast<ulong*>(msg + 1),msg->length);
+	esc::FileRead::Response r;
+	ib >> r;
+	return r.err >= 0 && r.res > 0;
+}
+
+VFSChannel::Message *VFSDevice::createMsg(USER const void *data,size_t size,int *res) {
+	VFSChannel::Message *msg;
+	uintptr_t addr = reinterpret_cast<uintptr_t>(data);
+
+	/* lend large page-aligned buffers to the receiver instead of copying them */
+	if(data && size >= VFSChannel::Message::LEND_SIZE && ((addr | size) & (PAGE_SIZE - 1)) == 0 &&
+			PageDir::isInUserSpace(addr,size)) {
+		size_t pages = size / PAGE_SIZE;
+		msg = new (pages * sizeof(frameno_t)) VFSChannel::Message(size);
+		if(EXPECT_FALSE(msg == NULL)) {
+			*res = -ENOMEM;
+			return NULL;
+		}
+
+		VirtMem *vm = Thread::getRunning()->getProc()->getVM();
+		if(vm->lendPages(addr,pages,msg->frames()) == 0) {
+			msg->pages = pages;
+			return msg;
+		}
+		/* not possible (e.g. not present or shared memory); copy it as usual */
+		delete msg;
+	}
+
+	msg = new (size) VFSChannel::Message(size);
+	if(EXPECT_FALSE(msg == NULL)) {
+		*res = -ENOMEM;
+		return NULL;
+	}
+
+	if(EXPECT_TRUE(data)) {
+		if(EXPECT_FALSE((*res = UserAccess::read(msg + 1,data,size)) < 0)) {
+			delete msg;
+			return NULL;
+		}
+	}
+	return msg;
+}
+
+int VFSDevice::readLent(VFSChannel::Message *msg,USER void *data) {
+	uintptr_t addr = reinterpret_cast<uintptr_t>(data);
+	frameno_t *frames = msg->frames();
+
+	/* if the buffer is suitable, map the frames copy-on-write into it */
+	if((addr & (PAGE_SIZE - 1)) == 0 && PageDir::isInUserSpace(addr,msg->length)) {
+		VirtMem *vm = Thread::getRunning()->getProc()->getVM();
+		if(vm->adoptPages(addr,msg->pages,frames) == 0)
+			return 0;
+	}
+
+	/* otherwise copy it. we can't access the frame and the user memory at the same time, because
+	 * the latter might cause a pagefault that needs the temporary mapping as well. */
+	void *buf = Cache::alloc(PAGE_SIZE);
+	if(EXPECT_FALSE(buf == NULL))
+		return -ENOMEM;
+
+	int res = 0;
+	for(size_t i = 0; i < msg->pages; i++) {
+		PageDir::copyFromFrame(frames[i],buf);
+		if(EXPECT_FALSE((res = UserAccess::write((char*)data + i * PAGE_SIZE,buf,PAGE_SIZE)) < 0))
+			break;
+	}
+	Cache::free(buf);
+	return res;
+}
+
 VFSChannel::Message *VFSDevice::getMsg(esc::SList<VFSChannel::Message> *list,msgid_t mid,ushort flags) {
 	/* drivers get always the first message */
 	if(flags & VFS_DEVICE)
@@ -376,7 +495,7 @@ void VFSDevice::print(OStream &os) const {
 	bool valid;
 	const VFSNode *chan = openDir(false,&valid);
 	if(valid) {
-		os.writef("%s (creator=%d, lastClient=%s):\n",name,creator,lastClient ? lastClient->getName() : "-");
+		os.writef("%s (creator=%d, nextClient=%s):\n",name,creator,readyFirst ? readyFirst->getName() : "-");
 		while(chan != NULL) {
 			os.pushIndent();
 			chan->print(os);
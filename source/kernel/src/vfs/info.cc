@@ -19,6 +19,7 @@
 
 #include <mem/cache.h>
 #include <mem/kheap.h>
+#include <mem/pagecache.h>
 #include <mem/pagedir.h>
 #include <mem/physmem.h>
 #include <mem/physmemareas.h>
@@ -50,6 +51,8 @@ void VFSInfo::init(VFSNode *sysNode) {
 	VFSNode::release(createObj<MemUsageFile>(kern,sysNode));
 	VFSNode::release(createObj<CPUFile>(kern,sysNode));
 	VFSNode::release(createObj<StatsFile>(kern,sysNode));
+	VFSNode::release(createObj<CacheFile>(kern,sysNode));
+	VFSNode::release(createObj<PageCacheFile>(kern,sysNode));
 }
 
 void VFSInfo::traceReadCallback(VFSNode *node,size_t *dataSize,void **buffer) {
@@ -200,7 +203,7 @@ void VFSInfo::statsReadCallback(A_UNUSED VFSNode *node,size_t *dataSize,void **b
 		"Threads:",Thread::getCount(),
 		"Interrupts:",Interrupts::getCount(),
 		"CPUCycles:",cycles.val64,
-		"UpTime:",Timer::getIntrptCount() / Timer::FREQUENCY_DIV
+		"UpTime:",(size_t)(Timer::getRuntime() / 1000)
 	);
 	*buffer = os.keepString();
 	*dataSize = os.getLength();
@@ -256,6 +259,20 @@ void VFSInfo::memUsageReadCallback(A_UNUSED VFSNode *node,size_t *dataSize,void
 	*dataSize = os.getLength();
 }
 
+void VFSInfo::cacheReadCallback(A_UNUSED VFSNode *node,size_t *dataSize,void **buffer) {
+	OStringStream os;
+	Cache::print(os);
+	*buffer = os.keepString();
+	*dataSize = os.getLength();
+}
+
+void VFSInfo::pageCacheReadCallback(A_UNUSED VFSNode *node,size_t *dataSize,void **buffer) {
+	OStringStream os;
+	PageCache::print(os);
+	*buffer = os.keepString();
+	*dataSize = os.getLength();
+}
+
 void VFSInfo::regionsReadCallback(VFSNode *node,size_t *dataSize,void **buffer) {
 	Proc *p = getProc(node,dataSize,buffer);
 	if(!p)
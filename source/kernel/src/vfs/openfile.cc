@@ -19,6 +19,7 @@
 
 #include <esc/ipc/ipcbuf.h>
 #include <mem/cache.h>
+#include <mem/pagecache.h>
 #include <sys/messages.h>
 #include <task/proc.h>
 #include <vfs/channel.h>
@@ -207,6 +208,9 @@ int OpenFile::mkdir(const char *name,mode_t mode) {
 	else if(IS_CHANNEL(node->getMode())) {
 		VFSChannel *chan = static_cast<VFSChannel*>(node);
 		err = VFSFS::mkdir(chan,name,S_IFDIR | (mode & MODE_PERM));
+		/* the new node might reuse the inode of a file with cached pages */
+		if(err == 0)
+			PageCache::invalidateDev(devNo);
 	}
 	return err;
 }
@@ -235,6 +239,9 @@ int OpenFile::symlink(const char *name,const char *target) {
 	else if(IS_CHANNEL(node->getMode())) {
 		VFSChannel *chan = static_cast<VFSChannel*>(node);
 		err = VFSFS::symlink(chan,name,target);
+		/* the new node might reuse the inode of a file with cached pages */
+		if(err == 0)
+			PageCache::invalidateDev(devNo);
 	}
 	return err;
 }
@@ -332,8 +339,22 @@ ssize_t OpenFile::read(USER void *buffer,size_t count) {
 	if(EXPECT_FALSE(!(flags & VFS_READ)))
 		return -EACCES;
 
-	/* use the read-handler */
-	ssize_t readBytes = node->read(this,buffer,position,count);
+	/* take as much as possible from the page cache, if it's a file in a userspace fs */
+	ssize_t readBytes = 0;
+	if(devNo != VFS_DEV_NO) {
+		readBytes = PageCache::read(devNo,nodeNo,position,buffer,count);
+		if(EXPECT_FALSE(readBytes < 0))
+			return readBytes;
+	}
+
+	/* use the read-handler for the rest */
+	if((size_t)readBytes < count) {
+		ssize_t res = node->read(this,(char*)buffer + readBytes,position + readBytes,count - readBytes);
+		if(res < 0 && readBytes == 0)
+			return res;
+		if(res > 0)
+			readBytes += res;
+	}
 	if(EXPECT_TRUE(readBytes > 0)) {
 		LockGuard<SpinLock> g(&lock);
 		position += readBytes;
@@ -348,6 +369,8 @@ ssize_t OpenFile::write(USER const void *buffer,size_t count) {
 
 	/* write to the node */
 	ssize_t writtenBytes = node->write(this,buffer,position,count);
+	if(devNo != VFS_DEV_NO)
+		PageCache::invalidate(devNo,nodeNo);
 	if(EXPECT_TRUE(writtenBytes > 0)) {
 		LockGuard<SpinLock> g(&lock);
 		position += writtenBytes;
@@ -357,7 +380,7 @@ ssize_t OpenFile::write(USER const void *buffer,size_t count) {
 }
 
 int OpenFile::sendMsg(msgid_t id,USER const void *data1,size_t size1,
-		USER const void *data2,size_t size2) {
+		USER const void *data2,size_t size2,uint fflags) {
 	/* the device-messages (open, read, write, close) are always allowed and the driver can always
 	 * send messages */
 	if(EXPECT_FALSE(!isDeviceMsg(id & 0xFFFF) && !(flags & (VFS_MSGS | VFS_DEVICE))))
@@ -366,7 +389,7 @@ int OpenFile::sendMsg(msgid_t id,USER const void *data1,size_t size1,
 	if(EXPECT_FALSE(!IS_CHANNEL(node->getMode())))
 		return -ENOTSUP;
 
-	return static_cast<VFSChannel*>(node)->send(flags,id,data1,size1,data2,size2);
+	return static_cast<VFSChannel*>(node)->send(flags | fflags,id,data1,size1,data2,size2);
 }
 
 ssize_t OpenFile::receiveMsg(msgid_t *id,USER void *data,size_t size,uint fflags) {
@@ -387,6 +410,7 @@ int OpenFile::truncate(off_t length) {
 	else if(IS_CHANNEL(node->getMode())) {
 		VFSChannel *chan = static_cast<VFSChannel*>(node);
 		res = VFSFS::truncate(chan,length);
+		PageCache::invalidate(devNo,nodeNo);
 	}
 	return res;
 }
@@ -20,6 +20,7 @@
 #include <fs/permissions.h>
 #include <mem/cache.h>
 #include <mem/dynarray.h>
+#include <mem/pagecache.h>
 #include <mem/pagedir.h>
 #include <sys/messages.h>
 #include <task/filedesc.h>
@@ -288,8 +289,12 @@ int VFS::openPath(pid_t pid,ushort flags,mode_t mode,const char *path,ssize_t *s
 		goto error;
 
 	/* store the path for debugging purposes */
-	if(openmsg == MSG_FS_OPEN)
+	if(openmsg == MSG_FS_OPEN) {
 		(*file)->setPath(strdup(path));
+		/* a new file might reuse the inode of a file with cached pages */
+		if(flags & (VFS_CREATE | VFS_TRUNCATE))
+			PageCache::invalidate((*file)->getDev(),(*file)->getNodeNo());
+	}
 	VFSNode::release(node);
 
 	/* append? */
@@ -0,0 +1,111 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <mem/pagedir.h>
+#include <sys/test.h>
+#include <task/proc.h>
+#include <task/smp.h>
+#include <common.h>
+#include <cpu.h>
+
+/* forward declarations */
+static void test_shootdown();
+static void test_batch(PageDir *pdir,cpuid_t other);
+static void test_flushAll(PageDir *pdir,cpuid_t other);
+static bool test_waitForFlush(cpuid_t id);
+
+/* our test-module */
+sTestModule tModShootdown = {
+	"TLB shootdowns",
+	&test_shootdown
+};
+
+static void test_shootdown() {
+	/* we need another CPU that receives the shootdowns */
+	cpuid_t cur = SMP::getCurId();
+	cpuid_t other = cur;
+	for(auto cpu = SMP::begin(); cpu != SMP::end(); ++cpu) {
+		if(cpu->id != cur && cpu->ready) {
+			other = cpu->id;
+			break;
+		}
+	}
+	if(other == cur) {
+		test_caseStart("Batching TLB shootdowns (skipped, only one CPU)");
+		test_caseSucceeded();
+		return;
+	}
+
+	/* pretend that the other CPU has our page-directory loaded */
+	PageDir *pdir = Proc::getByPid(Proc::getRunning())->getPageDir();
+	bool loaded = pdir->getCPUs() & (1UL << other);
+	pdir->setLoaded(other,true);
+
+	test_batch(pdir,other);
+	test_flushAll(pdir,other);
+
+	if(!loaded)
+		pdir->setLoaded(other,false);
+}
+
+static void test_batch(PageDir *pdir,cpuid_t other) {
+	test_caseStart("Batching TLB shootdowns");
+	test_assertTrue(test_waitForFlush(other));
+
+	/* within a batch, the flushes are only queued */
+	SMP::beginTLBBatch();
+	SMP::flushTLB(pdir,0x1000,1);
+	SMP::flushTLB(pdir,0x3000,2);
+	test_assertSize(SMP::getPendingFlushes(other),3);
+
+	/* ending a nested batch doesn't send the IPI either */
+	SMP::beginTLBBatch();
+	SMP::flushTLB(pdir,0x8000,1);
+	SMP::endTLBBatch();
+	test_assertSize(SMP::getPendingFlushes(other),4);
+
+	/* the outermost one does */
+	SMP::endTLBBatch();
+	test_assertTrue(test_waitForFlush(other));
+
+	test_caseSucceeded();
+}
+
+static void test_flushAll(PageDir *pdir,cpuid_t other) {
+	test_caseStart("Turning too many shootdowns into a complete flush");
+	test_assertTrue(test_waitForFlush(other));
+
+	SMP::beginTLBBatch();
+	SMP::flushTLB(pdir,0x1000,1);
+	SMP::flushTLB(pdir,0x10000,100);
+	test_assertSize(SMP::getPendingFlushes(other),SMP::FLUSH_ALL);
+	/* further flushes don't change that */
+	SMP::flushTLB(pdir,0x2000,1);
+	test_assertSize(SMP::getPendingFlushes(other),SMP::FLUSH_ALL);
+	SMP::endTLBBatch();
+	test_assertTrue(test_waitForFlush(other));
+
+	test_caseSucceeded();
+}
+
+static bool test_waitForFlush(cpuid_t id) {
+	for(int i = 0; i < 100000000 && SMP::getPendingFlushes(id) != 0; ++i)
+		CPU::pause();
+	return SMP::getPendingFlushes(id) == 0;
+}
@@ -20,6 +20,7 @@
 #include <mem/cache.h>
 #include <sys/test.h>
 #include <common.h>
+#include <string.h>
 #include <video.h>
 
 #include "testutils.h"
@@ -28,6 +29,7 @@
 static void test_cache();
 static void test_cache_1();
 static void test_cache_2();
+static void test_cache_3();
 
 static const uint TEST_COUNT    = 1000;
 static size_t sizes[] = {4,8,16,32,64,128,256,512,1024};
@@ -41,6 +43,7 @@ sTestModule tModCache = {
 static void test_cache() {
 	test_cache_1();
 	test_cache_2();
+	test_cache_3();
 }
 
 static void test_cache_1(void) {
@@ -106,3 +109,29 @@ static void test_cache_2(void) {
 
 	test_caseSucceeded();
 }
+
+static void test_cache_3(void) {
+	test_caseStart("Per-CPU magazines");
+
+	void *areas[64];
+	for(size_t s = 0; s < ARRAY_SIZE(sizes); ++s) {
+		size_t before = Cache::getUsedMem();
+
+		/* more than fit into a magazine, so that it has to be refilled and drained */
+		for(size_t i = 0; i < ARRAY_SIZE(areas); ++i) {
+			areas[i] = Cache::alloc(sizes[s]);
+			test_assertTrue(areas[i] != NULL);
+			memset(areas[i],0x55,sizes[s]);
+		}
+		for(size_t i = 0; i < ARRAY_SIZE(areas); ++i)
+			Cache::free(areas[i]);
+		test_assertSize(Cache::getUsedMem(),before);
+
+		/* the last freed object should be handed out first */
+		void *p = Cache::alloc(sizes[s]);
+		test_assertPtr(p,areas[ARRAY_SIZE(areas) - 1]);
+		Cache::free(p);
+	}
+
+	test_caseSucceeded();
+}
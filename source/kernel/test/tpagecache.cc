@@ -0,0 +1,224 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <mem/cache.h>
+#include <mem/copyonwrite.h>
+#include <mem/pagecache.h>
+#include <mem/pagedir.h>
+#include <mem/physmem.h>
+#include <sys/test.h>
+#include <common.h>
+#include <string.h>
+
+#include "testutils.h"
+
+/* a device and inode that won't be used by a real filesystem */
+#define TEST_DEV		0x7FFF
+#define TEST_INO		1
+#define PAGE_COUNT		8
+
+/* forward declarations */
+static void test_pagecache();
+static void test_insert();
+static void test_read();
+static void test_evict();
+static void test_share();
+static bool insertPage(const char *buf,size_t no,ulong gen);
+static void fillPages(char *buf,size_t start,size_t count);
+static bool checkPage(const char *buf,size_t no);
+
+/* our test-module */
+sTestModule tModPageCache = {
+	"Page cache",
+	&test_pagecache
+};
+
+static char *pageBuf;
+static char *readBuf;
+
+static void test_pagecache() {
+	pageBuf = (char*)Cache::alloc(PAGE_SIZE);
+	readBuf = (char*)Cache::alloc(PAGE_SIZE * 2);
+
+	test_insert();
+	test_read();
+	test_evict();
+	test_share();
+
+	Cache::free(readBuf);
+	Cache::free(pageBuf);
+}
+
+static void test_insert() {
+	test_caseStart("Inserting, finding and invalidating pages");
+	checkMemoryBefore(false);
+
+	size_t before = PageCache::getPageCount();
+	fillPages(pageBuf,0,PAGE_COUNT);
+	test_assertSize(PageCache::getPageCount(),before + PAGE_COUNT);
+
+	/* inserting an existing page doesn't change anything */
+	fillPages(pageBuf,0,1);
+	test_assertSize(PageCache::getPageCount(),before + PAGE_COUNT);
+
+	for(size_t i = 0; i < PAGE_COUNT; ++i) {
+		test_assertTrue(PageCache::get(TEST_DEV,TEST_INO,i * PAGE_SIZE,pageBuf));
+		test_assertTrue(checkPage(pageBuf,i));
+	}
+	test_assertFalse(PageCache::get(TEST_DEV,TEST_INO,PAGE_COUNT * PAGE_SIZE,pageBuf));
+	test_assertFalse(PageCache::get(TEST_DEV,TEST_INO + 1,0,pageBuf));
+
+	/* pages that have been read before an invalidation are not inserted anymore */
+	ulong gen = PageCache::getGeneration();
+	PageCache::invalidate(TEST_DEV,TEST_INO);
+	test_assertSize(PageCache::getPageCount(),before);
+	test_assertFalse(insertPage(pageBuf,0,gen));
+	test_assertSize(PageCache::getPageCount(),before);
+	test_assertFalse(PageCache::get(TEST_DEV,TEST_INO,0,pageBuf));
+
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+
+static void test_read() {
+	test_caseStart("Reading from the page cache");
+	checkMemoryBefore(false);
+
+	fillPages(pageBuf,0,1);
+
+	/* within the first page */
+	test_assertSSize(PageCache::read(TEST_DEV,TEST_INO,10,readBuf,100),100);
+	test_assertInt(readBuf[0],1);
+	test_assertInt(readBuf[99],1);
+
+	/* stops at the second page, which is not cached */
+	test_assertSSize(PageCache::read(TEST_DEV,TEST_INO,PAGE_SIZE / 2,readBuf,PAGE_SIZE),
+		PAGE_SIZE / 2);
+	test_assertSSize(PageCache::read(TEST_DEV,TEST_INO,PAGE_SIZE,readBuf,PAGE_SIZE),0);
+
+	/* across both pages */
+	fillPages(pageBuf,1,1);
+	test_assertSSize(PageCache::read(TEST_DEV,TEST_INO,PAGE_SIZE / 2,readBuf,PAGE_SIZE),
+		PAGE_SIZE);
+	test_assertInt(readBuf[PAGE_SIZE / 2 - 1],1);
+	test_assertInt(readBuf[PAGE_SIZE / 2],2);
+
+	PageCache::invalidate(TEST_DEV,TEST_INO);
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+
+static void test_evict() {
+	test_caseStart("Evicting the least recently used pages");
+
+	/* evict everything else first, so that we know which pages are the oldest */
+	frameno_t frames[PAGE_COUNT];
+	size_t n;
+	while((n = PageCache::evict(frames,PAGE_COUNT)) > 0)
+		PhysMem::free(frames,n,PhysMem::USR);
+
+	checkMemoryBefore(false);
+	fillPages(pageBuf,0,PAGE_COUNT);
+
+	/* use the first page again, so that the second one is the oldest now */
+	test_assertTrue(PageCache::get(TEST_DEV,TEST_INO,0,pageBuf));
+
+	test_assertSize(PageCache::evict(frames,2),2);
+	PhysMem::free(frames,2,PhysMem::USR);
+	test_assertSize(PageCache::getPageCount(),PAGE_COUNT - 2);
+	test_assertTrue(PageCache::get(TEST_DEV,TEST_INO,0,pageBuf));
+	test_assertFalse(PageCache::get(TEST_DEV,TEST_INO,1 * PAGE_SIZE,pageBuf));
+	test_assertFalse(PageCache::get(TEST_DEV,TEST_INO,2 * PAGE_SIZE,pageBuf));
+	test_assertTrue(PageCache::get(TEST_DEV,TEST_INO,3 * PAGE_SIZE,pageBuf));
+
+	PageCache::invalidateDev(TEST_DEV);
+	test_assertSize(PageCache::getPageCount(),0);
+
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+
+static void test_share() {
+	test_caseStart("Sharing pages with the page cache");
+
+	frameno_t frames[PAGE_COUNT];
+	size_t n;
+	while((n = PageCache::evict(frames,PAGE_COUNT)) > 0)
+		PhysMem::free(frames,n,PhysMem::USR);
+
+	checkMemoryBefore(false);
+	fillPages(pageBuf,0,2);
+
+	/* the cache and we use the frame now */
+	frameno_t frame = PageCache::share(TEST_DEV,TEST_INO,0);
+	test_assertTrue(frame != PhysMem::INVALID_FRAME);
+	test_assertUInt(*PhysMem::getRefCount(frame),2);
+	test_assertTrue(PageCache::share(TEST_DEV,TEST_INO,2 * PAGE_SIZE) == PhysMem::INVALID_FRAME);
+	PageDir::copyFromFrame(frame,pageBuf);
+	test_assertTrue(checkPage(pageBuf,0));
+
+	/* frames that are in use are not evicted */
+	test_assertSize(PageCache::evict(frames,2),1);
+	PhysMem::free(frames,1,PhysMem::USR);
+	test_assertSize(PageCache::getPageCount(),1);
+	test_assertSize(PageCache::evict(frames,2),0);
+
+	/* if the cache drops the page, we are the last user */
+	bool other;
+	PageCache::invalidate(TEST_DEV,TEST_INO);
+	test_assertSize(PageCache::getPageCount(),0);
+	CopyOnWrite::remove(frame,&other);
+	test_assertFalse(other);
+	PhysMem::free(frame,PhysMem::USR);
+
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+
+static bool insertPage(const char *buf,size_t no,ulong gen) {
+	if(!PhysMem::reserve(1,false))
+		return false;
+	frameno_t frame = PhysMem::allocate(PhysMem::USR);
+	if(frame == PhysMem::INVALID_FRAME)
+		return false;
+	PageDir::copyToFrame(frame,buf);
+	if(!PageCache::insert(TEST_DEV,TEST_INO,no * PAGE_SIZE,frame,gen)) {
+		PhysMem::free(frame,PhysMem::USR);
+		return false;
+	}
+	/* leave it to the cache */
+	bool other;
+	CopyOnWrite::remove(frame,&other);
+	return true;
+}
+
+static void fillPages(char *buf,size_t start,size_t count) {
+	for(size_t i = start; i < start + count; ++i) {
+		memset(buf,i + 1,PAGE_SIZE);
+		insertPage(buf,i,PageCache::getGeneration());
+	}
+}
+
+static bool checkPage(const char *buf,size_t no) {
+	for(size_t i = 0; i < PAGE_SIZE; ++i) {
+		if(buf[i] != (char)(no + 1))
+			return false;
+	}
+	return true;
+}
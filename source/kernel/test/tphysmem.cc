@@ -30,6 +30,8 @@ static void test_mm();
 static void test_default();
 static void test_contiguous();
 static void test_contiguous_align();
+static void test_contiguous_buddy();
+static void test_batch();
 static void test_mm_allocate();
 static void test_mm_free();
 
@@ -45,6 +47,8 @@ static void test_mm() {
 	test_default();
 	test_contiguous();
 	test_contiguous_align();
+	test_contiguous_buddy();
+	test_batch();
 }
 
 static void test_default() {
@@ -166,6 +170,55 @@ static void test_contiguous_align() {
 	test_caseSucceeded();
 }
 
+static void test_contiguous_buddy() {
+	ssize_t res[16];
+
+	test_caseStart("[Buddy] Fragment, merge and request a large block");
+	checkMemoryBefore(false);
+	for(size_t i = 0; i < ARRAY_SIZE(res); ++i) {
+		res[i] = PhysMem::allocateContiguous(1,1);
+		test_assertTrue(res[i] >= 0);
+	}
+	/* free every other first so that the buddies can only be merged at the end */
+	for(size_t i = 0; i < ARRAY_SIZE(res); i += 2)
+		PhysMem::freeContiguous(res[i],1);
+	for(size_t i = 1; i < ARRAY_SIZE(res); i += 2)
+		PhysMem::freeContiguous(res[i],1);
+	res[0] = PhysMem::allocateContiguous(64,64);
+	test_assertTrue(res[0] >= 0);
+	test_assertTrue((res[0] % 64) == 0);
+	PhysMem::freeContiguous(res[0],64);
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+
+	test_caseStart("[Buddy] Request with non-power-of-2 alignment");
+	checkMemoryBefore(false);
+	res[0] = PhysMem::allocateContiguous(7,3);
+	test_assertTrue(res[0] >= 0);
+	test_assertTrue((res[0] % 3) == 0);
+	res[1] = PhysMem::allocateContiguous(9,1);
+	test_assertTrue(res[1] >= 0);
+	PhysMem::freeContiguous(res[0],7);
+	PhysMem::freeContiguous(res[1],9);
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+
+static void test_batch() {
+	test_caseStart("Requesting and freeing %d user frames at once",FRAME_COUNT);
+	checkMemoryBefore(false);
+	test_assertTrue(PhysMem::reserve(FRAME_COUNT,false));
+	test_assertSize(PhysMem::allocate(PhysMem::USR,FRAME_COUNT,frames),FRAME_COUNT);
+	PhysMem::free(frames,FRAME_COUNT,PhysMem::USR);
+
+	/* the frames should be in the cache of this CPU now */
+	size_t count = PhysMem::allocateCached(FRAME_COUNT,frames);
+	test_assertTrue(count > 0);
+	PhysMem::free(frames,count,PhysMem::USR);
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+
 static void test_mm_allocate() {
 	ssize_t i = 0;
 	while(i < FRAME_COUNT) {
@@ -19,6 +19,7 @@
 
 #include <mem/pagedir.h>
 #include <mem/physmem.h>
+#include <mem/virtmem.h>
 #include <sys/test.h>
 #include <task/proc.h>
 #include <task/thread.h>
@@ -32,6 +33,10 @@
 static void test_proc();
 #ifndef __mmix__
 static void test_proc_clone();
+static void test_proc_clone_phys();
+#if defined(__x86__)
+static void test_proc_clone_sharedpt();
+#endif
 static void test_thread();
 #endif
 
@@ -46,6 +51,10 @@ static void test_proc() {
 	 * get a new kernel-stack */
 #ifndef __mmix__
 	test_proc_clone();
+	test_proc_clone_phys();
+#if defined(__x86__)
+	test_proc_clone_sharedpt();
+#endif
 	test_thread();
 #endif
 }
@@ -86,6 +95,62 @@ static void test_proc_clone() {
 	test_caseSucceeded();
 }
 
+static void test_proc_clone_phys() {
+	/* mapped physical memory is shared with the child, not copied on write. this has to work for
+	 * memory without reference counters, e.g. device memory behind the last frame */
+	test_init("Cloning processes with mapped physical memory");
+	Proc *p = Thread::getRunning()->getProc();
+	uintptr_t phys = PhysMem::getFrameCount() * PAGE_SIZE;
+	uintptr_t virt = p->getVM()->mapphys(&phys,PAGE_SIZE * 4,0,MAP_PHYS_MAP);
+	test_assertTrue(PageDir::isInUserSpace(virt,PAGE_SIZE * 4));
+
+	pid_t pid = Proc::clone(0);
+	if(pid == 0) {
+		Proc::terminate();
+		A_UNREACHED;
+	}
+	test_assertTrue(pid > 0);
+	Proc::waitChild(NULL,-1,0);
+	test_assertTrue(Proc::getByPid(pid) == NULL);
+
+	test_assertInt(p->getVM()->unmap(virt),0);
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+
+#if defined(__x86__)
+static void test_proc_clone_sharedpt() {
+	/* page-tables that are completely covered by a private region are shared with the child until
+	 * one of them changes something in it */
+	test_init("Cloning processes with shared page-tables");
+	Proc *p = Thread::getRunning()->getProc();
+	PageTables *pts = p->getPageDir()->getPageTables();
+	uintptr_t addr = 0;
+	VMRegion *vm;
+	test_assertInt(p->getVM()->map(&addr,PT_SIZE * 2,0,PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_POPULATE,NULL,0,&vm),0);
+	uintptr_t pt = (vm->virt() + PT_SIZE - 1) & ~(PT_SIZE - 1);
+
+	pid_t pid = Proc::clone(0);
+	if(pid == 0) {
+		Proc::terminate();
+		A_UNREACHED;
+	}
+	test_assertTrue(pid > 0);
+	test_assertTrue(pts->isSharedPT(pt));
+
+	/* depending on whether the child is still there, we get a copy or the page-table itself */
+	test_assertInt(VirtMem::pagefault(pt,true),0);
+	test_assertFalse(pts->isSharedPT(pt));
+	Proc::waitChild(NULL,-1,0);
+	test_assertTrue(Proc::getByPid(pid) == NULL);
+
+	test_assertInt(p->getVM()->unmap(vm->virt()),0);
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+#endif
+
 static int threadcnt = 0;
 
 static void thread_test() {
@@ -34,6 +34,9 @@
 #if defined(__mmix__)
 extern sTestModule tModAddrSpace;
 #endif
+#if defined(__x86__)
+extern sTestModule tModShootdown;
+#endif
 extern sTestModule tModVMReg;
 extern sTestModule tModVMFree;
 extern sTestModule tModMM;
@@ -48,6 +51,8 @@ extern sTestModule tModSwapMap;
 extern sTestModule tModVmm;
 extern sTestModule tModPmemAreas;
 extern sTestModule tModCache;
+extern sTestModule tModPageCache;
+extern sTestModule tModTimer;
 
 EXTERN_C void unittest_run();
 EXTERN_C void unittest_start();
@@ -84,6 +89,11 @@ void unittest_run() {
 	test_register(&tModVmm);
 	test_register(&tModPmemAreas);
 	test_register(&tModCache);
+	test_register(&tModPageCache);
+	test_register(&tModTimer);
+#if defined(__x86__)
+	test_register(&tModShootdown);
+#endif
 	test_start();
 
 	/* stay here */
@@ -28,6 +28,7 @@ static void test_swapmap1();
 static void test_swapmap2();
 static void test_swapmap5();
 static void test_swapmap6();
+static void test_swapmap7();
 static void test_doStart(const char *title);
 static void test_finish();
 
@@ -44,6 +45,7 @@ static void test_swapmap() {
 	test_swapmap2();
 	test_swapmap5();
 	test_swapmap6();
+	test_swapmap7();
 }
 
 static void test_swapmap1() {
@@ -61,8 +63,8 @@ static void test_swapmap1() {
 	test_assertTrue(SwapMap::isUsed(blocks[2]));
 	test_assertTrue(SwapMap::isUsed(blocks[3]));
 	test_assertTrue(SwapMap::isUsed(blocks[4]));
-	test_assertFalse(SwapMap::isUsed(blocks[4] - 1));
-	test_assertFalse(SwapMap::isUsed(blocks[4] - 2));
+	test_assertFalse(SwapMap::isUsed(blocks[4] + 1));
+	test_assertFalse(SwapMap::isUsed(blocks[4] + 2));
 
 	SwapMap::free(blocks[0]);
 	SwapMap::free(blocks[1]);
@@ -161,6 +163,41 @@ static void test_swapmap6() {
 	Cache::free(blocks);
 }
 
+static void test_swapmap7() {
+	ulong blocks[3];
+	size_t counts[3];
+	test_doStart("Testing alloc of consecutive blocks");
+
+	blocks[0] = SwapMap::alloc(4,counts + 0);
+	test_assertTrue(blocks[0] != SwapMap::INVALID);
+	test_assertSize(counts[0],4);
+	for(size_t i = 0; i < 4; i++)
+		test_assertTrue(SwapMap::isUsed(blocks[0] + i));
+
+	/* make a hole of 2 blocks and fill it again */
+	blocks[1] = SwapMap::alloc(2,counts + 1);
+	test_assertSize(counts[1],2);
+	test_assertTrue(blocks[1] == blocks[0] + 4);
+	SwapMap::free(blocks[0] + 1);
+	SwapMap::free(blocks[0] + 2);
+	for(size_t i = 0; i < SwapMap::freeSpace() / PAGE_SIZE; i++) {
+		blocks[2] = SwapMap::alloc(2,counts + 2);
+		if(blocks[2] == blocks[0] + 1)
+			break;
+		for(size_t j = 0; j < counts[2]; j++)
+			SwapMap::free(blocks[2] + j);
+	}
+	test_assertTrue(blocks[2] == blocks[0] + 1);
+	test_assertSize(counts[2],2);
+
+	for(size_t i = 0; i < 4; i++)
+		SwapMap::free(blocks[0] + i);
+	SwapMap::free(blocks[1]);
+	SwapMap::free(blocks[1] + 1);
+
+	test_finish();
+}
+
 static void test_doStart(const char *title) {
 	test_caseStart(title);
 	spaceBefore = SwapMap::freeSpace();
@@ -0,0 +1,96 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/test.h>
+#include <task/proc.h>
+#include <task/thread.h>
+#include <task/timer.h>
+#include <common.h>
+#include <cpu.h>
+
+#include "testutils.h"
+
+/* the sleeper sleeps that long first and is then waked up much earlier by us */
+static const time_t FAR_SLEEP		= 800;	/* ms */
+static const time_t NEAR_SLEEP		= 20;	/* ms */
+
+/* forward declarations */
+static void test_timer();
+static void test_timer_remote();
+static void sleeper_thread();
+
+/* our test-module */
+sTestModule tModTimer = {
+	"Timer",
+	&test_timer
+};
+
+static volatile tid_t sleeper;
+static volatile cpuid_t sleeperCPU;
+static volatile bool sleeping;
+static volatile uint64_t wokenAt;
+
+static void test_timer() {
+	test_timer_remote();
+}
+
+static void test_timer_remote() {
+	/* a listener that is added to the wheel of another CPU has to wake up that CPU in time, even
+	 * if it idles and has programmed its timer for a later listener */
+	test_caseStart("Expiring a listener in the wheel of another CPU");
+
+	int tid = Proc::startThread((uintptr_t)&sleeper_thread,0,NULL);
+	test_assertTrue(tid >= 0);
+
+	/* yield, so that the sleeper runs here and an idle CPU takes us */
+	uint64_t end = CPU::rdtsc() + Timer::timeToCycles(FAR_SLEEP * 1000 / 4);
+	while(!sleeping && CPU::rdtsc() < end)
+		Thread::switchAway();
+	test_assertTrue(sleeping);
+
+	if(Thread::getRunning()->getCPU() == sleeperCPU) {
+		/* we can't test it on one CPU; just let the sleeper finish */
+		tprintf("Skipped, because we run on the same CPU as the sleeper\n");
+		Proc::join(tid);
+		test_caseSucceeded();
+		return;
+	}
+
+	/* the sleeper has a listener, so that the new one goes into the same wheel */
+	uint64_t start = CPU::rdtsc();
+	test_assertInt(Timer::sleepFor(sleeper,NEAR_SLEEP,true),0);
+	Proc::join(tid);
+
+	time_t elapsed = Timer::cyclesToTime(wokenAt - start) / 1000;
+	tprintf("Sleeper woke up after %u ms\n",elapsed);
+	test_assertTrue(elapsed < FAR_SLEEP / 2);
+	test_caseSucceeded();
+}
+
+static void sleeper_thread() {
+	Thread *t = Thread::getRunning();
+	sleeper = t->getTid();
+	sleeperCPU = t->getCPU();
+	Timer::sleepFor(t->getTid(),FAR_SLEEP,true);
+	sleeping = true;
+	Thread::switchAway();
+
+	wokenAt = CPU::rdtsc();
+	Proc::terminateThread(0);
+}
@@ -33,6 +33,7 @@ static void test_vmfree_inOrder();
 static void test_vmfree_revOrder();
 static void test_vmfree_randOrder();
 static void test_vmfree_allocAt();
+static void test_vmfree_aligned();
 static void test_vmfree_allocNFree(size_t *sizes,size_t *freeIndices,const char *msg);
 
 /* our test-module */
@@ -46,6 +47,7 @@ static void test_vmfree() {
 	test_vmfree_revOrder();
 	test_vmfree_randOrder();
 	test_vmfree_allocAt();
+	test_vmfree_aligned();
 }
 
 static void test_vmfree_inOrder() {
@@ -121,6 +123,36 @@ static void test_vmfree_allocAt() {
 	test_caseSucceeded();
 }
 
+static void test_vmfree_aligned() {
+	size_t areas,size = TOTAL_SIZE;
+	test_caseStart("Allocating aligned areas");
+	checkMemoryBefore(false);
+
+	{
+		VMFreeMap map(PAGE_SIZE,size);
+
+		uintptr_t a1 = map.allocate(2 * PAGE_SIZE,16 * PAGE_SIZE);
+		test_assertSize(a1,16 * PAGE_SIZE);
+		uintptr_t a2 = map.allocate(16 * PAGE_SIZE,16 * PAGE_SIZE);
+		test_assertSize(a2,32 * PAGE_SIZE);
+		/* the space in front of them is still usable */
+		uintptr_t a3 = map.allocate(PAGE_SIZE);
+		test_assertSize(a3,PAGE_SIZE);
+		/* not enough space at an aligned address */
+		test_assertSize(map.allocate(32 * PAGE_SIZE,32 * PAGE_SIZE),0);
+
+		map.free(a2,16 * PAGE_SIZE);
+		map.free(a3,PAGE_SIZE);
+		map.free(a1,2 * PAGE_SIZE);
+
+		test_assertSize(map.getSize(&areas),size);
+		test_assertSize(areas,1);
+	}
+
+	checkMemoryAfter(false);
+	test_caseSucceeded();
+}
+
 static void test_vmfree_allocNFree(size_t *sizes,size_t *freeIndices,const char *msg) {
 	size_t areas;
 	uintptr_t addrs[AREA_COUNT];
@@ -25,7 +25,7 @@
 static const size_t DIRE_SIZE	= sizeof(struct dirent) - (NAME_MAX + 1);
 
 bool readdirto(DIR *dir,struct dirent *e) {
-	if(fread(e,1,DIRE_SIZE,dir) > 0) {
+	while(fread(e,1,DIRE_SIZE,dir) > 0) {
 		/* convert endianess */
 		e->d_namelen = le16tocpu(e->d_namelen);
 		e->d_reclen = le16tocpu(e->d_reclen);
@@ -35,6 +35,16 @@ bool readdirto(DIR *dir,struct dirent *e) {
 		if(len >= NAME_MAX)
 			return false;
 
+		/* skip empty entries (e.g. free space or the index of ext2 directories) */
+		if(len == 0) {
+			/* a record can't be shorter than its header */
+			if(e->d_reclen < DIRE_SIZE)
+				return false;
+			if(e->d_reclen > DIRE_SIZE && fseek(dir,e->d_reclen - DIRE_SIZE,SEEK_CUR) < 0)
+				return false;
+			continue;
+		}
+
 		/* now read the name */
 		if(fread(e->d_name,1,len,dir) > 0) {
 			/* if the record is longer, we have to skip the stuff until the next record */
@@ -48,6 +58,7 @@ bool readdirto(DIR *dir,struct dirent *e) {
 			e->d_name[e->d_namelen] = '\0';
 			return true;
 		}
+		break;
 	}
 
 	return false;
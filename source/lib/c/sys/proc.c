@@ -48,6 +48,26 @@ int fexecvpe(int fd,const char **args,const char **env) {
 	return syscall3(SYSCALL_EXEC,fd,(ulong)args,(ulong)env);
 }
 
+int spawnv(const char *path,const char **args) {
+	return spawnvpe(path,args,(const char**)environ);
+}
+
+int spawnvpe(const char *path,const char **args,const char **env) {
+	char apath[MAX_PATH_LEN];
+	int fd = open(abspath(apath,sizeof(apath),path),O_EXEC | O_READ);
+	if(fd < 0)
+		return fd;
+	int res = fspawnvpe(fd,args,env);
+	close(fd);
+	if(res < 0)
+		errno = res;
+	return res;
+}
+
+int fspawnvpe(int fd,const char **args,const char **env) {
+	return syscall3(SYSCALL_SPAWN,fd,(ulong)args,(ulong)env);
+}
+
 int execvp(const char *file,const char **args) {
 	char path[MAX_PATH_LEN];
 	size_t len,flen;
@@ -21,11 +21,12 @@
 #include <esc/vthrow.h>
 #include <sys/common.h>
 #include <sys/messages.h>
+#include <sys/thread.h>
 
 namespace esc {
 
 Device::Device(const char *path,mode_t mode,uint type,uint ops)
-	: _ops(), _id(createdev(path,mode,type,ops | DEV_CLOSE)), _run(true) {
+	: _ops(), _table(), _id(createdev(path,mode,type,ops | DEV_CLOSE)), _run(true) {
 	if(_id < 0)
 		VTHROWE("createdev(" << path << ")",_id);
 	set(MSG_FILE_CLOSE,std::make_memfun(this,&Device::close),false);
@@ -43,6 +44,7 @@ void Device::set(msgid_t op,handler_type *handler,bool rep) {
 	assert(handler != NULL);
 	unset(op);
 	_ops[op] = Handler(handler,rep);
+	buildTable();
 }
 
 void Device::unset(msgid_t op) {
@@ -50,6 +52,27 @@ void Device::unset(msgid_t op) {
 	if(it != _ops.end()) {
 		delete it->second.func;
 		_ops.erase(it);
+		buildTable();
+	}
+}
+
+void Device::buildTable() {
+	/* search for the smallest size without collisions. the ops are usually a few consecutive
+	 * numbers in one or two blocks, so that this terminates quickly with a small table */
+	for(size_t size = _ops.size() > 0 ? _ops.size() : 1; ; ++size) {
+		bool collision = false;
+		_table.assign(size,Slot());
+		for(auto it = _ops.begin(); it != _ops.end(); ++it) {
+			Slot &slot = _table[it->first % size];
+			if(slot.handler) {
+				collision = true;
+				break;
+			}
+			slot.op = it->first;
+			slot.handler = &it->second;
+		}
+		if(!collision)
+			break;
 	}
 }
 
@@ -70,6 +93,49 @@ void Device::loop() {
 	}
 }
 
+void Device::loop(size_t workers) {
+	if(workers <= 1) {
+		loop();
+		return;
+	}
+
+	std::vector<tid_t> tids;
+	for(size_t i = 0; i < workers; ++i) {
+		int tid = startthread(workerThread,this);
+		if(tid < 0) {
+			printe("Unable to start worker thread");
+			break;
+		}
+		tids.push_back(tid);
+	}
+
+	ulong buf[IPC_DEF_SIZE / sizeof(ulong)];
+	size_t next = 0;
+	while(_run) {
+		msgid_t mid;
+		int fd = getwork(_id,&mid,buf,sizeof(buf),0);
+		if(EXPECT_FALSE(fd < 0)) {
+			if(fd != -EINTR)
+				printe("getwork failed");
+			continue;
+		}
+
+		IPCStream is(fd,buf,sizeof(buf),mid);
+		handleMsg(mid,is);
+
+		/* all further messages of this client go to the next worker, so that we only get the first
+		 * message of every client and bind each one once. we do that after handling the message
+		 * to preserve the order. if the client is gone already, it fails silently */
+		if(tids.size() > 0)
+			::bindto(fd,tids[next++ % tids.size()]);
+	}
+}
+
+int Device::workerThread(void *arg) {
+	static_cast<Device*>(arg)->loop();
+	return 0;
+}
+
 void Device::reply(IPCStream &is,errcode_t errcode) {
 	try {
 		is << errcode << Reply();
@@ -80,13 +146,15 @@ void Device::reply(IPCStream &is,errcode_t errcode) {
 }
 
 void Device::handleMsg(msgid_t mid,IPCStream &is) {
-	oplist_type::iterator it = _ops.find(mid & 0xFFFF);
-	Handler &h = (*it).second;
+	const Slot &slot = _table[(mid & 0xFFFF) % _table.size()];
+	if(EXPECT_FALSE(slot.handler == NULL || slot.op != (mid & 0xFFFF))) {
+		reply(is,-ENOTSUP);
+		return;
+	}
+
+	const Handler &h = *slot.handler;
 	try {
-		if(EXPECT_FALSE(it == _ops.end()))
-			reply(is,-ENOTSUP);
-		else
-			(*h.func)(is);
+		(*h.func)(is);
 	}
 	catch(const esc::default_error &e) {
 		// TODO printe is annoying here since it prints errno, which is typically nonsense.
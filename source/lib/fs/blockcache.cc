@@ -17,36 +17,43 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <esc/util.h>
 #include <fs/blockcache.h>
 #include <fs/fsdev.h>
 #include <sys/common.h>
 #include <sys/debug.h>
 #include <sys/thread.h>
+#include <algorithm>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-#define ALLOC_LOCK	0xF7180000
+#include <string.h>
 
 namespace fs {
 
 BlockCache::BlockCache(int fd,size_t blocks,size_t bsize)
-		: _blockCacheSize(blocks), _blockSize(bsize), _hashmap(new CBlock*[HASH_SIZE]()),
-		  _oldestBlock(NULL), _newestBlock(NULL), _freeBlocks(NULL),
-		  _blockCache(new CBlock[blocks]), _blockmem(), _hits(), _misses() {
+		: _blockCacheSize(blocks), _blockSize(bsize), _hashmap(new CBlock*[HASH_SIZE]()), _lists(),
+		  _inMax(esc::Util::max(blocks / 4,(size_t)1)), _ghost(esc::Util::max(blocks / 2,(size_t)1)),
+		  _freeBlocks(NULL),
+		  _blockCache(new CBlock[blocks]), _dirtyList(new DirtyBlock[blocks]), _blockmem(),
+		  _iobuf(), _raNext(), _raWindow(1), _flusherStarted(), _flusher(-1), _stop(), _hits(),
+		  _misses(), _evictions(), _ghostHits(), _readahead(), _writes(), _directReads() {
 	size_t i;
 	CBlock *bentry;
-	if(sharebuf(fd,_blockCacheSize * _blockSize,&_blockmem,0) < 0) {
+	/* share the buffer for the multi-block requests as well */
+	if(sharebuf(fd,(_blockCacheSize + MAX_IO_BLOCKS) * _blockSize,&_blockmem,0) < 0) {
 		if(_blockmem == NULL)
 			VTHROW("Unable to create block cache");
 		printe("Unable to share buffer with disk driver");
 	}
+	_iobuf = (char*)_blockmem + _blockCacheSize * _blockSize;
 	bentry = _blockCache;
 	for(i = 0; i < _blockCacheSize; i++) {
 		bentry->blockNo = 0;
 		bentry->buffer = (char*)_blockmem + i * _blockSize;
 		bentry->dirty = false;
 		bentry->refs = 0;
+		bentry->queue = QUEUE_FREE;
 		bentry->prev = (i < _blockCacheSize - 1) ? bentry + 1 : NULL;
 		bentry->next = _freeBlocks;
 		bentry->hnext = NULL;
@@ -56,178 +63,447 @@ BlockCache::BlockCache(int fd,size_t blocks,size_t bsize)
 }
 
 BlockCache::~BlockCache() {
+	_stop = true;
+	if(_flusher >= 0)
+		join(_flusher);
 	destroybuf(_blockmem);
 	delete[] _hashmap;
+	delete[] _dirtyList;
 	delete[] _blockCache;
 }
 
-void BlockCache::flush() {
-	CBlock *bentry = _newestBlock;
-	while(bentry != NULL) {
-		sassert(tpool_lock(ALLOC_LOCK,LOCK_EXCLUSIVE | LOCK_KEEP) == 0);
-		if(bentry->dirty) {
-			acquire(bentry,READ);
-			writeBlocks(bentry->buffer,bentry->blockNo,1);
-			bentry->dirty = false;
-			doRelease(bentry,false);
+void BlockCache::writeBack(bool skipUsed) {
+	std::lock_guard<std::mutex> guard(_ioLock);
+
+	/* collect the dirty blocks without locking; we check that again when writing them */
+	size_t count = 0;
+	for(size_t i = 0; i < _blockCacheSize; i++) {
+		CBlock *b = _blockCache + i;
+		if(b->dirty) {
+			_dirtyList[count].blockNo = b->blockNo;
+			_dirtyList[count].block = b;
+			count++;
 		}
-		sassert(tpool_unlock(ALLOC_LOCK) == 0);
-		bentry = bentry->next;
 	}
+	if(count == 0)
+		return;
+
+	/* sort them, so that we can write consecutive blocks with one request */
+	std::sort(_dirtyList,_dirtyList + count,compareDirty);
+
+	size_t i = 0;
+	while(i < count) {
+		block_t start = _dirtyList[i].blockNo;
+		size_t n = 0;
+		while(i < count && n < MAX_IO_BLOCKS && _dirtyList[i].blockNo == start + n) {
+			CBlock *b = _dirtyList[i++].block;
+			std::lock_guard<std::mutex> lguard(lockOf(start + n));
+			/* it might have been written or replaced meanwhile. and if somebody uses it, it
+			 * might be changed at the moment; the next run will write it */
+			if(b->blockNo != start + n || !b->dirty || (skipUsed && b->refs > 0))
+				break;
+			memcpy(_iobuf + n * _blockSize,b->buffer,_blockSize);
+			b->dirty = false;
+			n++;
+		}
+
+		if(n > 0) {
+			writeBlocks(_iobuf,start,n);
+			_writes++;
+		}
+	}
+}
+
+bool BlockCache::compareDirty(const DirtyBlock &a,const DirtyBlock &b) {
+	return a.blockNo < b.blockNo;
+}
+
+void BlockCache::startFlusher() {
+	std::lock_guard<std::mutex> guard(_ioLock);
+	if(!_flusherStarted) {
+		_flusherStarted = true;
+		_flusher = startthread(flusher,this);
+		if(_flusher < 0)
+			printe("Unable to start flusher thread");
+	}
+}
+
+int BlockCache::flusher(void *arg) {
+	BlockCache *cache = static_cast<BlockCache*>(arg);
+	while(!cache->_stop) {
+		usleep(FLUSH_INTERVAL);
+		if(!cache->_stop)
+			cache->writeBack(true);
+	}
+	return 0;
 }
 
 void BlockCache::acquire(CBlock *b,A_UNUSED uint mode) {
-	assert(!(mode & WRITE) || b->refs == 0);
-	b->refs++;
-	sassert(tpool_unlock(ALLOC_LOCK) == 0);
+	assert(!(mode & WRITE) || b->refs == 1);
 	sassert(tpool_lock((uint)b,(mode & WRITE) ? LOCK_EXCLUSIVE : 0) == 0);
 }
 
-void BlockCache::doRelease(CBlock *b,bool unlockAlloc) {
-	sassert(tpool_lock(ALLOC_LOCK,LOCK_EXCLUSIVE | LOCK_KEEP) == 0);
+void BlockCache::doRelease(CBlock *b) {
+	unref(b);
+	sassert(tpool_unlock((uint)b) == 0);
+}
+
+void BlockCache::unref(CBlock *b) {
+	/* the block-number can't change while we have a reference */
+	std::lock_guard<std::mutex> guard(lockOf(b->blockNo));
 	assert(b->refs > 0);
 	b->refs--;
-	if(unlockAlloc)
-		sassert(tpool_unlock(ALLOC_LOCK) == 0);
-	sassert(tpool_unlock((uint)b) == 0);
 }
 
 CBlock *BlockCache::doRequest(block_t blockNo,bool doRead,uint mode) {
-	CBlock *block,*bentry;
-
-	/* acquire tpool_lock for getting a block */
-	sassert(tpool_lock(ALLOC_LOCK,LOCK_EXCLUSIVE | LOCK_KEEP) == 0);
-
-	/* search for the block. perhaps it's already in cache */
-	bentry = _hashmap[blockNo % HASH_SIZE];
-	while(bentry != NULL) {
-		if(bentry->blockNo == blockNo) {
-			/* remove from list and put at the beginning of the usedlist because it was
-			 * used most recently */
-			if(bentry->prev != NULL) {
-				/* update oldest */
-				if(_oldestBlock == bentry)
-					_oldestBlock = bentry->prev;
-				/* remove */
-				bentry->prev->next = bentry->next;
-				if(bentry->next)
-					bentry->next->prev = bentry->prev;
-				/* put at the beginning */
-				bentry->prev = NULL;
-				bentry->next = _newestBlock;
-				bentry->next->prev = bentry;
-				_newestBlock = bentry;
-			}
-			acquire(bentry,mode);
-			_hits++;
-			return bentry;
-		}
-		bentry = bentry->hnext;
+	bool created;
+	CBlock *block = get(blockNo,&created);
+	if(block == NULL)
+		return NULL;
+	if(!created) {
+		_hits++;
+		acquire(block,mode);
+		return block;
 	}
 
-	/* init cached block */
-	block = getBlock(blockNo);
-	block->blockNo = blockNo;
-	block->dirty = false;
-	block->refs = 0;
-
 	/* now read from disk */
+	_misses++;
 	if(doRead) {
 		/* we need always a write-tpool_lock because we have to read the content into it */
 		acquire(block,WRITE);
-		if(readBlocks(block->buffer,blockNo,1) != 0) {
-			block->blockNo = 0;
-			doRelease(block,true);
+		bool loaded = load(block);
+		sassert(tpool_unlock((uint)block) == 0);
+		if(!loaded) {
+			discard(block);
 			return NULL;
 		}
-		doRelease(block,false);
 	}
 
 	acquire(block,mode);
-	_misses++;
 	return block;
 }
 
-CBlock *BlockCache::getBlock(block_t blockNo) {
+bool BlockCache::load(CBlock *block) {
+	block_t blockNo = block->blockNo;
+	std::lock_guard<std::mutex> guard(_ioLock);
+
+	/* if we're reading sequentially, the next miss is the block behind the last one we've read */
+	if(blockNo == _raNext)
+		_raWindow = esc::Util::min(esc::Util::max(_raWindow * 2,MIN_READAHEAD),MAX_IO_BLOCKS);
+	else
+		_raWindow = 1;
+
+	/* stop at the first block that is already in the cache */
+	size_t count = 1;
+	for(; count < _raWindow; count++) {
+		std::lock_guard<std::mutex> lguard(lockOf(blockNo + count));
+		if(find(blockNo + count))
+			break;
+	}
+
+	/* the read might fail at the end of the device; try it again with just the requested block */
+	if(count > 1 && readBlocks(_iobuf,blockNo,count) == 0) {
+		memcpy(block->buffer,_iobuf,_blockSize);
+		for(size_t i = 1; i < count; i++) {
+			bool created;
+			CBlock *b = get(blockNo + i,&created);
+			if(b == NULL)
+				break;
+			/* if somebody else has been faster, keep his version */
+			if(created) {
+				acquire(b,WRITE);
+				memcpy(b->buffer,_iobuf + i * _blockSize,_blockSize);
+				sassert(tpool_unlock((uint)b) == 0);
+				_readahead++;
+			}
+			unref(b);
+		}
+	}
+	else {
+		count = 1;
+		if(readBlocks(block->buffer,blockNo,1) != 0)
+			return false;
+	}
+
+	_raNext = blockNo + count;
+	return true;
+}
+
+bool BlockCache::readDirect(void *buffer,block_t start,size_t count) {
+	char *dst = (char*)buffer;
+	size_t i = 0;
+	while(i < count) {
+		{
+			std::lock_guard<std::mutex> guard(lockOf(start + i));
+			CBlock *b = find(start + i);
+			if(b) {
+				memcpy(dst + i * _blockSize,b->buffer,_blockSize);
+				_hits++;
+				i++;
+				continue;
+			}
+		}
+
+		/* read all following blocks that are not in the cache with one request */
+		size_t n = 1;
+		for(; i + n < count && n < MAX_IO_BLOCKS; n++) {
+			std::lock_guard<std::mutex> guard(lockOf(start + i + n));
+			if(find(start + i + n))
+				break;
+		}
+
+		/* the disk driver can only access the shared buffer */
+		std::lock_guard<std::mutex> guard(_ioLock);
+		if(readBlocks(_iobuf,start + i,n) != 0)
+			return false;
+		memcpy(dst + i * _blockSize,_iobuf,n * _blockSize);
+		_directReads++;
+		i += n;
+	}
+	return true;
+}
+
+void BlockCache::discard(CBlock *block) {
+	std::lock_guard<std::mutex> guard(lockOf(block->blockNo));
+	assert(block->refs == 1);
+	unhash(block);
+	block->blockNo = 0;
+	block->refs = 0;
+
+	std::lock_guard<std::mutex> lguard(_lruLock);
+	unlink(block);
+	addToFree(block);
+}
+
+CBlock *BlockCache::find(block_t blockNo) {
+	CBlock *bentry = _hashmap[blockNo % HASH_SIZE];
+	while(bentry != NULL) {
+		if(bentry->blockNo == blockNo)
+			return bentry;
+		bentry = bentry->hnext;
+	}
+	return NULL;
+}
+
+CBlock *BlockCache::get(block_t blockNo,bool *created) {
+	/* the number of victims in a row that were in use */
+	size_t busy = 0;
+	while(true) {
+		/* search for the block. perhaps it's already in cache */
+		{
+			std::lock_guard<std::mutex> guard(lockOf(blockNo));
+			CBlock *block = find(blockNo);
+			if(block) {
+				block->refs++;
+				/* blocks in the in-queue stay where they are, because a second access shortly
+				 * after the first one doesn't mean that it's used frequently */
+				std::lock_guard<std::mutex> lguard(_lruLock);
+				if(block->queue == QUEUE_MAIN) {
+					unlink(block);
+					addToFront(block,QUEUE_MAIN);
+				}
+				*created = false;
+				return block;
+			}
+		}
+
+		/* choose the entry to replace. we can't hold the lock for blockNo meanwhile, because we
+		 * need the lock of the victim as well and have to take the locks in a fixed order */
+		uint from;
+		CBlock *victim;
+		{
+			std::lock_guard<std::mutex> guard(_lruLock);
+			victim = getVictim(&from);
+		}
+
+		bool used = from != QUEUE_FREE;
+		block_t oldNo = victim->blockNo;
+		std::mutex *first = &lockOf(blockNo);
+		std::mutex *second = used ? &lockOf(oldNo) : first;
+		if(second < first)
+			std::swap(first,second);
+		first->lock();
+		if(second != first)
+			second->lock();
+
+		/* somebody else might have loaded the block or started to use the victim meanwhile */
+		bool usable = find(blockNo) == NULL && victim->refs == 0;
+		if(usable) {
+			if(used) {
+				/* if it is dirty we have to write it first to disk */
+				if(victim->dirty) {
+					writeBlocks(victim->buffer,oldNo,1);
+					victim->dirty = false;
+				}
+				unhash(victim);
+			}
+			victim->blockNo = blockNo;
+			victim->refs = 1;
+			hash(victim);
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(_lruLock);
+			if(usable) {
+				/* remember the blocks that have been used only once */
+				if(from == QUEUE_IN)
+					_ghost.add(oldNo);
+				if(used)
+					_evictions++;
+				/* if it has been evicted from the in-queue recently, it's used repeatedly */
+				bool ghostHit = _ghost.remove(blockNo);
+				if(ghostHit)
+					_ghostHits++;
+				addToFront(victim,ghostHit ? QUEUE_MAIN : QUEUE_IN);
+			}
+			/* if somebody uses it, it's a frequently used one */
+			else if(victim->refs > 0)
+				addToFront(victim,QUEUE_MAIN);
+			else if(used)
+				addToBack(victim,from);
+			else
+				addToFree(victim);
+		}
+
+		if(second != first)
+			second->unlock();
+		first->unlock();
+
+		if(usable) {
+			*created = true;
+			return victim;
+		}
+
+		/* if we went through all entries without finding one that is not in use, give up */
+		if(victim->refs > 0 && ++busy >= _blockCacheSize) {
+			printe("No free block-cache entry for block %u",blockNo);
+			return NULL;
+		}
+	}
+}
+
+CBlock *BlockCache::getVictim(uint *from) {
 	CBlock *block = _freeBlocks;
 	if(block != NULL) {
-		/* remove from freelist and put in usedlist */
+		/* remove from freelist; it's put in a queue as soon as it's hashed */
 		_freeBlocks = block->next;
 		if(_freeBlocks)
 			_freeBlocks->prev = NULL;
-		/* block->prev is already NULL */
-		block->next = _newestBlock;
-		if(block->next)
-			block->next->prev = block;
-		_newestBlock = block;
-		/* update oldest */
-		if(_oldestBlock == NULL)
-			_oldestBlock = block;
-		/* insert into hashmap */
-		CBlock **list = &_hashmap[blockNo % HASH_SIZE];
-		block->hnext = *list;
-		*list = block;
+		block->queue = QUEUE_NONE;
+		*from = QUEUE_FREE;
 		return block;
 	}
 
-	/* take the oldest one */
-	block = _oldestBlock;
-	assert(block->refs == 0);
-	_oldestBlock = block->prev;
-	_oldestBlock->next = NULL;
-	/* remove from hashmap */
-	bool diffhash = block->blockNo % HASH_SIZE != blockNo % HASH_SIZE;
-	if(diffhash) {
-		CBlock **list = &_hashmap[block->blockNo % HASH_SIZE];
-		CBlock *b = *list, *p = NULL;
-		while(b != NULL) {
-			if(b == block) {
-				if(p)
-					p->hnext = b->hnext;
-				else
-					*list = b->hnext;
-				break;
-			}
-			p = b;
-			b = b->hnext;
-		}
-	}
-	/* put at beginning of usedlist */
+	/* replace blocks that have been used only once, as long as there are enough of them */
+	uint queue = QUEUE_MAIN;
+	if(_lists[QUEUE_IN].count > _inMax || _lists[QUEUE_MAIN].count == 0)
+		queue = QUEUE_IN;
+
+	/* take the oldest one out of the queue to prevent that others choose it, too */
+	block = _lists[queue].oldest;
+	assert(block != NULL);
+	unlink(block);
+	block->queue = QUEUE_NONE;
+	*from = queue;
+	return block;
+}
+
+void BlockCache::unlink(CBlock *block) {
+	BlockList *list = _lists + block->queue;
+	if(block->prev)
+		block->prev->next = block->next;
+	else
+		list->newest = block->next;
+	if(block->next)
+		block->next->prev = block->prev;
+	else
+		list->oldest = block->prev;
+	list->count--;
+}
+
+void BlockCache::addToFront(CBlock *block,uint queue) {
+	BlockList *list = _lists + queue;
+	block->queue = queue;
 	block->prev = NULL;
-	block->next = _newestBlock;
+	block->next = list->newest;
 	if(block->next)
 		block->next->prev = block;
-	_newestBlock = block;
-	/* insert into hashmap */
-	if(diffhash) {
-		CBlock **list = &_hashmap[blockNo % HASH_SIZE];
-		block->hnext = *list;
-		*list = block;
-	}
-	/* if it is dirty we have to write it first to disk */
-	if(block->dirty) {
-		acquire(block,READ);
-		writeBlocks(block->buffer,block->blockNo,1);
-		doRelease(block,false);
+	list->newest = block;
+	if(list->oldest == NULL)
+		list->oldest = block;
+	list->count++;
+}
+
+void BlockCache::addToBack(CBlock *block,uint queue) {
+	BlockList *list = _lists + queue;
+	block->queue = queue;
+	block->next = NULL;
+	block->prev = list->oldest;
+	if(block->prev)
+		block->prev->next = block;
+	list->oldest = block;
+	if(list->newest == NULL)
+		list->newest = block;
+	list->count++;
+}
+
+void BlockCache::addToFree(CBlock *block) {
+	block->queue = QUEUE_FREE;
+	block->prev = NULL;
+	block->next = _freeBlocks;
+	if(_freeBlocks)
+		_freeBlocks->prev = block;
+	_freeBlocks = block;
+}
+
+void BlockCache::hash(CBlock *block) {
+	CBlock **list = &_hashmap[block->blockNo % HASH_SIZE];
+	block->hnext = *list;
+	*list = block;
+}
+
+void BlockCache::unhash(CBlock *block) {
+	CBlock **list = &_hashmap[block->blockNo % HASH_SIZE];
+	CBlock *b = *list, *p = NULL;
+	while(b != NULL) {
+		if(b == block) {
+			if(p)
+				p->hnext = b->hnext;
+			else
+				*list = b->hnext;
+			break;
+		}
+		p = b;
+		b = b->hnext;
 	}
-	return block;
+	block->hnext = NULL;
 }
 
 void BlockCache::printStats(FILE *f) {
 	float hitrate;
 	size_t used = 0,dirty = 0;
-	CBlock *bentry = _newestBlock;
-	while(bentry != NULL) {
-		used++;
-		if(bentry->dirty)
-			dirty++;
-		bentry = bentry->next;
+	{
+		std::lock_guard<std::mutex> guard(_lruLock);
+		for(size_t i = 0; i < ARRAY_SIZE(_lists); i++) {
+			for(CBlock *bentry = _lists[i].newest; bentry != NULL; bentry = bentry->next) {
+				used++;
+				if(bentry->dirty)
+					dirty++;
+			}
+		}
 	}
 	fprintf(f,"\tTotal blocks: %zu\n",_blockCacheSize);
 	fprintf(f,"\tUsed blocks: %zu\n",used);
+	fprintf(f,"\tIn-queue blocks: %zu (max %zu)\n",_lists[QUEUE_IN].count,_inMax);
+	fprintf(f,"\tMain-queue blocks: %zu\n",_lists[QUEUE_MAIN].count);
 	fprintf(f,"\tDirty blocks: %zu\n",dirty);
 	fprintf(f,"\tHits: %lu\n",_hits);
 	fprintf(f,"\tMisses: %lu\n",_misses);
+	fprintf(f,"\tEvictions: %lu\n",_evictions);
+	fprintf(f,"\tGhost hits: %lu\n",_ghostHits);
+	fprintf(f,"\tRead ahead: %lu\n",_readahead);
+	fprintf(f,"\tWrite requests: %lu\n",_writes);
+	fprintf(f,"\tDirect read requests: %lu\n",_directReads);
 	if(_hits == 0)
 		hitrate = 0;
 	else
@@ -238,17 +514,17 @@ void BlockCache::printStats(FILE *f) {
 #if DEBUGGING
 
 void BlockCache::print() {
-	size_t i = 0;
-	CBlock *block;
-	printf("Used blocks:\n\t");
-	block = _newestBlock;
-	while(block != NULL) {
-		if(++i % 8 == 0)
-			printf("\n\t");
-		printf("%zu ",block->blockNo);
-		block = block->next;
+	static const char *names[] = {"In-queue","Main-queue"};
+	for(size_t q = 0; q < ARRAY_SIZE(_lists); q++) {
+		size_t i = 0;
+		printf("%s blocks:\n\t",names[q]);
+		for(CBlock *block = _lists[q].newest; block != NULL; block = block->next) {
+			if(++i % 8 == 0)
+				printf("\n\t");
+			printf("%zu ",block->blockNo);
+		}
+		printf("\n");
 	}
-	printf("\n");
 }
 
 #endif
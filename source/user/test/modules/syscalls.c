@@ -51,6 +51,7 @@ static bool is_blacklisted(long sysc) {
 		SYSCALL_FORK,
 		SYSCALL_STARTTHREAD,
 		SYSCALL_EXEC,
+		SYSCALL_SPAWN,
 		SYSCALL_ACKSIG,
 		/* we don't want to exit, sleep or block */
 		SYSCALL_EXIT,
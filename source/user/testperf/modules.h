@@ -27,6 +27,7 @@ extern int mod_file(int,char**);
 extern int mod_mmap(int,char**);
 extern int mod_sendrecv(int,char**);
 extern int mod_pingpong(int,char**);
+extern int mod_devread(int,char**);
 extern int mod_pipe(int,char**);
 extern int mod_reading(int,char**);
 extern int mod_writenull(int,char**);
@@ -36,3 +37,4 @@ extern int mod_chgsize(int,char**);
 extern int mod_pagefault(int,char**);
 extern int mod_heap(int,char**);
 extern int mod_stdio(int,char**);
+extern int mod_wakeup(int,char**);
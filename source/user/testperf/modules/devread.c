@@ -0,0 +1,113 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/common.h>
+#include <sys/driver.h>
+#include <sys/io.h>
+#include <sys/messages.h>
+#include <sys/proc.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../modules.h"
+
+/* the layout of FileRead::Request and FileRead::Response in the IPC buffer */
+typedef struct {
+	size_t offset;
+	size_t count;
+	ssize_t shmemoff;
+} sReadRequest;
+
+typedef struct {
+	errcode_t err;
+	size_t res;
+} sReadResponse;
+
+static void server(void);
+
+static size_t readCount = 100000;
+static char buffer[4096];
+
+int mod_devread(int argc,char *argv[]) {
+	if(argc > 2)
+		readCount = atoi(argv[2]);
+
+	int pid;
+	if((pid = fork()) == 0)
+		server();
+	else {
+		int fd;
+		do {
+			fd = open("/dev/readbench",O_RDONLY);
+			if(fd < 0)
+				yield();
+		}
+		while(fd < 0);
+
+		/* the read round-trip consists of the request, the response and the data message */
+		size_t sizes[] = {4,1024,sizeof(buffer)};
+		for(size_t s = 0; s < ARRAY_SIZE(sizes); ++s) {
+			uint64_t begin = rdtsc();
+			for(size_t i = 0; i < readCount; ++i) {
+				if(read(fd,buffer,sizes[s]) != (ssize_t)sizes[s])
+					printe("read failed");
+			}
+			uint64_t end = rdtsc();
+			printf("read(%4zu): %Lu cycles, per call: %Lu\n",
+				sizes[s],end - begin,(end - begin) / readCount);
+		}
+
+		close(fd);
+		if(kill(pid,SIGTERM) < 0)
+			perror("kill");
+		waitchild(NULL,-1,0);
+	}
+	return 0;
+}
+
+static void server(void) {
+	ulong msg[IPC_DEF_SIZE / sizeof(ulong)];
+	int dev = createdev("/dev/readbench",0444,DEV_TYPE_CHAR,DEV_READ);
+	if(dev < 0) {
+		printe("Unable to create device");
+		return;
+	}
+
+	while(1) {
+		msgid_t mid;
+		int fd = getwork(dev,&mid,msg,sizeof(msg),0);
+		if(fd < 0) {
+			printe("Unable to get work");
+			continue;
+		}
+		if((mid & 0xFFFF) != MSG_FILE_READ)
+			continue;
+
+		sReadRequest *req = (sReadRequest*)msg;
+		sReadResponse resp;
+		resp.err = 0;
+		resp.res = req->count < sizeof(buffer) ? req->count : sizeof(buffer);
+		if(send(fd,mid,&resp,sizeof(resp)) < 0 || send(fd,mid,buffer,resp.res) < 0)
+			printe("Message-sending failed");
+	}
+}
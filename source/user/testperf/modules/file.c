@@ -31,6 +31,8 @@
 #include "../modules.h"
 
 #define TEST_COUNT		2000
+#define LARGE_SIZE		(16 * 1024 * 1024)
+#define LARGE_COUNT		4
 
 typedef ssize_t (*test_func)(int fd,void *buf,size_t count);
 
@@ -151,6 +153,38 @@ static void test_fstat(const char *path) {
 	printf("fstat     : %6Lu cycles/call\n",total / TEST_COUNT);
 }
 
+static void test_largewrite(const char *path) {
+	uint64_t start,end,total = 0;
+	for(int i = 0; i < LARGE_COUNT; ++i) {
+		start = rdtsc();
+		int fd = creat(path,0600);
+		if(fd < 0) {
+			printe("open of '%s' failed",path);
+			return;
+		}
+		for(size_t off = 0; off < LARGE_SIZE; off += sizeof(buffer)) {
+			if(write(fd,buffer,sizeof(buffer)) != sizeof(buffer)) {
+				printe("write failed");
+				close(fd);
+				return;
+			}
+		}
+		/* include the time to write it to disk */
+		if(syncfs(fd) < 0)
+			printe("syncfs failed");
+		close(fd);
+		end = rdtsc();
+		total += end - start;
+
+		if(unlink(path) < 0)
+			printe("Unable to unlink '%s'",path);
+	}
+
+	printf("write(%zuM): %Lu cycles/file, %Lu MB/s\n",
+			(size_t)LARGE_SIZE / (1024 * 1024),total / LARGE_COUNT,
+			((uint64_t)LARGE_SIZE * LARGE_COUNT) / tsctotime(total));
+}
+
 static void test_sharebuf(const char *path,size_t bufsize) {
 	uint64_t start,end,sharetime,destrtime;
 
@@ -184,7 +218,7 @@ static void test_sharebuf(const char *path,size_t bufsize) {
 	printf("destroybuf(%6zub): %Lu cycles/call\n",bufsize,destrtime / TEST_COUNT);
 }
 
-int mod_file(A_UNUSED int argc,A_UNUSED char *argv[]) {
+int mod_file(int argc,char *argv[]) {
 	size_t i;
 	int fd = creat("/tmp/test",0600);
 	if(fd < 0) {
@@ -212,6 +246,12 @@ int mod_file(A_UNUSED int argc,A_UNUSED char *argv[]) {
 	test_fstat("/tmp/test");
 	fflush(stdout);
 
+	/* the file for the large writes can be put on a different filesystem */
+	const char *largefile = argc > 2 ? argv[2] : "/tmp/large";
+	printf("\nWriting %s...\n",largefile);
+	test_largewrite(largefile);
+	fflush(stdout);
+
 	const char *filename = "/zeros";
 	printf("\nUsing %s...\n",filename);
 	test_openseekclose(filename);
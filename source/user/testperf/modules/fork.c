@@ -27,6 +27,9 @@
 #include "../modules.h"
 
 #define TEST_COUNT		1000
+#define EXEC_COUNT		100
+
+static const char *execArgs[] = {"/bin/sleep","0",NULL};
 
 static void firenforget(void) {
 	size_t i;
@@ -67,6 +70,42 @@ static void waitdead(void) {
 	printf("fork      : %Lu cycles/call\n",total / TEST_COUNT);
 }
 
+static void forkexec(void) {
+	size_t i;
+	uint64_t total = 0;
+	for(i = 0; i < EXEC_COUNT; ++i) {
+		uint64_t start = rdtsc();
+		int pid = fork();
+		if(pid == 0) {
+			execv(execArgs[0],execArgs);
+			exit(EXIT_FAILURE);
+		}
+		else if(pid < 0) {
+			printe("fork failed");
+			return;
+		}
+		waitchild(NULL,-1,0);
+		total += rdtsc() - start;
+	}
+	printf("fork+exec : %Lu cycles/call\n",total / EXEC_COUNT);
+}
+
+static void spawnwait(void) {
+	size_t i;
+	uint64_t total = 0;
+	for(i = 0; i < EXEC_COUNT; ++i) {
+		uint64_t start = rdtsc();
+		int pid = spawnv(execArgs[0],execArgs);
+		if(pid < 0) {
+			printe("spawn failed");
+			return;
+		}
+		waitchild(NULL,-1,0);
+		total += rdtsc() - start;
+	}
+	printf("spawn     : %Lu cycles/call\n",total / EXEC_COUNT);
+}
+
 int mod_fork(A_UNUSED int argc,A_UNUSED char *argv[]) {
 	printf("Fire and forget...\n");
 	fflush(stdout);
@@ -74,5 +113,9 @@ int mod_fork(A_UNUSED int argc,A_UNUSED char *argv[]) {
 	printf("Wait until they're dead...\n");
 	fflush(stdout);
 	waitdead();
+	printf("Execute a program...\n");
+	fflush(stdout);
+	forkexec();
+	spawnwait();
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,91 @@
+/**
+ * $Id$
+ * Copyright (C) 2008 - 2014 Nils Asmussen
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <sys/common.h>
+#include <sys/sync.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../modules.h"
+
+#define TEST_COUNT		10000
+#define MAX_WAITERS		512
+
+static int sem1;
+static int sem2;
+static int waitSems[MAX_WAITERS];
+
+static int thread_waiter(void *arg) {
+	semdown(waitSems[(size_t)arg]);
+	return 0;
+}
+
+static int thread_partner(A_UNUSED void *arg) {
+	for(int i = 0; i < TEST_COUNT; ++i) {
+		semdown(sem2);
+		semup(sem1);
+	}
+	return 0;
+}
+
+static void run_test(size_t waiters) {
+	/* let <waiters> threads block on different semaphores, so that the scheduler has to manage
+	 * them while we measure how long it takes to wake up our partner */
+	for(size_t i = 0; i < waiters; ++i) {
+		waitSems[i] = semcrt(0);
+		if(waitSems[i] < 0 || startthread(thread_waiter,(void*)i) < 0) {
+			printe("Unable to start waiter");
+			exit(EXIT_FAILURE);
+		}
+	}
+	/* give them the chance to block */
+	usleep(100 * 1000);
+
+	sem1 = semcrt(0);
+	sem2 = semcrt(0);
+	if(sem1 < 0 || sem2 < 0 || startthread(thread_partner,NULL) < 0) {
+		printe("Unable to start partner");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t start = rdtsc();
+	for(int i = 0; i < TEST_COUNT; ++i) {
+		semup(sem2);
+		semdown(sem1);
+	}
+	uint64_t end = rdtsc();
+	printf("%4zu waiters: %Lu cycles/wakeup\n",waiters,(end - start) / (TEST_COUNT * 2));
+	fflush(stdout);
+
+	for(size_t i = 0; i < waiters; ++i)
+		semup(waitSems[i]);
+	join(0);
+	for(size_t i = 0; i < waiters; ++i)
+		semdestr(waitSems[i]);
+	semdestr(sem2);
+	semdestr(sem1);
+}
+
+int mod_wakeup(A_UNUSED int argc,A_UNUSED char *argv[]) {
+	for(size_t waiters = 0; waiters <= MAX_WAITERS; waiters = waiters ? waiters * 4 : 8)
+		run_test(waiters);
+	return 0;
+}
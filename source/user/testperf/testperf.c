@@ -42,6 +42,7 @@ static sTestModule modules[] = {
 	{"mmap",		mod_mmap},
 	{"sendrecv",	mod_sendrecv},
 	{"pingpong",	mod_pingpong},
+	{"devread",		mod_devread},
 	{"pipe",		mod_pipe},
 	{"reading",		mod_reading},
 	{"writenull",	mod_writenull},
@@ -51,6 +52,7 @@ static sTestModule modules[] = {
 	{"pagefault",	mod_pagefault},
 	{"heap",		mod_heap},
 	{"stdio",		mod_stdio},
+	{"wakeup",		mod_wakeup},
 };
 
 int main(int argc,char *argv[]) {